@@ -0,0 +1,34 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+
+#include "db_functions.h"
+
+#define GROUP_BUCKETS 64	 // initial buckets of the group table, it doubles as groups are added
+#define AGGREGATE_TEXT_SIZE 24 // VARCHAR size announced for SUM, MIN, MAX and AVG results
+
+// the running state of one aggregate of one group
+typedef struct accumulator accumulator_t;
+struct accumulator {
+	int64_t sum;
+	int32_t min;
+	int32_t max;
+};
+
+typedef struct group group_t;
+struct group {
+	group_t *next;	// in the same bucket
+	group_t *after; // groups are reported in the order they were first seen
+	uint32_t hash;
+	int64_t count;
+	char *key; // the group column as stored in the row
+	accumulator_t accumulators[];
+};
+
+bool has_aggregates(request_t *request);
+int aggregate_scan(scan_t *scan, request_t *request, arena_t *arena, char **client_msg);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef APPEND_H
+#define APPEND_H
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "segments.h"
+#include "string_hash.h"
+
+#define APPEND_BUCKETS 64
+
+// called by the thread that wrote a batch, with the rows in the order they were written and
+// the row number of the first one, -1 if the write failed
+typedef void (*append_func_t)(const char *table, int row_size, const char *rows, size_t length, long first_row, void *arg);
+
+// a row waiting for the next batch, it lives on the stack of the INSERT that queued it
+typedef struct append_entry append_entry_t;
+struct append_entry {
+	const char *row;
+	size_t length;
+	long row_number; // once it was written, -1 if the write failed
+	bool done;
+	append_entry_t *next;
+};
+
+// the rows waiting to be appended to one table, its queue has a lock of its own so INSERTs into other tables never wait on it
+typedef struct appender appender_t;
+struct appender {
+	char *name;
+	pthread_mutex_t lock;	// guards first, last and writing
+	pthread_cond_t written; // broadcast whenever a batch is done
+	append_entry_t *first;
+	append_entry_t *last;
+	bool writing;		// a thread is writing a batch, rows queued now go into the next one
+	segments_t *segments; // the table loaded for appending by the first batch, kept until the last INSERT is done
+	uint64_t rows;		  // appended so far, added to the totals of appends when the entry is freed
+	uint64_t batches;
+	size_t references; // guarded by appends->lock, entries are freed when no INSERT is using them
+	appender_t *next;
+};
+
+/*
+ * Combines the INSERTs into a table into batches. The INSERT that finds nobody writing writes
+ * every row queued by then with one write, the others wait for it and the rows that arrive in
+ * the meantime make up the next batch.
+ */
+typedef struct appends appends_t;
+struct appends {
+	pthread_mutex_t lock; // guards the buckets, the references of the appenders and the totals
+	appender_t *buckets[APPEND_BUCKETS];
+	uint64_t rows; // appended by appenders that were freed since
+	uint64_t batches;
+};
+
+appends_t *appends_create();
+void appends_destroy(appends_t *appends);
+
+long append_row(appends_t *appends, const char *table, int row_size, const char *row, size_t length, append_func_t func, void *arg);
+void appends_counters(appends_t *appends, uint64_t *rows, uint64_t *batches);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_BLOCK_SIZE 4096 // minimum size of the blocks chained on when the arena runs out
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+// the first allocation of an arena always starts this many bytes after the arena itself
+#define ARENA_HEADER_SIZE ARENA_ROUND(sizeof(arena_t))
+
+typedef struct arena_block arena_block_t;
+struct arena_block {
+	arena_block_t *next;
+};
+
+typedef struct arena arena_t;
+struct arena {
+	char *cursor; // next free byte in the current block
+	char *end;
+	size_t size; // size of the first block
+	arena_block_t *blocks; // overflow blocks, the first block is allocated together with the arena
+};
+
+arena_t *arena_create(size_t size);
+void arena_destroy(arena_t *arena);
+void arena_reset(arena_t *arena);
+
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_calloc(arena_t *arena, size_t size);
+char *arena_strndup(arena_t *arena, const char *str, size_t length);
+void *arena_grow(arena_t *arena, void *memory, size_t old_size, size_t new_size);
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "hash_index.h"
+#include "string_hash.h"
+
+#define CATALOG_MAGIC "dbcatalg"
+#define CATALOG_FORMAT 1
+#define CATALOG_BUCKETS 64				 // to start with, doubled as tables are added
+#define CATALOG_CHECKPOINT_RECORDS 1024 // change records appended before the directory is rewritten, at least
+#define CATALOG_CREATE 'C'
+#define CATALOG_DROP 'D'
+
+/*
+ * The catalog file starts with a header and a directory of every table at the last
+ * checkpoint, followed by the change records appended since.
+ */
+typedef struct catalog_header catalog_header_t;
+struct catalog_header {
+	char magic[8];
+	uint32_t format;
+	uint32_t reserved;
+	uint64_t generation;	 // checkpoints written so far
+	uint64_t nr_of_tables;	 // in the directory
+	uint64_t directory_size; // bytes, the change records start after it
+};
+
+// a directory entry is the lengths followed by the name and the columns, without any terminators
+typedef struct catalog_entry catalog_entry_t;
+struct catalog_entry {
+	uint32_t name_length;
+	uint32_t columns_length;
+};
+
+// appended for every CREATE TABLE and DROP TABLE, a record that doesn't match its checksum ends the file
+typedef struct catalog_record catalog_record_t;
+struct catalog_record {
+	uint32_t type; // CATALOG_CREATE or CATALOG_DROP
+	uint32_t checksum;
+	uint32_t name_length;
+	uint32_t columns_length; // 0 for CATALOG_DROP
+};
+
+// an index on a column of a table, open for as long as the index exists
+typedef struct catalog_index catalog_index_t;
+struct catalog_index {
+	char *name;
+	char *column;
+	hash_index_t *index;
+	catalog_index_t *next; // on the same table
+};
+
+typedef struct catalog_table catalog_table_t;
+struct catalog_table {
+	char *name;
+	char *columns;			// the column definitions as CREATE TABLE wrote them, "1id INT,name VARCHAR(8)"
+	bool transient;			// a memory table, it is never written to the catalog file
+	catalog_index_t *indexes;
+	catalog_table_t *next;	// in the same bucket
+	catalog_table_t *newer; // in the order the tables were created
+	catalog_table_t *older;
+};
+
+typedef struct catalog catalog_t;
+struct catalog {
+	pthread_rwlock_t lock;
+	char *path;
+	FILE *file; // change records are appended to it
+	catalog_table_t **buckets;
+	size_t nr_of_buckets;
+	size_t nr_of_tables;
+	catalog_table_t *oldest;
+	catalog_table_t *newest;
+	uint64_t generation;
+	size_t nr_of_records; // appended since the last checkpoint
+	uint64_t schema;	  // counts every table created or dropped, starting at 1
+	char *index_path;	  // the index definitions, a line per index: name,table,column. NULL if indexes aren't kept
+};
+
+typedef void (*catalog_func_t)(const char *name, const char *columns, void *arg);
+
+catalog_t *catalog_open(const char *path, const char *legacy_path);
+void catalog_close(catalog_t *catalog);
+
+bool catalog_exists(catalog_t *catalog, const char *name);
+char *catalog_columns(catalog_t *catalog, arena_t *arena, const char *name);
+void catalog_each(catalog_t *catalog, catalog_func_t func, void *arg);
+uint64_t catalog_schema(catalog_t *catalog);
+
+int catalog_create(catalog_t *catalog, const char *name, const char *columns, bool transient);
+int catalog_drop(catalog_t *catalog, const char *name);
+
+int catalog_open_indexes(catalog_t *catalog, const char *path);
+catalog_index_t *catalog_indexes(catalog_t *catalog, const char *table);
+catalog_index_t *catalog_index_named(catalog_t *catalog, const char *name);
+catalog_index_t *catalog_index_on(catalog_t *catalog, const char *table, const char *column);
+int catalog_add_index(catalog_t *catalog, const char *table, const char *name, const char *column, hash_index_t *index);
+
+#endif
@@ -1,9 +1,11 @@
 #ifndef DB_FUNCTIONS_H
 #define DB_FUNCTIONS_H
 
+#ifndef _GNU_SOURCE // server.h may have pulled in the system headers already
 #define _POSIX_C_SOURCE 200809L
 #define _DEFAULT_SOURCE
 #define _GNU_SOURCE
+#endif
 #include <errno.h>
 
 #include <fcntl.h>
@@ -17,26 +19,75 @@
 #include <syslog.h>
 #include <unistd.h>
 
+#include "arena.h"
+#include "catalog.h"
 #include "dynamic_string.h"
+#include "hash_index.h"
+#include "memory_tables.h"
+#include "primary_keys.h"
+#include "protocol.h"
 #include "queue.h"
 #include "request.h"
+#include "segments.h"
 #include "server.h"
 #include "table_t.h"
+#include "trace.h"
 
-#define META_FILE "../database/meta.txt"
+#define CATALOG_FILE "../database/catalog.bin"
+#define META_FILE "../database/meta.txt" // the text catalog of earlier versions, imported into CATALOG_FILE once
+#define INDEX_CATALOG "../database/indexes.txt" // one line per index: name,table,column
+#define LOCK_FILE "../database/server.lock"
 #define DATA_FILE_PATH "../database/"
 #define DATA_FILE_ENDING ".txt"
 #define COL_DELIM ","
 #define TYPE_DELIM " "
 #define ROW_DELIM "\n"
 #define START_LENGTH 64
-#define MULTIPLIER 2
 #define CHARS_PER_INT 10
-#define CHARS_PER_SEND 400
+#define SEND_BUFFER_SIZE 16384 // SELECT results are sent once this much is buffered
+#define SCAN_ARENA_SIZE (2 * SEND_BUFFER_SIZE)
+#define SCAN_BATCH 1024 // rows read at a time by scans that aggregate or sort them
 #define PADDING '0'
+#define SCRATCH_ARENA_SIZE 16384 // per worker thread, only requests that outgrow it allocate
 
 extern char *log_file;
 
+// a SELECT in progress, kept on the connection while the client drains its output
+typedef struct scan scan_t;
+struct scan {
+	struct server *server;
+	size_t socket;
+	int protocol;
+	arena_t *arena; // holds the scan itself, the template columns and the buffers
+	FILE *data_file;
+	segments_t *segments; // behind data_file, NULL if it isn't a table on disk
+	char *table; // ranges scanned in parallel open the table again, NULL if the rows aren't a table's
+	column_t *columns;
+	char *row;
+	int row_size;
+	long next_row;
+	long nr_of_rows;
+	uint32_t *rows; // row numbers to visit from an index lookup, NULL visits every row
+	char *key;		// rows are only sent if they hold key at key_offset, NULL sends all
+	int key_offset;
+	int key_width;
+	long nr_of_matches;
+	long nr_to_skip; // matches of a filtered scan that OFFSET drops before the first one is sent
+	long limit;		 // matches a filtered scan sends before it stops, -1 sends all
+	FILE *order_file; // sorted run of an ORDER BY too large for memory, it holds the row numbers to visit
+	char *order_entry;
+	int order_entry_size;
+	dynamicstr out;
+	uint64_t trace[TRACE_STAMPS]; // of the SELECT, it is finished when the last row is queued
+	char *statement;
+	char *cache_key;			  // the response goes into the result cache once it is complete, NULL if it doesn't
+	char *cache_tables[2];		  // the FROM and the JOIN table
+	uint64_t cache_versions[2];	  // of cache_tables when the SELECT locked them
+	char *capture;				  // everything sent so far, kept for the cache
+	size_t capture_length;
+	size_t capture_capacity;
+};
+
 typedef struct is_primary_key is_primary_key;
 struct is_primary_key {
 	int total_row_size;
@@ -46,25 +97,42 @@ struct is_primary_key {
 
 void execute_request(void *arg);
 
-void create_table(client_request *cli_req, char **client_msg);
-void print_tables(char **client_msg);
-void print_schema(char *name, char **client_msg);
-int add_table(table_t *table, dynamicstr *output_buffer, FILE *meta, char **error_msg);
-void select_table(client_request *cli_req, char **client_msg);
-void drop_table(client_request *cli_req, char **client_msg);
-bool table_exists(char *name, FILE *meta);
+// the statement handlers return -1 if the message they leave in client_msg reports an error
+int create_table(client_request *cli_req, char **client_msg);
+void print_tables(arena_t *arena, catalog_t *catalog, char **client_msg);
+int print_schema(arena_t *arena, catalog_t *catalog, char *name, char **client_msg);
+int print_stats(client_request *cli_req, char **client_msg);
+void print_replication(client_request *cli_req, char **client_msg);
+int add_table(arena_t *arena, table_t *table, dynamicstr *output_buffer, char **error_msg);
+int select_table(client_request *cli_req, char **client_msg);
+scan_t *scan_create(client_request *cli_req, arena_t *scan_arena, FILE *data_file, column_t *columns, int row_size, long nr_of_rows);
+void resume_scan(void *arg);
+void encode_result_header(dynamicstr *out, column_t *columns);
+void encode_binary_row(dynamicstr *out, column_t *columns, const char *row);
+void encode_text_row(dynamicstr *out, column_t *columns, const char *row);
+size_t scan_read_batch(scan_t *scan, char *batch, uint32_t *row_numbers);
+int32_t decode_int(const char *field);
+void scan_destroy(scan_t *scan);
+int drop_table(client_request *cli_req, char **client_msg);
+int create_index(client_request *cli_req, char **client_msg);
+FILE *create_temp_file(const char *ending);
+int column_width(column_t *column);
+column_t *find_column(column_t *first, const char *name, int *offset);
 void quit_connection(client_request *cli_req);
-int create_data_file(char *name);
-void insert_data(client_request *cli_req, char **client_msg);
-void create_template_column(char *name, FILE *meta, column_t **first, int *chars_in_row);
-int create_full_data_path_from_name(char *name, char **full_path);
+int create_data_file(arena_t *arena, char *name);
+FILE *table_open(const char *name, int row_size, segments_t **segments);
+int insert_data(client_request *cli_req, char **client_msg);
+int apply_statement(struct server *server, arena_t *arena, char *statement);
+int apply_rows(struct server *server, arena_t *arena, const char *table, int row_size, const char *rows, size_t length, long first_row);
+void create_template_column(arena_t *arena, catalog_t *catalog, char *name, column_t **first, int *chars_in_row);
+int create_full_data_path_from_name(arena_t *arena, char *name, char **full_path);
 void log_to_file(const char *format, ...);
+char *create_format_buffer(arena_t *arena, const char *format, ...);
 
 bool is_valid_varchar(column_t *col);
 
-int column_to_buffer(column_t *table_column, column_t *input_column,
-					 dynamicstr *output_buffer, int primary_key, char **client_msg);
-int populate_column(column_t *current, char *table_row, is_primary_key *is_pk);
-int unpopulate_column(column_t *current);
+int column_to_buffer(arena_t *arena, column_t *table_column, column_t *input_column,
+					 dynamicstr *row, int primary_key, char **client_msg);
+int populate_column(arena_t *arena, column_t *current, const char *table_row, is_primary_key *is_pk);
 
 #endif
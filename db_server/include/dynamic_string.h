@@ -5,14 +5,29 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
+
+#define STRING_MIN_CAPACITY 64
+#define STRING_GROWTH 2 // capacity is multiplied by this whenever an append doesn't fit
+
 typedef struct dynamicstr dynamicstr;
 struct dynamicstr {
-  int size;
-  char *buffer;
+  size_t length;   // characters in buffer, excluding the terminator
+  size_t capacity; // bytes allocated for buffer
+  char *buffer;    // always NUL-terminated once anything has been appended
+  arena_t *arena;  // allocate from this arena, or from the heap if NULL
 };
 
-void string_init(dynamicstr **target);
-void string_set(dynamicstr **destination, char *format, ...);
-void string_free(dynamicstr **target);
+void string_init(dynamicstr *target, arena_t *arena, size_t capacity);
+void string_free(dynamicstr *target);
+void string_clear(dynamicstr *target);
+int string_reserve(dynamicstr *target, size_t extra);
+
+int string_append(dynamicstr *target, const char *data, size_t length);
+int string_append_str(dynamicstr *target, const char *str);
+int string_append_char(dynamicstr *target, char ch);
+int string_append_int(dynamicstr *target, int value, size_t width, char pad);
+int string_append_padded(dynamicstr *target, const char *data, size_t length, size_t width, char pad);
+int string_set(dynamicstr *target, const char *format, ...);
 
 #endif
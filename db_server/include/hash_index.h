@@ -0,0 +1,75 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+// an on-disk linear hash from the hash of a fixed-width key to the rows holding it.
+// <name>.idx holds a header page followed by the primary page of every bucket, so a
+// bucket is found with one read; pages that overflow a bucket live in <name>.ovf
+#define INDEX_FILE_ENDING ".idx"
+#define OVERFLOW_FILE_ENDING ".ovf"
+#define INDEX_PAGE_SIZE 4096
+#define INDEX_MAGIC 0x58444948 // "HIDX"
+#define INDEX_INITIAL_BUCKETS 4
+#define INDEX_MAX_LOAD 0.75 // split a bucket once the entries fill this much of the primary pages
+
+typedef struct index_entry index_entry_t;
+struct index_entry {
+	uint32_t hash;
+	uint32_t row; // row number in the data file
+};
+
+// the page layout, count entries follow the page header
+typedef struct index_page index_page_t;
+struct index_page {
+	uint32_t count;
+	uint32_t next; // overflow page, counted from 1, 0 ends the chain
+	index_entry_t entries[(INDEX_PAGE_SIZE - 2 * sizeof(uint32_t)) / sizeof(index_entry_t)];
+};
+
+#define INDEX_ENTRIES_PER_PAGE (sizeof(((index_page_t *)0)->entries) / sizeof(index_entry_t))
+
+// stored at the start of the first page
+typedef struct index_header index_header_t;
+struct index_header {
+	uint32_t magic;
+	uint32_t key_offset; // where the key is in a row, and how wide it is
+	uint32_t key_width;
+	uint32_t level; // there are INDEX_INITIAL_BUCKETS << level buckets plus split
+	uint32_t split; // next bucket to split
+	uint32_t overflow_pages;
+	uint32_t free_overflow; // chain of overflow pages that splits emptied
+	uint32_t reserved;
+	uint64_t entries;
+};
+
+typedef struct hash_index hash_index_t;
+struct hash_index {
+	int fd;
+	int overflow_fd;
+	bool dirty; // the header has to be written back on close
+	index_header_t header;
+};
+
+uint32_t hash_index_hash(const char *key, size_t length);
+
+int hash_index_create(const char *path, uint32_t key_offset, uint32_t key_width);
+hash_index_t *hash_index_open(const char *path);
+int hash_index_close(hash_index_t *index);
+int hash_index_sync(hash_index_t *index);
+int hash_index_remove(const char *path);
+
+int hash_index_insert(hash_index_t *index, const char *row, uint32_t row_number);
+int hash_index_lookup(hash_index_t *index, const char *key, arena_t *arena, uint32_t **rows, size_t *count);
+
+#endif
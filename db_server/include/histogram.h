@@ -0,0 +1,32 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// log-linear buckets in the style of HdrHistogram: values below 128 are
+// exact, above that every power of two is split into 64 buckets, which
+// keeps the relative error of any recorded value under 1.6%
+#define HISTOGRAM_SUB_BUCKETS 64
+#define HISTOGRAM_BUCKETS (2 * HISTOGRAM_SUB_BUCKETS + 57 * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct histogram histogram_t;
+struct histogram {
+	uint64_t counts[HISTOGRAM_BUCKETS];
+	uint64_t total;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+void histogram_init(histogram_t *histogram);
+void histogram_record(histogram_t *histogram, uint64_t value);
+void histogram_record_local(histogram_t *histogram, uint64_t value);
+void histogram_merge(histogram_t *into, const histogram_t *from);
+
+uint64_t histogram_percentile(const histogram_t *histogram, double percentile);
+double histogram_mean(const histogram_t *histogram);
+
+#endif
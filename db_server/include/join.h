@@ -0,0 +1,55 @@
+#ifndef JOIN_H
+#define JOIN_H
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "db_functions.h"
+
+#ifndef JOIN_MEMORY
+#define JOIN_MEMORY (16 * 1024 * 1024) // bytes of build rows one JOIN keeps in memory before it partitions both tables
+#endif
+#define JOIN_MAX_PARTITIONS 128 // partitions of a grace hash join, each is a pair of files
+#define JOIN_FILE_ENDING ".join"
+#define JOIN_END UINT32_MAX // ends a chain of the build table
+
+// one of the two tables of a JOIN
+typedef struct join_side join_side_t;
+struct join_side {
+	char *name;
+	column_t *columns;
+	int row_size;
+	FILE *file;
+	long nr_of_rows;
+	int key_offset; // of the ON column in a row
+	int key_width;
+};
+
+// the build rows of a hash join, with their keys chained by hash
+typedef struct join_table join_table_t;
+struct join_table {
+	char *rows;
+	uint32_t *hashes;
+	uint32_t *next; // the next row in the same bucket, JOIN_END ends the chain
+	uint32_t *buckets;
+	size_t nr_of_rows;
+	size_t nr_of_buckets;
+};
+
+typedef struct join join_t;
+struct join {
+	join_side_t sides[2]; // the FROM table and the JOIN table, a result row is one of each in this order
+	int build;			  // the side the hash table is built on, the smaller one
+	int key_width;		  // of the keys compared, narrower VARCHARs are padded to it
+	char *keys;			  // room for the two keys being compared
+	FILE *out;			  // the result rows
+	long nr_of_results;
+	char *result;
+	int result_size;
+};
+
+scan_t *join_scan(client_request *cli_req, char **client_msg);
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef LOCK_MANAGER_H
+#define LOCK_MANAGER_H
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "string_hash.h"
+
+#define LOCK_BUCKETS 64
+
+// lock modes, LM_IS is only meaningful on the catalog. On a table LM_IX is taken by INSERTs,
+// which append to it side by side but not while it is read
+#define LM_NONE -1
+#define LM_IS 0
+#define LM_IX 1
+#define LM_S 2
+#define LM_X 3
+#define LM_MODES 4
+
+typedef struct lock_stats lock_stats_t;
+struct lock_stats {
+	uint64_t acquired; // number of times the lock was granted
+	uint64_t waited;   // number of times the caller had to block
+	uint64_t wait_ns;  // total time spent blocking
+	uint64_t max_wait_ns;
+};
+
+typedef struct table_lock table_lock_t;
+struct table_lock {
+	char *name;
+	pthread_cond_t cond; // the mutex is the manager's table_mutex
+	size_t holders[LM_MODES];
+	size_t waiting[LM_MODES];
+	size_t references; // entries are freed when nobody holds or waits for them
+	table_lock_t *next;
+};
+
+typedef struct lock_manager lock_manager_t;
+struct lock_manager {
+	// multi-granularity lock on the catalog (the meta file)
+	pthread_mutex_t catalog_mutex;
+	pthread_cond_t catalog_cond;
+	size_t catalog_holders[LM_MODES];
+	size_t catalog_waiting_x; // new requests queue behind a waiting writer
+
+	// per-table multi-granularity locks
+	pthread_mutex_t table_mutex; // guards the buckets and every table lock
+	table_lock_t *buckets[LOCK_BUCKETS];
+
+	lock_stats_t catalog_stats[LM_MODES];
+	lock_stats_t table_stats[LM_MODES];
+
+	int file_lock; // held for the lifetime of the process to keep other servers out
+};
+
+lock_manager_t *lock_manager_create(const char *lock_path);
+void lock_manager_destroy(lock_manager_t *manager);
+
+void lock_catalog(lock_manager_t *manager, int mode);
+void unlock_catalog(lock_manager_t *manager, int mode);
+
+table_lock_t *lock_table(lock_manager_t *manager, const char *name, int mode);
+void unlock_table(lock_manager_t *manager, table_lock_t *lock, int mode);
+void lock_tables(lock_manager_t *manager, const char **names, size_t count, const int *modes, table_lock_t **locks);
+void unlock_tables(lock_manager_t *manager, table_lock_t **locks, const int *modes, size_t count);
+
+void lock_manager_stats(lock_manager_t *manager, lock_stats_t *catalog, lock_stats_t *tables);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef MEMORY_TABLES_H
+#define MEMORY_TABLES_H
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "string_hash.h"
+
+#define MEMORY_CHUNK_SIZE (256 * 1024) // bytes a chunk holds at most, rounded down to whole rows
+#define MEMORY_CHUNK_ALIGNMENT 64	   // chunks start on a cache line
+#define MEMORY_DIRECTORY_SIZE 16	   // chunks the first directory of a table has room for, doubled as it fills up
+#define MEMORY_BUCKETS 64
+
+/*
+ * The chunks of a memory table in the order they were filled. A full directory is replaced by
+ * one twice its size, the old one is kept until the table is freed since a reader may still
+ * be looking at it.
+ */
+typedef struct memory_directory memory_directory_t;
+struct memory_directory {
+	size_t capacity;
+	memory_directory_t *older;
+	char *chunks[];
+};
+
+/*
+ * A table created with ENGINE=MEMORY. Its rows have the layout of a data file but live in
+ * chunks in this process and are gone once it exits. Appends are serialized by append_lock,
+ * readers take no lock: they only look at the bytes before size, which is published once the
+ * rows before it were copied.
+ */
+typedef struct memory_table memory_table_t;
+struct memory_table {
+	char *name;
+	int row_size;
+	long chunk_size;
+	pthread_mutex_t append_lock;
+	size_t nr_of_chunks;		   // allocated so far, guarded by append_lock
+	memory_directory_t *directory; // the current one, replaced under append_lock
+	long size;					   // bytes of rows readers may see
+	size_t references;			   // the registry and every open file hold one
+	memory_table_t *next;		   // in the same bucket
+};
+
+int memory_table_create(const char *name, int row_size);
+int memory_table_drop(const char *name);
+bool memory_table_exists(const char *name);
+long memory_table_append(const char *name, const char *rows, size_t length);
+FILE *memory_table_open(const char *name);
+
+#endif
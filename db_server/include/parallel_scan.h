@@ -0,0 +1,38 @@
+#ifndef PARALLEL_SCAN_H
+#define PARALLEL_SCAN_H
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "db_functions.h"
+
+#define PARALLEL_RANGE_ROWS 65536 // fewest rows worth handing to another worker
+#define PARALLEL_MAX_RANGES 8	  // most ranges one scan is split into, the calling thread included
+
+// called for one range of a table, range is a private copy of the scan restricted to its rows
+typedef int (*range_func_t)(scan_t *range, void *state);
+
+// a table scan split into row ranges, shared between the calling thread and the helpers it
+// queued on the pool. Ranges are claimed one at a time, so the caller never waits for a
+// helper that didn't get a thread
+typedef struct parallel parallel_t;
+struct parallel {
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	size_t nr_of_ranges;
+	size_t next_range;	// first range nobody has claimed
+	size_t running;		// ranges claimed but not finished
+	size_t references;	// the calling thread and the helpers it queued
+	scan_t *scan;
+	range_func_t func;
+	void **states; // one per range, handed to func
+	bool failed;
+};
+
+size_t scan_parallelism(scan_t *scan);
+int parallel_scan(scan_t *scan, size_t nr_of_ranges, range_func_t func, void **states);
+
+#endif
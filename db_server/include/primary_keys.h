@@ -0,0 +1,51 @@
+#ifndef PRIMARY_KEYS_H
+#define PRIMARY_KEYS_H
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "catalog.h"
+#include "string_hash.h"
+
+#define PK_BUCKETS 64
+#define PK_SET_INITIAL 64 // slots of the key set of a new table, it doubles at half load
+
+// the key sequence and the set of keys of every table with a primary key, so that INSERT
+// neither reads the tail of the data file nor has to search it for duplicates
+typedef struct pk_table pk_table_t;
+struct pk_table {
+	char *name;
+	int64_t next_key; // first key that was never handed out, advanced with atomic adds
+
+	pthread_mutex_t lock; // guards the key set
+	int64_t *keys;		  // open addressing, PK_EMPTY and PK_REMOVED mark unused slots
+	size_t capacity;
+	size_t count;
+	size_t used; // keys and removed slots, which both lengthen probes
+	pk_table_t *next;
+};
+
+typedef struct primary_keys primary_keys_t;
+struct primary_keys {
+	pthread_rwlock_t lock; // guards the buckets, not the tables in them
+	pk_table_t *buckets[PK_BUCKETS];
+};
+
+primary_keys_t *primary_keys_create();
+void primary_keys_destroy(primary_keys_t *keys);
+int primary_keys_load(primary_keys_t *keys, catalog_t *catalog);
+
+pk_table_t *primary_keys_table(primary_keys_t *keys, const char *name, int pk_offset, int row_size);
+void primary_keys_forget(primary_keys_t *keys, const char *name);
+
+bool pk_next(pk_table_t *table, int *key);
+bool pk_claim(pk_table_t *table, int key);
+void pk_release(pk_table_t *table, int key);
+
+#endif
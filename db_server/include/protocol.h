@@ -0,0 +1,50 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "dynamic_string.h"
+
+#define PROTOCOL_TEXT 0
+#define PROTOCOL_BINARY 1
+
+// a client asks for the binary protocol by sending the handshake as the very
+// first bytes of the connection, the server echoes it back to accept
+#define PROTOCOL_VERSION 1
+#define HANDSHAKE_SIZE 8
+#define HANDSHAKE_MAGIC "\x7f" "DBPROT"
+
+// every frame is a 4 byte big-endian payload length and a type byte
+#define FRAME_HEADER_SIZE 5
+#define FRAME_MAX_SIZE (1 << 20)
+
+#define F_QUERY 'Q'    // client: statement text
+#define F_RESULT 'T'   // server: u16 column count, per column u8 type, u16 size, u16 name length, name
+#define F_ROW 'D'      // server: per column INT as i32, VARCHAR as u16 length and bytes
+#define F_COMPLETE 'C' // server: u32 row count followed by the status message
+#define F_ERROR 'E'    // server: error message
+
+void protocol_handshake(char *buffer);
+bool protocol_is_handshake(const char *data, size_t length);
+
+size_t protocol_begin_frame(dynamicstr *out, char type);
+void protocol_end_frame(dynamicstr *out, size_t start);
+int protocol_append_frame(dynamicstr *out, char type, const char *payload, size_t length);
+
+int protocol_append_u8(dynamicstr *out, uint8_t value);
+int protocol_append_u16(dynamicstr *out, uint16_t value);
+int protocol_append_u32(dynamicstr *out, uint32_t value);
+uint16_t protocol_read_u16(const char *data);
+uint32_t protocol_read_u32(const char *data);
+
+long protocol_frame_size(const char *data, size_t length);
+int protocol_send(int socket, const char *data, size_t length);
+
+#endif
@@ -1,19 +1,33 @@
 #ifndef QUEUE_H
 #define QUEUE_H
 
+#define _GNU_SOURCE
+
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "arena.h"
 #include "request.h"
+#include "statement_cache.h"
+#include "trace.h"
 
 typedef struct client_request client_request;
 struct client_request
 {
 	request_t *request;
+	char *msg; // the statement text, the request points into it
+	char *statement; // untouched copy of msg for traces, the slow query log and the replication log, NULL when all are off
+	char *cache_key; // of a SELECT in the result cache, NULL for other statements
+	binding_t *binding; // of the cached statement the request was cloned from, NULL if it isn't cached
 	size_t client_socket;
+	int protocol; // PROTOCOL_TEXT or PROTOCOL_BINARY, decided when the connection was made
+	bool suspended; // the statement goes on after execute_request returns, see resume_scan
 	char *error;
+	arena_t *arena; // scratch memory for the statement, released when it is done
 	void* server;
+	uint64_t trace[TRACE_STAMPS]; // when the statement reached each stage, see trace.h
 };
 
 typedef struct queue_t queue_t;
@@ -22,6 +36,7 @@ struct queue_t
 	client_request **requests;
 	size_t size;
 	size_t max_size;
+	size_t high_water; // most requests that were ever queued at once
 	size_t front;
 	size_t back;
 };
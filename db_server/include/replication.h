@@ -0,0 +1,128 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dynamic_string.h"
+
+#define REPLICATION_LOG "../database/replication.log"
+#define REPLICATION_POSITION "../database/replication.pos" // how far a replica got, kept in its own database
+#define REPLICATION_MAGIC "dbchange"
+#define REPLICATION_FORMAT 2
+#define REPLICATION_MAX_REPLICAS 16
+#define REPLICATION_CHUNK (1024 * 1024) // log bytes sent to a replica at a time
+#define REPLICATION_HEARTBEAT_MS 1000	 // a replica that has everything hears from its primary this often
+#define REPLICATION_RETRY_MS 1000		 // a replica tries to reach its primary again after this long
+#define REPLICATION_TRIM (4 * 1024 * 1024) // log bytes every connected replica applied before the primary frees them
+#define REPLICATION_PAGE 4096			   // the log is freed in whole pages
+
+#define REPLICATION_OFF 0
+#define REPLICATION_PRIMARY 1
+#define REPLICATION_REPLICA 2
+
+#define CHANGE_STATEMENT 'S' // a CREATE TABLE, DROP TABLE or CREATE INDEX as the client sent it
+#define CHANGE_ROWS 'R'		 // rows an INSERT appended to a table, as they were written
+
+/*
+ * The primary appends every change to the replication log once it was made and replicas tail
+ * it. The log starts with a header, its id tells a replica whether the positions it kept are
+ * positions in this log or in an earlier one.
+ *
+ * Once every connected replica confirmed that it applied the changes before a position, the
+ * primary moves begin up to it and punches the bytes before it out of the file. Positions
+ * don't move, the log stays as long as it was but only the part from begin on takes up disk.
+ * A replica that was away and asks for a position before begin can't catch up from the log,
+ * it has to start again from a copy of the primary's database. With no replica connected
+ * nothing is trimmed, so one that is restarted finds its changes.
+ */
+typedef struct change_log_header change_log_header_t;
+struct change_log_header {
+	char magic[8];
+	uint32_t format;
+	uint32_t reserved;
+	uint64_t id;
+	uint64_t begin; // of the first record still in the log
+};
+
+// followed by the table name and the statement or the rows, a record that doesn't match its checksum ends the log
+typedef struct change_record change_record_t;
+struct change_record {
+	uint32_t type; // CHANGE_STATEMENT or CHANGE_ROWS
+	uint32_t checksum;
+	uint32_t name_length; // 0 for CHANGE_STATEMENT
+	uint32_t row_size;
+	uint64_t first_row; // row number of the first of the rows in the primary's table
+	uint64_t length;	// of the statement or the rows
+	uint64_t timestamp; // CLOCK_REALTIME ns when the primary made the change
+};
+
+// sent by the primary to every replica that connects, the replica answers with the position it wants to start from
+typedef struct replication_hello replication_hello_t;
+struct replication_hello {
+	char magic[8];
+	uint64_t id;
+	uint64_t begin;
+	uint64_t end;
+};
+// after it a replica sends the position everything before was applied whenever it moves
+
+// precedes every chunk of the log sent to a replica, a chunk without bytes is a heartbeat
+typedef struct replication_frame replication_frame_t;
+struct replication_frame {
+	uint64_t end; // of the primary's log when the chunk was read
+	uint64_t length;
+};
+
+typedef struct replication replication_t;
+struct replication {
+	int role; // REPLICATION_PRIMARY or REPLICATION_REPLICA
+	size_t port;
+	struct server *server;
+	pthread_mutex_t lock;
+	pthread_cond_t appended; // broadcast whenever the log grows
+
+	// primary
+	int log; // the replication log, opened for appending
+	int socket; // replicas connect to it
+	uint64_t id;
+	uint64_t begin; // of the part of the log that is kept
+	uint64_t end;
+	uint64_t positions[REPLICATION_MAX_REPLICAS]; // sent to each connected replica so far
+	uint64_t confirmed[REPLICATION_MAX_REPLICAS]; // each connected replica applied everything before
+	bool connected[REPLICATION_MAX_REPLICAS];
+	bool trimming; // a sender is freeing the start of the log
+
+	// replica
+	int position_file;
+	uint64_t applied;		  // position in the primary's log everything before was applied
+	uint64_t primary_end;	  // of the primary's log, as the primary last reported it
+	uint64_t applied_at;	  // timestamp of the last change applied
+	uint64_t heard_ns;		  // when the primary was last heard from, stats_now_ns()
+	bool following;			  // connected to the primary
+};
+
+replication_t *replication_primary(size_t port);
+replication_t *replication_replica(size_t port);
+void replication_start(replication_t *replication, struct server *server);
+bool replication_read_only(replication_t *replication);
+int replication_log_statement(replication_t *replication, const char *statement);
+int replication_log_rows(replication_t *replication, const char *table, int row_size, const char *rows, size_t length, long first_row);
+void replication_report(replication_t *replication, dynamicstr *out);
+
+#endif
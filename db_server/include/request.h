@@ -2,6 +2,8 @@
 #define REQUEST_H
 #pragma GCC visibility push(default)
 
+#include <stddef.h>
+
 #define RT_CREATE   0
 #define RT_TABLES   1
 #define RT_SCHEMA   2
@@ -11,10 +13,22 @@
 #define RT_QUIT     6
 #define RT_DELETE   7
 #define RT_UPDATE   8
+#define RT_PREPARE  9
+#define RT_STATS    10
+#define RT_CREATE_INDEX 11
+#define RT_REPLICATION 12
+#define RT_TYPES    13 // number of request types
 
 #define DT_INT      0
 #define DT_VARCHAR  1
 
+#define AGG_NONE    0
+#define AGG_COUNT   1
+#define AGG_SUM     2
+#define AGG_MIN     3
+#define AGG_MAX     4
+#define AGG_AVG     5
+
 typedef struct request_t request_t;
 typedef struct column_t column_t;
 
@@ -31,6 +45,8 @@ struct column_t {
     int char_size;
     /* VARCHAR value for INSERT or UPDATE statement */
     char* char_val;
+    /* aggregate function of a SELECT column, AGG_NONE for a plain column */
+    char aggregate;
     /* pointer to next column entry */
     column_t* next;
 };
@@ -44,6 +60,24 @@ struct request_t {
     column_t* columns;
     /* column which to use in the WHERE statement */
     column_t* where;
+    /* name of the index for CREATE INDEX, the column is the only entry in columns */
+    char* index_name;
+    /* column which the aggregates of a SELECT are grouped by */
+    column_t* group_by;
+    /* column which the rows of a SELECT are sorted by */
+    column_t* order_by;
+    /* whether order_by sorts from the largest value down */
+    char descending;
+    /* LIMIT of a SELECT, -1 if it has none */
+    int limit;
+    /* rows a SELECT skips before the first one it sends */
+    int offset;
+    /* table a SELECT joins with table_name, NULL if it has no JOIN */
+    char* join_table;
+    /* columns the JOIN compares, the one of table_name first and the one of join_table next */
+    column_t* join_on;
+    /* whether CREATE TABLE keeps the table in memory only, ENGINE=MEMORY */
+    char memory;
 };
 
 /*
@@ -55,14 +89,33 @@ struct request_t {
  * parse_error: pointer to character pointer for error reporting
  *
  * returns: request_t filled with the information contained in the
- *          parsed command string
+ *          parsed command string -- NOTE: names and VARCHAR values point
+ *          into request_string, which is modified in place and has to
+ *          outlive the request
  *
  * errors: returns NULL in case of error
- *         allocates memory for error message and makes parse_error pointer
- *         point to it -- NOTE: this message buffer needs to be freed by the
- *         caller
+ *         makes parse_error point to a static error message, it must not
+ *         be freed
  * */
 request_t* parse_request(char* request_string, char** parse_error);
+/*
+ * Function: create_request
+ * ------------------------
+ * allocates an empty request_t at the start of a new arena
+ *
+ * size: initial number of bytes available for request_alloc, the arena
+ *       grows if more is needed
+ *
+ * returns: zeroed request_t, released with destroy_request
+ * */
+request_t* create_request(size_t size);
+/*
+ * Function: request_alloc
+ * -----------------------
+ * allocates memory from the arena of the provided request_t, it is
+ * released together with the request
+ * */
+void* request_alloc(request_t* request, size_t size);
 /*
  * Function: print_request
  * -----------------------
@@ -73,7 +126,7 @@ void print_request(request_t* request);
  * Function: destroy_request
  * -------------------------
  * frees all memory associated with the provided request_t
- * including the request_t itself
+ * including the request_t itself, in one call regardless of its size
  * */
 void destroy_request(request_t* request);
 
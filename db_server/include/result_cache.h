@@ -0,0 +1,71 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "request.h"
+#include "string_hash.h"
+
+#define RESULT_BUCKETS 256
+#define RESULT_CACHE_BYTES (32 * 1024 * 1024) // responses kept in total, the least recently used are dropped first
+#define RESULT_MAX_SIZE (1024 * 1024)		  // larger responses aren't cached
+#define VERSION_BUCKETS 64
+
+// when a table last changed, a result made at another version is stale. Versions are taken
+// from a clock shared by all tables, so a table that is dropped and created again never
+// gets a version it had before
+typedef struct table_version table_version_t;
+struct table_version {
+	char *name;
+	uint64_t version;
+	table_version_t *next;
+};
+
+// the complete encoded response of a SELECT
+typedef struct cached_result cached_result_t;
+struct cached_result {
+	char *key;			  // protocol and statement text with its whitespace collapsed
+	uint64_t versions[2]; // of the FROM and the JOIN table when the result was made
+	char *response;
+	size_t length;
+	size_t references;		// the cache itself and every statement sending the response
+	cached_result_t *next;	// in the same bucket
+	cached_result_t *newer; // towards the most recently used
+	cached_result_t *older;
+};
+
+typedef struct result_cache result_cache_t;
+struct result_cache {
+	pthread_mutex_t lock;
+	cached_result_t *buckets[RESULT_BUCKETS];
+	cached_result_t *newest;
+	cached_result_t *oldest;
+	size_t bytes;
+	table_version_t *versions[VERSION_BUCKETS]; // of the tables that exist, 0 stands for any other
+	uint64_t clock;								 // the last version handed out
+
+	uint64_t hits;
+	uint64_t misses;
+};
+
+result_cache_t *result_cache_create();
+void result_cache_destroy(result_cache_t *cache);
+
+char *result_cache_key(int protocol, const char *statement);
+cached_result_t *result_cache_lookup(result_cache_t *cache, const char *key, request_t *request);
+void result_cache_release(result_cache_t *cache, cached_result_t *result);
+void result_cache_insert(result_cache_t *cache, const char *key, char **tables, const uint64_t *versions, char *response,
+						 size_t length);
+void result_cache_versions(result_cache_t *cache, request_t *request, uint64_t *versions);
+void result_cache_bump(result_cache_t *cache, const char *table);
+void result_cache_forget(result_cache_t *cache, const char *table);
+void result_cache_counters(result_cache_t *cache, uint64_t *hits, uint64_t *misses, size_t *bytes);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+#define SEGMENT_MAGIC "dbsegmnt"
+#define SEGMENT_FORMAT 1
+#define SEGMENT_SIZE (64 * 1024 * 1024) // bytes a segment holds at most, rounded down to whole rows
+#define SEGMENT_ENDING ".seg"
+#define STORAGE_ENTRIES 64				 // transfers a thread hands to its ring at once
+#define STORAGE_FILES 64				 // segment files a thread's ring keeps registered
+#define STORAGE_BUFFER_SIZE (256 * 1024) // registered buffer every transfer of a thread goes through
+
+/*
+ * A table is stored as segment files, <name>.txt first and then <name>.1.txt, <name>.2.txt and
+ * so on. Rows are only appended to the last one, the tail. Once the tail is full it is sealed
+ * and a new one is started, a sealed segment is read-only and never changes again.
+ * <name>.seg lists the segments, a table without it is a single tail segment.
+ */
+typedef struct segment_manifest segment_manifest_t;
+struct segment_manifest {
+	char magic[8];
+	uint32_t format;
+	uint32_t nr_of_segments;
+	uint64_t capacity; // bytes of every segment started from now on
+};
+// followed by the size of every sealed segment, the tail is as long as its file
+
+typedef struct segment segment_t;
+struct segment {
+	int fd;
+	long start; // offset of its first byte in the table
+	long size;
+};
+
+// an open table, the cookie behind the FILE segments_open returns
+typedef struct segments segments_t;
+struct segments {
+	char *name;
+	segment_t *segments;
+	size_t nr_of_segments;
+	long capacity;
+	long position;
+	bool append;
+	int row_size;
+	uint64_t id; // tells the files of this load apart from those of earlier ones in a ring
+	bool registered; // some ring has a slot for one of its files
+};
+
+/*
+ * The io_uring a thread reads and writes tables with once segments_use_uring() turned it on.
+ * Segment files are registered as they are used. A slot keeps its file open until the
+ * segments are closed: the closing thread empties its own slots right away, every other ring
+ * empties the slots of closed segments on its next transfer. Every transfer goes through the
+ * registered buffer, so the kernel never has to map the pages of a request.
+ */
+typedef struct storage_ring storage_ring_t;
+struct storage_ring {
+	uring_t *ring;
+	char *buffer;
+	struct {
+		uint64_t id; // of the segments the file belongs to, 0 for an empty slot
+		size_t segment;
+	} files[STORAGE_FILES];
+	size_t next_slot; // taken over next when a file isn't registered yet
+	uint64_t generation; // of the closed segments when the slots were last emptied
+};
+
+void segments_use_uring(bool enabled);
+
+FILE *segments_open(const char *name, int row_size, bool append, segments_t **loaded);
+segments_t *segments_load(const char *name, int row_size, bool append);
+size_t segments_read_at(segments_t *segments, char *buffer, long offset, size_t length);
+size_t segments_read_rows(segments_t *segments, char *rows, const uint32_t *row_numbers, size_t count);
+long segments_append(segments_t *segments, const char *rows, size_t length);
+void segments_unload(segments_t *segments);
+int segments_drop(const char *name);
+
+#endif
@@ -1,11 +1,14 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <stdio.h>
@@ -18,19 +21,58 @@
 
 #define IP_ADDR "127.0.0.1"
 
+#include "append.h"
 #include "db_functions.h"
+#include "lock_manager.h"
+#include "primary_keys.h"
+#include "protocol.h"
 #include "queue.h"
+#include "replication.h"
 #include "request.h"
+#include "result_cache.h"
+#include "statement_cache.h"
+#include "stats.h"
+#include "trace.h"
 #include "thread_pool.h"
+#include "uring.h"
 
 // #define HELP "help me i suck at dis"
-#define HELP "-h\t\tPrint this text.\n-p <port>\tListen to port number port.\n-d\t\tRun as a daemon instead of as a normal program.\n-l <logfile>\tLog to logfile. If this option is not specified,\n\t\tlogging will be output to syslog, which is the default.\n-s [prefork]"
+#define HELP "-h\t\tPrint this text.\n-p <port>\tListen to port number port.\n-d\t\tRun as a daemon instead of as a normal program.\n-l <logfile>\tLog to logfile. If this option is not specified,\n\t\tlogging will be output to syslog, which is the default.\n-s [prefork]\n" \
+    "-t <tracefile>\tWrite sampled statement traces to tracefile as Chrome trace events.\n" \
+    "-r <rate>\tTrace one in rate statements (100).\n" \
+    "-q <ms>\t\tLog statements that take longer than ms with their breakdown.\n" \
+    "-i [posix|uring]\tAccept and receive with select() or io_uring (posix), uring also reads and writes the tables through a ring per thread and falls back to posix if the kernel refuses it.\n" \
+    "-R <port>\tShip every change to replicas that connect to port, the changes are logged in the database\n\t\tuntil every connected replica applied them.\n" \
+    "-F <port>\tRun as a read-only replica of the primary shipping changes on port. The replica keeps its own\n" \
+    "\t\tdatabase in ../database of the directory it runs in, start it from an empty or copied one."
 
 #define THREAD 0
 #define PREFORK 1
 #define FORK 2
 #define MUX 3
 
+#define IO_POSIX 0 // select() and a system call for every accept() and recv()
+#define IO_URING 1 // one io_uring_enter() submits and reaps every accept, receive and writable poll
+
+#define RECEIVE_SIZE 1024 // bytes received from a connection at a time
+
+#define OUTPUT_HIGH_WATERMARK (256 * 1024) // producers pause once this much output is queued on a connection
+#define OUTPUT_LOW_WATERMARK (64 * 1024)   // and are resumed when it has drained below this
+
+typedef struct connection connection_t;
+struct connection {
+    pthread_mutex_t lock;
+    int protocol;     // PROTOCOL_TEXT or PROTOCOL_BINARY
+    bool negotiated;  // the first bytes received decide the protocol
+    bool closing;     // close the socket once nothing is in flight
+    size_t in_flight; // statements dispatched but not answered yet
+    dynamicstr input; // received binary frames, dispatched one at a time to keep responses in order
+    size_t input_offset;
+    dynamicstr output; // responses the socket hasn't accepted yet, flushed by the listen loop
+    size_t output_offset;
+    struct scan *scan; // SELECT waiting for the output to drain, see resume_scan
+};
+
 typedef struct server server_t;
 struct server {
     queue_t *request_queue;
@@ -38,6 +80,13 @@ struct server {
     char *log_file;
 
     thread_pool_t *pool;
+    lock_manager_t *locks;
+    catalog_t *catalog; // every table and its columns
+    statement_cache_t *statements;
+    result_cache_t *results; // responses of SELECTs, valid until their tables are written
+    primary_keys_t *keys; // key sequence and key set of every table with a primary key
+    appends_t *appends; // INSERTs into the same table are written together
+    replication_t *replication; // NULL unless the server ships its changes or is a replica
     pthread_mutex_t enqueue_lock;
     sem_t empty_sem;
     sem_t full_sem;
@@ -48,6 +97,23 @@ struct server {
     struct sockaddr_storage storage;
     socklen_t address_size;
     fd_set current_sockets;
+    connection_t *connections; // indexed by socket descriptor
+
+    pthread_mutex_t write_lock;
+    fd_set write_sockets; // connections with queued output
+    int wake_pipe[2];     // wakes up select() when write_sockets changes
+
+    int io; // IO_POSIX or IO_URING, the listen loop falls back to IO_POSIX if io_uring can't be set up
+};
+
+// the state of the listen loop when it runs on io_uring
+typedef struct listener listener_t;
+struct listener {
+    uring_t *ring;
+    char *buffers;          // RECEIVE_SIZE bytes for every socket descriptor, registered with the ring
+    uint32_t *generations;  // bumped when a descriptor is accepted, completions for an earlier connection are dropped
+    fd_set polling;         // sockets with a writable poll in the ring
+    char drain[64];         // wake pipe bytes are read into this
 };
 
 typedef struct connection_args connection_args;
@@ -55,6 +121,8 @@ struct connection_args {
     server_t *server;
     size_t socket;
     char *msg;
+    uint64_t received_ns;
+    uint64_t dispatched_ns;
 };
 
 void assign_work(void *arg);
@@ -64,6 +132,12 @@ void server_listen(server_t *server);
 void server_destroy(server_t *server);
 void server_init(server_t *server);
 
+void connection_done(server_t *server, size_t socket);
+void connection_close(server_t *server, size_t socket);
+int connection_write(server_t *server, size_t socket, const char *data, size_t length);
+bool connection_congested(server_t *server, size_t socket);
+bool connection_park(server_t *server, size_t socket, struct scan *scan);
+
 void daemonize_server();
 char *get_ip_from_socket_fd(int fd);
 
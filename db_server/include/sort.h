@@ -0,0 +1,36 @@
+#ifndef SORT_H
+#define SORT_H
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "db_functions.h"
+
+#ifndef SORT_MEMORY
+#define SORT_MEMORY (16 * 1024 * 1024) // bytes of sort entries one ORDER BY keeps in memory before it spills a run
+#endif
+#define SORT_MERGE_THREADS 4 // most workers merging the runs of one ORDER BY, including its own
+#define SORT_FILE_ENDING ".sort"
+
+// a sort entry is the sort key encoded so that memcmp orders it, followed by the big-endian
+// row number, which also keeps rows with the same key in file order
+typedef struct merge merge_t;
+struct merge {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	FILE **runs; // sorted runs waiting to be merged, merged pairs are appended
+	size_t nr_of_runs;
+	size_t merging;	   // pairs being merged right now
+	size_t references; // the sorting thread and the helpers it queued on the pool
+	int entry_size;
+	bool failed;
+};
+
+int sort_scan(scan_t *scan, request_t *request, arena_t *arena, char **client_msg);
+uint32_t sort_entry_row(const char *entry, int entry_size);
+
+#endif
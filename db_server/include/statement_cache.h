@@ -0,0 +1,93 @@
+#ifndef STATEMENT_CACHE_H
+#define STATEMENT_CACHE_H
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "request.h"
+#include "string_hash.h"
+
+#define STATEMENT_BUCKETS 128
+#define STATEMENT_CACHE_SIZE 512 // the cache is flushed when it grows past this many shapes
+#define MAX_LITERALS 64
+#define STATEMENT_ARENA_SIZE 512 // initial arena size of a request cloned from a template
+#define BINDING_ARENA_SIZE 1024	 // initial arena size of the table template a statement is bound to
+
+typedef struct literal literal_t;
+struct literal {
+	const char *start; // points into the statement text
+	size_t length;
+	char data_type; // DT_INT for numbers, DT_VARCHAR for quoted strings
+};
+
+/*
+ * The table a cached statement runs against, resolved from the catalog by the first execution
+ * that finds it missing or made for an older schema. It only changes while the catalog is
+ * locked for a CREATE or DROP, so a statement that holds the catalog lock sees it as it is.
+ * The statement and every request cloned from it hold a reference.
+ */
+typedef struct binding binding_t;
+struct binding {
+	size_t references;
+	pthread_mutex_t lock; // taken to resolve it again
+	uint64_t schema;	  // catalog_schema() it was resolved at, 0 until it is resolved
+	arena_t *arena;		  // holds the columns
+	column_t *columns;	  // template of the table
+	int row_size;
+	int nr_of_columns;
+	int pk_offset;	   // where the primary key starts in a row, -1 if the table has none
+	column_t *key;	   // template column the WHERE clause compares, NULL if there is none
+	int key_offset;
+};
+
+typedef struct statement statement_t;
+struct statement {
+	char *key; // statement text with every literal replaced by '?'
+	request_t *template;
+	size_t nr_of_literals;
+	char data_types[MAX_LITERALS]; // type of the literal that fills each value column
+	int limit_literal;			   // literal that LIMIT takes, -1 if the statement has no LIMIT
+	int offset_literal;			   // and OFFSET
+	binding_t *binding;
+	statement_t *next;
+};
+
+typedef struct prepared prepared_t;
+struct prepared {
+	char *name;
+	size_t client_socket; // prepared statements are private to a connection
+	char *text;			  // statement body with '?' for each parameter
+	size_t nr_of_parameters;
+	prepared_t *next;
+};
+
+typedef struct statement_cache statement_cache_t;
+struct statement_cache {
+	pthread_rwlock_t lock;
+	statement_t *buckets[STATEMENT_BUCKETS];
+	size_t count;
+
+	pthread_mutex_t prepared_lock;
+	prepared_t *prepared[STATEMENT_BUCKETS];
+
+	uint64_t hits;
+	uint64_t misses;
+};
+
+statement_cache_t *statement_cache_create();
+void statement_cache_destroy(statement_cache_t *cache);
+
+request_t *statement_cache_parse(statement_cache_t *cache, size_t client_socket, char *text, char **error, binding_t **binding);
+void binding_release(binding_t *binding);
+void statement_cache_forget(statement_cache_t *cache, size_t client_socket);
+
+#endif
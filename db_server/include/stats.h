@@ -0,0 +1,38 @@
+#ifndef STATS_H
+#define STATS_H
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "histogram.h"
+#include "request.h"
+
+#define STATS_INVALID RT_TYPES			   // statements that didn't parse
+#define STATS_REQUEST_TYPES (RT_TYPES + 1) // every RT_* and STATS_INVALID
+
+// counters of one thread, only that thread writes them so they are never contended,
+// readers add up every thread's shard with stats_collect
+typedef struct thread_stats thread_stats_t;
+struct thread_stats {
+	uint64_t requests[STATS_REQUEST_TYPES];
+	uint64_t bytes_received;
+	uint64_t bytes_sent;
+	uint64_t connections_opened;
+	uint64_t connections_closed; // a connection can be closed by another thread than the one that opened it
+	histogram_t latency[STATS_REQUEST_TYPES]; // nanoseconds from receiving a statement to its last response byte queued
+	thread_stats_t *next;
+};
+
+extern const char *stats_request_names[STATS_REQUEST_TYPES];
+
+thread_stats_t *stats_local();
+void stats_add(uint64_t *counter, uint64_t value);
+void stats_request(int type, uint64_t latency_ns);
+void stats_collect(thread_stats_t *total);
+uint64_t stats_now_ns();
+
+#endif
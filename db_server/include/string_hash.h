@@ -0,0 +1,14 @@
+#ifndef STRING_HASH_H
+#define STRING_HASH_H
+
+#include <stddef.h>
+
+// djb2 of text, seed tells apart equal texts of different owners. Callers reduce it to their buckets
+static inline size_t string_hash(const char *text, size_t seed) {
+	size_t hash = 5381 + seed;
+	while (*text)
+		hash = hash * 33 + (unsigned char)*text++;
+	return hash;
+}
+
+#endif
@@ -20,6 +20,7 @@ struct thread_pool
 	pthread_cond_t work_cond;
 	pthread_cond_t working_cond;
 	size_t working_count;
+	size_t queued_count; // work items waiting for a thread
 	size_t thread_count;
 	bool stop;
 };
@@ -37,6 +38,7 @@ thread_pool_t* thread_pool_create(size_t size);
 void thread_pool_destroy(thread_pool_t* pool);
 bool thread_pool_add_work(thread_pool_t* pool, thread_func_t func, void* arg);
 void thread_pool_wait(thread_pool_t* pool);
+size_t thread_pool_idle(thread_pool_t* pool);
 
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// points in the life of a statement, each request carries a monotonic timestamp for every
+// one of them and the span ending at a stage is named after it, see trace_span_names
+#define TRACE_RECEIVED 0   // select() returned with the statement's bytes
+#define TRACE_DISPATCHED 1 // handed to the pool as handle_connection
+#define TRACE_HANDLED 2	   // handle_connection started
+#define TRACE_PARSED 3
+#define TRACE_ENQUEUED 4 // got a free slot in request_queue
+#define TRACE_DEQUEUED 5 // assign_work took it off request_queue
+#define TRACE_STARTED 6	 // execute_request started
+#define TRACE_LOCKED 7
+#define TRACE_EXECUTED 8
+#define TRACE_DONE 9 // the last byte of the response was queued
+#define TRACE_STAMPS 10
+
+#define TRACE_SAMPLE_RATE 100 // one in this many statements is traced by default
+
+extern const char *trace_span_names[TRACE_STAMPS];
+
+int trace_open(const char *path, unsigned int sample_rate, double slow_ms);
+void trace_close();
+bool trace_enabled();
+
+void trace_stamp(uint64_t *trace, int stage);
+void trace_finish(uint64_t *trace, const char *type, size_t socket, const char *statement);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef URING_H
+#define URING_H
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define URING_ENTRIES 256		// submissions queued before they have to be handed to the kernel
+#define URING_COMPLETIONS 4096 // room for a receive and a writable poll on every connection
+
+// an io_uring driven through the raw system calls, the rings are shared with the kernel
+typedef struct uring uring_t;
+struct uring {
+	int fd;
+	unsigned *sq_head; // advanced by the kernel as it consumes submissions
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned sq_queued; // submissions filled in but not handed to the kernel yet
+	unsigned *cq_head;
+	unsigned *cq_tail; // advanced by the kernel as it posts completions
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+};
+
+uring_t *uring_create(unsigned entries, unsigned completions);
+void uring_destroy(uring_t *ring);
+
+struct io_uring_sqe *uring_sqe(uring_t *ring);
+int uring_submit(uring_t *ring, unsigned wait_nr);
+struct io_uring_cqe *uring_peek(uring_t *ring);
+void uring_seen(uring_t *ring);
+
+int uring_register_files(uring_t *ring, const int *fds, unsigned count);
+int uring_update_file(uring_t *ring, unsigned index, int fd);
+int uring_register_buffer(uring_t *ring, void *base, size_t length);
+
+#endif
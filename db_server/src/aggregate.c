@@ -0,0 +1,396 @@
+#include "aggregate.h"
+#include "parallel_scan.h"
+
+// what a SELECT with aggregates reads and reports, one entry per result column
+typedef struct plan plan_t;
+struct plan {
+	size_t nr_of_outputs;
+	char *kinds;	   // AGG_* of each result column, AGG_NONE is the group column
+	int *offsets;	   // where the INT input of each result column starts in a row, -1 if it reads none
+	column_t *results; // the result columns as announced to binary clients
+	column_t *group;   // template column of GROUP BY
+	int group_offset;
+	int group_width; // 0 puts every row in a single group
+};
+
+typedef struct group_table group_table_t;
+struct group_table {
+	group_t **buckets;
+	size_t nr_of_buckets;
+	size_t nr_of_groups;
+	group_t *first;
+	group_t **last;
+	size_t nr_of_accumulators;
+	int key_width;
+	arena_t *arena;
+};
+
+static const char *function_names[] = {"", "COUNT", "SUM", "MIN", "MAX", "AVG"};
+
+bool has_aggregates(request_t *request) {
+	if (request->group_by)
+		return true;
+	for (column_t *col = request->columns; col; col = col->next)
+		if (col->aggregate != AGG_NONE)
+			return true;
+	return false;
+}
+
+// checks the select list against the table and works out where every input is
+static int make_plan(scan_t *scan, request_t *request, plan_t *plan, arena_t *arena, char **client_msg) {
+	memset(plan, 0, sizeof(*plan));
+	if (!request->columns) {
+		*client_msg = create_format_buffer(arena, "error: column '*' has to be in GROUP BY or in an aggregate\n");
+		return -1;
+	}
+	if (request->group_by) {
+		if (!(plan->group = find_column(scan->columns, request->group_by->name, &plan->group_offset))) {
+			*client_msg = create_format_buffer(arena, "error: table '%s' has no column '%s'\n", request->table_name, request->group_by->name);
+			return -1;
+		}
+		plan->group_width = column_width(plan->group);
+	}
+
+	for (column_t *col = request->columns; col; col = col->next)
+		plan->nr_of_outputs++;
+	plan->kinds = arena_alloc(scan->arena, plan->nr_of_outputs);
+	plan->offsets = arena_alloc(scan->arena, plan->nr_of_outputs * sizeof(int));
+
+	column_t **link = &plan->results;
+	size_t i = 0;
+	for (column_t *col = request->columns; col; col = col->next, i++) {
+		column_t *result = arena_calloc(scan->arena, sizeof(column_t));
+		*link = result;
+		link = &result->next;
+		plan->kinds[i] = col->aggregate;
+		plan->offsets[i] = -1;
+
+		if (col->aggregate == AGG_NONE) {
+			if (!plan->group || strcmp(col->name, plan->group->name) != 0) {
+				*client_msg = create_format_buffer(arena, "error: column '%s' has to be in GROUP BY or in an aggregate\n", col->name);
+				return -1;
+			}
+			*result = *plan->group;
+			result->next = NULL;
+			continue;
+		}
+
+		// only COUNT fits the 32 bit INTs of the protocol, the others are sent as text
+		result->name = create_format_buffer(scan->arena, "%s(%s)", function_names[(int)col->aggregate], col->name);
+		result->data_type = col->aggregate == AGG_COUNT ? DT_INT : DT_VARCHAR;
+		result->char_size = AGGREGATE_TEXT_SIZE;
+		if (col->aggregate == AGG_COUNT && strcmp(col->name, "*") == 0)
+			continue;
+
+		int offset = 0;
+		column_t *input = find_column(scan->columns, col->name, &offset);
+		if (!input) {
+			*client_msg = create_format_buffer(arena, "error: table '%s' has no column '%s'\n", request->table_name, col->name);
+			return -1;
+		}
+		if (col->aggregate == AGG_COUNT) // there are no NULLs, every row counts
+			continue;
+		if (input->data_type != DT_INT) {
+			*client_msg = create_format_buffer(arena, "error: %s needs an INT column but '%s' is a VARCHAR\n",
+											   function_names[(int)col->aggregate], col->name);
+			return -1;
+		}
+		plan->offsets[i] = offset;
+	}
+	return 0;
+}
+
+static int group_table_init(group_table_t *groups, arena_t *arena, size_t nr_of_accumulators, int key_width) {
+	memset(groups, 0, sizeof(*groups));
+	groups->last = &groups->first;
+	groups->nr_of_accumulators = nr_of_accumulators;
+	groups->key_width = key_width;
+	groups->arena = arena;
+	groups->nr_of_buckets = GROUP_BUCKETS;
+	groups->buckets = calloc(GROUP_BUCKETS, sizeof(group_t *));
+	return groups->buckets ? 0 : -1;
+}
+
+static int grow_buckets(group_table_t *groups) {
+	size_t nr_of_buckets = 2 * groups->nr_of_buckets;
+	group_t **buckets = calloc(nr_of_buckets, sizeof(group_t *));
+	if (!buckets)
+		return -1;
+
+	for (group_t *group = groups->first; group; group = group->after) {
+		size_t bucket = group->hash & (nr_of_buckets - 1);
+		group->next = buckets[bucket];
+		buckets[bucket] = group;
+	}
+	free(groups->buckets);
+	groups->buckets = buckets;
+	groups->nr_of_buckets = nr_of_buckets;
+	return 0;
+}
+
+// the group of key, which is added if this is the first row that has it
+static group_t *find_group(group_table_t *groups, const char *key) {
+	uint32_t hash = hash_index_hash(key, groups->key_width);
+	group_t *group = groups->buckets[hash & (groups->nr_of_buckets - 1)];
+	for (; group; group = group->next)
+		if (group->hash == hash && memcmp(group->key, key, groups->key_width) == 0)
+			return group;
+
+	if (groups->nr_of_groups >= groups->nr_of_buckets && grow_buckets(groups) < 0)
+		return NULL;
+	if (!(group = arena_calloc(groups->arena, sizeof(group_t) + groups->nr_of_accumulators * sizeof(accumulator_t))) ||
+		!(group->key = arena_alloc(groups->arena, groups->key_width + 1)))
+		return NULL;
+	memcpy(group->key, key, groups->key_width);
+	group->hash = hash;
+	for (size_t i = 0; i < groups->nr_of_accumulators; i++) {
+		group->accumulators[i].min = INT32_MAX;
+		group->accumulators[i].max = INT32_MIN;
+	}
+
+	size_t bucket = hash & (groups->nr_of_buckets - 1);
+	group->next = groups->buckets[bucket];
+	groups->buckets[bucket] = group;
+	*groups->last = group;
+	groups->last = &group->after;
+	groups->nr_of_groups++;
+	return group;
+}
+
+// the kernels below run over decoded columns with fixed trip counts and no data
+// dependent branches, which lets the compiler vectorize them
+static void decode_column(const char *rows, int row_size, int offset, size_t count, int32_t *values) {
+	for (size_t i = 0; i < count; i++)
+		values[i] = decode_int(rows + i * row_size + offset);
+}
+
+static int64_t sum_kernel(const int32_t *values, size_t count) {
+	int64_t sum = 0;
+	for (size_t i = 0; i < count; i++)
+		sum += values[i];
+	return sum;
+}
+
+static int32_t min_kernel(const int32_t *values, size_t count, int32_t min) {
+	for (size_t i = 0; i < count; i++)
+		min = values[i] < min ? values[i] : min;
+	return min;
+}
+
+static int32_t max_kernel(const int32_t *values, size_t count, int32_t max) {
+	for (size_t i = 0; i < count; i++)
+		max = values[i] > max ? values[i] : max;
+	return max;
+}
+
+static int reduce(scan_t *scan, plan_t *plan, group_table_t *groups) {
+	char *batch = malloc((size_t)SCAN_BATCH * scan->row_size);
+	int32_t *values = malloc(SCAN_BATCH * sizeof(int32_t));
+	group_t **row_groups = malloc(SCAN_BATCH * sizeof(group_t *));
+	int result = batch && values && row_groups ? 0 : -1;
+
+	while (result == 0 && scan->next_row < scan->nr_of_rows) {
+		size_t count = scan_read_batch(scan, batch, NULL);
+
+		if (!plan->group_width) { // one group, every input column is reduced in one go
+			group_t *all = groups->first;
+			all->count += count;
+			for (size_t i = 0; i < plan->nr_of_outputs; i++) {
+				accumulator_t *acc = &all->accumulators[i];
+				if (plan->offsets[i] < 0)
+					continue;
+				decode_column(batch, scan->row_size, plan->offsets[i], count, values);
+				if (plan->kinds[i] == AGG_MIN)
+					acc->min = min_kernel(values, count, acc->min);
+				else if (plan->kinds[i] == AGG_MAX)
+					acc->max = max_kernel(values, count, acc->max);
+				else
+					acc->sum += sum_kernel(values, count);
+			}
+			continue;
+		}
+
+		for (size_t r = 0; r < count; r++) {
+			if (!(row_groups[r] = find_group(groups, batch + r * scan->row_size + plan->group_offset))) {
+				result = -1;
+				break;
+			}
+			row_groups[r]->count++;
+		}
+		for (size_t i = 0; result == 0 && i < plan->nr_of_outputs; i++) {
+			if (plan->offsets[i] < 0)
+				continue;
+			decode_column(batch, scan->row_size, plan->offsets[i], count, values);
+			for (size_t r = 0; r < count; r++) {
+				accumulator_t *acc = &row_groups[r]->accumulators[i];
+				acc->sum += values[r];
+				acc->min = values[r] < acc->min ? values[r] : acc->min;
+				acc->max = values[r] > acc->max ? values[r] : acc->max;
+			}
+		}
+	}
+
+	free(batch);
+	free(values);
+	free(row_groups);
+	return result;
+}
+
+// the groups one range of a parallel aggregate found
+typedef struct partial partial_t;
+struct partial {
+	plan_t *plan;
+	group_table_t groups;
+};
+
+static int reduce_range(scan_t *range, void *state) {
+	partial_t *partial = state;
+	return reduce(range, partial->plan, &partial->groups);
+}
+
+// adds the groups of a range to groups, in the order the range first saw them
+static int combine(group_table_t *groups, group_table_t *partial) {
+	for (group_t *from = partial->first; from; from = from->after) {
+		group_t *into = find_group(groups, from->key);
+		if (!into)
+			return -1;
+		into->count += from->count;
+		for (size_t i = 0; i < groups->nr_of_accumulators; i++) {
+			accumulator_t *acc = &into->accumulators[i];
+			acc->sum += from->accumulators[i].sum;
+			acc->min = from->accumulators[i].min < acc->min ? from->accumulators[i].min : acc->min;
+			acc->max = from->accumulators[i].max > acc->max ? from->accumulators[i].max : acc->max;
+		}
+	}
+	return 0;
+}
+
+// reduces the ranges of a large table on several workers, each into groups of its own.
+// They are combined in range order, so the groups keep the order of a single scan
+static int reduce_parallel(scan_t *scan, plan_t *plan, group_table_t *groups, size_t nr_of_ranges) {
+	partial_t *partials = calloc(nr_of_ranges, sizeof(partial_t));
+	void **states = calloc(nr_of_ranges, sizeof(void *));
+	int result = partials && states ? 0 : -1;
+
+	for (size_t i = 0; result == 0 && i < nr_of_ranges; i++) {
+		arena_t *arena = arena_create(SCAN_ARENA_SIZE); // group_table_init keeps it, freed below
+		partials[i].plan = plan;
+		states[i] = &partials[i];
+		if (!arena || group_table_init(&partials[i].groups, arena, groups->nr_of_accumulators, groups->key_width) < 0 ||
+			(!plan->group_width && !find_group(&partials[i].groups, "")))
+			result = -1;
+	}
+	if (result == 0)
+		result = parallel_scan(scan, nr_of_ranges, reduce_range, states);
+	for (size_t i = 0; result == 0 && i < nr_of_ranges; i++)
+		result = combine(groups, &partials[i].groups);
+
+	for (size_t i = 0; partials && i < nr_of_ranges; i++) {
+		free(partials[i].groups.buckets);
+		arena_destroy(partials[i].groups.arena);
+	}
+	free(partials);
+	free(states);
+	return result;
+}
+
+// the group column the way encode_text_row and encode_binary_row send it
+static void encode_key(dynamicstr *out, int protocol, column_t *column, const char *key) {
+	int width = column_width(column);
+	if (protocol == PROTOCOL_BINARY && column->data_type == DT_INT) {
+		protocol_append_u32(out, (uint32_t)decode_int(key));
+		return;
+	}
+
+	// text keeps the last character so 0 stays 0, binary VARCHARs drop all of the padding
+	int keep = protocol == PROTOCOL_TEXT ? 1 : 0;
+	int skip = 0;
+	while (skip < width - keep && key[skip] == PADDING)
+		skip++;
+	if (protocol == PROTOCOL_BINARY)
+		protocol_append_u16(out, (uint16_t)(width - skip));
+	string_append(out, key + skip, width - skip);
+}
+
+static void encode_group(dynamicstr *out, int protocol, plan_t *plan, group_t *group) {
+	char text[AGGREGATE_TEXT_SIZE + 8];
+	size_t start = protocol == PROTOCOL_BINARY ? protocol_begin_frame(out, F_ROW) : 0;
+
+	for (size_t i = 0; i < plan->nr_of_outputs; i++) {
+		accumulator_t *acc = &group->accumulators[i];
+		char kind = plan->kinds[i];
+
+		if (kind == AGG_NONE) {
+			encode_key(out, protocol, plan->group, group->key);
+		} else if (kind == AGG_COUNT && protocol == PROTOCOL_BINARY) {
+			protocol_append_u32(out, (uint32_t)group->count);
+		} else {
+			if (kind == AGG_COUNT)
+				snprintf(text, sizeof(text), "%" PRId64, group->count);
+			else if (!group->count) // the aggregate of no rows is NULL, the same as in SQL
+				snprintf(text, sizeof(text), "NULL");
+			else if (kind == AGG_SUM)
+				snprintf(text, sizeof(text), "%" PRId64, acc->sum);
+			else if (kind == AGG_MIN)
+				snprintf(text, sizeof(text), "%d", acc->min);
+			else if (kind == AGG_MAX)
+				snprintf(text, sizeof(text), "%d", acc->max);
+			else
+				snprintf(text, sizeof(text), "%.3f", (double)acc->sum / group->count);
+
+			if (protocol == PROTOCOL_BINARY)
+				protocol_append_u16(out, (uint16_t)strlen(text));
+			string_append_str(out, text);
+		}
+		if (protocol == PROTOCOL_TEXT)
+			string_append_char(out, i + 1 < plan->nr_of_outputs ? '\t' : '\n');
+	}
+
+	if (protocol == PROTOCOL_BINARY)
+		protocol_end_frame(out, start);
+}
+
+// runs a SELECT with aggregates over the rows of scan and queues the whole result in scan->out
+int aggregate_scan(scan_t *scan, request_t *request, arena_t *arena, char **client_msg) {
+	plan_t plan;
+	group_table_t groups;
+
+	if (make_plan(scan, request, &plan, arena, client_msg) < 0)
+		return -1;
+	if (group_table_init(&groups, scan->arena, plan.nr_of_outputs, plan.group_width) < 0 ||
+		(!plan.group_width && !find_group(&groups, ""))) { // without GROUP BY there is a result even for no rows
+		free(groups.buckets);
+		*client_msg = create_format_buffer(arena, "error: server ran out of memory\n");
+		return -1;
+	}
+
+	// COUNT(*) of a whole table is known from the size of its file
+	bool counts_only = !plan.group_width && !scan->key;
+	for (size_t i = 0; i < plan.nr_of_outputs; i++)
+		counts_only = counts_only && plan.kinds[i] == AGG_COUNT;
+
+	size_t nr_of_ranges = counts_only ? 1 : scan_parallelism(scan);
+	if (counts_only) {
+		groups.first->count = scan->nr_of_rows;
+	} else if ((nr_of_ranges > 1 ? reduce_parallel(scan, &plan, &groups, nr_of_ranges) : reduce(scan, &plan, &groups)) < 0) {
+		free(groups.buckets);
+		*client_msg = create_format_buffer(arena, "error: server ran out of memory\n");
+		return -1;
+	}
+
+	if (scan->protocol == PROTOCOL_BINARY)
+		encode_result_header(&scan->out, plan.results);
+	for (group_t *group = groups.first; group; group = group->after)
+		encode_group(&scan->out, scan->protocol, &plan, group);
+
+	if (scan->protocol == PROTOCOL_BINARY) {
+		size_t start = protocol_begin_frame(&scan->out, F_COMPLETE);
+		protocol_append_u32(&scan->out, (uint32_t)groups.nr_of_groups);
+		protocol_end_frame(&scan->out, start);
+	} else if (!groups.nr_of_groups) {
+		string_append_str(&scan->out, "no matching rows\n");
+	}
+
+	free(groups.buckets);
+	return 0;
+}
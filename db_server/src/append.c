@@ -0,0 +1,170 @@
+#include "append.h"
+#include "db_functions.h"
+
+appends_t *appends_create() {
+	appends_t *appends = calloc(1, sizeof(appends_t));
+	if (!appends)
+		return NULL;
+
+	pthread_mutex_init(&appends->lock, NULL);
+	return appends;
+}
+
+void appends_destroy(appends_t *appends) {
+	if (!appends) // sanity check
+		return;
+
+	// appenders only exist while an INSERT uses them, by now there are none
+	pthread_mutex_destroy(&appends->lock);
+	free(appends);
+}
+
+// the caller holds appends->lock
+static appender_t *appender_get(appends_t *appends, const char *name) {
+	size_t bucket = string_hash(name, 0) % APPEND_BUCKETS;
+	appender_t *appender;
+
+	for (appender = appends->buckets[bucket]; appender; appender = appender->next)
+		if (strcmp(appender->name, name) == 0)
+			break;
+
+	if (!appender) { // the first INSERT into this table in a while, create its entry
+		if (!(appender = calloc(1, sizeof(appender_t))))
+			return NULL;
+		if (!(appender->name = strdup(name))) {
+			free(appender);
+			return NULL;
+		}
+		pthread_mutex_init(&appender->lock, NULL);
+		pthread_cond_init(&appender->written, NULL);
+		appender->next = appends->buckets[bucket];
+		appends->buckets[bucket] = appender;
+	}
+	appender->references++;
+	return appender;
+}
+
+// the caller holds appends->lock
+static void appender_put(appends_t *appends, appender_t *appender) {
+	if (--appender->references)
+		return;
+
+	appender_t **link = &appends->buckets[string_hash(appender->name, 0) % APPEND_BUCKETS];
+	while (*link != appender)
+		link = &(*link)->next;
+	*link = appender->next;
+
+	appends->rows += appender->rows;
+	appends->batches += appender->batches;
+	segments_unload(appender->segments);
+	pthread_cond_destroy(&appender->written);
+	pthread_mutex_destroy(&appender->lock);
+	free(appender->name);
+	free(appender);
+}
+
+// writes the rows of batch as one buffer and numbers them, the caller is the appender's writer but doesn't hold its lock
+static void write_batch(appender_t *appender, int row_size, append_entry_t *batch, append_func_t func, void *arg) {
+	const char *table = appender->name;
+	size_t length = 0;
+	for (append_entry_t *entry = batch; entry; entry = entry->next)
+		length += entry->length;
+
+	// a batch of one row is written as it is
+	char *rows = batch->next ? malloc(length) : (char *)batch->row;
+	if (rows && batch->next) {
+		size_t offset = 0;
+		for (append_entry_t *entry = batch; entry; entry = entry->next) {
+			memcpy(rows + offset, entry->row, entry->length);
+			offset += entry->length;
+		}
+	}
+
+	if (!appender->segments)
+		appender->segments = segments_load(table, row_size, true);
+	long first_row = rows && appender->segments ? segments_append(appender->segments, rows, length) : -1;
+	if (first_row < 0)
+		log_to_file("Error: Couldn't append %zu bytes to '%s' in write_batch()\n", length, table);
+	if (!rows)
+		length = 0;
+	long row_number = first_row;
+	for (append_entry_t *entry = batch; entry; entry = entry->next) {
+		entry->row_number = row_number;
+		if (row_number >= 0)
+			row_number += (long)(entry->length / row_size);
+	}
+
+	func(table, row_size, rows, length, first_row, arg);
+	if (rows != batch->row)
+		free(rows);
+}
+
+/*
+ * Appends row, length bytes made of whole rows of row_size, to table and returns its row
+ * number, or -1 if it couldn't be written. If another INSERT is writing a batch the row waits
+ * for the next one. func is called once for every batch this thread writes. The caller holds
+ * the table in LM_IX, so no SELECT sees a batch while it is being written.
+ */
+long append_row(appends_t *appends, const char *table, int row_size, const char *row, size_t length, append_func_t func, void *arg) {
+	append_entry_t entry = {row, length, -1, false, NULL};
+
+	pthread_mutex_lock(&appends->lock);
+	appender_t *appender = appender_get(appends, table);
+	pthread_mutex_unlock(&appends->lock);
+	if (!appender)
+		return -1;
+
+	pthread_mutex_lock(&appender->lock);
+	if (appender->last)
+		appender->last->next = &entry;
+	else
+		appender->first = &entry;
+	appender->last = &entry;
+
+	while (!entry.done) {
+		if (appender->writing) {
+			pthread_cond_wait(&appender->written, &appender->lock);
+			continue;
+		}
+
+		// nobody is writing, this thread writes every row queued so far, its own included
+		append_entry_t *batch = appender->first;
+		appender->first = appender->last = NULL;
+		appender->writing = true;
+		pthread_mutex_unlock(&appender->lock);
+
+		write_batch(appender, row_size, batch, func, arg);
+
+		pthread_mutex_lock(&appender->lock);
+		appender->writing = false;
+		uint64_t rows = 0;
+		for (append_entry_t *next; batch; batch = next) {
+			next = batch->next; // the entry belongs to its INSERT again once it is done
+			rows++;
+			batch->done = true;
+		}
+		__atomic_add_fetch(&appender->rows, rows, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&appender->batches, 1, __ATOMIC_RELAXED);
+		pthread_cond_broadcast(&appender->written);
+	}
+	long row_number = entry.row_number;
+	pthread_mutex_unlock(&appender->lock);
+
+	pthread_mutex_lock(&appends->lock);
+	appender_put(appends, appender);
+	pthread_mutex_unlock(&appends->lock);
+	return row_number;
+}
+
+// the rows appended so far and the writes they took, for .stats
+void appends_counters(appends_t *appends, uint64_t *rows, uint64_t *batches) {
+	pthread_mutex_lock(&appends->lock);
+	*rows = appends->rows;
+	*batches = appends->batches;
+	for (size_t i = 0; i < APPEND_BUCKETS; i++)
+		for (appender_t *appender = appends->buckets[i]; appender; appender = appender->next) {
+			*rows += __atomic_load_n(&appender->rows, __ATOMIC_RELAXED);
+			*batches += __atomic_load_n(&appender->batches, __ATOMIC_RELAXED);
+		}
+	pthread_mutex_unlock(&appends->lock);
+}
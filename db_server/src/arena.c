@@ -0,0 +1,89 @@
+#include "arena.h"
+
+arena_t *arena_create(size_t size) {
+	arena_t *arena = malloc(ARENA_HEADER_SIZE + ARENA_ROUND(size));
+	if (!arena)
+		return NULL;
+
+	arena->cursor = (char *)arena + ARENA_HEADER_SIZE;
+	arena->end = arena->cursor + ARENA_ROUND(size);
+	arena->size = ARENA_ROUND(size);
+	arena->blocks = NULL;
+
+	return arena;
+}
+
+void arena_destroy(arena_t *arena) {
+	if (!arena) // sanity check
+		return;
+
+	arena_block_t *current, *next;
+	for (current = arena->blocks; current; current = next) {
+		next = current->next;
+		free(current);
+	}
+	free(arena);
+}
+
+void arena_reset(arena_t *arena) {
+	// drop the overflow blocks and rewind to the start of the first block
+	arena_block_t *current, *next;
+	for (current = arena->blocks; current; current = next) {
+		next = current->next;
+		free(current);
+	}
+	arena->blocks = NULL;
+	arena->cursor = (char *)arena + ARENA_HEADER_SIZE;
+	arena->end = arena->cursor + arena->size;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+	size = ARENA_ROUND(size);
+
+	if (size > (size_t)(arena->end - arena->cursor)) { // chain on a new block big enough for the request
+		size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+		arena_block_t *block = malloc(ARENA_ROUND(sizeof(arena_block_t)) + block_size);
+		if (!block)
+			return NULL;
+
+		block->next = arena->blocks;
+		arena->blocks = block;
+		arena->cursor = (char *)block + ARENA_ROUND(sizeof(arena_block_t));
+		arena->end = arena->cursor + block_size;
+	}
+
+	void *memory = arena->cursor;
+	arena->cursor += size;
+	return memory;
+}
+
+void *arena_calloc(arena_t *arena, size_t size) {
+	void *memory = arena_alloc(arena, size);
+	if (memory)
+		memset(memory, 0, size);
+	return memory;
+}
+
+char *arena_strndup(arena_t *arena, const char *str, size_t length) {
+	char *copy = arena_alloc(arena, length + 1);
+	if (!copy)
+		return NULL;
+
+	memcpy(copy, str, length);
+	copy[length] = '\0';
+	return copy;
+}
+
+void *arena_grow(arena_t *arena, void *memory, size_t old_size, size_t new_size) {
+	// the latest allocation can be extended in place if the block has room left
+	if (memory && (char *)memory + ARENA_ROUND(old_size) == arena->cursor &&
+		ARENA_ROUND(new_size) <= (size_t)(arena->end - (char *)memory)) {
+		arena->cursor = (char *)memory + ARENA_ROUND(new_size);
+		return memory;
+	}
+
+	void *bigger = arena_alloc(arena, new_size);
+	if (bigger && memory)
+		memcpy(bigger, memory, old_size < new_size ? old_size : new_size);
+	return bigger;
+}
@@ -0,0 +1,570 @@
+#define _GNU_SOURCE
+#include "private_variables.h"
+#include "histogram.h"
+#include "protocol.h"
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HELP "usage: bench [options]\n\n" \
+	"-p <port>\tConnect to port number port (7798).\n" \
+	"-c <n>\t\tOpen n connections (8).\n" \
+	"-t <n>\t\tSpread the connections over n threads (2).\n" \
+	"-d <seconds>\tRun for this long (5).\n" \
+	"-r <rate>\tOpen loop, send rate requests per second in total. Without it\n" \
+	"\t\tevery connection sends its next request once the last one is answered.\n" \
+	"-m <mix>\tRequest mix as op=weight pairs (insert=50,select=10,lookup=40).\n" \
+	"\t\tops: create, insert, select, drop, lookup\n" \
+	"-n <rows>\tRows inserted into the bench table before the run (1000).\n" \
+	"-j\t\tPrint the results as JSON.\n" \
+	"-k\t\tKeep the bench table after the run."
+
+#define BENCH_TABLE "bench"
+#define MAX_OUTSTANDING 4096 // requests a connection can have in flight in open loop mode
+#define PRELOAD_BATCH 256
+
+#define OP_CREATE 0
+#define OP_INSERT 1
+#define OP_SELECT 2
+#define OP_DROP 3
+#define OP_LOOKUP 4
+#define OP_COUNT 5
+
+static const char *op_names[OP_COUNT] = {"create", "insert", "select", "drop", "lookup"};
+
+typedef struct outstanding outstanding_t;
+struct outstanding {
+	uint64_t start_ns; // when the request was supposed to go out, which avoids coordinated omission
+	int op;
+};
+
+typedef struct connection connection_t;
+struct connection {
+	int socket;
+	int id;
+	dynamicstr input;
+	size_t input_offset;
+	outstanding_t queue[MAX_OUTSTANDING];
+	size_t head;
+	size_t count;
+	uint64_t next_send_ns;
+	uint64_t tables_created; // every connection creates and drops its own tables, in order
+	uint64_t tables_dropped;
+};
+
+typedef struct worker worker_t;
+struct worker {
+	pthread_t thread;
+	connection_t *connections;
+	size_t nr_of_connections;
+	unsigned int seed;
+	histogram_t latency[OP_COUNT];
+	uint64_t errors[OP_COUNT];
+	bool failed;
+};
+
+typedef struct options options_t;
+struct options {
+	size_t port;
+	size_t connections;
+	size_t threads;
+	double duration;
+	double rate;
+	unsigned int mix[OP_COUNT];
+	unsigned int mix_total;
+	size_t rows;
+	bool json;
+	bool keep;
+};
+
+static options_t options = {7798, 8, 2, 5.0, 0.0, {0, 50, 10, 0, 40}, 100, 1000, false, false};
+static uint64_t deadline_ns;
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int connect_to_server() {
+	struct sockaddr_in server_address;
+	int client_socket = socket(PF_INET, SOCK_STREAM, 0);
+	setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+
+	server_address.sin_family = AF_INET;
+	server_address.sin_port = htons(options.port);
+	server_address.sin_addr.s_addr = inet_addr(IP_ADDR);
+	memset(server_address.sin_zero, '\0', sizeof(server_address.sin_zero));
+	if (connect(client_socket, (struct sockaddr *)&server_address, sizeof(server_address)) < 0) {
+		perror("connect");
+		close(client_socket);
+		return -1;
+	}
+
+	// switch to the binary protocol, it's the only one that tells us when a result is complete
+	char handshake[HANDSHAKE_SIZE];
+	protocol_handshake(handshake);
+	if (protocol_send(client_socket, handshake, HANDSHAKE_SIZE) < 0 || recv(client_socket, handshake, HANDSHAKE_SIZE, MSG_WAITALL) != HANDSHAKE_SIZE ||
+		!protocol_is_handshake(handshake, HANDSHAKE_SIZE)) {
+		printf("error: the server doesn't speak the binary protocol\n");
+		close(client_socket);
+		return -1;
+	}
+	return client_socket;
+}
+
+static int send_statement(connection_t *conn, const char *statement) {
+	char frame[256];
+	size_t length = strlen(statement);
+	if (length + FRAME_HEADER_SIZE > sizeof(frame))
+		return -1;
+
+	frame[0] = (char)(length >> 24);
+	frame[1] = (char)(length >> 16);
+	frame[2] = (char)(length >> 8);
+	frame[3] = (char)length;
+	frame[4] = F_QUERY;
+	memcpy(frame + FRAME_HEADER_SIZE, statement, length);
+	return protocol_send(conn->socket, frame, FRAME_HEADER_SIZE + length);
+}
+
+// returns 1 for every completed response, -1 for an error response, 0 if
+// no complete response is buffered and -2 if the connection broke
+static int next_response(connection_t *conn) {
+	while (true) {
+		char *frame = conn->input.buffer + conn->input_offset;
+		long size = protocol_frame_size(frame, conn->input.length - conn->input_offset);
+		if (size < 0)
+			return -2;
+		if (size == 0)
+			break;
+
+		conn->input_offset += size;
+		if (frame[FRAME_HEADER_SIZE - 1] == F_COMPLETE)
+			return 1;
+		if (frame[FRAME_HEADER_SIZE - 1] == F_ERROR)
+			return -1;
+	}
+
+	// keep the partial frame and throw away everything before it
+	size_t left = conn->input.length - conn->input_offset;
+	memmove(conn->input.buffer, conn->input.buffer + conn->input_offset, left);
+	conn->input.length = left;
+	conn->input_offset = 0;
+	return 0;
+}
+
+static int read_responses(connection_t *conn) {
+	if (string_reserve(&conn->input, 65536) < 0)
+		return -1;
+	ssize_t received = recv(conn->socket, conn->input.buffer + conn->input.length, conn->input.capacity - conn->input.length - 1, MSG_DONTWAIT);
+	if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		return -1;
+	if (received > 0)
+		conn->input.length += received;
+	return 0;
+}
+
+static int pick_op(worker_t *worker) {
+	unsigned int roll = (unsigned int)rand_r(&worker->seed) % options.mix_total;
+	for (int op = 0; op < OP_COUNT; op++) {
+		if (roll < options.mix[op])
+			return op;
+		roll -= options.mix[op];
+	}
+	return OP_INSERT;
+}
+
+static void build_statement(worker_t *worker, connection_t *conn, int *op, char *statement, size_t size) {
+	char name[9];
+	if (*op == OP_DROP && conn->tables_dropped == conn->tables_created) // nothing to drop yet
+		*op = OP_CREATE;
+
+	switch (*op) {
+	case OP_CREATE:
+		snprintf(statement, size, "CREATE TABLE %s_%d_%" PRIu64 " (id INT, name VARCHAR(8));", BENCH_TABLE, conn->id, conn->tables_created++);
+		break;
+	case OP_DROP:
+		snprintf(statement, size, "DROP TABLE %s_%d_%" PRIu64 ";", BENCH_TABLE, conn->id, conn->tables_dropped++);
+		break;
+	case OP_SELECT:
+		snprintf(statement, size, "SELECT * FROM %s;", BENCH_TABLE);
+		break;
+	case OP_LOOKUP:
+		snprintf(statement, size, "SELECT * FROM %s WHERE id=%d;", BENCH_TABLE, 1 + rand_r(&worker->seed) % (int)(options.rows ? options.rows : 1));
+		break;
+	default:
+		for (size_t i = 0; i < sizeof(name) - 1; i++)
+			name[i] = 'a' + rand_r(&worker->seed) % 26;
+		name[sizeof(name) - 1] = '\0';
+		snprintf(statement, size, "INSERT INTO %s VALUES ('%s');", BENCH_TABLE, name);
+		break;
+	}
+}
+
+static bool send_next(worker_t *worker, connection_t *conn, uint64_t start_ns) {
+	char statement[128];
+	int op = pick_op(worker);
+	build_statement(worker, conn, &op, statement, sizeof(statement));
+	if (send_statement(conn, statement) < 0)
+		return false;
+
+	outstanding_t *slot = &conn->queue[(conn->head + conn->count) % MAX_OUTSTANDING];
+	slot->start_ns = start_ns;
+	slot->op = op;
+	conn->count++;
+	return true;
+}
+
+static void *run_worker(void *arg) {
+	worker_t *worker = (worker_t *)arg;
+	struct pollfd *fds = calloc(worker->nr_of_connections, sizeof(struct pollfd));
+	uint64_t interval_ns = options.rate > 0 ? (uint64_t)(1e9 * options.connections / options.rate) : 0;
+	uint64_t start = now_ns();
+
+	for (size_t i = 0; i < worker->nr_of_connections; i++) {
+		fds[i].fd = worker->connections[i].socket;
+		fds[i].events = POLLIN;
+		// stagger the connections so an open loop run doesn't send in bursts
+		worker->connections[i].next_send_ns = start + (interval_ns ? (uint64_t)rand_r(&worker->seed) % interval_ns : 0);
+	}
+
+	while (true) {
+		uint64_t now = now_ns();
+		bool sending = now < deadline_ns;
+		bool waiting = false;
+		uint64_t wake_ns = deadline_ns;
+
+		for (size_t i = 0; i < worker->nr_of_connections; i++) {
+			connection_t *conn = &worker->connections[i];
+			if (sending && interval_ns) {
+				// open loop: send on schedule no matter how far behind the server is
+				while (conn->next_send_ns <= now && conn->next_send_ns < deadline_ns && conn->count < MAX_OUTSTANDING) {
+					if (!send_next(worker, conn, conn->next_send_ns))
+						goto broken;
+					conn->next_send_ns += interval_ns;
+				}
+				if (conn->next_send_ns < wake_ns)
+					wake_ns = conn->next_send_ns;
+			} else if (sending && conn->count == 0 && !send_next(worker, conn, now)) {
+				goto broken;
+			}
+			waiting |= conn->count > 0;
+		}
+
+		if (!sending && !waiting)
+			break;
+
+		int timeout_ms = sending && wake_ns > now ? (int)((wake_ns - now) / 1000000) : 0;
+		if (!interval_ns || !sending)
+			timeout_ms = 100;
+		if (poll(fds, worker->nr_of_connections, timeout_ms) < 0 && errno != EINTR)
+			goto broken;
+
+		for (size_t i = 0; i < worker->nr_of_connections; i++) {
+			connection_t *conn = &worker->connections[i];
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			if (read_responses(conn) < 0)
+				goto broken;
+
+			int result;
+			while (conn->count > 0 && (result = next_response(conn)) != 0) {
+				if (result == -2)
+					goto broken;
+
+				outstanding_t *slot = &conn->queue[conn->head];
+				conn->head = (conn->head + 1) % MAX_OUTSTANDING;
+				conn->count--;
+				histogram_record(&worker->latency[slot->op], now_ns() - slot->start_ns);
+				if (result < 0)
+					worker->errors[slot->op]++;
+			}
+		}
+
+		// give up on requests the server never answers
+		if (!sending && now_ns() > deadline_ns + 10 * 1000000000ULL)
+			goto broken;
+	}
+
+	free(fds);
+	return NULL;
+
+broken:
+	fprintf(stderr, "error: lost a connection to the server\n");
+	worker->failed = true;
+	free(fds);
+	return NULL;
+}
+
+// runs statements on one connection and waits for all the answers
+static int run_statements(int client_socket, const char **statements, size_t count) {
+	connection_t *conn = calloc(1, sizeof(connection_t));
+	conn->socket = client_socket;
+	string_init(&conn->input, NULL, 0);
+
+	int errors = 0;
+	for (size_t i = 0; i < count; i++)
+		if (send_statement(conn, statements[i]) < 0)
+			errors = -1;
+
+	for (size_t answered = 0; errors >= 0 && answered < count;) {
+		int result = next_response(conn);
+		if (result == 0 && read_responses(conn) < 0)
+			result = -2;
+		if (result == -2)
+			errors = -1;
+		else if (result != 0) {
+			answered++;
+			errors += result < 0;
+		}
+	}
+
+	string_free(&conn->input);
+	free(conn);
+	return errors;
+}
+
+static int preload(int client_socket) {
+	const char *create = "CREATE TABLE " BENCH_TABLE " (id INT, name VARCHAR(8), PRIMARY KEY(id));";
+	run_statements(client_socket, &create, 1); // fails if the table is left over from an earlier run
+
+	char (*inserts)[64] = malloc(PRELOAD_BATCH * sizeof(*inserts));
+	const char *batch[PRELOAD_BATCH];
+	for (size_t done = 0; done < options.rows;) {
+		size_t count = options.rows - done < PRELOAD_BATCH ? options.rows - done : PRELOAD_BATCH;
+		for (size_t i = 0; i < count; i++) {
+			snprintf(inserts[i], sizeof(inserts[i]), "INSERT INTO %s VALUES ('preload');", BENCH_TABLE);
+			batch[i] = inserts[i];
+		}
+		if (run_statements(client_socket, batch, count) != 0) {
+			free(inserts);
+			return -1;
+		}
+		done += count;
+	}
+	free(inserts);
+	return 0;
+}
+
+static void cleanup(worker_t *workers) {
+	int client_socket = connect_to_server();
+	if (client_socket < 0)
+		return;
+
+	char statement[128];
+	const char *drop = statement;
+	for (size_t w = 0; w < options.threads; w++) {
+		for (size_t i = 0; i < workers[w].nr_of_connections; i++) {
+			connection_t *conn = &workers[w].connections[i];
+			while (conn->tables_dropped < conn->tables_created) {
+				snprintf(statement, sizeof(statement), "DROP TABLE %s_%d_%" PRIu64 ";", BENCH_TABLE, conn->id, conn->tables_dropped++);
+				run_statements(client_socket, &drop, 1);
+			}
+		}
+	}
+	if (!options.keep) {
+		snprintf(statement, sizeof(statement), "DROP TABLE %s;", BENCH_TABLE);
+		run_statements(client_socket, &drop, 1);
+	}
+	close(client_socket);
+}
+
+static void print_text(histogram_t *latency, uint64_t *errors, double elapsed) {
+	uint64_t total = 0, failed = 0;
+	for (int op = 0; op < OP_COUNT; op++) {
+		total += latency[op].total;
+		failed += errors[op];
+	}
+
+	printf("%zu connections on %zu threads, %s loop", options.connections, options.threads, options.rate > 0 ? "open" : "closed");
+	if (options.rate > 0)
+		printf(" at %.0f req/s", options.rate);
+	printf(", %.2f s\n", elapsed);
+	printf("%" PRIu64 " requests, %" PRIu64 " errors, %.1f req/s\n\n", total, failed, total / elapsed);
+
+	printf("%-8s %10s %8s %10s %10s %10s %10s %10s\n", "op", "count", "errors", "mean us", "p50 us", "p99 us", "p99.9 us", "max us");
+	for (int op = 0; op <= OP_COUNT; op++) {
+		histogram_t *h = &latency[op];
+		if (h->total == 0)
+			continue;
+		printf("%-8s %10" PRIu64 " %8" PRIu64 " %10.1f %10.1f %10.1f %10.1f %10.1f\n", op == OP_COUNT ? "all" : op_names[op], h->total,
+			   op == OP_COUNT ? failed : errors[op], histogram_mean(h) / 1e3, histogram_percentile(h, 50) / 1e3, histogram_percentile(h, 99) / 1e3,
+			   histogram_percentile(h, 99.9) / 1e3, h->max / 1e3);
+	}
+}
+
+static void print_json_latency(histogram_t *h) {
+	printf("{\"count\": %" PRIu64 ", \"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f", h->total,
+		   histogram_mean(h) / 1e3, histogram_percentile(h, 50) / 1e3, histogram_percentile(h, 99) / 1e3, histogram_percentile(h, 99.9) / 1e3,
+		   h->total ? h->max / 1e3 : 0.0);
+}
+
+static void print_json(histogram_t *latency, uint64_t *errors, double elapsed) {
+	uint64_t failed = 0;
+	for (int op = 0; op < OP_COUNT; op++)
+		failed += errors[op];
+
+	printf("{\"connections\": %zu, \"threads\": %zu, \"mode\": \"%s\", \"rate\": %.0f, \"duration_s\": %.3f, ", options.connections, options.threads,
+		   options.rate > 0 ? "open" : "closed", options.rate, elapsed);
+	printf("\"requests\": %" PRIu64 ", \"errors\": %" PRIu64 ", \"throughput\": %.1f, \"latency\": ", latency[OP_COUNT].total, failed,
+		   latency[OP_COUNT].total / elapsed);
+	print_json_latency(&latency[OP_COUNT]);
+	printf("}, \"ops\": {");
+	bool first = true;
+	for (int op = 0; op < OP_COUNT; op++) {
+		if (latency[op].total == 0)
+			continue;
+		printf("%s\"%s\": ", first ? "" : ", ", op_names[op]);
+		print_json_latency(&latency[op]);
+		printf(", \"errors\": %" PRIu64 "}", errors[op]);
+		first = false;
+	}
+	printf("}}\n");
+}
+
+static bool parse_mix(char *mix) {
+	memset(options.mix, 0, sizeof(options.mix));
+	options.mix_total = 0;
+
+	for (char *pair = strtok(mix, ","); pair; pair = strtok(NULL, ",")) {
+		char *weight = strchr(pair, '=');
+		if (!weight)
+			return false;
+		*weight++ = '\0';
+
+		int op;
+		for (op = 0; op < OP_COUNT && strcmp(pair, op_names[op]) != 0; op++)
+			;
+		if (op == OP_COUNT)
+			return false;
+		options.mix[op] = (unsigned int)strtoul(weight, NULL, 10);
+		options.mix_total += options.mix[op];
+	}
+	return options.mix_total > 0;
+}
+
+int main(int argc, char *argv[]) {
+	// start at one because the first argument is the name of the executable
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-h") == 0) {
+			printf("%s\n", HELP);
+			exit(EXIT_SUCCESS);
+		} else if (strcmp(argv[i], "-j") == 0) {
+			options.json = true;
+			continue;
+		} else if (strcmp(argv[i], "-k") == 0) {
+			options.keep = true;
+			continue;
+		}
+
+		if (i + 1 >= argc) {
+			printf("error: expected a positional argument\n");
+			exit(EXIT_FAILURE);
+		}
+		char *second_arg = argv[++i];
+
+		if (strcmp(argv[i - 1], "-p") == 0)
+			options.port = strtoumax(second_arg, NULL, 10);
+		else if (strcmp(argv[i - 1], "-c") == 0)
+			options.connections = strtoumax(second_arg, NULL, 10);
+		else if (strcmp(argv[i - 1], "-t") == 0)
+			options.threads = strtoumax(second_arg, NULL, 10);
+		else if (strcmp(argv[i - 1], "-d") == 0)
+			options.duration = strtod(second_arg, NULL);
+		else if (strcmp(argv[i - 1], "-r") == 0)
+			options.rate = strtod(second_arg, NULL);
+		else if (strcmp(argv[i - 1], "-n") == 0)
+			options.rows = strtoumax(second_arg, NULL, 10);
+		else if (strcmp(argv[i - 1], "-m") == 0) {
+			if (!parse_mix(second_arg)) {
+				printf("error: expected a mix like insert=50,select=50 but got %s\n", second_arg);
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			printf("Incorrect argument '%s'\n\n%s\n", argv[i - 1], HELP);
+			exit(3);
+		}
+	}
+
+	if (options.connections == 0 || options.threads == 0 || options.duration <= 0) {
+		printf("error: expected at least one connection, one thread and a positive duration\n");
+		exit(EXIT_FAILURE);
+	}
+	if (options.threads > options.connections)
+		options.threads = options.connections;
+
+	int setup_socket = connect_to_server();
+	if (setup_socket < 0 || preload(setup_socket) < 0) {
+		printf("error: couldn't set up the '%s' table\n", BENCH_TABLE);
+		exit(EXIT_FAILURE);
+	}
+	close(setup_socket);
+
+	// connections are dealt out to the threads round robin
+	worker_t *workers = calloc(options.threads, sizeof(worker_t));
+	for (size_t w = 0; w < options.threads; w++) {
+		workers[w].nr_of_connections = options.connections / options.threads + (w < options.connections % options.threads);
+		workers[w].connections = calloc(workers[w].nr_of_connections, sizeof(connection_t));
+		workers[w].seed = (unsigned int)(now_ns() ^ (w * 2654435761u));
+		for (int op = 0; op < OP_COUNT; op++)
+			histogram_init(&workers[w].latency[op]);
+
+		for (size_t i = 0; i < workers[w].nr_of_connections; i++) {
+			connection_t *conn = &workers[w].connections[i];
+			conn->id = (int)(i * options.threads + w);
+			string_init(&conn->input, NULL, 0);
+			if ((conn->socket = connect_to_server()) < 0)
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	uint64_t start = now_ns();
+	deadline_ns = start + (uint64_t)(options.duration * 1e9);
+	for (size_t w = 0; w < options.threads; w++)
+		pthread_create(&workers[w].thread, NULL, run_worker, &workers[w]);
+
+	bool failed = false;
+	histogram_t latency[OP_COUNT + 1]; // the last one is every op together
+	uint64_t errors[OP_COUNT] = {0};
+	for (int op = 0; op <= OP_COUNT; op++)
+		histogram_init(&latency[op]);
+
+	for (size_t w = 0; w < options.threads; w++) {
+		pthread_join(workers[w].thread, NULL);
+		failed |= workers[w].failed;
+		for (int op = 0; op < OP_COUNT; op++) {
+			histogram_merge(&latency[op], &workers[w].latency[op]);
+			histogram_merge(&latency[OP_COUNT], &workers[w].latency[op]);
+			errors[op] += workers[w].errors[op];
+		}
+	}
+	double elapsed = (now_ns() - start) / 1e9;
+
+	if (options.json)
+		print_json(latency, errors, elapsed);
+	else
+		print_text(latency, errors, elapsed);
+
+	for (size_t w = 0; w < options.threads; w++) {
+		for (size_t i = 0; i < workers[w].nr_of_connections; i++) {
+			close(workers[w].connections[i].socket);
+			string_free(&workers[w].connections[i].input);
+		}
+	}
+	cleanup(workers);
+	for (size_t w = 0; w < options.threads; w++)
+		free(workers[w].connections);
+	free(workers);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,576 @@
+#include "catalog.h"
+#include "db_functions.h"
+
+static uint32_t record_checksum(uint32_t type, const char *name, size_t name_length, const char *columns, size_t columns_length) {
+	uint32_t hash = 2166136261u ^ type; // FNV-1a
+	for (size_t i = 0; i < name_length; i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	for (size_t i = 0; i < columns_length; i++)
+		hash = (hash ^ (unsigned char)columns[i]) * 16777619u;
+	return hash;
+}
+
+// the caller holds catalog->lock
+static catalog_table_t **find_link(catalog_t *catalog, const char *name) {
+	catalog_table_t **link = &catalog->buckets[string_hash(name, 0) & (catalog->nr_of_buckets - 1)];
+	while (*link && strcmp((*link)->name, name) != 0)
+		link = &(*link)->next;
+	return link;
+}
+
+// the caller holds catalog->lock
+static catalog_table_t *find_table(catalog_t *catalog, const char *name) {
+	return *find_link(catalog, name);
+}
+
+static void grow_buckets(catalog_t *catalog) {
+	size_t nr_of_buckets = catalog->nr_of_buckets * 2;
+	catalog_table_t **buckets = calloc(nr_of_buckets, sizeof(catalog_table_t *));
+	if (!buckets) // the chains just get longer
+		return;
+
+	for (catalog_table_t *table = catalog->oldest; table; table = table->newer) {
+		size_t bucket = string_hash(table->name, 0) & (nr_of_buckets - 1);
+		table->next = buckets[bucket];
+		buckets[bucket] = table;
+	}
+	free(catalog->buckets);
+	catalog->buckets = buckets;
+	catalog->nr_of_buckets = nr_of_buckets;
+}
+
+// the caller holds catalog->lock for writing and checked that there is no table called name
+static int add_table_entry(catalog_t *catalog, const char *name, size_t name_length, const char *columns, size_t columns_length) {
+	catalog_table_t *table = calloc(1, sizeof(catalog_table_t));
+	if (!table)
+		return -1;
+	table->name = strndup(name, name_length);
+	table->columns = strndup(columns, columns_length);
+	if (!table->name || !table->columns) {
+		free(table->name);
+		free(table->columns);
+		free(table);
+		return -1;
+	}
+
+	if (catalog->nr_of_tables >= catalog->nr_of_buckets)
+		grow_buckets(catalog);
+	catalog_table_t **bucket = &catalog->buckets[string_hash(table->name, 0) & (catalog->nr_of_buckets - 1)];
+	table->next = *bucket;
+	*bucket = table;
+	table->older = catalog->newest;
+	if (catalog->newest)
+		catalog->newest->newer = table;
+	else
+		catalog->oldest = table;
+	catalog->newest = table;
+	catalog->nr_of_tables++;
+	return 0;
+}
+
+static char *index_file(const char *name) {
+	size_t length = strlen(DATA_FILE_PATH) + strlen(name) + 1;
+	char *path = malloc(length);
+	if (path)
+		snprintf(path, length, "%s%s", DATA_FILE_PATH, name);
+	return path;
+}
+
+// closes indexes, and deletes their files if remove is set
+static void free_indexes(catalog_index_t *indexes, bool remove) {
+	for (catalog_index_t *next; indexes; indexes = next) {
+		next = indexes->next;
+		if (hash_index_close(indexes->index) < 0)
+			log_to_file("Error: Couldn't write the header of index '%s' in free_indexes()\n", indexes->name);
+		char *path = remove ? index_file(indexes->name) : NULL;
+		if (path && hash_index_remove(path) < 0)
+			log_to_file("Error: Couldn't remove() index '%s' in free_indexes()\n", indexes->name);
+		free(path);
+		free(indexes->name);
+		free(indexes->column);
+		free(indexes);
+	}
+}
+
+// the caller holds catalog->lock for writing
+static void remove_table_entry(catalog_t *catalog, const char *name) {
+	catalog_table_t **link = find_link(catalog, name);
+	catalog_table_t *table = *link;
+	if (!table)
+		return;
+
+	*link = table->next;
+	if (table->newer)
+		table->newer->older = table->older;
+	else
+		catalog->newest = table->older;
+	if (table->older)
+		table->older->newer = table->newer;
+	else
+		catalog->oldest = table->newer;
+	catalog->nr_of_tables--;
+
+	free_indexes(table->indexes, false);
+	free(table->name);
+	free(table->columns);
+	free(table);
+}
+
+// a file of its own next to path that replace_file() renames over it, every writer has its own temporary name
+static FILE *create_temp(const char *path, char **temp_path) {
+	size_t length = strlen(path);
+	if (!(*temp_path = malloc(length + 8)))
+		return NULL;
+	snprintf(*temp_path, length + 8, "%s.XXXXXX", path);
+
+	int fd = mkstemp(*temp_path);
+	if (fd >= 0)
+		fchmod(fd, 0644); // mkstemp leaves it readable by the owner only, unlike the data files
+	FILE *file = fd < 0 ? NULL : fdopen(fd, "w");
+	if (!file) {
+		log_to_file("Error: Couldn't create '%s' in create_temp()\n", *temp_path);
+		if (fd >= 0) {
+			close(fd);
+			unlink(*temp_path);
+		}
+		free(*temp_path);
+	}
+	return file;
+}
+
+// renames file over path once it is on disk, so a crash leaves either the old or the new file behind
+static int replace_file(FILE *file, char *temp_path, const char *path, bool failed) {
+	failed = failed || fflush(file) != 0 || fsync(fileno(file)) < 0;
+	if (fclose(file) != 0 || failed || rename(temp_path, path) < 0) {
+		log_to_file("Error: Couldn't write '%s' in replace_file()\n", temp_path);
+		unlink(temp_path);
+		free(temp_path);
+		return -1;
+	}
+	free(temp_path);
+	return 0;
+}
+
+/*
+ * Writes the header and the directory of every table to a file of its own and renames it over
+ * the catalog, so a crash leaves either the old or the new catalog behind. The caller holds
+ * catalog->lock for writing.
+ */
+static int checkpoint(catalog_t *catalog) {
+	char *temp_path = NULL;
+	FILE *file = create_temp(catalog->path, &temp_path);
+	if (!file)
+		return -1;
+
+	catalog_header_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CATALOG_MAGIC, sizeof(header.magic));
+	header.format = CATALOG_FORMAT;
+	header.generation = catalog->generation + 1;
+	for (catalog_table_t *table = catalog->oldest; table; table = table->newer)
+		if (!table->transient) {
+			header.nr_of_tables++;
+			header.directory_size += sizeof(catalog_entry_t) + strlen(table->name) + strlen(table->columns);
+		}
+
+	bool failed = fwrite(&header, sizeof(header), 1, file) < 1;
+	for (catalog_table_t *table = catalog->oldest; table && !failed; table = table->newer) {
+		if (table->transient)
+			continue;
+		catalog_entry_t entry = {(uint32_t)strlen(table->name), (uint32_t)strlen(table->columns)};
+		failed = fwrite(&entry, sizeof(entry), 1, file) < 1 || fwrite(table->name, 1, entry.name_length, file) < entry.name_length ||
+				 fwrite(table->columns, 1, entry.columns_length, file) < entry.columns_length;
+	}
+	if (replace_file(file, temp_path, catalog->path, failed) < 0)
+		return -1;
+
+	// records are appended to the new file from now on
+	if (catalog->file)
+		fclose(catalog->file);
+	if (!(catalog->file = fopen(catalog->path, "a"))) {
+		log_to_file("Error: Couldn't fopen() '%s' in checkpoint()\n", catalog->path);
+		return -1;
+	}
+	catalog->generation++;
+	catalog->nr_of_records = 0;
+	return 0;
+}
+
+// reads the tables of a meta.txt catalog, a line per table with the name in front of its columns
+static int import_legacy(catalog_t *catalog, const char *legacy_path) {
+	FILE *meta = fopen(legacy_path, "r");
+	if (!meta) // a new database
+		return 0;
+
+	char *line = NULL;
+	size_t nr_of_chars = 0;
+	ssize_t length;
+	int result = 0;
+	while (result == 0 && (length = getline(&line, &nr_of_chars, meta)) != -1) {
+		if (length && line[length - 1] == '\n')
+			line[--length] = '\0';
+		char *columns = strstr(line, COL_DELIM);
+		if (!columns)
+			continue;
+		*columns++ = '\0';
+		if (!find_table(catalog, line))
+			result = add_table_entry(catalog, line, strlen(line), columns, strlen(columns));
+	}
+	free(line);
+	fclose(meta);
+	return result;
+}
+
+// replays the directory and the change records in buffer, returns the length of the part that is intact
+static size_t replay(catalog_t *catalog, const char *buffer, size_t size) {
+	const catalog_header_t *header = (const catalog_header_t *)buffer;
+	size_t offset = sizeof(catalog_header_t);
+	size_t end = offset + header->directory_size;
+	if (end > size || end < offset)
+		return 0;
+
+	for (uint64_t i = 0; i < header->nr_of_tables; i++) {
+		catalog_entry_t entry;
+		if (offset + sizeof(entry) > end)
+			return 0;
+		memcpy(&entry, buffer + offset, sizeof(entry));
+		offset += sizeof(entry);
+		if ((size_t)entry.name_length + entry.columns_length > end - offset)
+			return 0;
+		if (add_table_entry(catalog, buffer + offset, entry.name_length, buffer + offset + entry.name_length, entry.columns_length) < 0)
+			return 0;
+		offset += entry.name_length + entry.columns_length;
+	}
+	catalog->generation = header->generation;
+
+	// a record cut short by a crash, or one that doesn't match its checksum, ends the catalog
+	offset = end;
+	while (offset + sizeof(catalog_record_t) <= size) {
+		catalog_record_t record;
+		memcpy(&record, buffer + offset, sizeof(record));
+		const char *name = buffer + offset + sizeof(record);
+		size_t left = size - offset - sizeof(record);
+		if (record.name_length == 0 || (size_t)record.name_length + record.columns_length > left ||
+			record.checksum != record_checksum(record.type, name, record.name_length, name + record.name_length, record.columns_length))
+			break;
+
+		char *copy = strndup(name, record.name_length);
+		if (!copy)
+			break;
+		remove_table_entry(catalog, copy); // a record replaces whatever was known under the name
+		free(copy);
+		if (record.type == CATALOG_CREATE &&
+			add_table_entry(catalog, name, record.name_length, name + record.name_length, record.columns_length) < 0)
+			break;
+		offset += sizeof(record) + record.name_length + record.columns_length;
+		catalog->nr_of_records++;
+	}
+	return offset;
+}
+
+// reads the whole catalog file at once, so loading takes a single read however many tables there are
+static int load(catalog_t *catalog) {
+	FILE *file = fopen(catalog->path, "r+");
+	if (!file)
+		return -1;
+
+	struct stat info;
+	char *buffer = NULL;
+	int result = -1;
+	if (fstat(fileno(file), &info) == 0 && (size_t)info.st_size >= sizeof(catalog_header_t) && (buffer = malloc(info.st_size)) &&
+		fread(buffer, 1, info.st_size, file) == (size_t)info.st_size) {
+		catalog_header_t *header = (catalog_header_t *)buffer;
+		if (memcmp(header->magic, CATALOG_MAGIC, sizeof(header->magic)) != 0 || header->format != CATALOG_FORMAT) {
+			log_to_file("Error: '%s' isn't a catalog of this version in load()\n", catalog->path);
+		} else {
+			size_t intact = replay(catalog, buffer, (size_t)info.st_size);
+			if (intact == 0) {
+				log_to_file("Error: The directory of '%s' is damaged in load()\n", catalog->path);
+			} else {
+				result = 0;
+				if (intact < (size_t)info.st_size) { // later records would be hidden behind the damaged one
+					log_to_file("Error: Dropped %ld damaged bytes at the end of '%s' in load()\n", (long)(info.st_size - intact),
+								catalog->path);
+					if (ftruncate(fileno(file), (off_t)intact) < 0)
+						result = -1;
+				}
+			}
+		}
+	}
+
+	free(buffer);
+	fclose(file);
+	return result;
+}
+
+/*
+ * Loads the catalog at path, or creates it from the meta.txt at legacy_path the first time.
+ * Returns NULL if the file exists but can't be read.
+ */
+catalog_t *catalog_open(const char *path, const char *legacy_path) {
+	catalog_t *catalog = calloc(1, sizeof(catalog_t));
+	if (!catalog)
+		return NULL;
+	pthread_rwlock_init(&catalog->lock, NULL);
+	catalog->nr_of_buckets = CATALOG_BUCKETS;
+	catalog->schema = 1;
+	catalog->buckets = calloc(catalog->nr_of_buckets, sizeof(catalog_table_t *));
+	catalog->path = strdup(path);
+	if (!catalog->buckets || !catalog->path) {
+		catalog_close(catalog);
+		return NULL;
+	}
+
+	int result;
+	if (access(path, F_OK) == 0) {
+		result = load(catalog);
+		if (result == 0 && catalog->nr_of_records >= CATALOG_CHECKPOINT_RECORDS)
+			result = checkpoint(catalog);
+		else if (result == 0 && !(catalog->file = fopen(path, "a")))
+			result = -1;
+	} else {
+		result = import_legacy(catalog, legacy_path);
+		if (result == 0)
+			result = checkpoint(catalog);
+		if (result == 0 && access(legacy_path, F_OK) == 0)
+			log_to_file("Imported %ld tables from '%s' into '%s'\n", (long)catalog->nr_of_tables, legacy_path, path);
+	}
+	if (result < 0) {
+		log_to_file("Error: Couldn't open the catalog '%s' in catalog_open()\n", path);
+		catalog_close(catalog);
+		return NULL;
+	}
+	return catalog;
+}
+
+void catalog_close(catalog_t *catalog) {
+	if (!catalog) // sanity check
+		return;
+
+	for (catalog_table_t *table = catalog->oldest, *newer; table; table = newer) {
+		newer = table->newer;
+		free_indexes(table->indexes, false);
+		free(table->name);
+		free(table->columns);
+		free(table);
+	}
+	if (catalog->file)
+		fclose(catalog->file);
+	pthread_rwlock_destroy(&catalog->lock);
+	free(catalog->buckets);
+	free(catalog->path);
+	free(catalog->index_path);
+	free(catalog);
+}
+
+bool catalog_exists(catalog_t *catalog, const char *name) {
+	pthread_rwlock_rdlock(&catalog->lock);
+	bool exists = find_table(catalog, name) != NULL;
+	pthread_rwlock_unlock(&catalog->lock);
+	return exists;
+}
+
+// a copy of the column definitions of table name in arena, NULL if there is no such table
+char *catalog_columns(catalog_t *catalog, arena_t *arena, const char *name) {
+	pthread_rwlock_rdlock(&catalog->lock);
+	catalog_table_t *table = find_table(catalog, name);
+	char *columns = table ? arena_strndup(arena, table->columns, strlen(table->columns)) : NULL;
+	pthread_rwlock_unlock(&catalog->lock);
+	return columns;
+}
+
+// calls func for every table in the order they were created, func mustn't change the catalog
+void catalog_each(catalog_t *catalog, catalog_func_t func, void *arg) {
+	pthread_rwlock_rdlock(&catalog->lock);
+	for (catalog_table_t *table = catalog->oldest; table; table = table->newer)
+		func(table->name, table->columns, arg);
+	pthread_rwlock_unlock(&catalog->lock);
+}
+
+// what is bound to the tables as they are now has to be resolved again once this changes
+uint64_t catalog_schema(catalog_t *catalog) {
+	return __atomic_load_n(&catalog->schema, __ATOMIC_ACQUIRE);
+}
+
+// appends a change record, the caller holds catalog->lock for writing
+static int append_record(catalog_t *catalog, uint32_t type, const char *name, const char *columns) {
+	catalog_record_t record;
+	record.type = type;
+	record.name_length = (uint32_t)strlen(name);
+	record.columns_length = columns ? (uint32_t)strlen(columns) : 0;
+	record.checksum = record_checksum(type, name, record.name_length, columns, record.columns_length);
+
+	if (!catalog->file || fwrite(&record, sizeof(record), 1, catalog->file) < 1 ||
+		fwrite(name, 1, record.name_length, catalog->file) < record.name_length ||
+		fwrite(columns, 1, record.columns_length, catalog->file) < record.columns_length || fflush(catalog->file) != 0) {
+		log_to_file("Error: Couldn't append to '%s' in append_record()\n", catalog->path);
+		return -1;
+	}
+	catalog->nr_of_records++;
+	return 0;
+}
+
+// rewrites the directory once the records outnumber the tables, which keeps loading and checkpoints linear overall
+static void maybe_checkpoint(catalog_t *catalog) {
+	if (catalog->nr_of_records >= CATALOG_CHECKPOINT_RECORDS && catalog->nr_of_records >= catalog->nr_of_tables)
+		checkpoint(catalog); // the records are still there if it fails
+}
+
+// adds table name, returns -1 if it already exists or the change couldn't be written. A
+// transient table is only kept in memory, it is gone once the server restarts
+int catalog_create(catalog_t *catalog, const char *name, const char *columns, bool transient) {
+	pthread_rwlock_wrlock(&catalog->lock);
+	int result = find_table(catalog, name) ? -1 : transient ? 0 : append_record(catalog, CATALOG_CREATE, name, columns);
+	if (result == 0 && add_table_entry(catalog, name, strlen(name), columns, strlen(columns)) < 0)
+		result = -1;
+	if (result == 0) {
+		catalog->newest->transient = transient;
+		__atomic_add_fetch(&catalog->schema, 1, __ATOMIC_RELEASE);
+	}
+	if (result == 0 && !transient)
+		maybe_checkpoint(catalog);
+	pthread_rwlock_unlock(&catalog->lock);
+	return result;
+}
+
+// rewrites the index definitions of every table, the caller holds catalog->lock for writing
+static int write_indexes(catalog_t *catalog) {
+	char *temp_path = NULL;
+	FILE *file = catalog->index_path ? create_temp(catalog->index_path, &temp_path) : NULL;
+	if (!file)
+		return -1;
+
+	bool failed = false;
+	for (catalog_table_t *table = catalog->oldest; table && !failed; table = table->newer)
+		for (catalog_index_t *index = table->indexes; index && !failed; index = index->next)
+			failed = fprintf(file, "%s,%s,%s\n", index->name, table->name, index->column) < 0;
+	return replace_file(file, temp_path, catalog->index_path, failed);
+}
+
+// removes table name and its indexes, returns -1 if it doesn't exist or the change couldn't be written
+int catalog_drop(catalog_t *catalog, const char *name) {
+	pthread_rwlock_wrlock(&catalog->lock);
+	catalog_table_t *table = find_table(catalog, name);
+	int result = !table ? -1 : table->transient ? 0 : append_record(catalog, CATALOG_DROP, name, NULL);
+	if (result == 0) {
+		catalog_index_t *indexes = table->indexes;
+		table->indexes = NULL;
+		remove_table_entry(catalog, name);
+		// the files go once no definition refers to them, a crash in between only leaves them behind
+		if (indexes && write_indexes(catalog) < 0)
+			log_to_file("Error: Couldn't write the index definitions without table '%s' in catalog_drop()\n", name);
+		free_indexes(indexes, true);
+		__atomic_add_fetch(&catalog->schema, 1, __ATOMIC_RELEASE);
+		maybe_checkpoint(catalog);
+	}
+	pthread_rwlock_unlock(&catalog->lock);
+	return result;
+}
+
+/*
+ * Opens the indexes defined in the file at path, whose changes are written there from now on.
+ * An index that can't be opened is left out. Returns -1 if the file exists but can't be read.
+ */
+int catalog_open_indexes(catalog_t *catalog, const char *path) {
+	if (!(catalog->index_path = strdup(path)))
+		return -1;
+	FILE *file = fopen(path, "r");
+	if (!file) // no index was ever created
+		return access(path, F_OK) == 0 ? -1 : 0;
+
+	char *line = NULL;
+	size_t nr_of_chars = 0;
+	pthread_rwlock_wrlock(&catalog->lock);
+	while (getline(&line, &nr_of_chars, file) != -1) {
+		char *rest = NULL;
+		char *name = strtok_r(line, COL_DELIM, &rest);
+		char *table_name = strtok_r(NULL, COL_DELIM, &rest);
+		char *column = strtok_r(NULL, COL_DELIM ROW_DELIM, &rest);
+		catalog_table_t *table = name && table_name && column ? find_table(catalog, table_name) : NULL;
+		if (!table)
+			continue;
+
+		catalog_index_t *index = calloc(1, sizeof(catalog_index_t));
+		char *index_path = index_file(name);
+		if (index && index_path && (index->index = hash_index_open(index_path)) && (index->name = strdup(name)) &&
+			(index->column = strdup(column))) {
+			index->next = table->indexes;
+			table->indexes = index;
+		} else {
+			log_to_file("Error: Couldn't open index '%s' in catalog_open_indexes()\n", name);
+			if (index)
+				free_indexes(index, false);
+		}
+		free(index_path);
+	}
+	pthread_rwlock_unlock(&catalog->lock);
+	free(line);
+	fclose(file);
+	return 0;
+}
+
+/*
+ * The indexes on table, NULL if it has none. Indexes only come and go while the catalog is
+ * locked exclusively, so they stay valid for as long as the caller holds the catalog lock.
+ */
+catalog_index_t *catalog_indexes(catalog_t *catalog, const char *table) {
+	pthread_rwlock_rdlock(&catalog->lock);
+	catalog_table_t *entry = find_table(catalog, table);
+	catalog_index_t *indexes = entry ? entry->indexes : NULL;
+	pthread_rwlock_unlock(&catalog->lock);
+	return indexes;
+}
+
+// the index called name on any table, NULL if there is none
+catalog_index_t *catalog_index_named(catalog_t *catalog, const char *name) {
+	catalog_index_t *found = NULL;
+	pthread_rwlock_rdlock(&catalog->lock);
+	for (catalog_table_t *table = catalog->oldest; table && !found; table = table->newer)
+		for (catalog_index_t *index = table->indexes; index && !found; index = index->next)
+			if (strcmp(index->name, name) == 0)
+				found = index;
+	pthread_rwlock_unlock(&catalog->lock);
+	return found;
+}
+
+// the index on column of table, NULL if the column isn't indexed
+catalog_index_t *catalog_index_on(catalog_t *catalog, const char *table, const char *column) {
+	catalog_index_t *index = catalog_indexes(catalog, table);
+	while (index && strcmp(index->column, column) != 0)
+		index = index->next;
+	return index;
+}
+
+/*
+ * Adds the open index called name on column of table and writes the definitions out. The
+ * catalog owns index from then on. Returns -1 if there is no such table or the definitions
+ * couldn't be written, the caller still owns index then.
+ */
+int catalog_add_index(catalog_t *catalog, const char *table, const char *name, const char *column, hash_index_t *index) {
+	catalog_index_t *entry = calloc(1, sizeof(catalog_index_t));
+	if (!entry || !(entry->name = strdup(name)) || !(entry->column = strdup(column))) {
+		if (entry)
+			free(entry->name);
+		free(entry);
+		return -1;
+	}
+	entry->index = index;
+
+	pthread_rwlock_wrlock(&catalog->lock);
+	catalog_table_t *owner = find_table(catalog, table);
+	int result = -1;
+	if (owner) {
+		entry->next = owner->indexes;
+		owner->indexes = entry;
+		if ((result = write_indexes(catalog)) < 0)
+			owner->indexes = entry->next;
+	}
+	pthread_rwlock_unlock(&catalog->lock);
+
+	if (result < 0) {
+		free(entry->name);
+		free(entry->column);
+		free(entry);
+	}
+	return result;
+}
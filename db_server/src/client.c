@@ -1,4 +1,6 @@
 #include "private_variables.h"
+#include "protocol.h"
+#include "request.h"
 #include <arpa/inet.h>
 #include <fcntl.h> // for open
 #include <netinet/in.h>
@@ -9,9 +11,119 @@
 #include <sys/socket.h>
 #include <unistd.h> // for close
 
+#define USAGE "usage: client [-p port] [-b] \"statement\" [\"statement\" ...]\n\n-p\tConnect to port instead of 7798, to reach a replica say.\n-b\tUse the binary protocol, several statements are pipelined.\n"
+
+static int recv_all(int socket, char *buffer, size_t length) {
+	while (length > 0) {
+		ssize_t received = recv(socket, buffer, length, 0);
+		if (received <= 0)
+			return -1;
+		buffer += received;
+		length -= received;
+	}
+	return 0;
+}
+
+// prints one result the same way the text protocol does, returns -1 if the connection broke
+static int print_result(int client_socket, dynamicstr *frame) {
+	uint16_t nr_of_columns = 0;
+	char *types = NULL;
+
+	while (true) {
+		string_clear(frame);
+		if (string_reserve(frame, FRAME_HEADER_SIZE) < 0 || recv_all(client_socket, frame->buffer, FRAME_HEADER_SIZE) < 0)
+			break;
+
+		uint32_t length = protocol_read_u32(frame->buffer);
+		char type = frame->buffer[FRAME_HEADER_SIZE - 1];
+		if (length > FRAME_MAX_SIZE || string_reserve(frame, length) < 0 || recv_all(client_socket, frame->buffer, length) < 0)
+			break;
+
+		char *payload = frame->buffer;
+		char *end = payload + length;
+		switch (type) {
+		case F_RESULT:
+			nr_of_columns = protocol_read_u16(payload);
+			payload += 2;
+			free(types);
+			types = malloc(nr_of_columns ? nr_of_columns : 1);
+			for (uint16_t i = 0; i < nr_of_columns; i++) {
+				types[i] = payload[0];
+				payload += 5 + protocol_read_u16(payload + 3); // type, size, name length and name
+			}
+			break;
+		case F_ROW:
+			for (uint16_t i = 0; i < nr_of_columns && payload < end; i++) {
+				if (types[i] == DT_INT) {
+					printf("%d", (int32_t)protocol_read_u32(payload));
+					payload += 4;
+				} else {
+					uint16_t size = protocol_read_u16(payload);
+					printf("%.*s", (int)size, payload + 2);
+					payload += 2 + size;
+				}
+				putchar(i + 1 < nr_of_columns ? '\t' : '\n');
+			}
+			break;
+		case F_COMPLETE:
+			printf("%.*s\n", (int)(length - 4), payload + 4);
+			free(types);
+			return 0;
+		case F_ERROR:
+			printf("%.*s\n", (int)length, payload);
+			free(types);
+			return 0;
+		default:
+			printf("error: unknown frame type '%c'\n", type);
+			break;
+		}
+	}
+
+	free(types);
+	perror("recv");
+	return -1;
+}
+
+static int run_binary(int client_socket, int count, char *statements[]) {
+	char handshake[HANDSHAKE_SIZE];
+	protocol_handshake(handshake);
+	if (protocol_send(client_socket, handshake, HANDSHAKE_SIZE) < 0 || recv_all(client_socket, handshake, HANDSHAKE_SIZE) < 0) {
+		perror("handshake");
+		return 1;
+	}
+	if (!protocol_is_handshake(handshake, HANDSHAKE_SIZE)) {
+		printf("error: the server doesn't speak the binary protocol\n");
+		return 1;
+	}
+
+	// send every statement up front, the server answers them in order
+	dynamicstr frames;
+	string_init(&frames, NULL, 0);
+	for (int i = 0; i < count; i++)
+		protocol_append_frame(&frames, F_QUERY, statements[i], strlen(statements[i]));
+	if (protocol_send(client_socket, frames.buffer, frames.length) < 0)
+		perror("send\n");
+
+	int status = 0;
+	for (int i = 0; i < count && status == 0; i++)
+		status = print_result(client_socket, &frames);
+
+	string_free(&frames);
+	return status ? 1 : 0;
+}
+
 int main(int argc, char *argv[]) {
-	if (argc != 2) {
-		printf("Provide one request string in quotation marks!\n");
+	int port = 7798;
+	int first = 1;
+	if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+		port = atoi(argv[2]);
+		first = 3;
+	}
+	bool binary = argc > first && strcmp(argv[first], "-b") == 0;
+	if (binary)
+		first++;
+	if (argc - first < 1 || (!binary && argc - first != 1)) {
+		printf("Provide one request string in quotation marks!\n\n%s", USAGE);
 		exit(1);
 	}
 
@@ -30,7 +142,7 @@ int main(int argc, char *argv[]) {
 	server_address.sin_family = AF_INET;
 
 	//Set port number, using htons function
-	server_address.sin_port = htons(7798);
+	server_address.sin_port = htons(port);
 
 	//Set IP address to localhost
 	server_address.sin_addr.s_addr = inet_addr(IP_ADDR);
@@ -40,14 +152,22 @@ int main(int argc, char *argv[]) {
 	address_size = sizeof server_address;
 	connect(client_socket, (struct sockaddr *)&server_address, address_size);
 	// while ((connect(client_socket, (struct sockaddr *) &server_address, address_size) == -1));
-	strcpy(message, argv[1]);
+
+	if (binary) {
+		int status = run_binary(client_socket, argc - first, argv + first);
+		close(client_socket);
+		return status;
+	}
+
+	strncpy(message, argv[first], sizeof(message) - 1);
+	message[sizeof(message) - 1] = '\0';
 
 	if (send(client_socket, message, strlen(message), 0) < 0)
 		perror("send\n");
 
 	memset(&message, 0, 1024); // clear
 
-	if (recv(client_socket, message, 1024, 0) == -1) {
+	if (recv(client_socket, message, 1024 - 1, 0) == -1) {
 		perror("recv");
 		return 1;
 	}
@@ -1,13 +1,10 @@
 #include "db_functions.h"
+#include "aggregate.h"
+#include "sort.h"
+#include "parallel_scan.h"
+#include "join.h"
 
-static size_t realloc_str(char **str, size_t size) {
-	if (!*(str) || !(*str = (char *)realloc(*str, (size_t)(size * MULTIPLIER))))
-		return 0;
-
-	return (size_t)(size * MULTIPLIER);
-}
-
-static char *create_format_buffer(const char *format, ...) {
+char *create_format_buffer(arena_t *arena, const char *format, ...) {
 	if (!format)
 		return NULL;
 
@@ -17,7 +14,7 @@ static char *create_format_buffer(const char *format, ...) {
 	size_t length = vsnprintf(NULL, 0, format, args) + 1;
 	va_end(args);
 
-	char *buffer = (char *)malloc(length);
+	char *buffer = (char *)arena_alloc(arena, length);
 	va_start(args, format);
 	vsnprintf(buffer, length, format, args);
 	va_end(args);
@@ -25,752 +22,1488 @@ static char *create_format_buffer(const char *format, ...) {
 	return buffer;
 }
 
+static void send_message(client_request *cli_req, const char *msg, bool failed) {
+	if (cli_req->protocol == PROTOCOL_TEXT) {
+		if (connection_write(cli_req->server, cli_req->client_socket, msg, strlen(msg)) < 0)
+			log_to_file("Error: Couldn't send() to socket %ld in send_message()\n", cli_req->client_socket);
+		return;
+	}
+
+	dynamicstr out;
+	string_init(&out, cli_req->arena, FRAME_HEADER_SIZE + strlen(msg) + sizeof(uint32_t));
+	if (failed) {
+		protocol_append_frame(&out, F_ERROR, msg, strlen(msg));
+	} else {
+		size_t start = protocol_begin_frame(&out, F_COMPLETE);
+		protocol_append_u32(&out, 0);
+		string_append_str(&out, msg);
+		protocol_end_frame(&out, start);
+	}
+
+	if (connection_write(cli_req->server, cli_req->client_socket, out.buffer, out.length) < 0)
+		log_to_file("Error: Couldn't send() to socket %ld in send_message()\n", cli_req->client_socket);
+}
+
+void encode_result_header(dynamicstr *out, column_t *columns) {
+	size_t start = protocol_begin_frame(out, F_RESULT);
+	uint16_t count = 0;
+	for (column_t *col = columns; col; col = col->next)
+		count++;
+	protocol_append_u16(out, count);
+
+	for (column_t *col = columns; col; col = col->next) {
+		protocol_append_u8(out, (uint8_t)col->data_type);
+		protocol_append_u16(out, col->data_type == DT_INT ? sizeof(int32_t) : (uint16_t)col->char_size);
+		protocol_append_u16(out, (uint16_t)strlen(col->name));
+		string_append_str(out, col->name);
+	}
+	protocol_end_frame(out, start);
+}
+
+void encode_binary_row(dynamicstr *out, column_t *columns, const char *row) {
+	char field[CHARS_PER_INT + 1];
+	size_t start = protocol_begin_frame(out, F_ROW);
+
+	for (column_t *col = columns; col; col = col->next) {
+		if (col->data_type == DT_INT) {
+			memcpy(field, row, CHARS_PER_INT);
+			field[CHARS_PER_INT] = '\0';
+			protocol_append_u32(out, (uint32_t)(int32_t)strtol(field, NULL, 10));
+			row += CHARS_PER_INT;
+			continue;
+		}
+
+		// VARCHARs are stored left padded
+		int skip = 0;
+		while (skip < col->char_size && row[skip] == PADDING)
+			skip++;
+		protocol_append_u16(out, (uint16_t)(col->char_size - skip));
+		string_append(out, row + skip, col->char_size - skip);
+		row += col->char_size;
+	}
+	protocol_end_frame(out, start);
+}
+
+void encode_text_row(dynamicstr *out, column_t *columns, const char *row) {
+	for (column_t *col = columns; col; col = col->next) {
+		int width = (col->data_type == DT_INT) ? CHARS_PER_INT : col->char_size;
+
+		// ignore the padding but always keep the last character, so 0 stays 0
+		int skip = 0;
+		while (skip < width - 1 && row[skip] == PADDING)
+			skip++;
+		string_append(out, row + skip, width - skip);
+		string_append_char(out, col->next ? '\t' : '\n');
+		row += width;
+	}
+}
+
+// an INT as stored in a row, zero padded with the sign in front of the padding
+int32_t decode_int(const char *field) {
+	uint32_t value = 0;
+	for (int i = 0; i < CHARS_PER_INT; i++) {
+		uint32_t digit = (uint32_t)(field[i] - '0'); // the sign wraps around and counts as 0
+		value = value * 10 + (digit < 10 ? digit : 0);
+	}
+	return field[0] == '-' ? (int32_t)(0u - value) : (int32_t)value;
+}
+
+// reads the rows of the next batch that pass the scan's filter into batch, returns how many.
+// row_numbers, if set, receives the row number of each of them
+size_t scan_read_batch(scan_t *scan, char *batch, uint32_t *row_numbers) {
+	size_t count = 0;
+
+	if (scan->rows && scan->segments) { // the candidates of an index lookup, read together
+		const uint32_t *candidates = scan->rows + scan->next_row;
+		size_t wanted = scan->nr_of_rows - scan->next_row;
+		if (wanted > SCAN_BATCH)
+			wanted = SCAN_BATCH;
+		size_t read = segments_read_rows(scan->segments, batch, candidates, wanted);
+		if (read < wanted) {
+			log_to_file("Error: Couldn't read row %u in scan_read_batch()\n", candidates[read]);
+			scan->nr_of_rows = scan->next_row + read;
+		}
+		scan->next_row += read;
+
+		for (size_t i = 0; i < read; i++) {
+			char *row = batch + i * scan->row_size;
+			if (scan->key && memcmp(row + scan->key_offset, scan->key, scan->key_width) != 0)
+				continue;
+			if (count != i)
+				memcpy(batch + count * scan->row_size, row, scan->row_size);
+			if (row_numbers)
+				row_numbers[count] = candidates[i];
+			count++;
+		}
+		return count;
+	}
+	if (scan->rows) { // of a memory table, every one is a seek
+		while (count < SCAN_BATCH && scan->next_row < scan->nr_of_rows) {
+			char *row = batch + count * scan->row_size;
+			uint32_t row_number = scan->rows[scan->next_row++];
+			if (fseek(scan->data_file, (long)row_number * scan->row_size, SEEK_SET) < 0 ||
+				fread(row, sizeof(char), scan->row_size, scan->data_file) < (size_t)scan->row_size) {
+				log_to_file("Error: Couldn't read row %u in scan_read_batch()\n", row_number);
+				scan->nr_of_rows = scan->next_row;
+				break;
+			}
+			if (scan->key && memcmp(row + scan->key_offset, scan->key, scan->key_width) != 0)
+				continue;
+			if (row_numbers)
+				row_numbers[count] = row_number;
+			count++;
+		}
+		return count;
+	}
+
+	long first = scan->next_row;
+	size_t wanted = scan->nr_of_rows - scan->next_row;
+	if (wanted > SCAN_BATCH)
+		wanted = SCAN_BATCH;
+	size_t read = fread(batch, scan->row_size, wanted, scan->data_file);
+	if (read < wanted) {
+		log_to_file("Error: Couldn't fread() row %ld in scan_read_batch()\n", first + (long)read);
+		scan->nr_of_rows = first + read;
+	}
+	scan->next_row += read;
+
+	// keep the matching rows at the front of the batch
+	for (size_t i = 0; i < read; i++) {
+		char *row = batch + i * scan->row_size;
+		if (scan->key && memcmp(row + scan->key_offset, scan->key, scan->key_width) != 0)
+			continue;
+		if (count != i)
+			memcpy(batch + count * scan->row_size, row, scan->row_size);
+		if (row_numbers)
+			row_numbers[count] = (uint32_t)(first + i);
+		count++;
+	}
+	return count;
+}
+
+// the response won't be complete or is too large, it isn't cached
+static void uncache_scan(scan_t *scan) {
+	free(scan->cache_key);
+	free(scan->capture);
+	scan->cache_key = scan->capture = NULL;
+}
+
+// keeps a copy of what flush_scan sends for the result cache
+static void capture_scan(scan_t *scan) {
+	size_t length = scan->capture_length + scan->out.length;
+	if (length > RESULT_MAX_SIZE) {
+		uncache_scan(scan);
+		return;
+	}
+	if (length > scan->capture_capacity) {
+		size_t capacity = scan->capture_capacity ? 2 * scan->capture_capacity : SEND_BUFFER_SIZE;
+		while (capacity < length)
+			capacity *= 2;
+		char *capture = realloc(scan->capture, capacity);
+		if (!capture) {
+			uncache_scan(scan);
+			return;
+		}
+		scan->capture = capture;
+		scan->capture_capacity = capacity;
+	}
+	memcpy(scan->capture + scan->capture_length, scan->out.buffer, scan->out.length);
+	scan->capture_length = length;
+}
+
+static bool flush_scan(scan_t *scan) {
+	if (scan->cache_key)
+		capture_scan(scan);
+	bool sent = connection_write(scan->server, scan->socket, scan->out.buffer, scan->out.length) == 0;
+	if (!sent) {
+		log_to_file("Error: Couldn't send() to socket %ld in flush_scan()\n", scan->socket);
+		uncache_scan(scan);
+	}
+	string_clear(&scan->out);
+	return sent;
+}
+
+// hands the complete response to the result cache, which checks that no write came in since
+static void cache_scan(scan_t *scan) {
+	if (!scan->cache_key)
+		return;
+	result_cache_insert(scan->server->results, scan->cache_key, scan->cache_tables, scan->cache_versions, scan->capture,
+						scan->capture_length);
+	scan->capture = NULL;
+	uncache_scan(scan);
+}
+
+// queues rows until the table is done or the client falls behind, returns
+// false if the scan was parked on the connection to be resumed later, the
+// caller destroys a scan that is done
+static bool continue_scan(scan_t *scan) {
+	while (scan->next_row < scan->nr_of_rows) {
+		if (scan->order_file && fread(scan->order_entry, scan->order_entry_size, 1, scan->order_file) < 1) {
+			log_to_file("Error: Couldn't fread() sorted row %ld in continue_scan()\n", scan->next_row);
+			scan->nr_of_rows = scan->next_row;
+			uncache_scan(scan);
+			break;
+		}
+		long row_number = scan->rows ? (long)scan->rows[scan->next_row]
+						  : scan->order_file ? (long)sort_entry_row(scan->order_entry, scan->order_entry_size) : -1;
+		uint32_t wanted = (uint32_t)row_number;
+		if (row_number >= 0 && scan->segments) { // no seek, the next sequential row is still where the file is
+			if (segments_read_rows(scan->segments, scan->row, &wanted, 1) < 1) {
+				log_to_file("Error: Couldn't read row %ld in continue_scan()\n", row_number);
+				scan->nr_of_rows = scan->next_row;
+				uncache_scan(scan);
+				break;
+			}
+		} else if (row_number >= 0 && fseek(scan->data_file, row_number * scan->row_size, SEEK_SET) < 0) {
+			log_to_file("Error: Couldn't fseek() to row %ld in continue_scan()\n", row_number);
+			scan->nr_of_rows = scan->next_row;
+			uncache_scan(scan);
+			break;
+		}
+		if ((row_number < 0 || !scan->segments) &&
+			fread(scan->row, sizeof(char), scan->row_size, scan->data_file) < (size_t)scan->row_size) {
+			log_to_file("Error: Couldn't fread() row %ld in continue_scan()\n", scan->next_row);
+			scan->nr_of_rows = scan->next_row;
+			uncache_scan(scan);
+			break;
+		}
+		scan->next_row++;
+		if (scan->key && memcmp(scan->row + scan->key_offset, scan->key, scan->key_width) != 0)
+			continue; // another value, or a hash collision of the index
+		if (scan->nr_to_skip) {
+			scan->nr_to_skip--;
+			continue;
+		}
+		if (++scan->nr_of_matches == scan->limit) // the rest of the table isn't read
+			scan->nr_of_rows = scan->next_row;
+
+		if (scan->protocol == PROTOCOL_BINARY)
+			encode_binary_row(&scan->out, scan->columns, scan->row);
+		else
+			encode_text_row(&scan->out, scan->columns, scan->row);
+
+		if (scan->out.length < SEND_BUFFER_SIZE)
+			continue;
+		if (!flush_scan(scan)) // the client is gone, there is nobody to send the rest to
+			return true;
+
+		// stop producing while the client can't keep up, the thread is more useful elsewhere,
+		// the time spent waiting for the client is traced as part of the response
+		if (!connection_congested(scan->server, scan->socket))
+			continue;
+		if (!scan->trace[TRACE_EXECUTED])
+			trace_stamp(scan->trace, TRACE_EXECUTED);
+		if (connection_park(scan->server, scan->socket, scan))
+			return false;
+	}
+
+	if (scan->protocol == PROTOCOL_BINARY) {
+		size_t start = protocol_begin_frame(&scan->out, F_COMPLETE);
+		protocol_append_u32(&scan->out, (uint32_t)scan->nr_of_matches);
+		protocol_end_frame(&scan->out, start);
+	} else if (scan->nr_of_matches == 0) { // text clients wait until they get something
+		string_append_str(&scan->out, "no matching rows\n");
+	}
+	if (!scan->out.length || flush_scan(scan))
+		cache_scan(scan);
+
+	return true;
+}
+
+// records the latency of a statement and traces it once the response is complete
+static void finish_statement(uint64_t *trace, int type, size_t socket, const char *statement) {
+	trace_stamp(trace, TRACE_DONE);
+	stats_request(type, trace[TRACE_DONE] - trace[TRACE_RECEIVED]);
+	trace_finish(trace, stats_request_names[type], socket, statement);
+}
+
+// lock modes taken on the catalog and on the requested table, indexed by RT_*. INSERTs into
+// the same table run side by side, their rows are written together by append_row
+static const int catalog_modes[] = {LM_X, LM_S, LM_IS, LM_X, LM_IX, LM_IS, LM_NONE, LM_NONE, LM_NONE, LM_NONE, LM_NONE, LM_X, LM_NONE};
+static const int table_modes[] = {LM_X, LM_NONE, LM_NONE, LM_X, LM_IX, LM_S, LM_NONE, LM_NONE, LM_NONE, LM_NONE, LM_NONE, LM_X, LM_NONE};
+// the statements that write to the database, a replica refuses them
+static const bool writes_database[] = {true, false, false, true, true, false, false, true, true, false, false, true, false};
+// those of them that change it and are logged for the replicas, DELETE and UPDATE don't do anything yet
+static const bool changes_database[] = {true, false, false, true, true, false, false, false, false, false, false, true, false};
+
 void execute_request(void *arg) {
+	// scratch memory of every statement run on this worker, reset when the statement is done
+	static __thread arena_t *scratch = NULL;
 	client_request *cli_req = ((client_request *)arg);
 	char *client_msg = NULL;
+	server_t *server = cli_req->server;
+	lock_manager_t *locks = server->locks;
+	table_lock_t *table_locks[2] = {NULL, NULL};
+	int modes[2] = {LM_NONE, LM_NONE};
+	size_t nr_of_tables = 0;
+	int catalog_mode, table_mode;
+	int status = 0; // of the statement, -1 if client_msg is an error
+
+	trace_stamp(cli_req->trace, TRACE_STARTED);
+	if (!scratch)
+		scratch = arena_create(SCRATCH_ARENA_SIZE);
+	arena_t *arena = cli_req->arena = scratch;
 
 	if (cli_req->error) {
-		if (send(cli_req->client_socket, cli_req->error, strlen(cli_req->error), 0) < 0)
-			log_to_file("Error: Couldn't send() to socket %ld in execute_request()\n", cli_req->client_socket);
-
-		free(cli_req->error);
+		send_message(cli_req, cli_req->error, true);
+
+		arena_reset(arena);
+		finish_statement(cli_req->trace, STATS_INVALID, cli_req->client_socket, cli_req->statement);
+		connection_done(cli_req->server, cli_req->client_socket);
+		free(cli_req->statement);
+		free(cli_req->cache_key);
+		free(cli_req->msg);
+		binding_release(cli_req->binding);
 		free(cli_req);
 		return;
 	}
 
-	switch (cli_req->request->request_type) {
+	// the catalog is always locked before the table, which keeps the ordering deadlock free
+	int type = cli_req->request->request_type;
+	bool read_only = writes_database[type] && replication_read_only(server->replication);
+	catalog_mode = read_only ? LM_NONE : catalog_modes[type];
+	table_mode = read_only ? LM_NONE : table_modes[type];
+	if (catalog_mode != LM_NONE)
+		lock_catalog(locks, catalog_mode);
+	// the catalog lock keeps memory tables from coming or going. An INSERT into one only copies
+	// the row into memory, SELECTs go on reading the rows that were there before it
+	request_t *request = cli_req->request;
+	bool memory = type == RT_CREATE ? request->memory
+				: (type == RT_INSERT || type == RT_DROP) && !read_only && memory_table_exists(request->table_name);
+	if (memory && type == RT_INSERT)
+		table_mode = LM_IS;
+	if (table_mode != LM_NONE) { // a JOIN reads a second table, lock_tables keeps the two in a fixed order
+		const char *names[2] = {cli_req->request->table_name, cli_req->request->join_table};
+		modes[0] = modes[1] = table_mode;
+		nr_of_tables = cli_req->request->join_table ? 2 : 1;
+		lock_tables(locks, names, nr_of_tables, modes, table_locks);
+	}
+	trace_stamp(cli_req->trace, TRACE_LOCKED);
+
+	if (read_only) { // a replica only changes through what its primary ships
+		client_msg = create_format_buffer(arena, "error: this server is a read-only replica\n");
+		status = -1;
+	} else switch (type) {
 	case RT_CREATE:
-		create_table(cli_req, &client_msg);
+		status = create_table(cli_req, &client_msg);
 		break;
 	case RT_TABLES:
-		print_tables(&client_msg);
+		print_tables(arena, ((server_t *)cli_req->server)->catalog, &client_msg);
 		break;
 	case RT_SCHEMA:
-		print_schema(cli_req->request->table_name, &client_msg);
+		status = print_schema(arena, ((server_t *)cli_req->server)->catalog, cli_req->request->table_name, &client_msg);
 		break;
 	case RT_DROP:
-		drop_table(cli_req, &client_msg);
+		status = drop_table(cli_req, &client_msg);
 		break;
 	case RT_INSERT:
-		insert_data(cli_req, &client_msg);
+		status = insert_data(cli_req, &client_msg);
 		break;
 	case RT_SELECT:
-		select_table(cli_req, &client_msg);
+		status = select_table(cli_req, &client_msg);
 		break;
 	case RT_QUIT:
 		quit_connection(cli_req);
 		break;
-	case RT_DELETE:
-		printf("RT_DELETE\n");
-		break;
+	case RT_DELETE: // parsed, but there is nothing that removes or rewrites rows yet
 	case RT_UPDATE:
-		printf("RT_UPDATE\n");
+		client_msg = create_format_buffer(arena, "error: %s is not supported\n", type == RT_DELETE ? "DELETE" : "UPDATE");
+		status = -1;
+		break;
+	case RT_PREPARE:
+		client_msg = create_format_buffer(arena, "successfully prepared statement '%s'\n", cli_req->request->table_name);
+		break;
+	case RT_STATS:
+		status = print_stats(cli_req, &client_msg);
+		break;
+	case RT_CREATE_INDEX:
+		status = create_index(cli_req, &client_msg);
+		break;
+	case RT_REPLICATION:
+		print_replication(cli_req, &client_msg);
 		break;
 	}
-
-	if (client_msg && send(cli_req->client_socket, client_msg, strlen(client_msg), 0) < 0) {
-		log_to_file("Error: Couldn't send() to socket %ld in execute_request()\n", cli_req->client_socket);
-		free(client_msg);
+	trace_stamp(cli_req->trace, TRACE_EXECUTED);
+
+	// logged before the locks are released, so the replicas see the changes to a table in the
+	// order they were made. INSERTs log their rows as they are written, memory tables stay on this server
+	if (changes_database[type] && type != RT_INSERT && !memory && status == 0 &&
+		replication_log_statement(server->replication, cli_req->statement) < 0)
+		log_to_file("Error: Couldn't log the change for the replicas in execute_request()\n");
+
+	if (nr_of_tables)
+		unlock_tables(locks, table_locks, modes, nr_of_tables);
+	if (catalog_mode != LM_NONE)
+		unlock_catalog(locks, catalog_mode);
+
+	if (client_msg)
+		send_message(cli_req, client_msg, status < 0);
+
+	arena_reset(arena);
+	if (!cli_req->suspended) { // a parked SELECT finishes the statement in resume_scan
+		finish_statement(cli_req->trace, cli_req->request->request_type, cli_req->client_socket, cli_req->statement);
+		connection_done(cli_req->server, cli_req->client_socket);
 	}
-
 	destroy_request(cli_req->request);
+	binding_release(cli_req->binding);
+	free(cli_req->statement);
+	free(cli_req->cache_key);
+	free(cli_req->msg);
 	free(cli_req);
 }
 
-void create_table(client_request *cli_req, char **client_msg) {
+int create_table(client_request *cli_req, char **client_msg) {
+	arena_t *arena = cli_req->arena;
+	catalog_t *catalog = ((server_t *)cli_req->server)->catalog;
 	table_t table;
-	FILE *meta = NULL;
 	table.name = cli_req->request->table_name;
 	table.columns = cli_req->request->columns;
 
-	// create file if it doesn't exists, and open it for reading
-	meta = (access(META_FILE, F_OK) == -1) ? fopen(META_FILE, "w+") : fopen(META_FILE, "r");
-	int metaDescriptor = fileno(meta);
-	struct flock lock;
-	memset(&lock, 0, sizeof(lock));
-	lock.l_type = F_WRLCK;
-
-	fcntl(metaDescriptor, F_OFD_SETLKW, &lock);
-	if (table_exists(table.name, meta)) {
-		*client_msg = create_format_buffer("error: table '%s' already exists\n", table.name);
-		fclose(meta);
-		return;
+	if (catalog_exists(catalog, table.name)) {
+		*client_msg = create_format_buffer(arena, "error: table '%s' already exists\n", table.name);
+		return -1;
 	}
 
 	column_t *col = cli_req->request->columns;
 	while (col) {
 		if (col->data_type == DT_VARCHAR && !is_valid_varchar(col)) {
-			*client_msg = create_format_buffer("error: VARCHAR contained faulty value '%d'\n", col->char_size);
-			fclose(meta);
-			return;
+			*client_msg = create_format_buffer(arena, "error: VARCHAR contained faulty value '%d'\n", col->char_size);
+			return -1;
 		}
 
 		col = col->next;
 	}
 
-	dynamicstr *output_buffer;
-	string_init(&output_buffer);
-	if (add_table(&table, output_buffer, meta, client_msg) < 0) {
-		// Implicates that an error occured
-		string_free(&output_buffer);
-		fclose(meta);
-		return;
-	};
+	dynamicstr columns;
+	string_init(&columns, arena, START_LENGTH);
+	if (add_table(arena, &table, &columns, client_msg) < 0) // Implicates that an error occured
+		return -1;
 
-	if (create_data_file(table.name) < 0) {
-		*client_msg = create_format_buffer("error: could not create data file for table '%s'\n", table.name);
-		string_free(&output_buffer);
-		fclose(meta);
+	// a memory table has the rows of a data file, only in chunks of this process
+	bool memory = cli_req->request->memory;
+	is_primary_key is_pk = {0, 0, false};
+	if (memory)
+		populate_column(arena, (column_t *)arena_calloc(arena, sizeof(column_t)), columns.buffer, &is_pk);
+	if (memory ? memory_table_create(table.name, is_pk.total_row_size) < 0 : create_data_file(arena, table.name) < 0) {
+		*client_msg = create_format_buffer(arena, "error: could not create data file for table '%s'\n", table.name);
+		return -1;
 	}
 
-	if (fprintf(meta, "%s", output_buffer->buffer) < 0)
-		;
-
-	fclose(meta);
-	string_free(&output_buffer);
+	if (catalog_create(catalog, table.name, columns.buffer, memory) < 0) {
+		if (memory)
+			memory_table_drop(table.name);
+		*client_msg = create_format_buffer(arena, "error: the server couldn't add table '%s' to the catalog\n", table.name);
+		return -1;
+	}
+	result_cache_bump(((server_t *)cli_req->server)->results, table.name);
 	log_to_file("Connection %s created table '%s'\n", get_ip_from_socket_fd(cli_req->client_socket), table.name);
 
-	*client_msg = create_format_buffer("successfully created table '%s'\n", table.name);
+	*client_msg = create_format_buffer(arena, "successfully created table '%s'\n", table.name);
+	return 0;
 }
 
-void print_tables(char **client_msg) {
-	char *buffer;
-
-	FILE *meta = fopen(META_FILE, "r");
-	if (!meta) // if the database is empty, the table can't exist in the database
-	{
-		*client_msg = create_format_buffer("no tables found in database\n");
-		return;
-	}
-
-	char *token = NULL;
-	char *line = NULL;
-	size_t nr_of_chars = 0;
-	size_t buffer_length = START_LENGTH;
-	buffer = (char *)calloc(buffer_length, sizeof(char));
-
-	// check database meta file for the table name
-	while (getline(&line, &nr_of_chars, meta) != -1) {
-		token = strtok(line, COL_DELIM);
-		// realloc if token can't fit in buffer
-		while (strlen(token) > buffer_length - strlen(buffer))
-			buffer_length = realloc_str(&buffer, buffer_length);
-		strcat(buffer, token);
-		strcat(buffer, "\n");
-	}
-	free(line); // free the getline allocated line
-	fclose(meta);
-
-	*client_msg = buffer;
+static void list_table(const char *name, const char *columns, void *arg) {
+	dynamicstr *buffer = arg;
+	string_append_str(buffer, name);
+	string_append_char(buffer, '\n');
 }
 
-void print_schema(char *name, char **client_msg) {
-	FILE *meta = fopen(META_FILE, "r");
-	if (!meta) // if the database is empty, the table can't exist in the database
-	{
-		*client_msg = create_format_buffer("error: '%s' does not exist\n", META_FILE);
-		return;
-	}
+void print_tables(arena_t *arena, catalog_t *catalog, char **client_msg) {
+	dynamicstr buffer;
+	string_init(&buffer, arena, START_LENGTH);
+	catalog_each(catalog, list_table, &buffer);
 
-	char *token = NULL;
-	char *line = NULL;
-	size_t nr_of_chars = 0;
-	bool exists = false;
-
-	while (getline(&line, &nr_of_chars, meta) != -1) {
-		token = strtok(line, COL_DELIM);
-		if (strcmp(token, name) == 0) {
-			exists = true;
-			break;
-		}
-	}
+	// an empty response would leave text clients waiting for an answer
+	*client_msg = buffer.length ? buffer.buffer : create_format_buffer(arena, "no tables found in database\n");
+}
 
-	if (!exists) { // the while loop continued until the end without finding the table
-		free(line);
-		fclose(meta);
-		*client_msg = create_format_buffer("error: table '%s' does not exists\n", name);
-		return;
+int print_schema(arena_t *arena, catalog_t *catalog, char *name, char **client_msg) {
+	char *columns = catalog_columns(catalog, arena, name);
+	if (!columns) {
+		*client_msg = create_format_buffer(arena, "error: table '%s' does not exists\n", name);
+		return -1;
 	}
 
 	// found the table
-	size_t buffer_length = START_LENGTH;
-	char *buffer = (char *)calloc(buffer_length * sizeof(char), sizeof(char));
+	dynamicstr buffer;
+	string_init(&buffer, arena, START_LENGTH);
 	bool is_primary_key;
+	size_t length;
+	char *token = NULL;
 
 	// print all the columns of the table
-	while ((token = strtok(0, TYPE_DELIM))) {
+	char *rest = NULL;
+	for (token = strtok_r(columns, TYPE_DELIM, &rest); token; token = strtok_r(NULL, TYPE_DELIM, &rest)) {
 		is_primary_key = false;
-		while (strlen(token) + 2 > buffer_length - strlen(buffer)) // +2 for the tabs
-			buffer_length = realloc_str(&buffer, buffer_length);
-
 		if (token[0] == '1') { // remove unnessecary primary key indication
 			is_primary_key = true;
 			token++;
 		}
-		strcat(buffer, token);
-		strcat(buffer, "\t");
-		if (strlen(token) < 8) // format output for smaller names
-			strcat(buffer, "\t");
-
-		token = strtok(0, COL_DELIM);
-
-		while (strlen(token) + 1 > buffer_length - strlen(buffer)) // +1 for the newline
-			buffer_length = realloc_str(&buffer, buffer_length);
-
-		strcat(buffer, token);
-		if (is_primary_key) {
-			if (buffer[strlen(buffer) - 1] == '\n')
-				buffer[strlen(buffer) - 1] = '\0';
-			strcat(buffer, "\tPRIMARY KEY");
-		}
-		strcat(buffer, "\n");
+		length = strlen(token);
+		string_append(&buffer, token, length);
+		string_append_char(&buffer, '\t');
+		if (length < 8) // format output for smaller names
+			string_append_char(&buffer, '\t');
+
+		token = strtok_r(NULL, COL_DELIM, &rest);
+		string_append_str(&buffer, token);
+		if (is_primary_key)
+			string_append_str(&buffer, "\tPRIMARY KEY");
+		string_append_char(&buffer, '\n');
 	}
 
 	// remove last newline
-	buffer[strlen(buffer) - 1] = '\0';
+	if (buffer.length)
+		buffer.buffer[--buffer.length] = '\0';
 
-	*client_msg = buffer;
-	free(line); // free the getline allocated string
-	fclose(meta);
-	return;
-
-	// free(line); // free the getline allocated string
-	// fclose(meta);
-	//
-	// *client_msg = create_format_buffer("error: table '%s' does not exists\n", name);
+	*client_msg = buffer.buffer;
+	return 0;
 }
 
-int add_table(table_t *table, dynamicstr *output_buffer, FILE *meta, char **error_msg) {
-	// Issue: When using bytelocking two tables of the same name could occur.
-	// Solution: Lock the whole file, look for table name, if it doesn't exist
-	// add it, unlock the file.
+int print_stats(client_request *cli_req, char **client_msg) {
+	server_t *server = cli_req->server;
+	lock_stats_t catalog[LM_MODES], tables[LM_MODES];
+	uint64_t catalog_waits = 0, catalog_wait_ns = 0, table_waits = 0, table_wait_ns = 0;
 
-	if (!(meta = freopen(NULL, "a", meta))) {
-		log_to_file(log_file, "Error: Couldn't freopen() in add_table()\n");
+	thread_stats_t *total = malloc(sizeof(thread_stats_t)); // too large for the stack or the scratch arena
+	if (!total) {
+		*client_msg = create_format_buffer(cli_req->arena, "error: server ran out of memory\n");
 		return -1;
 	}
+	stats_collect(total);
+
+	lock_manager_stats(server->locks, catalog, tables);
+	for (int mode = 0; mode < LM_MODES; mode++) {
+		catalog_waits += catalog[mode].waited;
+		catalog_wait_ns += catalog[mode].wait_ns;
+		table_waits += tables[mode].waited;
+		table_wait_ns += tables[mode].wait_ns;
+	}
 
-	struct flock lock;
-	memset(&lock, 0, sizeof(lock));
-	lock.l_type = F_WRLCK;
-	int meta_descriptor = fileno(meta);
+	pthread_mutex_lock(&server->enqueue_lock);
+	size_t queued = size(server->request_queue);
+	size_t high_water = server->request_queue->high_water;
+	pthread_mutex_unlock(&server->enqueue_lock);
+
+	pthread_mutex_lock(&server->pool->work_mutex);
+	size_t busy = server->pool->working_count; // includes assign_work and this statement
+	size_t idle = server->pool->thread_count - busy;
+	size_t waiting = server->pool->queued_count;
+	pthread_mutex_unlock(&server->pool->work_mutex);
+
+	uint64_t result_hits, result_misses, append_rows, append_batches;
+	size_t result_bytes;
+	result_cache_counters(server->results, &result_hits, &result_misses, &result_bytes);
+	appends_counters(server->appends, &append_rows, &append_batches);
+
+	dynamicstr buffer;
+	string_init(&buffer, cli_req->arena, 1024);
+	string_set(&buffer, "connections: %" PRIu64 " active, %" PRIu64 " accepted\n",
+			   total->connections_opened - total->connections_closed, total->connections_opened);
+	string_set(&buffer, "bytes: %" PRIu64 " received, %" PRIu64 " sent\n", total->bytes_received, total->bytes_sent);
+	string_set(&buffer, "request queue: %zu queued, %zu high water, %zu slots\n", queued, high_water, server->queue_size);
+	string_set(&buffer, "workers: %zu busy, %zu idle, %zu jobs waiting\n", busy, idle, waiting);
+	string_set(&buffer, "listen loop: %s\n", server->io == IO_URING ? "io_uring" : "select()");
+	string_set(&buffer, "lock waits: catalog %" PRIu64 " (%.3f ms), tables %" PRIu64 " (%.3f ms)\n",
+			   catalog_waits, catalog_wait_ns / 1e6, table_waits, table_wait_ns / 1e6);
+	string_set(&buffer, "statement cache: %" PRIu64 " hits, %" PRIu64 " misses\n",
+			   __atomic_load_n(&server->statements->hits, __ATOMIC_RELAXED), __atomic_load_n(&server->statements->misses, __ATOMIC_RELAXED));
+	string_set(&buffer, "result cache: %" PRIu64 " hits, %" PRIu64 " misses, %zu bytes\n", result_hits, result_misses, result_bytes);
+	string_set(&buffer, "appends: %" PRIu64 " rows in %" PRIu64 " writes\n", append_rows, append_batches);
+
+	// latencies in microseconds, only for the request types that were seen
+	string_set(&buffer, "%-8s %8s %9s %9s %9s %9s\n", "request", "count", "mean_us", "p50_us", "p99_us", "max_us");
+	for (int type = 0; type < STATS_REQUEST_TYPES; type++) {
+		histogram_t *latency = &total->latency[type];
+		if (!total->requests[type])
+			continue;
+		string_set(&buffer, "%-8s %8" PRIu64 " %9.1f %9.1f %9.1f %9.1f\n", stats_request_names[type], total->requests[type],
+				   histogram_mean(latency) / 1e3, histogram_percentile(latency, 50) / 1e3, histogram_percentile(latency, 99) / 1e3,
+				   latency->max / 1e3);
+	}
+	free(total);
 
-	fcntl(meta_descriptor, F_OFD_SETLKW, &lock);
+	*client_msg = buffer.buffer;
+	return 0;
+}
 
-	string_set(&output_buffer, "%s%s", table->name, COL_DELIM);
+void print_replication(client_request *cli_req, char **client_msg) {
+	dynamicstr buffer;
+	string_init(&buffer, cli_req->arena, 256);
+	replication_report(((server_t *)cli_req->server)->replication, &buffer);
+	*client_msg = buffer.buffer;
+}
 
+// writes the column definitions of table to output_buffer the way the catalog keeps them
+int add_table(arena_t *arena, table_t *table, dynamicstr *output_buffer, char **error_msg) {
 	int primary_key_count = 0;
 
-	column_t *col = table->columns;
-	while (col->next && (primary_key_count <= 1)) // loop while the column is not the last one
-	{
+	column_t *col;
+	for (col = table->columns; col && (primary_key_count <= 1); col = col->next) {
 		// write each column to the file with the appropriate type format
-		if (col->data_type == DT_INT) {
-			if (col->is_primary_key) {
-				string_set(&output_buffer, "1%s%sINT%s", col->name, TYPE_DELIM, COL_DELIM);
-				primary_key_count += 1;
-			} else
-				string_set(&output_buffer, "%s%sINT%s", col->name, TYPE_DELIM, COL_DELIM);
-		} else {
-			if (col->is_primary_key) {
+		if (col->is_primary_key) {
+			if (col->data_type != DT_INT) {
 				// error, primary keys are not allowed on VARCHARS
-				*error_msg = create_format_buffer("syntax error: Primary keys are only allowed on int values.\n");
+				*error_msg = create_format_buffer(arena, "syntax error: Primary keys are only allowed on int values.\n");
 				return -1;
-			} else
-				string_set(&output_buffer, "%s%sVARCHAR(%d)%s", col->name, TYPE_DELIM, col->char_size, COL_DELIM);
-		}
-
-		col = col->next;
-	}
-	// handle last one separately to instead use a newline instead of the column delimiter
-	if (col->data_type == DT_INT) {
-		if (col->is_primary_key) {
-			string_set(&output_buffer, "1%s%sINT%s", col->name, TYPE_DELIM, ROW_DELIM);
+			}
+			string_append_char(output_buffer, '1');
 			primary_key_count += 1;
-		} else
-			string_set(&output_buffer, "%s%sINT%s", col->name, TYPE_DELIM, ROW_DELIM);
-	} else {
-		if (col->is_primary_key) {
-			// error, primary keys are not allowed on VARCHARS
-			*error_msg = create_format_buffer("syntax error: Primary keys are only allowed on int values.\n");
-			return -1;
-		} else
-			string_set(&output_buffer, "%s%sVARCHAR(%d)%s", col->name, TYPE_DELIM, col->char_size, ROW_DELIM);
+		}
+		string_append_str(output_buffer, col->name);
+		string_append_str(output_buffer, TYPE_DELIM);
+		if (col->data_type == DT_INT) {
+			string_append_str(output_buffer, "INT");
+		} else {
+			string_append_str(output_buffer, "VARCHAR(");
+			string_append_int(output_buffer, col->char_size, 0, PADDING);
+			string_append_char(output_buffer, ')');
+		}
+		if (col->next)
+			string_append_str(output_buffer, COL_DELIM);
 	}
 
 	if (primary_key_count > 1) {
 		//error, to many primary keys
-		*error_msg = create_format_buffer("syntax error: Only one primary key is allowed.\n");
+		*error_msg = create_format_buffer(arena, "syntax error: Only one primary key is allowed.\n");
 		return -1;
 	}
 	return 0;
 }
 
-void select_table(client_request *cli_req, char **client_msg) {
-	FILE *meta = fopen(META_FILE, "r");
-	if (!meta) // if the database is empty, the table can't exist in the database
-	{
-		*client_msg = create_format_buffer("error: '%s' does not exist\n", META_FILE);
-		return;
+// a scratch file in the data directory. It is unlinked right away, so it disappears with its
+// last descriptor even if the server dies
+FILE *create_temp_file(const char *ending) {
+	static unsigned int sequence = 0;
+	char path[128];
+
+	snprintf(path, sizeof(path), "%s%d.%u%s", DATA_FILE_PATH, (int)getpid(), __atomic_fetch_add(&sequence, 1, __ATOMIC_RELAXED), ending);
+	FILE *file = fopen(path, "w+");
+	if (!file) {
+		log_to_file("Error: Couldn't fopen() '%s' in create_temp_file()\n", path);
+		return NULL;
 	}
+	unlink(path);
+	return file;
+}
 
-	// TODO: release lock somehow
-	int meta_descriptor = fileno(meta);
-	struct flock lock;
-	memset(&lock, 0, sizeof(lock));
-	lock.l_type = F_RDLCK;
+int column_width(column_t *column) {
+	return column->data_type == DT_INT ? CHARS_PER_INT : column->char_size;
+}
 
-	fcntl(meta_descriptor, F_OFD_SETLKW, &lock);
+// finds a column of a table template and where it starts in a row
+column_t *find_column(column_t *first, const char *name, int *offset) {
+	*offset = 0;
+	for (column_t *col = first; col; col = col->next) {
+		if (strcmp(col->name, name) == 0)
+			return col;
+		*offset += column_width(col);
+	}
+	return NULL;
+}
 
+// a copy of a table template in arena, NULL if it ran out of memory
+static column_t *copy_columns(arena_t *arena, const column_t *columns) {
 	column_t *first = NULL;
-	int chars_in_row = 0;
-	if (!table_exists(cli_req->request->table_name, meta))
-	{
-		fclose(meta);
-		*client_msg = create_format_buffer("Error: Table doesn't exist.\n");
-		return;
+	for (column_t **link = &first; columns; columns = columns->next, link = &(*link)->next) {
+		if (!(*link = arena_alloc(arena, sizeof(column_t))))
+			return NULL;
+		**link = *columns;
+		(*link)->name = arena_strndup(arena, columns->name, strlen(columns->name));
+		(*link)->next = NULL;
 	}
-	create_template_column(cli_req->request->table_name, meta, &first, &chars_in_row);
-	fclose(meta);
+	return first;
+}
 
-	// did not find the table
-	if (first == NULL) {
-		*client_msg = create_format_buffer("error: '%s' does not exist\n", cli_req->request->table_name);
-		return;
-	}
+/*
+ * The binding of the cached statement cli_req was cloned from, resolved against the current
+ * schema. NULL if the statement isn't cached, joins two tables or its table doesn't exist,
+ * the caller then reads the catalog itself. The caller holds the catalog lock, so the schema
+ * can't change while it uses the binding.
+ */
+static binding_t *bind_schema(client_request *cli_req) {
+	binding_t *binding = cli_req->binding;
+	request_t *request = cli_req->request;
+	if (!binding || request->join_table)
+		return NULL;
 
-	// increment chars_in_row nr_of_columns - 1 times since the msg sent to client is tab-separated between columns
-	column_t *current = first;
-	while (current->next) {
-		chars_in_row++;
-		current = current->next;
+	catalog_t *catalog = ((server_t *)cli_req->server)->catalog;
+	uint64_t schema = catalog_schema(catalog);
+	if (__atomic_load_n(&binding->schema, __ATOMIC_ACQUIRE) == schema)
+		return binding->columns ? binding : NULL;
+
+	// only statements that found it out of date get here, and all of them want the same schema
+	pthread_mutex_lock(&binding->lock);
+	if (binding->schema != schema) {
+		arena_t *arena = arena_create(BINDING_ARENA_SIZE);
+		column_t *first = NULL;
+		int row_size = 0;
+		if (arena)
+			create_template_column(arena, catalog, request->table_name, &first, &row_size);
+
+		int offset = 0;
+		binding->nr_of_columns = 0;
+		binding->pk_offset = -1;
+		for (column_t *column = first; column; column = column->next) {
+			if (column->is_primary_key)
+				binding->pk_offset = offset;
+			offset += column_width(column);
+			binding->nr_of_columns++;
+		}
+		binding->key = first && request->where ? find_column(first, request->where->name, &binding->key_offset) : NULL;
+		binding->columns = first;
+		binding->row_size = row_size;
+		if (binding->arena) // nobody else holds the catalog lock at the schema it was resolved at
+			arena_destroy(binding->arena);
+		binding->arena = arena;
+		__atomic_store_n(&binding->schema, schema, __ATOMIC_RELEASE);
 	}
+	pthread_mutex_unlock(&binding->lock);
+	return binding->columns ? binding : NULL;
+}
 
-	char *final_name = NULL;
-	if (create_full_data_path_from_name(cli_req->request->table_name, &final_name) < 0) {
-		log_to_file("Error: Couldn't create_full_data_path_from_name() in select_table()\n");
+static char *index_path(arena_t *arena, const char *name) {
+	return create_format_buffer(arena, "%s%s", DATA_FILE_PATH, name);
+}
 
-		*client_msg = create_format_buffer("error: server ran out of memory\n");
-		unpopulate_column(first);
+// adds rows that were just appended to table to each of its indexes, the caller holds the catalog lock
+static void update_indexes(catalog_t *catalog, const char *table, const char *rows, int row_size, size_t nr_of_rows, long first_row) {
+	for (catalog_index_t *info = catalog_indexes(catalog, table); info; info = info->next) {
+		for (size_t i = 0; i < nr_of_rows; i++)
+			if (hash_index_insert(info->index, rows + i * row_size, (uint32_t)(first_row + i)) < 0)
+				log_to_file("Error: Couldn't add row %ld to index '%s' in update_indexes()\n", first_row + (long)i, info->name);
+		if (hash_index_sync(info->index) < 0)
+			log_to_file("Error: Couldn't write the header of index '%s' in update_indexes()\n", info->name);
+	}
+}
+
+// append_func_t of INSERT, run by the INSERT that wrote the batch
+static void inserted_rows(const char *table, int row_size, const char *rows, size_t length, long first_row, void *arg) {
+	client_request *cli_req = arg;
+	result_cache_bump(((server_t *)cli_req->server)->results, table); // even part of a batch changes what a SELECT reads
+	if (first_row < 0)
 		return;
+	update_indexes(((server_t *)cli_req->server)->catalog, table, rows, row_size, length / row_size, first_row);
+	if (replication_log_rows(((server_t *)cli_req->server)->replication, table, row_size, rows, length, first_row) < 0)
+		log_to_file("Error: Couldn't log the rows appended to '%s' for the replicas in inserted_rows()\n", table);
+}
+
+int create_index(client_request *cli_req, char **client_msg) {
+	arena_t *arena = cli_req->arena;
+	request_t *request = cli_req->request;
+	catalog_t *catalog = ((server_t *)cli_req->server)->catalog;
+	char *column_name = request->columns->name;
+
+	catalog_index_t *existing = catalog_index_named(catalog, request->index_name);
+	if (existing) {
+		*client_msg = create_format_buffer(arena, "error: index '%s' already exists\n", existing->name);
+		return -1;
+	}
+	if ((existing = catalog_index_on(catalog, request->table_name, column_name))) {
+		*client_msg = create_format_buffer(arena, "error: column '%s' is already indexed by '%s'\n", column_name, existing->name);
+		return -1;
 	}
 
-	FILE *data_file = fopen(final_name, "r");
-	size_t data_descriptor = fileno(data_file);
-	struct flock data_lock;
-	memset(&data_lock, 0, sizeof(data_lock));
-	data_lock.l_type = F_RDLCK;
+	column_t *first = NULL;
+	int chars_in_row = 0;
+	create_template_column(arena, catalog, request->table_name, &first, &chars_in_row);
+	if (!first) {
+		*client_msg = create_format_buffer(arena, "error: '%s' does not exist\n", request->table_name);
+		return -1;
+	}
 
-	fcntl(data_descriptor, F_OFD_SETLKW, &data_lock);
+	int offset = 0;
+	column_t *column = find_column(first, column_name, &offset);
+	if (!column) {
+		*client_msg = create_format_buffer(arena, "error: table '%s' has no column '%s'\n", request->table_name, column_name);
+		return -1;
+	}
 
-	int chars_in_file = lseek(data_descriptor, 0, SEEK_END); // lseek to end of file
-	if(chars_in_file == 0) {
-		log_to_file("Error: Table is empty.\n");
+	if (memory_table_exists(request->table_name)) { // its rows are gone with the server, an index on disk would outlive them
+		*client_msg = create_format_buffer(arena, "error: memory table '%s' can't be indexed\n", request->table_name);
+		return -1;
+	}
 
-		*client_msg = create_format_buffer("Error: Table is empty.\n");
-		unpopulate_column(first);
-		fclose(data_file);
-		return;
+	FILE *data_file = table_open(request->table_name, chars_in_row, NULL);
+	if (!data_file) {
+		*client_msg = create_format_buffer(arena, "error: the file for table '%s' does not exist\n", request->table_name);
+		return -1;
 	}
-	lseek(data_descriptor, 0, SEEK_SET);					 // lseek back to beginning
 
-	int remaining_rows = chars_in_file / chars_in_row;
-	int chars_in_column, count, k;
-	char ch = '0';
+	// index the rows that are already in the table
+	char *path = index_path(arena, request->index_name);
+	char *row = arena_alloc(arena, chars_in_row);
+	hash_index_t *index = NULL;
+	bool failed = hash_index_create(path, offset, column_width(column)) < 0 || !(index = hash_index_open(path));
+	for (uint32_t row_number = 0; !failed && fread(row, sizeof(char), chars_in_row, data_file) == (size_t)chars_in_row; row_number++)
+		failed = hash_index_insert(index, row, row_number) < 0;
+	fclose(data_file);
 
-	// allocate buffer to send to client
-	char *msg = calloc(CHARS_PER_SEND, sizeof(char));
+	// the catalog keeps the index open from now on
+	if (failed || hash_index_sync(index) < 0 || catalog_add_index(catalog, request->table_name, request->index_name, column_name, index) < 0) {
+		log_to_file("Error: Couldn't build index '%s' in create_index()\n", request->index_name);
+		hash_index_close(index);
+		hash_index_remove(path);
+		*client_msg = create_format_buffer(arena, "error: the server wasn't able to create index '%s'\n", request->index_name);
+		return -1;
+	}
 
-	while (remaining_rows >= 0) // iterate while there are rows left
-	{
-		count = 0;
-		while (true) // iterate for each row
-		{
-			current = first;
-			while (current) // iterate for each column
-			{
-				// how many chars to iterate over for the current column
-				chars_in_column = (current->char_size == 0) ? CHARS_PER_INT : current->char_size;
-
-				// iterate and ignore the padding
-				for (k = 0; k < chars_in_column; k++)
-					if ((ch = (char)fgetc(data_file)) != PADDING)
-						break;
-
-				// keep the last character because it wasn't padding
-				msg[count++] = ch;
-				k++;
-				// extract the rest of the value
-				for (int l = k; l < chars_in_column; l++)
-					msg[count++] = (char)fgetc(data_file);
-
-				if (current->next) // append '\t' if it's not the last column
-					msg[count++] = '\t';
-
-				current = current->next;
-			}
-			// extract the newline at the end of the column
-			msg[count++] = (char)fgetc(data_file);
+	log_to_file("Connection %s created index '%s' on '%s'\n", get_ip_from_socket_fd(cli_req->client_socket), request->index_name, request->table_name);
+	*client_msg = create_format_buffer(arena, "successfully created index '%s' on table '%s'\n", request->index_name, request->table_name);
+	return 0;
+}
 
-			remaining_rows--;
-			// break out of this loop if the buffer is full or there are no
-			// remaining rows in the data file
-			if (count + chars_in_row > CHARS_PER_SEND || remaining_rows <= 0)
+// the matching rows one range of a parallel filter found
+typedef struct matches matches_t;
+struct matches {
+	uint32_t *rows;
+	size_t count;
+	size_t capacity;
+};
+
+static int match_range(scan_t *range, void *state) {
+	matches_t *matches = state;
+	char *batch = malloc((size_t)SCAN_BATCH * range->row_size);
+	int result = batch ? 0 : -1;
+
+	while (result == 0 && range->next_row < range->nr_of_rows) {
+		if (matches->capacity - matches->count < SCAN_BATCH) {
+			size_t capacity = matches->capacity ? 2 * matches->capacity : 4 * SCAN_BATCH;
+			uint32_t *rows = realloc(matches->rows, capacity * sizeof(uint32_t));
+			if (!rows) {
+				result = -1;
 				break;
+			}
+			matches->rows = rows;
+			matches->capacity = capacity;
 		}
+		matches->count += scan_read_batch(range, batch, matches->rows + matches->count);
+	}
 
-		if (send(cli_req->client_socket, msg, count, 0) < 0)
-			log_to_file("Error: Couldn't send() to socket %ld in select_table()\n", cli_req->client_socket);
+	free(batch);
+	return result;
+}
 
-		memset(msg, 0, count); // clear msg buffer
+// filters the ranges of a large table on several workers, the scan then visits the
+// matching rows in table order like it visits the candidates of an index lookup
+static int filter_parallel(scan_t *scan, size_t nr_of_ranges) {
+	matches_t *matches = calloc(nr_of_ranges, sizeof(matches_t));
+	void **states = calloc(nr_of_ranges, sizeof(void *));
+	int result = matches && states ? 0 : -1;
+
+	for (size_t i = 0; result == 0 && i < nr_of_ranges; i++)
+		states[i] = &matches[i];
+	if (result == 0)
+		result = parallel_scan(scan, nr_of_ranges, match_range, states);
+
+	size_t total = 0;
+	for (size_t i = 0; result == 0 && i < nr_of_ranges; i++)
+		total += matches[i].count;
+	if (result == 0 && (scan->rows = arena_alloc(scan->arena, (total ? total : 1) * sizeof(uint32_t)))) {
+		scan->nr_of_rows = 0;
+		for (size_t i = 0; i < nr_of_ranges; i++) {
+			memcpy(scan->rows + scan->nr_of_rows, matches[i].rows, matches[i].count * sizeof(uint32_t));
+			scan->nr_of_rows += matches[i].count;
+		}
+		scan->next_row = 0;
+		scan->key = NULL; // every row left matches
+	} else {
+		result = -1;
 	}
 
-	free(msg);
-	free(final_name);
-	fclose(data_file);
+	for (size_t i = 0; matches && i < nr_of_ranges; i++)
+		free(matches[i].rows);
+	free(matches);
+	free(states);
+	return result;
 }
 
-void drop_table(client_request *cli_req, char **client_msg) {
-	FILE *meta = fopen(META_FILE, "r+");
-	if (!meta) // if the database is empty, the table can't exist in the database
-	{
-		*client_msg = create_format_buffer("error: '%s' does not exist\n", META_FILE);
-		return;
+// restricts a scan to the rows matching the WHERE clause, through an index on the column if there is one
+static int filter_scan(client_request *cli_req, scan_t *scan, char **client_msg) {
+	arena_t *arena = cli_req->arena;
+	column_t *where = cli_req->request->where;
+
+	binding_t *binding = bind_schema(cli_req);
+	column_t *column = binding ? binding->key : find_column(scan->columns, where->name, &scan->key_offset);
+	if (binding)
+		scan->key_offset = binding->key_offset;
+	if (!column) {
+		*client_msg = create_format_buffer(arena, "error: table '%s' has no column '%s'\n", cli_req->request->table_name, where->name);
+		return -1;
+	}
+	if (column->data_type != where->data_type) {
+		*client_msg = create_format_buffer(arena, "syntax error, value(s) are of wrong data type.\n");
+		return -1;
 	}
 
-	int meta_descriptor = fileno(meta);
-	struct flock lock;
-	memset(&lock, 0, sizeof(lock));
-	lock.l_type = F_WRLCK;
-	fcntl(meta_descriptor, F_OFD_SETLKW, &lock);
-
-	// server_t *server = ((server_t *)cli_req->server);
-	char temp_name[] = "temp.txt";
-	FILE *temp_file = fopen(temp_name, "w"); // create and open a temporary file in write mode
-	char *line = NULL;
-	size_t nr_of_chars = 0;
-	size_t length = strlen(cli_req->request->table_name);
-	size_t i;
-	bool failed = true;
-	// copy all the contents to the temporary file except the specific line
-	while (getline(&line, &nr_of_chars, meta) != -1) {
-		// name check, we use this instead of strtok since we need to preserve the value of line
-		for (i = 0; i < length && line[i] == cli_req->request->table_name[i]; i++)
-			;
-		// check if the loop didn't exit early and that the next character on the line is COL_DELIM
-		if (i == length && line[i] == COL_DELIM[0]) {
-			failed = false;
-			continue;
+	// the key is encoded the way insert_data stores the column
+	dynamicstr key;
+	scan->key_width = column_width(column);
+	string_init(&key, scan->arena, scan->key_width);
+	if (where->data_type == DT_INT) {
+		string_append_int(&key, where->int_val, CHARS_PER_INT, PADDING);
+	} else {
+		char *value = where->char_val + 1; // without the quotes
+		size_t length = strlen(value) - 1;
+		if (length > (size_t)column->char_size) { // no row can hold it
+			scan->nr_of_rows = 0;
+			return 0;
 		}
+		string_append_padded(&key, value, length, column->char_size, PADDING);
+	}
+	scan->key = key.buffer;
+
+	// the rows of a join aren't the rows the indexes of its tables point to
+	catalog_t *catalog = ((server_t *)cli_req->server)->catalog;
+	catalog_index_t *info = cli_req->request->join_table ? NULL : catalog_index_on(catalog, cli_req->request->table_name, column->name);
+	size_t count = 0;
+	if (info && hash_index_lookup(info->index, scan->key, scan->arena, &scan->rows, &count) == 0) {
+		scan->nr_of_rows = count;
+	} else if (info) { // the full scan still finds the rows
+		log_to_file("Error: Couldn't look up index '%s' in filter_scan()\n", info->name);
+		scan->rows = NULL;
+	}
 
-		fprintf(temp_file, "%s", line); // copy line to temp file
+	// aggregates filter while they reduce, and a LIMIT without ORDER BY is better off stopping early
+	request_t *request = cli_req->request;
+	size_t nr_of_ranges = scan_parallelism(scan);
+	if (nr_of_ranges > 1 && !has_aggregates(request) && (request->limit < 0 || request->order_by) &&
+		filter_parallel(scan, nr_of_ranges) < 0) {
+		*client_msg = create_format_buffer(arena, "error: the server couldn't filter table '%s'\n", request->table_name);
+		return -1;
 	}
-	free(line);
-	fclose(meta);
-	fclose(temp_file);
+	return 0;
+}
 
-	if (failed) {
-		*client_msg = create_format_buffer("error: '%s' does not exist\n", cli_req->request->table_name);
-		remove(temp_name); // remove the temporary file since the request failed
+// applies LIMIT and OFFSET. Every row an unfiltered scan visits is sent, so it starts right at the
+// first row of the page and ends after the last one. A filtered scan counts its matches instead
+static int limit_scan(scan_t *scan, request_t *request) {
+	scan->limit = -1;
+	if (request->limit == 0) {
+		scan->nr_of_rows = 0;
+		return 0;
+	}
+	if (scan->key) {
+		scan->nr_to_skip = request->offset;
+		scan->limit = request->limit;
+		return 0;
+	}
+
+	long first = request->offset < scan->nr_of_rows ? request->offset : scan->nr_of_rows;
+	if (request->limit > 0 && first + request->limit < scan->nr_of_rows)
+		scan->nr_of_rows = first + request->limit;
+	scan->next_row = first;
+	if (scan->rows || first == 0)
+		return 0;
+
+	// rows are fixed width, and so are the entries of a sorted run
+	FILE *file = scan->order_file ? scan->order_file : scan->data_file;
+	long stride = scan->order_file ? scan->order_entry_size : scan->row_size;
+	if (fseek(file, first * stride, SEEK_SET) < 0) {
+		log_to_file("Error: Couldn't fseek() to row %ld in limit_scan()\n", first);
+		return -1;
+	}
+	return 0;
+}
+
+// a scan over nr_of_rows rows of data_file, which select_table narrows down and sends
+scan_t *scan_create(client_request *cli_req, arena_t *scan_arena, FILE *data_file, column_t *columns, int row_size, long nr_of_rows) {
+	scan_t *scan = arena_calloc(scan_arena, sizeof(scan_t));
+	scan->arena = scan_arena;
+	scan->server = cli_req->server;
+	scan->socket = cli_req->client_socket;
+	scan->protocol = cli_req->protocol;
+	scan->data_file = data_file;
+	scan->columns = columns;
+	scan->row_size = row_size;
+	scan->row = arena_alloc(scan_arena, row_size);
+	scan->nr_of_rows = nr_of_rows;
+	scan->statement = cli_req->statement ? arena_strndup(scan_arena, cli_req->statement, strlen(cli_req->statement)) : NULL;
+	memcpy(scan->trace, cli_req->trace, sizeof(scan->trace));
+	string_init(&scan->out, scan_arena, SEND_BUFFER_SIZE);
+	return scan;
+}
+
+// a scan over every row of the table of a SELECT, NULL if the table can't be read
+static scan_t *table_scan(client_request *cli_req, bool aggregate, char **client_msg) {
+	arena_t *arena = cli_req->arena;
+	catalog_t *catalog = ((server_t *)cli_req->server)->catalog;
+
+	column_t *first = NULL;
+	int chars_in_row = 0;
+	binding_t *binding = bind_schema(cli_req);
+	if (!binding && !catalog_exists(catalog, cli_req->request->table_name))
+	{
+		*client_msg = create_format_buffer(arena, "Error: Table doesn't exist.\n");
+		return NULL;
+	}
+	// the scan owns its memory since it may outlive this statement's scratch arena
+	arena_t *scan_arena = arena_create(SCAN_ARENA_SIZE);
+	if (binding) { // a copy, the binding is resolved again once the schema changes
+		first = copy_columns(scan_arena, binding->columns);
+		chars_in_row = binding->row_size;
 	} else {
-		char *data_file = NULL;
-		create_full_data_path_from_name(cli_req->request->table_name, &data_file);
-		if (remove(data_file) < 0) {
-			*client_msg = create_format_buffer("error: the server wasn't able to remove table '%s' from the database\n", cli_req->request->table_name);
-			log_to_file("Error: Couldn't remove() the file '%s' in drop_table()\n", data_file);
-			remove(temp_name); // remove the temporary file since the request failed
-			return;
+		create_template_column(scan_arena, catalog, cli_req->request->table_name, &first, &chars_in_row);
+	}
+
+	// did not find the table
+	if (first == NULL) {
+		arena_destroy(scan_arena);
+		*client_msg = create_format_buffer(arena, "error: '%s' does not exist\n", cli_req->request->table_name);
+		return NULL;
+	}
+
+	char *final_name = NULL;
+	if (create_full_data_path_from_name(arena, cli_req->request->table_name, &final_name) < 0) {
+		log_to_file("Error: Couldn't create_full_data_path_from_name() in table_scan()\n");
+		arena_destroy(scan_arena);
+
+		*client_msg = create_format_buffer(arena, "error: server ran out of memory\n");
+		return NULL;
+	}
+
+	segments_t *segments = NULL;
+	FILE *data_file = table_open(cli_req->request->table_name, chars_in_row, &segments);
+	if (!data_file) {
+		arena_destroy(scan_arena);
+		*client_msg = create_format_buffer(arena, "error: the file '%s' does not exist\n", final_name);
+		return NULL;
+	}
+
+	fseek(data_file, 0, SEEK_END);
+	long chars_in_file = ftell(data_file);
+	if (chars_in_file == 0 && cli_req->protocol == PROTOCOL_TEXT && !aggregate) {
+		log_to_file("Error: Table is empty.\n");
+
+		*client_msg = create_format_buffer(arena, "Error: Table is empty.\n");
+		arena_destroy(scan_arena);
+		fclose(data_file);
+		return NULL;
+	}
+	fseek(data_file, 0, SEEK_SET);
+
+	// rows appended after this point aren't part of the result, so the scan
+	// doesn't need the table lock if it has to wait for a slow client
+	scan_t *scan = scan_create(cli_req, scan_arena, data_file, first, chars_in_row, chars_in_file / chars_in_row);
+	scan->table = arena_strndup(scan_arena, cli_req->request->table_name, strlen(cli_req->request->table_name));
+	scan->segments = segments;
+	return scan;
+}
+
+int select_table(client_request *cli_req, char **client_msg) {
+	arena_t *arena = cli_req->arena;
+	request_t *request = cli_req->request;
+	server_t *server = cli_req->server;
+
+	// the tables are locked, so a cached response made at their current versions is what the scan would send
+	uint64_t versions[2];
+	if (cli_req->cache_key) {
+		cached_result_t *result = result_cache_lookup(server->results, cli_req->cache_key, request);
+		if (result) {
+			if (connection_write(server, cli_req->client_socket, result->response, result->length) < 0)
+				log_to_file("Error: Couldn't send() to socket %ld in select_table()\n", cli_req->client_socket);
+			result_cache_release(server->results, result);
+			return 0;
 		}
+		result_cache_versions(server->results, request, versions);
+	}
 
-		log_to_file("Connection %s dropped table '%s'\n", get_ip_from_socket_fd(cli_req->client_socket), cli_req->request->table_name);
-		*client_msg = create_format_buffer("successfully dropped table '%s'\n", cli_req->request->table_name);
+	bool aggregate = has_aggregates(cli_req->request);
+	scan_t *scan = cli_req->request->join_table ? join_scan(cli_req, client_msg) : table_scan(cli_req, aggregate, client_msg);
+	if (!scan)
+		return -1;
+	if (cli_req->cache_key) { // the scan may outlive the request
+		scan->cache_key = cli_req->cache_key;
+		cli_req->cache_key = NULL;
+		scan->cache_tables[0] = arena_strndup(scan->arena, request->table_name, strlen(request->table_name));
+		if (request->join_table)
+			scan->cache_tables[1] = arena_strndup(scan->arena, request->join_table, strlen(request->join_table));
+		memcpy(scan->cache_versions, versions, sizeof(versions));
+	}
 
-		remove(META_FILE);			  // remove the original file
-		rename(temp_name, META_FILE); // rename the temporary file to original name
+	if (cli_req->request->where && filter_scan(cli_req, scan, client_msg) < 0) {
+		scan_destroy(scan);
+		return -1;
+	}
+	if (aggregate && (cli_req->request->order_by || cli_req->request->limit >= 0 || cli_req->request->offset)) {
+		*client_msg = create_format_buffer(arena, "error: ORDER BY, LIMIT and OFFSET can't be combined with aggregates\n");
+		scan_destroy(scan);
+		return -1;
+	}
+	if (cli_req->request->order_by && sort_scan(scan, cli_req->request, arena, client_msg) < 0) {
+		scan_destroy(scan);
+		return -1;
+	}
+	if (aggregate) { // the result is small, it is sent without parking
+		int result = aggregate_scan(scan, cli_req->request, arena, client_msg);
+		if (result == 0 && flush_scan(scan))
+			cache_scan(scan);
+		scan_destroy(scan);
+		return result;
+	}
+	if (limit_scan(scan, cli_req->request) < 0) {
+		*client_msg = create_format_buffer(arena, "error: the server couldn't read table '%s'\n", cli_req->request->table_name);
+		scan_destroy(scan);
+		return -1;
 	}
+	if (scan->protocol == PROTOCOL_BINARY)
+		encode_result_header(&scan->out, scan->columns);
+
+	if (continue_scan(scan))
+		scan_destroy(scan);
+	else
+		cli_req->suspended = true;
+	return 0;
 }
 
-bool table_exists(char *name, FILE *meta) {
-	// if the database is empty, the table can't exist in the database
-	if (!(freopen(NULL, "r", meta)))
-		return false;
+void resume_scan(void *arg) {
+	scan_t *scan = (scan_t *)arg;
+	server_t *server = scan->server;
+	size_t socket = scan->socket;
 
-	char *token = NULL;
-	char *line = NULL;
-	size_t nr_of_chars = 0;
+	if (continue_scan(scan)) { // the statement is done once the last row is queued
+		finish_statement(scan->trace, RT_SELECT, socket, scan->statement);
+		scan_destroy(scan);
+		connection_done(server, socket);
+	}
+}
 
-	while (getline(&line, &nr_of_chars, meta) != -1) {
-		token = strtok(line, COL_DELIM);
-		if (strcmp(token, name) == 0) {
-			free(line); // free the getline allocated line
-			return true;
-		}
+void scan_destroy(scan_t *scan) {
+	uncache_scan(scan);
+	fclose(scan->data_file);
+	if (scan->order_file)
+		fclose(scan->order_file);
+	arena_destroy(scan->arena);
+}
+
+int drop_table(client_request *cli_req, char **client_msg) {
+	arena_t *arena = cli_req->arena;
+	server_t *server = ((server_t *)cli_req->server);
+	char *name = cli_req->request->table_name;
+	if (!catalog_exists(server->catalog, name)) {
+		*client_msg = create_format_buffer(arena, "error: '%s' does not exist\n", name);
+		return -1;
 	}
-	free(line); // free the getline allocated line
 
-	return false;
+	if (memory_table_drop(name) < 0 && segments_drop(name) < 0) {
+		*client_msg = create_format_buffer(arena, "error: the server wasn't able to remove table '%s' from the database\n", name);
+		log_to_file("Error: Couldn't remove the segments of '%s' in drop_table()\n", name);
+		return -1;
+	}
+	if (catalog_drop(server->catalog, name) < 0) {
+		*client_msg = create_format_buffer(arena, "error: the server wasn't able to remove table '%s' from the database\n", name);
+		log_to_file("Error: Couldn't remove table '%s' from the catalog in drop_table()\n", name);
+		return -1;
+	}
+
+	result_cache_forget(server->results, name);
+	primary_keys_forget(server->keys, name);
+	log_to_file("Connection %s dropped table '%s'\n", get_ip_from_socket_fd(cli_req->client_socket), name);
+	*client_msg = create_format_buffer(arena, "successfully dropped table '%s'\n", name);
+	return 0;
 }
 
 void quit_connection(client_request *cli_req) {
-	server_t *server = ((server_t *)cli_req->server);
 	log_to_file("Closed connection from %s\n", get_ip_from_socket_fd(cli_req->client_socket));
 
-	FD_CLR(cli_req->client_socket, &(server->current_sockets));
-	// shutdown + close to ensure that both the socket and the telnet connection is closed
-	if (shutdown(cli_req->client_socket, SHUT_RDWR) == -1)
-		log_to_file("Error: Couldn't shutdown() socket %ld in execute_request()\n", cli_req->client_socket);
-	if (close(cli_req->client_socket) == -1)
-		log_to_file("Error: Couldn't close() socket %ld in execute_request()\n", cli_req->client_socket);
+	if (cli_req->protocol == PROTOCOL_BINARY) // let the client know its statement was handled
+		send_message(cli_req, "", false);
+
+	// the socket itself is closed once this statement is done with it
+	connection_close(cli_req->server, cli_req->client_socket);
 }
 
 bool is_valid_varchar(column_t *col) { return col->char_size >= 0; }
 
-int create_data_file(char *t_name) {
+// opens table name for reading, a memory table or else its segments. NULL if it has neither.
+// segments, if set, receives the segments behind the file, NULL for a memory table
+FILE *table_open(const char *name, int row_size, segments_t **segments) {
+	FILE *file = memory_table_open(name);
+	if (file && segments)
+		*segments = NULL;
+	return file ? file : segments_open(name, row_size, false, segments);
+}
+
+int create_data_file(arena_t *arena, char *t_name) {
 	char *final_name = NULL;
-	if (create_full_data_path_from_name(t_name, &final_name) < 0)
+	if (create_full_data_path_from_name(arena, t_name, &final_name) < 0)
 		return -1;
 
 	int data_fd = open(final_name, O_CREAT, 0644);
+	if (data_fd < 0)
+		return -1;
 	close(data_fd);
-	free(final_name);
 	return 0;
 }
 
-void insert_data(client_request *cli_req, char **client_msg) {
-	FILE *meta = NULL;
-	FILE *data_file = NULL;
+int insert_data(client_request *cli_req, char **client_msg) {
+	arena_t *arena = cli_req->arena;
 	column_t *first = NULL;
 	char *data_file_name = NULL;
-	char *line = NULL;
 
 	table_t table;
 	table.name = cli_req->request->table_name;
 	table.columns = cli_req->request->columns;
 
-	if (create_full_data_path_from_name(table.name, &data_file_name) < 0) {
-		*client_msg = create_format_buffer("error: server could not create the data path from '%s'\n", table.name);
-		return;
-	}
-
-	if (!(meta = fopen(META_FILE, "r"))) {
-		*client_msg = create_format_buffer("error: '%s' does not exist\n", META_FILE);
-		free(data_file_name);
-		return;
-	}
-
-	if (access(data_file_name, F_OK) == -1) {
-		*client_msg = create_format_buffer("error: the file '%s' does not exist\n", data_file_name);
-		fclose(meta);
-		free(data_file_name);
-		return;
+	if (create_full_data_path_from_name(arena, table.name, &data_file_name) < 0) {
+		*client_msg = create_format_buffer(arena, "error: server could not create the data path from '%s'\n", table.name);
+		return -1;
 	}
 
-	if (!(data_file = fopen(data_file_name, "a+"))) {
-		*client_msg = create_format_buffer("error: the file '%s' does not exist\n", data_file_name);
-		fclose(meta);
-		free(data_file_name);
-		return;
+	bool memory = memory_table_exists(table.name);
+	if (!memory && access(data_file_name, F_OK) == -1) {
+		*client_msg = create_format_buffer(arena, "error: the file '%s' does not exist\n", data_file_name);
+		return -1;
 	}
 
-	int meta_descriptor = fileno(meta);
-	int data_file_descriptor = fileno(data_file);
-
-	struct flock meta_file_lock;
-	struct flock data_file_lock;
-
-	memset(&meta_file_lock, 0, sizeof(meta_file_lock));
-	memset(&data_file_lock, 0, sizeof(data_file_lock));
-
-	data_file_lock.l_type = F_WRLCK;
-	meta_file_lock.l_type = F_RDLCK;
-
-	fcntl(meta_descriptor, F_OFD_SETLKW, &meta_file_lock);
-	fcntl(data_file_descriptor, F_OFD_SETLKW, &data_file_lock);
-
-	// Get information from table, how many bytes is each column?
-	// Make sure that excess space is filled with null characters
-	// Check how INSERT fills up the request_t structure
-	// getline into buffer, remove the table name and put it into populate column
-	char *token = NULL;
-	bool exists = false;
-	size_t nr_of_chars = 0;
+	is_primary_key is_pk;
+	is_pk.found = false;
+	is_pk.size_to_pk = 0;
+	is_pk.total_row_size = 0;
+	int current_pk = -1;
+	pk_table_t *keys = NULL;
+	int current_counter = 0;
 
-	while (getline(&line, &nr_of_chars, meta) != -1) {
-		token = strtok(line, COL_DELIM);
-		if (strcmp(token, table.name) == 0) {
-			exists = true;
-			break;
+	// a cached statement has the table's columns at hand, anything else reads them from the catalog
+	binding_t *binding = bind_schema(cli_req);
+	if (binding) {
+		first = binding->columns;
+		is_pk.found = binding->pk_offset >= 0;
+		is_pk.size_to_pk = is_pk.found ? binding->pk_offset : 0;
+		is_pk.total_row_size = binding->row_size;
+		current_counter = binding->nr_of_columns - 1;
+	} else {
+		// Get information from table, how many bytes is each column?
+		// Make sure that excess space is filled with null characters
+		// Check how INSERT fills up the request_t structure
+		// the column definitions from the catalog go into populate column
+		char *columns = catalog_columns(((server_t *)cli_req->server)->catalog, arena, table.name);
+		if (!columns) { // Table doesn't exist
+			*client_msg = create_format_buffer(arena, "error: table '%s' doesn't exist\n", table.name);
+			return -1;
 		}
+
+		first = (column_t *)arena_calloc(arena, sizeof(column_t));
+		populate_column(arena, first, columns, &is_pk);
+		for (column_t *current = first; current->next != NULL; current = current->next)
+			current_counter += 1;
 	}
 
-	if (!exists) { // Table doesn't exist
-		*client_msg = create_format_buffer("error: table '%s' doesn't exist\n", table.name);
-		fclose(meta);
-		fclose(data_file);
-		free(data_file_name);
-		return;
+	column_t *input_current = table.columns;
+	int input_counter = 0;
+	while (input_counter < current_counter && input_current->next != NULL) {
+		input_counter += 1;
+		input_current = input_current->next;
 	}
+	// the primary key is generated unless the statement gives a value for every column
+	if (!((is_pk.found && (input_counter + 1 == current_counter)) || (current_counter == input_counter))) {
+		log_to_file("Error: Couldn't column_to_buffer() in insert_data()\n");
 
-	token = strtok(NULL, COL_DELIM);
+		*client_msg = create_format_buffer(arena, "Value count doesn't match column count.\n");
+		return -1;
+	};
 
-	first = (column_t *)malloc(sizeof(column_t));
-	first->next = NULL;
-	first->is_primary_key = 0;
-	is_primary_key *is_pk = (is_primary_key *)malloc(sizeof(is_primary_key));
-	is_pk->found = false;
-	is_pk->size_to_pk = 0;
-	is_pk->total_row_size = 0;
-	int current_pk = -1;
-	populate_column(first, token, is_pk);
-
-	if (is_pk->found) {
-		// total_size - primary_key size
-		char *int_buffer = (char *)malloc(11);
-		memset(int_buffer, 0, 11);
-		int offset_to_pk = is_pk->total_row_size - is_pk->size_to_pk;
-		fseek(data_file, 0, SEEK_END);
-		int file_size = ftell(data_file);
-		fseek(data_file, -offset_to_pk, SEEK_END);
-		if (file_size > 0) {
-			fread(int_buffer, sizeof(char), 10, data_file);
-			current_pk = (int)strtol(int_buffer, NULL, 10) + 1;
-		} else {
-			current_pk = 1;
+	if (is_pk.found) {
+		keys = primary_keys_table(((server_t *)cli_req->server)->keys, table.name, is_pk.size_to_pk, is_pk.total_row_size);
+		if (!keys)
+			*client_msg = create_format_buffer(arena, "error: the server couldn't read the keys of table '%s'\n", table.name);
+	}
+	if (keys && current_counter == input_counter) {
+		// an explicit key is encoded like any other value, it only has to be unique
+		if (binding && !(first = copy_columns(arena, first))) {
+			*client_msg = create_format_buffer(arena, "error: server ran out of memory\n");
+			return -1;
+		}
+		column_t *pk_column = first;
+		column_t *input = table.columns;
+		for (; !pk_column->is_primary_key; pk_column = pk_column->next)
+			input = input->next;
+		pk_column->is_primary_key = 0;
+
+		current_pk = input->int_val;
+		if (input->data_type != DT_INT) {
+			*client_msg = create_format_buffer(arena, "syntax error, value(s) are of wrong data type.\n");
+			keys = NULL;
+		} else if (!pk_claim(keys, current_pk)) {
+			*client_msg = create_format_buffer(arena, "error: table '%s' already has a row with key %d\n", table.name, current_pk);
+			keys = NULL;
 		}
-		free(int_buffer);
-		int_buffer = NULL;
-		// read 10 bytes
+	} else if (keys && !pk_next(keys, &current_pk)) {
+		*client_msg = create_format_buffer(arena, "error: table '%s' has run out of primary keys\n", table.name);
+		keys = NULL;
 	}
+	if (is_pk.found && !keys)
+		return -1;
 
+	// the encoded row is exactly total_row_size long, including the newline
+	dynamicstr row;
+	string_init(&row, arena, is_pk.total_row_size);
+	if (column_to_buffer(arena, first, table.columns, &row, current_pk, client_msg) < 0) {
+		log_to_file("Error: Couldn't column_to_buffer() in insert_data()\n");
+		if (keys)
+			pk_release(keys, current_pk);
+		return -1;
+	}
 
-	column_t *current = first;
-	column_t *input_current = table.columns;
-	int current_counter = 0;
-	int input_counter = 0;
-	while (current->next != NULL) {
-		current_counter += 1;
-		if (input_current->next != NULL) {
-			input_counter += 1;
-			input_current = input_current->next;
-		}
-		current = current->next;
+	string_append_str(&row, ROW_DELIM);
+	long row_number;
+	if (memory) { // a copy into the table's chunks, there is no write to batch and nothing for the indexes or the replicas
+		row_number = memory_table_append(table.name, row.buffer, row.length);
+		result_cache_bump(((server_t *)cli_req->server)->results, table.name);
+	} else
+		row_number = append_row(((server_t *)cli_req->server)->appends, table.name, is_pk.total_row_size, row.buffer, row.length,
+								inserted_rows, cli_req);
+	if (row_number < 0) {
+		log_to_file("Error: Couldn't append_row() in insert_data()\n");
+		*client_msg = create_format_buffer(arena, "error: the server wasn't able to write to table '%s'\n", table.name);
+		if (keys)
+			pk_release(keys, current_pk);
+		return -1;
 	}
-	if (!((is_pk->found && (input_counter + 1 == current_counter)) || (!is_pk->found && (current_counter == input_counter)))) {
-		log_to_file("Error: Couldn't column_to_buffer() in insert_data()\n");
 
-		*client_msg = create_format_buffer("Value count doesn't match column count.\n");
-		fclose(meta);
-		fclose(data_file);
-		free(data_file_name);
-		free(line);
-		unpopulate_column(first);
-		return;
-	};
+	*client_msg = create_format_buffer(arena, "successfully inserted row into table '%s'\n", table.name);
+	if (!memory) // the log would cost a memory table more than the INSERT itself
+		log_to_file("Connection %s inserted a row into table '%s'\n", get_ip_from_socket_fd(cli_req->client_socket), table.name);
+	return 0;
+}
 
-	dynamicstr *output_buffer;
-	string_init(&output_buffer);
-	if (column_to_buffer(first, table.columns, output_buffer, current_pk, client_msg) < 0) {
-		log_to_file("Error: Couldn't column_to_buffer() in insert_data()\n");
-		fclose(meta);
-		fclose(data_file);
-		free(data_file_name);
-		free(line);
-		unpopulate_column(first);
-		string_free(&output_buffer);
-		return;
+/*
+ * Runs a CREATE TABLE, DROP TABLE or CREATE INDEX the primary shipped to this replica, with
+ * the locks execute_request takes for it. Returns -1 if it failed.
+ */
+int apply_statement(server_t *server, arena_t *arena, char *statement) {
+	char *error = NULL;
+	request_t *request = parse_request(statement, &error);
+	int type = request ? request->request_type : RT_TYPES;
+	if (type != RT_CREATE && type != RT_DROP && type != RT_CREATE_INDEX) {
+		log_to_file("Error: The primary shipped '%s', which isn't a change, in apply_statement()\n", statement);
+		destroy_request(request);
+		return -1;
 	}
 
-	fseek(data_file, 0, SEEK_END);
-	if (fprintf(data_file, "%s\n", output_buffer->buffer) < 0) {
-		log_to_file("Error: Couldn't fprintf() in insert_data()\n");
-		fclose(meta);
-		fclose(data_file);
-		free(data_file_name);
-		free(line);
-		unpopulate_column(first);
-		string_free(&output_buffer);
-		return;
+	client_request cli_req;
+	memset(&cli_req, 0, sizeof(cli_req));
+	cli_req.request = request;
+	cli_req.server = server;
+	cli_req.arena = arena;
+	cli_req.client_socket = -1; // nobody to answer
+	const char *names[1] = {request->table_name};
+	table_lock_t *table_lock = NULL;
+	char *client_msg = NULL;
+	int status;
+
+	lock_catalog(server->locks, catalog_modes[type]);
+	lock_tables(server->locks, names, 1, &table_modes[type], &table_lock);
+	if (type == RT_CREATE)
+		status = create_table(&cli_req, &client_msg);
+	else if (type == RT_DROP)
+		status = drop_table(&cli_req, &client_msg);
+	else
+		status = create_index(&cli_req, &client_msg);
+	unlock_tables(server->locks, &table_lock, &table_modes[type], 1);
+	unlock_catalog(server->locks, catalog_modes[type]);
+	destroy_request(request);
+
+	if (status < 0) {
+		log_to_file("Error: Couldn't apply '%s' in apply_statement(): %s", statement, client_msg);
+		return -1;
 	}
+	return 0;
+}
 
-	*client_msg = create_format_buffer("successfully inserted row into table '%s'\n", table.name);
-	log_to_file("Connection %s inserted a row into table '%s'\n", get_ip_from_socket_fd(cli_req->client_socket), table.name);
+/*
+ * Appends rows the primary shipped to this replica, first_row is the row number of the first
+ * of them on the primary. Rows the table already has are skipped, so applying them twice
+ * leaves the table as it was. Returns -1 if they couldn't be written.
+ */
+int apply_rows(server_t *server, arena_t *arena, const char *table, int row_size, const char *rows, size_t length, long first_row) {
+	const char *names[1] = {table};
+	table_lock_t *table_lock = NULL;
+	int result = -1;
+
+	lock_catalog(server->locks, catalog_modes[RT_INSERT]);
+	lock_tables(server->locks, names, 1, &table_modes[RT_INSERT], &table_lock);
+	segments_t *segments = row_size > 0 ? segments_load(table, row_size, true) : NULL;
+	if (segments) {
+		segment_t *tail = &segments->segments[segments->nr_of_segments - 1];
+		long nr_of_rows = (long)(length / row_size);
+		long present = (tail->start + tail->size) / row_size - first_row; // of these rows
+		if (present < 0) {
+			log_to_file("Error: '%s' is missing rows before row %ld in apply_rows(), was the replica started from a copy?\n", table, first_row);
+			present = 0;
+		}
 
-	fclose(meta);
-	fclose(data_file);
-	free(data_file_name);
-	free(line);
-	unpopulate_column(first);
-	string_free(&output_buffer);
-	return;
+		result = 0;
+		if (present < nr_of_rows) {
+			const char *missing = rows + present * row_size;
+			long row_number = segments_append(segments, missing, (nr_of_rows - present) * row_size);
+			if (row_number >= 0)
+				update_indexes(server->catalog, table, missing, row_size, nr_of_rows - present, row_number);
+			else
+				result = -1;
+			result_cache_bump(server->results, table);
+		}
+		segments_unload(segments);
+	}
+	unlock_tables(server->locks, &table_lock, &table_modes[RT_INSERT], 1);
+	unlock_catalog(server->locks, catalog_modes[RT_INSERT]);
+
+	if (result < 0)
+		log_to_file("Error: Couldn't append the rows of '%s' in apply_rows()\n", table);
+	return result;
 }
 
-int column_to_buffer(column_t *table_column, column_t *input_column, dynamicstr *output_buffer, int primary_key, char **ret_msg)
+int column_to_buffer(arena_t *arena, column_t *table_column, column_t *input_column, dynamicstr *row, int primary_key, char **ret_msg)
 {
 	if (table_column->is_primary_key) {
 		if (input_column == NULL)
 			return 0;
 
-		char *integer_val = (char *)malloc(11);
-		memset(integer_val, 0, 11);
-		snprintf(integer_val, 10 + 1, "%0*d", 10, primary_key);
-
-		string_set(&output_buffer, "%s", integer_val);
+		string_append_int(row, primary_key, CHARS_PER_INT, PADDING);
 		table_column = table_column->next;
 	}
 	if ((table_column->next == NULL) && (input_column->next != NULL)) {
-		*ret_msg = create_format_buffer(
+		*ret_msg = create_format_buffer(arena,
 			"Too many column values.\n");
 		return -1;
 	}
 	if (table_column->data_type != input_column->data_type) {
 		// sanitation error
-		*ret_msg = create_format_buffer(
+		*ret_msg = create_format_buffer(arena,
 			"syntax error, value(s) are of wrong data type.\n");
 		return -1;
 	}
 	if (input_column->data_type == 0) {
 		// INT
 		// write the integer value and pad the rest
-		char *integer_val = (char *)malloc(10);
-		memset(integer_val, 0, 10);
-		snprintf(integer_val, 10 + 1, "%0*d", 10, input_column->int_val);
-
-		string_set(&output_buffer, "%s", integer_val);
+		string_append_int(row, input_column->int_val, CHARS_PER_INT, PADDING);
 	} else {
 		// VARCHAR
 		// Check if the length of the input matches char_size in table_column
 		char *input_str = input_column->char_val;
+		size_t input_length = strlen(input_str);
 		// Remove the ' '
-		if ((input_str[0] == '\'') &&
-			(input_str[strlen(input_str) - 1] == '\'')) {
+		if ((input_length >= 2) && (input_str[0] == '\'') &&
+			(input_str[input_length - 1] == '\'')) {
 			input_str++;
-			input_str[strlen(input_str) - 1] = 0;
+			input_length -= 2;
 		}
-		if (table_column->char_size < strlen(input_str)) {
+		if (table_column->char_size < input_length) {
 			// Input value is to large
-			*ret_msg = create_format_buffer(
+			*ret_msg = create_format_buffer(arena,
 				"syntax error, VARCHAR value \"%s\" is to big.\n",
 				input_column->char_val);
 			return -1;
 		}
-		char *varchar_val = (char *)malloc(table_column->char_size + 1);
-		int length = table_column->char_size - strlen(input_str);
-		if (length == 0)
-			snprintf(varchar_val, table_column->char_size + 1, "%s", input_str);
-		else
-			snprintf(varchar_val, table_column->char_size + 1, "%0*d%s", length,
-					 0, input_str);
-
-		string_set(&output_buffer, "%s", varchar_val);
-		free(varchar_val);
+		string_append_padded(row, input_str, input_length, table_column->char_size, PADDING);
 	}
 
 	if ((table_column->next != NULL)) {
 		// if primary key
 		// insert primary key value here
 		// then proceed
-		if (column_to_buffer(table_column->next, input_column->next,
-							 output_buffer, primary_key, ret_msg) < 0)
+		if (column_to_buffer(arena, table_column->next, input_column->next,
+							 row, primary_key, ret_msg) < 0)
 			return -1;
 	} else if ((table_column->next == NULL) && (input_column->next == NULL)) {
 		// time to return
@@ -779,21 +1512,20 @@ int column_to_buffer(column_t *table_column, column_t *input_column, dynamicstr
 	return 0;
 }
 
-int populate_column(column_t *current, char *table_row, is_primary_key *is_pk) {
+int populate_column(arena_t *arena, column_t *current, const char *table_row, is_primary_key *is_pk) {
 	// Hardcoded length, pretty extreme.
 	char column_name[50];
 	char column_type[50];
 	column_name[0] = '\0';
 	column_type[0] = '\0';
 
-	sscanf(table_row, "%s%*[ ]%[^,']", column_name, column_type);
-	current->name = (char *)malloc(strlen(column_name) + 1);
+	sscanf(table_row, "%49s%*[ ]%49[^,']", column_name, column_type);
+	current->name = arena_strndup(arena, column_name, strlen(column_name));
 	if (column_name[0] == '1') {
 		current->is_primary_key = 1;
 		is_pk->found = true;
 		is_pk->size_to_pk = is_pk->total_row_size;
 	}
-	strcpy(current->name, column_name);
 
 	if (column_type[0] == 'I') {
 		current->data_type = DT_INT;
@@ -803,12 +1535,11 @@ int populate_column(column_t *current, char *table_row, is_primary_key *is_pk) {
 		sscanf(column_type, "%*[^0123456789]%d", &current->char_size);
 		is_pk->total_row_size += current->char_size;
 	}
-	table_row = strtok(NULL, ",");
+	// no strtok(), INSERTs into the same table parse their columns at the same time
+	table_row = strchr(table_row, ',');
 	if (table_row != NULL) {
-		column_t *next = (column_t *)malloc(sizeof(column_t));
-		next->next = NULL;
-		next->is_primary_key = 0;
-		populate_column(next, table_row, is_pk);
+		column_t *next = (column_t *)arena_calloc(arena, sizeof(column_t));
+		populate_column(arena, next, table_row + 1, is_pk);
 		current->next = next;
 	} else {
 		// account for the new line
@@ -817,68 +1548,47 @@ int populate_column(column_t *current, char *table_row, is_primary_key *is_pk) {
 	return 0;
 }
 
-void create_template_column(char *name, FILE *meta, column_t **first, int *chars_in_row) {
-	if (!(freopen(NULL, "r", meta)))
-		return;
-	char *token = NULL;
-	char *line = NULL;
-	size_t nr_of_chars = 0;
-
-	// search through the meta file for the table name
-	while (getline(&line, &nr_of_chars, meta) != -1) {
-		token = strtok(line, COL_DELIM);
-		if (strcmp(token, name) == 0)
-			break;
-
-		free(line); // free the getline allocated line
-		line = NULL;
-	}
-
-	if (!line) // the while loop continued until the end without finding the table
+void create_template_column(arena_t *arena, catalog_t *catalog, char *name, column_t **first, int *chars_in_row) {
+	char *columns = catalog_columns(catalog, arena, name);
+	if (!columns) // there is no such table
 		return;
 
 	// found the table
 	*chars_in_row = 1; // start at 1 to account for the newline that is after each row
-	column_t *current = calloc(1, sizeof(column_t));
-
-	while ((token = strtok(0, TYPE_DELIM))) {
-		// iterate forward in the list every time except the first time
-		// the first time, first is NULL and we have allocated current outside the loop
-		// so we set first to current and operate on current instead of current->next
-		if (*first != NULL)
-			current = current->next;
-		else
-			*first = current;
+	column_t **link = first;
 
-		current->name = calloc(strlen(token) + 1, sizeof(char));
-		strcpy(current->name, token); // extract column name
+	char *rest = NULL;
+	for (char *token = strtok_r(columns, TYPE_DELIM, &rest); token; token = strtok_r(NULL, TYPE_DELIM, &rest)) {
+		column_t *current = arena_calloc(arena, sizeof(column_t));
+		*link = current;
+		link = &current->next;
+
+		if (token[0] == '1') { // the catalog marks the primary key with a leading 1
+			current->is_primary_key = 1;
+			token++;
+		}
+		current->name = arena_strndup(arena, token, strlen(token)); // extract column name
 
 		// extract column type
 		// if the column is an INT, the size will be CHARS_PER_INT bytes
 		// if the column is a VARCHAR, we need to extract the number of bytes
 		// this means that if the column->char_size is set, it is a VARCHAR,
 		// otherwise it's an INT
-		token = strtok(0, COL_DELIM);
+		token = strtok_r(NULL, COL_DELIM, &rest);
 		if (token[0] == 'I') {
+			current->data_type = DT_INT;
 			*chars_in_row += CHARS_PER_INT; // chars in an INT
 		} else {
+			current->data_type = DT_VARCHAR;
 			sscanf(token, "%*[^0123456789]%d", &current->char_size); // extract number between paranthesis
 			*chars_in_row += current->char_size;
 		}
-
-		current->next = calloc(1, sizeof(column_t)); // allocate new memory for the next column
 	}
-	// since we allocate new memeory at the end of the while loop, the last
-	// iteration will allocate memory unnecessarily, therefore we free it
-	free(current->next);
-	current->next = NULL;
-
-	free(line); // free the getline allocated line
 }
 
-int create_full_data_path_from_name(char *name, char **full_path) {
-	if ((*full_path = (char *)malloc(strlen(DATA_FILE_PATH) + strlen(name) + strlen(DATA_FILE_ENDING) + 1)) == NULL) {
-		log_to_file("Error: Couldn't malloc in create_full_data_path_from_name()\n");
+int create_full_data_path_from_name(arena_t *arena, char *name, char **full_path) {
+	if ((*full_path = (char *)arena_alloc(arena, strlen(DATA_FILE_PATH) + strlen(name) + strlen(DATA_FILE_ENDING) + 1)) == NULL) {
+		log_to_file("Error: Couldn't allocate memory in create_full_data_path_from_name()\n");
 		return -1;
 	}
 
@@ -920,15 +1630,3 @@ void log_to_file(const char *format, ...) {
 	}
 	va_end(args);
 }
-
-int unpopulate_column(column_t *current) {
-	if (current->name)
-		free(current->name);
-	current->name = NULL;
-
-	if (current->next != NULL)
-		unpopulate_column(current->next);
-	free(current);
-	current = NULL;
-	return 0;
-}
@@ -1,61 +1,142 @@
 #include "dynamic_string.h"
 
-void string_init(dynamicstr **target) {
-	(*target) = (struct dynamicstr *)malloc(sizeof(struct dynamicstr));
+void string_init(dynamicstr *target, arena_t *arena, size_t capacity) {
+	target->length = 0;
+	target->capacity = 0;
+	target->buffer = NULL;
+	target->arena = arena;
 
-	(*target)->size = 0;
-	(*target)->buffer = NULL;
+	if (capacity)
+		string_reserve(target, capacity);
 }
 
-void string_set(dynamicstr **destination, char *format, ...) {
-	// Possible optimization: Realloc a bigger size than needed
-	int len;
-	int sizediff;
+void string_free(dynamicstr *target) {
+	if (!target->arena) // arena strings are released with their arena
+		free(target->buffer);
+	target->buffer = NULL;
+	target->length = 0;
+	target->capacity = 0;
+}
+
+void string_clear(dynamicstr *target) {
+	target->length = 0;
+	if (target->buffer)
+		target->buffer[0] = '\0';
+}
+
+int string_reserve(dynamicstr *target, size_t extra) {
+	size_t needed = target->length + extra + 1; // +1 for the terminator
+	if (needed <= target->capacity)
+		return 0;
+
+	// grow geometrically so building a string of n bytes copies O(n) bytes in total
+	size_t capacity = target->capacity ? target->capacity : STRING_MIN_CAPACITY;
+	while (capacity < needed)
+		capacity *= STRING_GROWTH;
+
+	char *bigger = target->arena
+		? arena_grow(target->arena, target->buffer, target->capacity, capacity)
+		: realloc(target->buffer, capacity);
+	if (!bigger) {
+		perror("Unable to grow string buffer");
+		return -1;
+	}
+
+	if (!target->buffer)
+		bigger[0] = '\0';
+	target->buffer = bigger;
+	target->capacity = capacity;
+	return 0;
+}
+
+int string_append(dynamicstr *target, const char *data, size_t length) {
+	if (string_reserve(target, length) < 0)
+		return -1;
+
+	memcpy(target->buffer + target->length, data, length);
+	target->length += length;
+	target->buffer[target->length] = '\0';
+	return 0;
+}
+
+int string_append_str(dynamicstr *target, const char *str) {
+	return string_append(target, str, strlen(str));
+}
+
+int string_append_char(dynamicstr *target, char ch) {
+	if (string_reserve(target, 1) < 0)
+		return -1;
+
+	target->buffer[target->length++] = ch;
+	target->buffer[target->length] = '\0';
+	return 0;
+}
+
+int string_append_int(dynamicstr *target, int value, size_t width, char pad) {
+	// format right to left into a scratch buffer instead of going through printf
+	char digits[12];
+	char *cursor = digits + sizeof(digits);
+	unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+	do {
+		*--cursor = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+	} while (magnitude);
+
+	size_t length = digits + sizeof(digits) - cursor + (value < 0);
+	size_t padding = width > length ? width - length : 0;
+	if (string_reserve(target, padding + length) < 0)
+		return -1;
+
+	// like printf, zero padding goes between the sign and the digits
+	char *out = target->buffer + target->length;
+	if (value < 0 && pad == '0')
+		*out++ = '-';
+	memset(out, pad, padding);
+	out += padding;
+	if (value < 0 && pad != '0')
+		*out++ = '-';
+	memcpy(out, cursor, digits + sizeof(digits) - cursor);
+	target->length += padding + length;
+	target->buffer[target->length] = '\0';
+	return 0;
+}
+
+int string_append_padded(dynamicstr *target, const char *data, size_t length, size_t width, char pad) {
+	size_t padding = width > length ? width - length : 0;
+	if (string_reserve(target, padding + length) < 0)
+		return -1;
+
+	memset(target->buffer + target->length, pad, padding);
+	memcpy(target->buffer + target->length + padding, data, length);
+	target->length += padding + length;
+	target->buffer[target->length] = '\0';
+	return 0;
+}
+
+int string_set(dynamicstr *target, const char *format, ...) {
+	// appends formatted text, the result is only measured separately when it doesn't fit
+	if (string_reserve(target, 0) < 0)
+		return -1;
+
 	va_list args;
+	size_t room = target->capacity - target->length;
 
 	va_start(args, format);
-	len = vsnprintf(NULL, 0, format, args) + 1;
+	int length = vsnprintf(target->buffer + target->length, room, format, args);
 	va_end(args);
+	if (length < 0)
+		return -1;
 
-	// If size > 0 then don't add the null character to size
-	// This might mess up the "true" size?
-	if ((*destination)->size > 0)
-		(*destination)->size += len - 1;
-	else
-		(*destination)->size += len;
-
-	sizediff = (*destination)->size - len;
-	(*destination)->buffer =
-		realloc((*destination)->buffer, (*destination)->size + 1);
+	if ((size_t)length >= room) {
+		if (string_reserve(target, length) < 0)
+			return -1;
 
-	if ((*destination)->buffer == NULL) {
-		perror("Unable to realloc() ptr!");
-	} else {
 		va_start(args, format);
-		len = vsnprintf(NULL, 0, format, args) + 1;
+		vsnprintf(target->buffer + target->length, length + 1, format, args);
 		va_end(args);
-
-		sizediff = (*destination)->size - len;
-		(*destination)->buffer = realloc((*destination)->buffer, (*destination)->size + 1);
-
-		if ((*destination)->buffer == NULL) {
-			perror("Unable to realloc() ptr!");
-		} else {
-			va_start(args, format);
-			// "+ sizediff" to append to the buffer
-			vsnprintf((*destination)->buffer + sizediff, len, format, args);
-			va_end(args);
-		}
-		return;
 	}
-}
-
-void string_free(dynamicstr **target) {
-	if ((*target)->buffer)
-		free((*target)->buffer);
-	(*target)->buffer = NULL;
 
-	if (*target)
-		free(*target);
-	*target = NULL;
+	target->length += length;
+	return 0;
 }
@@ -0,0 +1,306 @@
+#include "hash_index.h"
+
+// pages are addressed by file and offset, primary pages in the index file and overflow pages in their own
+typedef struct page_ref page_ref_t;
+struct page_ref {
+	int fd;
+	off_t offset;
+};
+
+uint32_t hash_index_hash(const char *key, size_t length) {
+	uint32_t hash = 2166136261u; // FNV-1a
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)key[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static char *file_name(const char *path, const char *ending) {
+	char *name = malloc(strlen(path) + strlen(ending) + 1);
+	if (!name)
+		return NULL;
+	strcpy(name, path);
+	strcat(name, ending);
+	return name;
+}
+
+static size_t nr_of_buckets(index_header_t *header) {
+	return ((size_t)INDEX_INITIAL_BUCKETS << header->level) + header->split;
+}
+
+static uint32_t bucket_of(index_header_t *header, uint32_t hash) {
+	uint32_t bucket = hash % ((uint32_t)INDEX_INITIAL_BUCKETS << header->level);
+	if (bucket < header->split) // already split this round, the next level decides
+		bucket = hash % ((uint32_t)INDEX_INITIAL_BUCKETS << (header->level + 1));
+	return bucket;
+}
+
+static page_ref_t primary_page(hash_index_t *index, uint32_t bucket) {
+	return (page_ref_t){index->fd, (off_t)(bucket + 1) * INDEX_PAGE_SIZE};
+}
+
+static page_ref_t overflow_page(hash_index_t *index, uint32_t page) {
+	return (page_ref_t){index->overflow_fd, (off_t)(page - 1) * INDEX_PAGE_SIZE};
+}
+
+// a page past the end of the file is a bucket that was never written, it reads as empty
+static int read_page(page_ref_t ref, index_page_t *page) {
+	ssize_t length = pread(ref.fd, page, sizeof(*page), ref.offset);
+	if (length < 0)
+		return -1;
+	if (length < (ssize_t)sizeof(*page))
+		memset((char *)page + length, 0, sizeof(*page) - length);
+	return 0;
+}
+
+static int write_page(page_ref_t ref, index_page_t *page) {
+	return pwrite(ref.fd, page, sizeof(*page), ref.offset) == (ssize_t)sizeof(*page) ? 0 : -1;
+}
+
+static int write_header(hash_index_t *index) {
+	index_page_t page;
+	memset(&page, 0, sizeof(page));
+	memcpy(&page, &index->header, sizeof(index->header));
+	return pwrite(index->fd, &page, sizeof(page), 0) == (ssize_t)sizeof(page) ? 0 : -1;
+}
+
+static uint32_t allocate_overflow(hash_index_t *index) {
+	index_page_t page;
+	uint32_t number = index->header.free_overflow;
+
+	if (number && read_page(overflow_page(index, number), &page) == 0)
+		index->header.free_overflow = page.next;
+	else
+		number = ++index->header.overflow_pages;
+	index->dirty = true;
+	return number;
+}
+
+int hash_index_create(const char *path, uint32_t key_offset, uint32_t key_width) {
+	char *name = file_name(path, INDEX_FILE_ENDING);
+	char *overflow_name = file_name(path, OVERFLOW_FILE_ENDING);
+	int result = -1;
+
+	hash_index_t index;
+	memset(&index, 0, sizeof(index));
+	index.header.magic = INDEX_MAGIC;
+	index.header.key_offset = key_offset;
+	index.header.key_width = key_width;
+
+	if (name && overflow_name && (index.fd = open(name, O_CREAT | O_TRUNC | O_RDWR, 0644)) >= 0) {
+		if ((index.overflow_fd = open(overflow_name, O_CREAT | O_TRUNC | O_RDWR, 0644)) >= 0) {
+			result = write_header(&index);
+			close(index.overflow_fd);
+		}
+		close(index.fd);
+	}
+
+	free(name);
+	free(overflow_name);
+	return result;
+}
+
+hash_index_t *hash_index_open(const char *path) {
+	char *name = file_name(path, INDEX_FILE_ENDING);
+	char *overflow_name = file_name(path, OVERFLOW_FILE_ENDING);
+	hash_index_t *index = calloc(1, sizeof(hash_index_t));
+
+	if (!name || !overflow_name || !index)
+		goto failed;
+	index->overflow_fd = -1;
+	if ((index->fd = open(name, O_RDWR)) < 0 || (index->overflow_fd = open(overflow_name, O_RDWR)) < 0)
+		goto failed;
+	if (pread(index->fd, &index->header, sizeof(index->header), 0) != (ssize_t)sizeof(index->header) ||
+		index->header.magic != INDEX_MAGIC)
+		goto failed;
+
+	free(name);
+	free(overflow_name);
+	return index;
+
+failed:
+	if (index && index->fd >= 0)
+		close(index->fd);
+	if (index && index->overflow_fd >= 0)
+		close(index->overflow_fd);
+	free(index);
+	free(name);
+	free(overflow_name);
+	return NULL;
+}
+
+int hash_index_close(hash_index_t *index) {
+	if (!index) // sanity check
+		return 0;
+
+	int result = index->dirty ? write_header(index) : 0;
+	close(index->fd);
+	close(index->overflow_fd);
+	free(index);
+	return result;
+}
+
+// writes the header back if inserts changed it, the index stays open
+int hash_index_sync(hash_index_t *index) {
+	if (!index->dirty)
+		return 0;
+	if (write_header(index) < 0)
+		return -1;
+	index->dirty = false;
+	return 0;
+}
+
+int hash_index_remove(const char *path) {
+	char *name = file_name(path, INDEX_FILE_ENDING);
+	char *overflow_name = file_name(path, OVERFLOW_FILE_ENDING);
+	int result = (name && overflow_name && remove(name) == 0 && remove(overflow_name) == 0) ? 0 : -1;
+
+	free(name);
+	free(overflow_name);
+	return result;
+}
+
+// appends entry to the last page of the chain of bucket
+static int append_entry(hash_index_t *index, uint32_t bucket, index_entry_t entry) {
+	index_page_t page;
+	page_ref_t ref = primary_page(index, bucket);
+
+	if (read_page(ref, &page) < 0)
+		return -1;
+	while (page.count == INDEX_ENTRIES_PER_PAGE) {
+		if (!page.next) { // the chain is full, link a new overflow page
+			page.next = allocate_overflow(index);
+			if (write_page(ref, &page) < 0)
+				return -1;
+			ref = overflow_page(index, page.next);
+			memset(&page, 0, sizeof(page));
+			break;
+		}
+		ref = overflow_page(index, page.next);
+		if (read_page(ref, &page) < 0)
+			return -1;
+	}
+
+	page.entries[page.count++] = entry;
+	return write_page(ref, &page);
+}
+
+// replaces the chain of bucket with the entries that hash to it
+static int write_chain(hash_index_t *index, uint32_t bucket, index_entry_t *entries, size_t count, uint32_t modulus) {
+	index_page_t page;
+	page_ref_t ref = primary_page(index, bucket);
+
+	memset(&page, 0, sizeof(page));
+	for (size_t i = 0; i < count; i++) {
+		if (entries[i].hash % modulus != bucket)
+			continue;
+		if (page.count == INDEX_ENTRIES_PER_PAGE) {
+			page.next = allocate_overflow(index);
+			if (write_page(ref, &page) < 0)
+				return -1;
+			ref = overflow_page(index, page.next);
+			memset(&page, 0, sizeof(page));
+		}
+		page.entries[page.count++] = entries[i];
+	}
+	return write_page(ref, &page);
+}
+
+// moves the entries of the next bucket in line between it and its new sibling
+static int split_bucket(hash_index_t *index) {
+	index_header_t *header = &index->header;
+	uint32_t old_bucket = header->split;
+	uint32_t new_bucket = old_bucket + ((uint32_t)INDEX_INITIAL_BUCKETS << header->level);
+	uint32_t modulus = (uint32_t)INDEX_INITIAL_BUCKETS << (header->level + 1);
+	index_page_t page;
+
+	// collect the whole chain first, its overflow pages go back to the free list
+	size_t count = 0, capacity = INDEX_ENTRIES_PER_PAGE;
+	index_entry_t *entries = malloc(capacity * sizeof(index_entry_t));
+	if (!entries || read_page(primary_page(index, old_bucket), &page) < 0) {
+		free(entries);
+		return -1;
+	}
+	while (true) {
+		if (count + page.count > capacity) {
+			capacity *= 2;
+			index_entry_t *grown = realloc(entries, capacity * sizeof(index_entry_t));
+			if (!grown) {
+				free(entries);
+				return -1;
+			}
+			entries = grown;
+		}
+		memcpy(entries + count, page.entries, page.count * sizeof(index_entry_t));
+		count += page.count;
+
+		uint32_t next = page.next;
+		if (!next)
+			break;
+		if (read_page(overflow_page(index, next), &page) < 0) {
+			free(entries);
+			return -1;
+		}
+		index_page_t freed = {0, header->free_overflow, {{0, 0}}};
+		write_page(overflow_page(index, next), &freed);
+		header->free_overflow = next;
+	}
+
+	// the old bucket keeps the entries that still hash to it
+	header->split++;
+	if (header->split == ((uint32_t)INDEX_INITIAL_BUCKETS << header->level)) {
+		header->level++;
+		header->split = 0;
+	}
+	index->dirty = true;
+
+	int result = (write_chain(index, old_bucket, entries, count, modulus) == 0 &&
+				  write_chain(index, new_bucket, entries, count, modulus) == 0) ? 0 : -1;
+	free(entries);
+	return result;
+}
+
+int hash_index_insert(hash_index_t *index, const char *row, uint32_t row_number) {
+	index_entry_t entry = {hash_index_hash(row + index->header.key_offset, index->header.key_width), row_number};
+
+	if (append_entry(index, bucket_of(&index->header, entry.hash), entry) < 0)
+		return -1;
+	index->header.entries++;
+	index->dirty = true;
+
+	if (index->header.entries > INDEX_MAX_LOAD * INDEX_ENTRIES_PER_PAGE * nr_of_buckets(&index->header))
+		return split_bucket(index);
+	return 0;
+}
+
+// rows whose key hashes like key, the caller compares the keys to weed out collisions
+int hash_index_lookup(hash_index_t *index, const char *key, arena_t *arena, uint32_t **rows, size_t *count) {
+	uint32_t hash = hash_index_hash(key, index->header.key_width);
+	size_t capacity = 16;
+	index_page_t page;
+
+	*count = 0;
+	if (!(*rows = arena_alloc(arena, capacity * sizeof(uint32_t))))
+		return -1;
+	if (read_page(primary_page(index, bucket_of(&index->header, hash)), &page) < 0)
+		return -1;
+
+	while (true) {
+		for (uint32_t i = 0; i < page.count; i++) {
+			if (page.entries[i].hash != hash)
+				continue;
+			if (*count == capacity) {
+				*rows = arena_grow(arena, *rows, capacity * sizeof(uint32_t), 2 * capacity * sizeof(uint32_t));
+				if (!*rows)
+					return -1;
+				capacity *= 2;
+			}
+			(*rows)[(*count)++] = page.entries[i].row;
+		}
+		if (!page.next)
+			return 0;
+		if (read_page(overflow_page(index, page.next), &page) < 0)
+			return -1;
+	}
+}
@@ -0,0 +1,87 @@
+#include "histogram.h"
+
+static size_t bucket_of(uint64_t value) {
+	if (value < 2 * HISTOGRAM_SUB_BUCKETS)
+		return (size_t)value;
+
+	// shift the value down until it is in [64, 128), every shift is one more row of buckets
+	int shift = 63 - __builtin_clzll(value) - 6;
+	return 2 * HISTOGRAM_SUB_BUCKETS + (size_t)(shift - 1) * HISTOGRAM_SUB_BUCKETS + (size_t)((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+static uint64_t highest_in_bucket(size_t bucket) {
+	if (bucket < 2 * HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+
+	size_t row = (bucket - 2 * HISTOGRAM_SUB_BUCKETS) / HISTOGRAM_SUB_BUCKETS;
+	uint64_t sub = (bucket - 2 * HISTOGRAM_SUB_BUCKETS) % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+	int shift = (int)row + 1;
+	return ((sub + 1) << shift) - 1;
+}
+
+void histogram_init(histogram_t *histogram) {
+	memset(histogram, 0, sizeof(*histogram));
+	histogram->min = UINT64_MAX;
+}
+
+// safe to call from several threads at once, the counters are updated atomically
+void histogram_record(histogram_t *histogram, uint64_t value) {
+	__atomic_fetch_add(&histogram->counts[bucket_of(value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&histogram->total, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+
+	uint64_t min = __atomic_load_n(&histogram->min, __ATOMIC_RELAXED);
+	while (value < min && !__atomic_compare_exchange_n(&histogram->min, &min, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+	while (value > max && !__atomic_compare_exchange_n(&histogram->max, &max, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+// for a histogram only the calling thread records into, like a stats shard. A relaxed load and
+// store per counter is enough with a single writer and readers that may be a moment behind
+void histogram_record_local(histogram_t *histogram, uint64_t value) {
+	uint64_t *count = &histogram->counts[bucket_of(value)];
+	__atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&histogram->total, __atomic_load_n(&histogram->total, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&histogram->sum, __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+	if (value < __atomic_load_n(&histogram->min, __ATOMIC_RELAXED))
+		__atomic_store_n(&histogram->min, value, __ATOMIC_RELAXED);
+	if (value > __atomic_load_n(&histogram->max, __ATOMIC_RELAXED))
+		__atomic_store_n(&histogram->max, value, __ATOMIC_RELAXED);
+}
+
+void histogram_merge(histogram_t *into, const histogram_t *from) {
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+		into->counts[i] += from->counts[i];
+	into->total += from->total;
+	into->sum += from->sum;
+	if (from->min < into->min)
+		into->min = from->min;
+	if (from->max > into->max)
+		into->max = from->max;
+}
+
+// percentile in [0, 100], reported as the highest value of the bucket it falls in
+uint64_t histogram_percentile(const histogram_t *histogram, double percentile) {
+	if (histogram->total == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->total + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += histogram->counts[i];
+		if (seen >= rank) {
+			uint64_t value = highest_in_bucket(i);
+			return value < histogram->max ? value : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+
+double histogram_mean(const histogram_t *histogram) {
+	return histogram->total ? (double)histogram->sum / histogram->total : 0.0;
+}
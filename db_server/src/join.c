@@ -0,0 +1,268 @@
+#include "join.h"
+
+// the ON column of row, left padded to the width both sides are compared at
+static void make_key(join_t *join, join_side_t *side, const char *row, char *key) {
+	int padding = join->key_width - side->key_width;
+	memset(key, PADDING, padding);
+	memcpy(key + padding, row + side->key_offset, side->key_width);
+}
+
+// finds a table of the JOIN in the catalog and opens its data file
+static int open_side(client_request *cli_req, arena_t *scan_arena, char *name, const char *column_name,
+					 join_side_t *side, column_t **key, char **client_msg) {
+	arena_t *arena = cli_req->arena;
+
+	side->name = name;
+	create_template_column(scan_arena, ((server_t *)cli_req->server)->catalog, name, &side->columns, &side->row_size);
+	if (!side->columns) {
+		*client_msg = create_format_buffer(arena, "error: '%s' does not exist\n", name);
+		return -1;
+	}
+	if (!(*key = find_column(side->columns, column_name, &side->key_offset))) {
+		*client_msg = create_format_buffer(arena, "error: table '%s' has no column '%s'\n", name, column_name);
+		return -1;
+	}
+	side->key_width = column_width(*key);
+
+	if (!(side->file = table_open(name, side->row_size, NULL))) {
+		*client_msg = create_format_buffer(arena, "error: the data file of '%s' does not exist\n", name);
+		return -1;
+	}
+	fseek(side->file, 0, SEEK_END);
+	side->nr_of_rows = ftell(side->file) / side->row_size;
+	fseek(side->file, 0, SEEK_SET);
+	return 0;
+}
+
+// appends the result row made of a row of the FROM table and a row of the JOIN table
+static int emit(join_t *join, const char *first, const char *second) {
+	int first_size = join->sides[0].row_size - 1; // without its newline
+	memcpy(join->result, first, first_size);
+	memcpy(join->result + first_size, second, join->sides[1].row_size);
+	if (fwrite(join->result, join->result_size, 1, join->out) < 1) {
+		log_to_file("Error: Couldn't fwrite() a result row in emit()\n");
+		return -1;
+	}
+	join->nr_of_results++;
+	return 0;
+}
+
+static void free_table(join_table_t *table) {
+	free(table->rows);
+	free(table->hashes);
+	free(table->next);
+	free(table->buckets);
+}
+
+// reads the next nr_of_rows rows of file into memory and chains them by the hash of their key
+static int build_table(join_t *join, join_table_t *table, FILE *file, long nr_of_rows) {
+	join_side_t *side = &join->sides[join->build];
+	size_t count = (size_t)nr_of_rows;
+
+	memset(table, 0, sizeof(*table));
+	table->nr_of_rows = count;
+	table->nr_of_buckets = 16;
+	while (table->nr_of_buckets < count)
+		table->nr_of_buckets *= 2;
+	table->rows = malloc(count * side->row_size + 1);
+	table->hashes = malloc(count * sizeof(uint32_t) + 1);
+	table->next = malloc(count * sizeof(uint32_t) + 1);
+	table->buckets = malloc(table->nr_of_buckets * sizeof(uint32_t));
+	if (!table->rows || !table->hashes || !table->next || !table->buckets)
+		return -1;
+	if (fread(table->rows, side->row_size, count, file) < count) {
+		log_to_file("Error: Couldn't fread() the rows of '%s' in build_table()\n", side->name);
+		return -1;
+	}
+
+	// chained from the last row down, so rows with the same key are found in file order
+	memset(table->buckets, 0xff, table->nr_of_buckets * sizeof(uint32_t));
+	for (size_t i = count; i-- > 0;) {
+		make_key(join, side, table->rows + i * side->row_size, join->keys);
+		uint32_t hash = hash_index_hash(join->keys, join->key_width);
+		size_t bucket = hash & (table->nr_of_buckets - 1);
+		table->hashes[i] = hash;
+		table->next[i] = table->buckets[bucket];
+		table->buckets[bucket] = (uint32_t)i;
+	}
+	return 0;
+}
+
+// streams the next nr_of_rows rows of file and emits a result for every build row with the same key
+static int probe_table(join_t *join, join_table_t *table, FILE *file, long nr_of_rows) {
+	join_side_t *build = &join->sides[join->build];
+	join_side_t *probe = &join->sides[!join->build];
+	char *key = join->keys, *build_key = join->keys + join->key_width;
+	char *batch = malloc((size_t)SCAN_BATCH * probe->row_size);
+	int result = batch ? 0 : -1;
+
+	while (result == 0 && nr_of_rows > 0) {
+		size_t count = nr_of_rows < SCAN_BATCH ? (size_t)nr_of_rows : SCAN_BATCH;
+		if (fread(batch, probe->row_size, count, file) < count) {
+			log_to_file("Error: Couldn't fread() the rows of '%s' in probe_table()\n", probe->name);
+			result = -1;
+			break;
+		}
+		nr_of_rows -= count;
+
+		for (size_t i = 0; result == 0 && i < count; i++) {
+			const char *row = batch + i * probe->row_size;
+			make_key(join, probe, row, key);
+			uint32_t hash = hash_index_hash(key, join->key_width);
+
+			for (uint32_t j = table->buckets[hash & (table->nr_of_buckets - 1)]; result == 0 && j != JOIN_END; j = table->next[j]) {
+				const char *match = table->rows + (size_t)j * build->row_size;
+				if (table->hashes[j] != hash)
+					continue;
+				make_key(join, build, match, build_key);
+				if (memcmp(key, build_key, join->key_width) != 0)
+					continue;
+				result = join->build == 0 ? emit(join, match, row) : emit(join, row, match);
+			}
+		}
+	}
+
+	free(batch);
+	return result;
+}
+
+static int join_files(join_t *join, FILE *build, long build_rows, FILE *probe, long probe_rows) {
+	join_table_t table;
+	int result = build_table(join, &table, build, build_rows);
+	if (result == 0)
+		result = probe_table(join, &table, probe, probe_rows);
+	free_table(&table);
+	return result;
+}
+
+// splits the rows of a side by the hash of their key, a key lands in the same partition on both sides.
+// The partition is taken from the high bits of the hash, the buckets of a partition use the low ones
+static int partition_side(join_t *join, join_side_t *side, FILE **files, long *counts, size_t nr_of_partitions) {
+	char *batch = malloc((size_t)SCAN_BATCH * side->row_size);
+	long left = side->nr_of_rows;
+	int result = batch ? 0 : -1;
+
+	while (result == 0 && left > 0) {
+		size_t count = left < SCAN_BATCH ? (size_t)left : SCAN_BATCH;
+		if (fread(batch, side->row_size, count, side->file) < count) {
+			log_to_file("Error: Couldn't fread() the rows of '%s' in partition_side()\n", side->name);
+			result = -1;
+			break;
+		}
+		left -= count;
+
+		for (size_t i = 0; i < count; i++) {
+			const char *row = batch + i * side->row_size;
+			make_key(join, side, row, join->keys);
+			size_t partition = ((uint64_t)hash_index_hash(join->keys, join->key_width) * nr_of_partitions) >> 32;
+			if (fwrite(row, side->row_size, 1, files[partition]) < 1) {
+				log_to_file("Error: Couldn't fwrite() a partition of '%s' in partition_side()\n", side->name);
+				result = -1;
+				break;
+			}
+			counts[partition]++;
+		}
+	}
+
+	free(batch);
+	return result;
+}
+
+// the build side doesn't fit JOIN_MEMORY, both sides are partitioned to disk and joined a partition at a time
+static int grace_join(join_t *join, size_t nr_of_partitions) {
+	FILE **files = calloc(2 * nr_of_partitions, sizeof(FILE *)); // the partitions of side s start at s * nr_of_partitions
+	long *counts = calloc(2 * nr_of_partitions, sizeof(long));
+	int result = files && counts ? 0 : -1;
+
+	for (size_t i = 0; result == 0 && i < 2 * nr_of_partitions; i++)
+		if (!(files[i] = create_temp_file(JOIN_FILE_ENDING)))
+			result = -1;
+	for (int s = 0; result == 0 && s < 2; s++)
+		result = partition_side(join, &join->sides[s], files + s * nr_of_partitions, counts + s * nr_of_partitions, nr_of_partitions);
+
+	FILE **build = files + join->build * nr_of_partitions, **probe = files + !join->build * nr_of_partitions;
+	long *build_counts = counts + join->build * nr_of_partitions, *probe_counts = counts + !join->build * nr_of_partitions;
+	for (size_t p = 0; result == 0 && p < nr_of_partitions; p++) {
+		if (!build_counts[p] || !probe_counts[p])
+			continue;
+		rewind(build[p]);
+		rewind(probe[p]);
+		result = join_files(join, build[p], build_counts[p], probe[p], probe_counts[p]);
+	}
+
+	for (size_t i = 0; files && i < 2 * nr_of_partitions; i++)
+		if (files[i])
+			fclose(files[i]);
+	free(files);
+	free(counts);
+	return result;
+}
+
+/*
+ * Runs the JOIN of a SELECT as a hash join and returns a scan over its result, which then
+ * goes through WHERE, ORDER BY, LIMIT and the sending of rows like the rows of a table.
+ * The hash table is built on the smaller table and the larger one is streamed past it. If
+ * the build rows don't fit JOIN_MEMORY both tables are partitioned to disk first. The result
+ * rows are written to a temporary file as fixed-width rows, the columns of the FROM table
+ * followed by the ones of the JOIN table.
+ */
+scan_t *join_scan(client_request *cli_req, char **client_msg) {
+	arena_t *arena = cli_req->arena;
+	request_t *request = cli_req->request;
+	// the scan owns its memory since it may outlive this statement's scratch arena
+	arena_t *scan_arena = arena_create(SCAN_ARENA_SIZE);
+	column_t *keys[2];
+	join_t join;
+	memset(&join, 0, sizeof(join));
+
+	int result = open_side(cli_req, scan_arena, request->table_name, request->join_on->name, &join.sides[0], &keys[0], client_msg);
+	if (result == 0)
+		result = open_side(cli_req, scan_arena, request->join_table, request->join_on->next->name, &join.sides[1], &keys[1], client_msg);
+	if (result == 0 && keys[0]->data_type != keys[1]->data_type) {
+		*client_msg = create_format_buffer(arena, "error: JOIN can't compare an INT with a VARCHAR\n");
+		result = -1;
+	}
+
+	if (result == 0) {
+		join_side_t *sides = join.sides;
+		join.build = (long long)sides[1].nr_of_rows * sides[1].row_size < (long long)sides[0].nr_of_rows * sides[0].row_size;
+		join.key_width = sides[0].key_width > sides[1].key_width ? sides[0].key_width : sides[1].key_width;
+		join.keys = arena_alloc(scan_arena, 2 * join.key_width);
+		join.result_size = sides[0].row_size - 1 + sides[1].row_size;
+		join.result = arena_alloc(scan_arena, join.result_size);
+
+		join_side_t *build = &sides[join.build], *probe = &sides[!join.build];
+		size_t build_bytes = (size_t)build->nr_of_rows * (build->row_size + 3 * sizeof(uint32_t));
+		size_t nr_of_partitions = 2 * (build_bytes / JOIN_MEMORY + 1); // room for an uneven spread of the keys
+		if (nr_of_partitions > JOIN_MAX_PARTITIONS)
+			nr_of_partitions = JOIN_MAX_PARTITIONS;
+
+		if (!(join.out = create_temp_file(JOIN_FILE_ENDING)))
+			result = -1;
+		else if (build_bytes <= JOIN_MEMORY)
+			result = join_files(&join, build->file, build->nr_of_rows, probe->file, probe->nr_of_rows);
+		else
+			result = grace_join(&join, nr_of_partitions);
+	}
+
+	for (int s = 0; s < 2; s++)
+		if (join.sides[s].file)
+			fclose(join.sides[s].file);
+	if (result < 0 || fflush(join.out) != 0) {
+		if (!*client_msg)
+			*client_msg = create_format_buffer(arena, "error: the server couldn't join '%s' with '%s'\n", request->table_name, request->join_table);
+		if (join.out)
+			fclose(join.out);
+		arena_destroy(scan_arena);
+		return NULL;
+	}
+
+	// a result row holds the columns of both tables
+	column_t *last = join.sides[0].columns;
+	while (last->next)
+		last = last->next;
+	last->next = join.sides[1].columns;
+
+	rewind(join.out);
+	return scan_create(cli_req, scan_arena, join.out, join.sides[0].columns, join.result_size, join.nr_of_results);
+}
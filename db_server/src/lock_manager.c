@@ -0,0 +1,255 @@
+#include "lock_manager.h"
+
+// compatible[held][requested] for the multi-granularity catalog and table locks
+static const bool compatible[LM_MODES][LM_MODES] = {
+	/*         IS     IX     S      X  */
+	/* IS */ {true, true, true, false},
+	/* IX */ {true, true, false, false},
+	/* S  */ {true, false, true, false},
+	/* X  */ {false, false, false, false},
+};
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void record_wait(lock_stats_t *stats, uint64_t start) {
+	__atomic_fetch_add(&stats->acquired, 1, __ATOMIC_RELAXED);
+	if (!start) // got the lock without blocking
+		return;
+
+	uint64_t waited = now_ns() - start;
+	uint64_t max = __atomic_load_n(&stats->max_wait_ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->waited, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->wait_ns, waited, __ATOMIC_RELAXED);
+	while (waited > max && !__atomic_compare_exchange_n(&stats->max_wait_ns, &max, waited, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+lock_manager_t *lock_manager_create(const char *lock_path) {
+	int fd = open(lock_path, O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+		return NULL;
+
+	// the only file lock left, it keeps a second server process from
+	// operating on the same database directory concurrently
+	struct flock lock;
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = F_WRLCK;
+	if (fcntl(fd, F_OFD_SETLK, &lock) < 0) {
+		close(fd);
+		errno = EBUSY;
+		return NULL;
+	}
+
+	lock_manager_t *manager = calloc(1, sizeof(*manager));
+	manager->file_lock = fd;
+	pthread_mutex_init(&manager->catalog_mutex, NULL);
+	pthread_cond_init(&manager->catalog_cond, NULL);
+	pthread_mutex_init(&manager->table_mutex, NULL);
+
+	return manager;
+}
+
+void lock_manager_destroy(lock_manager_t *manager) {
+	if (!manager) // sanity check
+		return;
+
+	table_lock_t *current, *next;
+	for (size_t i = 0; i < LOCK_BUCKETS; i++) {
+		for (current = manager->buckets[i]; current; current = next) {
+			next = current->next;
+			pthread_cond_destroy(&current->cond);
+			free(current->name);
+			free(current);
+		}
+	}
+
+	pthread_mutex_destroy(&manager->catalog_mutex);
+	pthread_cond_destroy(&manager->catalog_cond);
+	pthread_mutex_destroy(&manager->table_mutex);
+	close(manager->file_lock); // releases the cross-process lock
+	free(manager);
+}
+
+static bool catalog_available(lock_manager_t *manager, int mode) {
+	for (int held = 0; held < LM_MODES; held++)
+		if (manager->catalog_holders[held] && !compatible[held][mode])
+			return false;
+
+	// don't let a steady stream of readers starve a writer
+	return mode == LM_X || !manager->catalog_waiting_x;
+}
+
+void lock_catalog(lock_manager_t *manager, int mode) {
+	uint64_t start = 0;
+
+	pthread_mutex_lock(&manager->catalog_mutex);
+	if (!catalog_available(manager, mode)) {
+		start = now_ns();
+		if (mode == LM_X)
+			manager->catalog_waiting_x++;
+		while (!catalog_available(manager, mode))
+			pthread_cond_wait(&manager->catalog_cond, &manager->catalog_mutex);
+		if (mode == LM_X)
+			manager->catalog_waiting_x--;
+	}
+	manager->catalog_holders[mode]++;
+	pthread_mutex_unlock(&manager->catalog_mutex);
+
+	record_wait(&manager->catalog_stats[mode], start);
+}
+
+void unlock_catalog(lock_manager_t *manager, int mode) {
+	pthread_mutex_lock(&manager->catalog_mutex);
+	manager->catalog_holders[mode]--;
+	pthread_cond_broadcast(&manager->catalog_cond);
+	pthread_mutex_unlock(&manager->catalog_mutex);
+}
+
+// the caller holds manager->table_mutex
+static table_lock_t *table_lock_get(lock_manager_t *manager, const char *name) {
+	size_t bucket = string_hash(name, 0) % LOCK_BUCKETS;
+	table_lock_t *lock;
+
+	for (lock = manager->buckets[bucket]; lock; lock = lock->next)
+		if (strcmp(lock->name, name) == 0)
+			break;
+
+	if (!lock) { // first user of this table, create its entry
+		lock = calloc(1, sizeof(*lock));
+		lock->name = strdup(name);
+		pthread_cond_init(&lock->cond, NULL);
+		lock->next = manager->buckets[bucket];
+		manager->buckets[bucket] = lock;
+	}
+	lock->references++;
+	return lock;
+}
+
+// the caller holds manager->table_mutex
+static void table_lock_put(lock_manager_t *manager, table_lock_t *lock) {
+	if (--lock->references)
+		return;
+
+	// unlink the entry so the map only holds tables that are in use
+	table_lock_t **link = &manager->buckets[string_hash(lock->name, 0) % LOCK_BUCKETS];
+	while (*link != lock)
+		link = &(*link)->next;
+	*link = lock->next;
+
+	pthread_cond_destroy(&lock->cond);
+	free(lock->name);
+	free(lock);
+}
+
+// a request that just arrived also queues behind incompatible ones already waiting, so a
+// steady stream of INSERTs doesn't starve a SELECT or the other way around
+static bool table_available(table_lock_t *lock, int mode, bool arrived) {
+	for (int held = 0; held < LM_MODES; held++) {
+		if (lock->holders[held] && !compatible[held][mode])
+			return false;
+		if (arrived && lock->waiting[held] && !compatible[held][mode])
+			return false;
+	}
+	return true;
+}
+
+table_lock_t *lock_table(lock_manager_t *manager, const char *name, int mode) {
+	uint64_t start = 0;
+
+	pthread_mutex_lock(&manager->table_mutex);
+	table_lock_t *lock = table_lock_get(manager, name);
+	if (!table_available(lock, mode, true)) {
+		start = now_ns();
+		lock->waiting[mode]++;
+		while (!table_available(lock, mode, false))
+			pthread_cond_wait(&lock->cond, &manager->table_mutex);
+		lock->waiting[mode]--;
+	}
+	lock->holders[mode]++;
+	pthread_mutex_unlock(&manager->table_mutex);
+
+	record_wait(&manager->table_stats[mode], start);
+	return lock;
+}
+
+void unlock_table(lock_manager_t *manager, table_lock_t *lock, int mode) {
+	if (!lock) // sanity check
+		return;
+
+	pthread_mutex_lock(&manager->table_mutex);
+	lock->holders[mode]--;
+	pthread_cond_broadcast(&lock->cond);
+	table_lock_put(manager, lock);
+	pthread_mutex_unlock(&manager->table_mutex);
+}
+
+void lock_tables(lock_manager_t *manager, const char **names, size_t count, const int *modes, table_lock_t **locks) {
+	size_t order[count];
+	size_t i, j, tmp;
+
+	// acquire in name order so two requests locking the same set of tables
+	// can never wait on each other in a cycle
+	for (i = 0; i < count; i++)
+		order[i] = i;
+	for (i = 1; i < count; i++)
+		for (j = i; j > 0 && strcmp(names[order[j - 1]], names[order[j]]) > 0; j--) {
+			tmp = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = tmp;
+		}
+
+	for (i = 0; i < count; i++) {
+		size_t current = order[i];
+		int mode = modes[current];
+
+		if (i > 0 && strcmp(names[order[i - 1]], names[current]) == 0) {
+			locks[current] = locks[order[i - 1]]; // already locked (self join)
+			continue;
+		}
+		// a table listed more than once is locked once in the strongest mode
+		for (j = i + 1; j < count && strcmp(names[order[j]], names[current]) == 0; j++)
+			if (modes[order[j]] > mode)
+				mode = modes[order[j]];
+
+		locks[current] = lock_table(manager, names[current], mode);
+	}
+}
+
+void unlock_tables(lock_manager_t *manager, table_lock_t **locks, const int *modes, size_t count) {
+	size_t i, j;
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < i && locks[j] != locks[i]; j++)
+			;
+		if (j < i) // only unlock the first occurrence of a shared lock
+			continue;
+
+		// in the strongest mode it was listed with, like lock_tables took it
+		int mode = modes[i];
+		for (j = i + 1; j < count; j++)
+			if (locks[j] == locks[i] && modes[j] > mode)
+				mode = modes[j];
+		unlock_table(manager, locks[i], mode);
+	}
+}
+
+void lock_manager_stats(lock_manager_t *manager, lock_stats_t *catalog, lock_stats_t *tables) {
+	for (int mode = 0; mode < LM_MODES; mode++) {
+		if (catalog) {
+			catalog[mode].acquired = __atomic_load_n(&manager->catalog_stats[mode].acquired, __ATOMIC_RELAXED);
+			catalog[mode].waited = __atomic_load_n(&manager->catalog_stats[mode].waited, __ATOMIC_RELAXED);
+			catalog[mode].wait_ns = __atomic_load_n(&manager->catalog_stats[mode].wait_ns, __ATOMIC_RELAXED);
+			catalog[mode].max_wait_ns = __atomic_load_n(&manager->catalog_stats[mode].max_wait_ns, __ATOMIC_RELAXED);
+		}
+		if (tables) {
+			tables[mode].acquired = __atomic_load_n(&manager->table_stats[mode].acquired, __ATOMIC_RELAXED);
+			tables[mode].waited = __atomic_load_n(&manager->table_stats[mode].waited, __ATOMIC_RELAXED);
+			tables[mode].wait_ns = __atomic_load_n(&manager->table_stats[mode].wait_ns, __ATOMIC_RELAXED);
+			tables[mode].max_wait_ns = __atomic_load_n(&manager->table_stats[mode].max_wait_ns, __ATOMIC_RELAXED);
+		}
+	}
+}
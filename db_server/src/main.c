@@ -1,10 +1,29 @@
 #include "server.h"
 
+// exits unless arg is a port number a server may listen to
+static size_t parse_port(const char *arg) {
+    size_t port = strtoumax(arg, NULL, 10);
+    if (port == 0) {
+        printf("error: expected an integer port number\n");
+        exit(EXIT_FAILURE);
+    } else if (port > 0xFFFF || port < 1024) {
+        printf("error: expected a valid port number in the range (1024-65535) but got %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+    return port;
+}
+
 int main(int argc, char *argv[]) {
     bool daemon = false;
     size_t port = 7798;
     size_t request_handling = 1;
     char *logfile = NULL;
+    char *tracefile = NULL;
+    unsigned int trace_rate = TRACE_SAMPLE_RATE;
+    double slow_ms = 0;
+    int io = IO_POSIX;
+    size_t ship_port = 0;   // -R, the server is a primary
+    size_t follow_port = 0; // -F, the server is a replica
     char *second_arg = NULL;
 
     // start at one because the first argument is the name of the executable
@@ -23,15 +42,34 @@ int main(int argc, char *argv[]) {
             second_arg = argv[i + 1];
 
             if (strcmp(argv[i], "-p") == 0) {
-                if ((port = strtoumax(second_arg, NULL, 10)) == 0) {
-                    printf("error: expected an integer port number\n");
+                port = parse_port(second_arg);
+            } else if (strcmp(argv[i], "-R") == 0) {
+                ship_port = parse_port(second_arg);
+            } else if (strcmp(argv[i], "-F") == 0) {
+                follow_port = parse_port(second_arg);
+            } else if (strcmp(argv[i], "-l") == 0) {
+                logfile = second_arg;
+            } else if (strcmp(argv[i], "-t") == 0) {
+                tracefile = second_arg;
+            } else if (strcmp(argv[i], "-r") == 0) {
+                if ((trace_rate = strtoul(second_arg, NULL, 10)) == 0) {
+                    printf("error: expected a positive sampling rate but got %s\n", second_arg);
                     exit(EXIT_FAILURE);
-                } else if (port > 0xFFFF || port < 1024) {
-                    printf("error: expected a valid port number in the range (1024-65535) but got %s\n", second_arg);
+                }
+            } else if (strcmp(argv[i], "-q") == 0) {
+                if ((slow_ms = strtod(second_arg, NULL)) <= 0) {
+                    printf("error: expected a positive number of milliseconds but got %s\n", second_arg);
+                    exit(EXIT_FAILURE);
+                }
+            } else if (strcmp(argv[i], "-i") == 0) {
+                if (strcmp(second_arg, "posix") == 0)
+                    io = IO_POSIX;
+                else if (strcmp(second_arg, "uring") == 0)
+                    io = IO_URING;
+                else {
+                    printf("error: expected one of [posix, uring] but got %s\n", second_arg);
                     exit(EXIT_FAILURE);
                 }
-            } else if (strcmp(argv[i], "-l") == 0) {
-                logfile = second_arg;
             } else if (strcmp(argv[i], "-s") == 0) {
                 if (strcmp(second_arg, "fork") == 0)
                     request_handling = FORK;
@@ -59,12 +97,30 @@ int main(int argc, char *argv[]) {
         printf("%s\n", HELP);
         exit(3);
     }
+    if (ship_port && follow_port) {
+        printf("error: a replica can't ship changes to replicas of its own\n");
+        exit(EXIT_FAILURE);
+    }
 
     server_t *server = server_create(daemon, port, request_handling, logfile);
     if (!server) {
         perror("server_create");
         return 1;
     }
+    if (trace_open(tracefile, trace_rate, slow_ms) < 0) {
+        perror("trace_open");
+        return 1;
+    }
+    server->io = io;
+    segments_use_uring(io == IO_URING);
+    if (ship_port && !(server->replication = replication_primary(ship_port))) {
+        perror("replication_primary");
+        return 1;
+    }
+    if (follow_port && !(server->replication = replication_replica(follow_port))) {
+        perror("replication_replica");
+        return 1;
+    }
     server_init(server);
     server_listen(server);
 
@@ -0,0 +1,230 @@
+#include "memory_tables.h"
+#include "db_functions.h"
+
+// an open memory table, the cookie behind the FILE memory_table_open returns
+typedef struct memory_file memory_file_t;
+struct memory_file {
+	memory_table_t *table;
+	long size; // of the table when it was opened
+	long position;
+};
+
+// every memory table of this process, by name
+static pthread_rwlock_t registry_lock = PTHREAD_RWLOCK_INITIALIZER;
+static memory_table_t *buckets[MEMORY_BUCKETS];
+
+// the caller holds registry_lock
+static memory_table_t **find_link(const char *name) {
+	memory_table_t **link = &buckets[string_hash(name, 0) % MEMORY_BUCKETS];
+	while (*link && strcmp((*link)->name, name) != 0)
+		link = &(*link)->next;
+	return link;
+}
+
+static void free_table(memory_table_t *table) {
+	for (size_t i = 0; i < table->nr_of_chunks; i++)
+		free(table->directory->chunks[i]);
+	for (memory_directory_t *next; table->directory; table->directory = next) {
+		next = table->directory->older;
+		free(table->directory);
+	}
+	pthread_mutex_destroy(&table->append_lock);
+	free(table->name);
+	free(table);
+}
+
+// table with a reference for the caller, NULL if there is no memory table called name
+static memory_table_t *table_get(const char *name) {
+	pthread_rwlock_rdlock(&registry_lock);
+	memory_table_t *table = *find_link(name);
+	if (table)
+		__atomic_fetch_add(&table->references, 1, __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&registry_lock);
+	return table;
+}
+
+static void table_put(memory_table_t *table) {
+	if (__atomic_sub_fetch(&table->references, 1, __ATOMIC_ACQ_REL) == 0)
+		free_table(table);
+}
+
+// adds memory table name with rows of row_size, returns -1 if it already exists or memory ran out
+int memory_table_create(const char *name, int row_size) {
+	memory_table_t *table = calloc(1, sizeof(memory_table_t));
+	if (!table)
+		return -1;
+	table->name = strdup(name);
+	table->directory = calloc(1, sizeof(memory_directory_t) + MEMORY_DIRECTORY_SIZE * sizeof(char *));
+	if (!table->name || !table->directory) {
+		free(table->directory);
+		free(table->name);
+		free(table);
+		return -1;
+	}
+	table->directory->capacity = MEMORY_DIRECTORY_SIZE;
+	table->row_size = row_size;
+	table->chunk_size = row_size > 0 ? MEMORY_CHUNK_SIZE / row_size * row_size : MEMORY_CHUNK_SIZE;
+	if (table->chunk_size < row_size)
+		table->chunk_size = row_size;
+	table->references = 1;
+	pthread_mutex_init(&table->append_lock, NULL);
+
+	pthread_rwlock_wrlock(&registry_lock);
+	memory_table_t **link = find_link(name);
+	if (*link) {
+		pthread_rwlock_unlock(&registry_lock);
+		free_table(table);
+		return -1;
+	}
+	*link = table;
+	pthread_rwlock_unlock(&registry_lock);
+	return 0;
+}
+
+// removes memory table name, its rows are freed once no file has it open. Returns -1 if there is no such memory table
+int memory_table_drop(const char *name) {
+	pthread_rwlock_wrlock(&registry_lock);
+	memory_table_t **link = find_link(name);
+	memory_table_t *table = *link;
+	if (table)
+		*link = table->next;
+	pthread_rwlock_unlock(&registry_lock);
+	if (!table)
+		return -1;
+
+	table_put(table);
+	return 0;
+}
+
+bool memory_table_exists(const char *name) {
+	pthread_rwlock_rdlock(&registry_lock);
+	bool exists = *find_link(name) != NULL;
+	pthread_rwlock_unlock(&registry_lock);
+	return exists;
+}
+
+// makes room for chunk i, the caller holds table->append_lock
+static int add_chunk(memory_table_t *table, size_t i) {
+	memory_directory_t *directory = table->directory;
+	if (i >= directory->capacity) { // readers keep using the old directory until they see the new one
+		size_t capacity = 2 * directory->capacity;
+		memory_directory_t *grown = malloc(sizeof(memory_directory_t) + capacity * sizeof(char *));
+		if (!grown)
+			return -1;
+		grown->capacity = capacity;
+		grown->older = directory;
+		memcpy(grown->chunks, directory->chunks, table->nr_of_chunks * sizeof(char *));
+		__atomic_store_n(&table->directory, grown, __ATOMIC_RELEASE);
+		directory = grown;
+	}
+
+	void *chunk;
+	if (posix_memalign(&chunk, MEMORY_CHUNK_ALIGNMENT, (size_t)table->chunk_size) != 0)
+		return -1;
+	directory->chunks[i] = chunk;
+	table->nr_of_chunks++;
+	return 0;
+}
+
+/*
+ * Appends length bytes of whole rows to memory table name and returns the row number of the
+ * first of them, or -1 if there is no such table or memory ran out. Readers see the rows once
+ * all of them were copied, never a part of them.
+ */
+long memory_table_append(const char *name, const char *rows, size_t length) {
+	memory_table_t *table = table_get(name);
+	if (!table)
+		return -1;
+
+	pthread_mutex_lock(&table->append_lock);
+	long first = table->size;
+	long size = first;
+	size_t copied = 0;
+	while (copied < length) {
+		size_t i = (size_t)(size / table->chunk_size);
+		long offset = size % table->chunk_size;
+		if (i >= table->nr_of_chunks && add_chunk(table, i) < 0)
+			break;
+
+		size_t room = (size_t)(table->chunk_size - offset);
+		size_t part = length - copied < room ? length - copied : room;
+		memcpy(table->directory->chunks[i] + offset, rows + copied, part);
+		copied += part;
+		size += (long)part;
+	}
+	if (copied == length) // the chunks and the rows in them are there before readers see the new size
+		__atomic_store_n(&table->size, size, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&table->append_lock);
+
+	long row_size = table->row_size;
+	table_put(table);
+	return copied == length ? first / row_size : -1;
+}
+
+static ssize_t memory_read(void *cookie, char *buffer, size_t size) {
+	memory_file_t *file = cookie;
+	memory_table_t *table = file->table;
+	memory_directory_t *directory = __atomic_load_n(&table->directory, __ATOMIC_ACQUIRE);
+	size_t read = 0;
+	while (read < size && file->position < file->size) {
+		long offset = file->position % table->chunk_size;
+		size_t left = (size_t)(table->chunk_size - offset);
+		if (left > (size_t)(file->size - file->position))
+			left = (size_t)(file->size - file->position);
+		if (left > size - read)
+			left = size - read;
+		memcpy(buffer + read, directory->chunks[file->position / table->chunk_size] + offset, left);
+		read += left;
+		file->position += (long)left;
+	}
+	return (ssize_t)read;
+}
+
+static int memory_seek(void *cookie, off64_t *offset, int whence) {
+	memory_file_t *file = cookie;
+	long position = (long)*offset;
+	if (whence == SEEK_CUR)
+		position += file->position;
+	else if (whence == SEEK_END)
+		position += file->size;
+	if (position < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*offset = file->position = position;
+	return 0;
+}
+
+static int memory_close(void *cookie) {
+	memory_file_t *file = cookie;
+	table_put(file->table);
+	free(file);
+	return 0;
+}
+
+static const cookie_io_functions_t memory_functions = {memory_read, NULL, memory_seek, memory_close};
+
+/*
+ * Opens memory table name for reading like a data file. Reads see the rows that were in the
+ * table when it was opened, the table stays around until the file is closed even if it is
+ * dropped. Returns NULL if there is no such memory table.
+ */
+FILE *memory_table_open(const char *name) {
+	memory_table_t *table = table_get(name);
+	if (!table)
+		return NULL;
+
+	memory_file_t *file = calloc(1, sizeof(memory_file_t));
+	FILE *stream = NULL;
+	if (file) {
+		file->table = table;
+		file->size = __atomic_load_n(&table->size, __ATOMIC_ACQUIRE);
+		stream = fopencookie(file, "r", memory_functions);
+	}
+	if (!stream) {
+		free(file);
+		table_put(table);
+	}
+	return stream;
+}
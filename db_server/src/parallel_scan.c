@@ -0,0 +1,112 @@
+#include "parallel_scan.h"
+
+// how many ranges a sequential scan is split into, from its size and the threads that are free
+size_t scan_parallelism(scan_t *scan) {
+	if (scan->rows || scan->order_file || !scan->table)
+		return 1;
+
+	size_t ranges = (size_t)(scan->nr_of_rows - scan->next_row) / PARALLEL_RANGE_ROWS;
+	size_t threads = thread_pool_idle(((server_t *)scan->server)->pool) + 1;
+	if (ranges > threads)
+		ranges = threads;
+	if (ranges > PARALLEL_MAX_RANGES)
+		ranges = PARALLEL_MAX_RANGES;
+	return ranges ? ranges : 1;
+}
+
+// scans range i with a file of its own, since every range reads from its own position
+static int run_range(parallel_t *parallel, size_t i) {
+	scan_t *scan = parallel->scan;
+	long rows = scan->nr_of_rows - scan->next_row;
+	scan_t range = *scan;
+
+	range.next_row = scan->next_row + rows * (long)i / (long)parallel->nr_of_ranges;
+	range.nr_of_rows = scan->next_row + rows * (long)(i + 1) / (long)parallel->nr_of_ranges;
+	if (!(range.data_file = table_open(scan->table, range.row_size, &range.segments))) {
+		log_to_file("Error: Couldn't table_open() '%s' in run_range()\n", scan->table);
+		return -1;
+	}
+
+	int result = -1;
+	if (fseek(range.data_file, range.next_row * range.row_size, SEEK_SET) < 0)
+		log_to_file("Error: Couldn't fseek() to row %ld in run_range()\n", range.next_row);
+	else
+		result = parallel->func(&range, parallel->states[i]);
+	fclose(range.data_file);
+	return result;
+}
+
+// claims ranges until none are left, the caller holds parallel->lock
+static void claim_ranges(parallel_t *parallel) {
+	while (!parallel->failed && parallel->next_range < parallel->nr_of_ranges) {
+		size_t i = parallel->next_range++;
+		parallel->running++;
+		pthread_mutex_unlock(&parallel->lock);
+
+		int result = run_range(parallel, i);
+
+		pthread_mutex_lock(&parallel->lock);
+		parallel->running--;
+		parallel->failed = parallel->failed || result < 0;
+		pthread_cond_broadcast(&parallel->done);
+	}
+}
+
+static void parallel_release(parallel_t *parallel) {
+	pthread_mutex_lock(&parallel->lock);
+	bool last = --parallel->references == 0;
+	pthread_mutex_unlock(&parallel->lock);
+	if (!last)
+		return;
+
+	pthread_mutex_destroy(&parallel->lock);
+	pthread_cond_destroy(&parallel->done);
+	free(parallel);
+}
+
+static void parallel_helper(void *arg) {
+	parallel_t *parallel = arg;
+
+	pthread_mutex_lock(&parallel->lock);
+	claim_ranges(parallel);
+	pthread_mutex_unlock(&parallel->lock);
+	parallel_release(parallel);
+}
+
+/*
+ * Splits the rows scan has left into nr_of_ranges ranges of about the same size and calls
+ * func for each of them, with states[i] for range i. The calling thread works on ranges
+ * too and returns once all of them are done, the scan itself isn't moved.
+ */
+int parallel_scan(scan_t *scan, size_t nr_of_ranges, range_func_t func, void **states) {
+	parallel_t *parallel = calloc(1, sizeof(parallel_t));
+	if (!parallel)
+		return -1;
+	pthread_mutex_init(&parallel->lock, NULL);
+	pthread_cond_init(&parallel->done, NULL);
+	parallel->nr_of_ranges = nr_of_ranges;
+	parallel->references = 1;
+	parallel->scan = scan;
+	parallel->func = func;
+	parallel->states = states;
+
+	thread_pool_t *pool = ((server_t *)scan->server)->pool;
+	for (size_t i = 1; i < nr_of_ranges; i++) {
+		pthread_mutex_lock(&parallel->lock);
+		parallel->references++;
+		pthread_mutex_unlock(&parallel->lock);
+		if (!thread_pool_add_work(pool, parallel_helper, parallel))
+			parallel_release(parallel);
+	}
+
+	// helpers that start after the last range was claimed have nothing left to do
+	pthread_mutex_lock(&parallel->lock);
+	claim_ranges(parallel);
+	while (parallel->running)
+		pthread_cond_wait(&parallel->done, &parallel->lock);
+	int result = parallel->failed ? -1 : 0;
+	pthread_mutex_unlock(&parallel->lock);
+
+	parallel_release(parallel);
+	return result;
+}
@@ -0,0 +1,90 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "request.h"
+
+#define LIBREQUEST "lib/librequest.so"
+#define DEFAULT_ITERATIONS 200000
+
+typedef request_t *(*parse_func_t)(char *request_string, char **parse_error);
+typedef void (*destroy_func_t)(request_t *request);
+
+static const char *statements[] = {
+	"CREATE TABLE students (id INT, first_name VARCHAR(7), last_name VARCHAR(8), PRIMARY KEY(id));",
+	"INSERT INTO students VALUES (42, 'Oscar', 'Svensson');",
+	"SELECT * FROM students;",
+	"SELECT first_name, last_name FROM students;",
+	"UPDATE students SET first_name='Emil', last_name='Johansson' WHERE id=42;",
+	"DELETE FROM students WHERE id=42;",
+	".schema students",
+	"INSERT INTO students VALUES (42, 'Oscar', 'Svensson'",
+	NULL,
+};
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// the in-tree parser writes into its input, so both parsers get a fresh copy every iteration
+static double measure(parse_func_t parse, destroy_func_t destroy, bool free_error, const char *statement, size_t iterations) {
+	size_t length = strlen(statement) + 1;
+	char *buffer = malloc(length);
+	char *error = NULL;
+
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < iterations; i++) {
+		memcpy(buffer, statement, length);
+		request_t *request = parse(buffer, &error);
+		if (request)
+			destroy(request);
+		else if (free_error)
+			free(error);
+	}
+	uint64_t elapsed = now_ns() - start;
+
+	free(buffer);
+	return (double)elapsed / iterations;
+}
+
+int main(int argc, char *argv[]) {
+	size_t iterations = DEFAULT_ITERATIONS;
+	if (argc > 1 && (iterations = strtoumax(argv[1], NULL, 10)) == 0) {
+		printf("usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	parse_func_t library_parse = NULL;
+	destroy_func_t library_destroy = NULL;
+	void *library = dlopen(LIBREQUEST, RTLD_NOW | RTLD_LOCAL);
+	if (library) {
+		*(void **)(&library_parse) = dlsym(library, "parse_request");
+		*(void **)(&library_destroy) = dlsym(library, "destroy_request");
+	}
+	if (!library_parse || !library_destroy)
+		printf("note: couldn't load %s, only measuring the in-tree parser\n\n", LIBREQUEST);
+
+	printf("%12s %12s %8s  %s\n", "in-tree", "librequest", "speedup", "statement");
+	for (const char **statement = statements; *statement; statement++) {
+		double in_tree = measure(parse_request, destroy_request, false, *statement, iterations);
+		if (!library_parse) {
+			printf("%9.1f ns %12s %8s  %.40s\n", in_tree, "-", "-", *statement);
+			continue;
+		}
+
+		double baseline = measure(library_parse, library_destroy, true, *statement, iterations);
+		printf("%9.1f ns %9.1f ns %7.2fx  %.40s\n", in_tree, baseline, baseline / in_tree, *statement);
+	}
+
+	if (library)
+		dlclose(library);
+	return 0;
+}
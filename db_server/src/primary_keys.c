@@ -0,0 +1,251 @@
+#include "primary_keys.h"
+#include "db_functions.h"
+
+#define PK_EMPTY INT64_MIN
+#define PK_REMOVED (INT64_MIN + 1) // keys are ints, neither marker can be one
+
+// sequential keys would fill neighbouring slots, the multiplication spreads them out
+static size_t slot_of(int64_t key, size_t capacity) {
+	return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+}
+
+// rehashes into a set large enough for twice the keys, which also drops removed slots
+static int grow_set(pk_table_t *table) {
+	size_t capacity = PK_SET_INITIAL;
+	while (capacity < 4 * (table->count + 1))
+		capacity *= 2;
+
+	int64_t *keys = malloc(capacity * sizeof(int64_t));
+	if (!keys)
+		return -1;
+	for (size_t i = 0; i < capacity; i++)
+		keys[i] = PK_EMPTY;
+
+	for (size_t i = 0; i < table->capacity; i++) {
+		if (table->keys[i] == PK_EMPTY || table->keys[i] == PK_REMOVED)
+			continue;
+		size_t slot = slot_of(table->keys[i], capacity);
+		while (keys[slot] != PK_EMPTY)
+			slot = (slot + 1) & (capacity - 1);
+		keys[slot] = table->keys[i];
+	}
+
+	free(table->keys);
+	table->keys = keys;
+	table->capacity = capacity;
+	table->used = table->count;
+	return 0;
+}
+
+// the slot holding key, or the empty slot that ends its probe
+static size_t find_slot(pk_table_t *table, int64_t key) {
+	size_t slot = slot_of(key, table->capacity);
+	while (table->keys[slot] != PK_EMPTY && table->keys[slot] != key)
+		slot = (slot + 1) & (table->capacity - 1);
+	return slot;
+}
+
+// adds key to the set unless it is already there, the caller holds table->lock
+static bool set_insert(pk_table_t *table, int64_t key) {
+	if (2 * (table->used + 1) > table->capacity && grow_set(table) < 0) {
+		log_to_file("Error: Couldn't grow the key set of '%s' in set_insert()\n", table->name);
+		return false;
+	}
+
+	size_t slot = find_slot(table, key);
+	if (table->keys[slot] == key)
+		return false;
+
+	// reuse the first removed slot of the probe, the key can't be further along
+	size_t free_slot = slot_of(key, table->capacity);
+	while (table->keys[free_slot] != PK_REMOVED && free_slot != slot)
+		free_slot = (free_slot + 1) & (table->capacity - 1);
+	if (free_slot == slot)
+		table->used++;
+	table->keys[free_slot] = key;
+	table->count++;
+	return true;
+}
+
+primary_keys_t *primary_keys_create() {
+	primary_keys_t *keys = calloc(1, sizeof(primary_keys_t));
+	if (!keys)
+		return NULL;
+	pthread_rwlock_init(&keys->lock, NULL);
+	return keys;
+}
+
+static void destroy_table(pk_table_t *table) {
+	pthread_mutex_destroy(&table->lock);
+	free(table->keys);
+	free(table->name);
+	free(table);
+}
+
+void primary_keys_destroy(primary_keys_t *keys) {
+	if (!keys) // sanity check
+		return;
+
+	for (size_t i = 0; i < PK_BUCKETS; i++) {
+		pk_table_t *table = keys->buckets[i];
+		while (table) {
+			pk_table_t *next = table->next;
+			destroy_table(table);
+			table = next;
+		}
+	}
+	pthread_rwlock_destroy(&keys->lock);
+	free(keys);
+}
+
+// reads every key of the table, the next key continues after the largest one
+static int load_table(pk_table_t *table, const char *name, int pk_offset, int row_size) {
+	FILE *data_file = table_open(name, row_size, NULL);
+	if (!data_file)
+		return -1;
+
+	char *row = malloc(row_size);
+	char digits[CHARS_PER_INT + 1] = {0};
+	if (!row) {
+		fclose(data_file);
+		return -1;
+	}
+
+	while (fread(row, sizeof(char), row_size, data_file) == (size_t)row_size) {
+		memcpy(digits, row + pk_offset, CHARS_PER_INT);
+		int key = (int)strtol(digits, NULL, 10);
+		if (!pk_claim(table, key))
+			log_to_file("Error: Table '%s' holds key %d more than once\n", table->name, key);
+	}
+
+	free(row);
+	fclose(data_file);
+	return 0;
+}
+
+static pk_table_t *find_table(primary_keys_t *keys, const char *name) {
+	pk_table_t *table = keys->buckets[string_hash(name, 0) % PK_BUCKETS];
+	while (table && strcmp(table->name, name) != 0)
+		table = table->next;
+	return table;
+}
+
+// the keys of table name, read from its data file the first time they are needed.
+// the caller holds the table's lock, which keeps primary_keys_forget away from it
+pk_table_t *primary_keys_table(primary_keys_t *keys, const char *name, int pk_offset, int row_size) {
+	pthread_rwlock_rdlock(&keys->lock);
+	pk_table_t *table = find_table(keys, name);
+	pthread_rwlock_unlock(&keys->lock);
+	if (table)
+		return table;
+
+	pthread_rwlock_wrlock(&keys->lock);
+	if ((table = find_table(keys, name))) { // loaded while we waited for the lock
+		pthread_rwlock_unlock(&keys->lock);
+		return table;
+	}
+
+	table = calloc(1, sizeof(pk_table_t));
+	if (!table || !(table->name = strdup(name))) {
+		pthread_rwlock_unlock(&keys->lock);
+		free(table);
+		return NULL;
+	}
+	pthread_mutex_init(&table->lock, NULL);
+	table->next_key = 1;
+	if (grow_set(table) < 0 || load_table(table, name, pk_offset, row_size) < 0) {
+		pthread_rwlock_unlock(&keys->lock);
+		log_to_file("Error: Couldn't load the keys of '%s' in primary_keys_table()\n", name);
+		destroy_table(table);
+		return NULL;
+	}
+
+	size_t bucket = string_hash(name, 0) % PK_BUCKETS;
+	table->next = keys->buckets[bucket];
+	keys->buckets[bucket] = table;
+	pthread_rwlock_unlock(&keys->lock);
+	return table;
+}
+
+// drops the keys of a table that no longer exists
+void primary_keys_forget(primary_keys_t *keys, const char *name) {
+	pthread_rwlock_wrlock(&keys->lock);
+	pk_table_t **link = &keys->buckets[string_hash(name, 0) % PK_BUCKETS];
+	while (*link && strcmp((*link)->name, name) != 0)
+		link = &(*link)->next;
+
+	pk_table_t *table = *link;
+	if (table)
+		*link = table->next;
+	pthread_rwlock_unlock(&keys->lock);
+
+	if (table)
+		destroy_table(table);
+}
+
+typedef struct load_state load_state_t;
+struct load_state {
+	primary_keys_t *keys;
+	arena_t *arena;
+	int result;
+};
+
+// catalog_each callback, registers the table if it has a primary key
+static void load_catalog_table(const char *name, const char *columns, void *arg) {
+	load_state_t *state = arg;
+	if (!*columns)
+		return;
+
+	is_primary_key is_pk = {0, 0, false};
+	populate_column(state->arena, arena_calloc(state->arena, sizeof(column_t)), columns, &is_pk);
+	if (is_pk.found && !primary_keys_table(state->keys, name, is_pk.size_to_pk, is_pk.total_row_size))
+		state->result = -1;
+	arena_reset(state->arena);
+}
+
+// loads every table of the catalog with a primary key, so the first INSERT doesn't pay for it
+int primary_keys_load(primary_keys_t *keys, catalog_t *catalog) {
+	load_state_t state = {keys, arena_create(START_LENGTH * 16), 0};
+	catalog_each(catalog, load_catalog_table, &state);
+	arena_destroy(state.arena);
+	return state.result;
+}
+
+// hands out the next key of the sequence, false once it has run past INT_MAX
+bool pk_next(pk_table_t *table, int *key) {
+	int64_t next;
+	do { // an explicit key may already have taken it
+		next = __atomic_fetch_add(&table->next_key, 1, __ATOMIC_RELAXED);
+		if (next > INT32_MAX)
+			return false;
+	} while (!pk_claim(table, (int)next));
+
+	*key = (int)next;
+	return true;
+}
+
+// adds an explicit key to the set, false if a row already has it
+bool pk_claim(pk_table_t *table, int key) {
+	pthread_mutex_lock(&table->lock);
+	bool claimed = set_insert(table, key);
+	pthread_mutex_unlock(&table->lock);
+	if (!claimed)
+		return false;
+
+	// the sequence has to stay ahead of every key in the table
+	int64_t next = __atomic_load_n(&table->next_key, __ATOMIC_RELAXED);
+	while (next <= key && !__atomic_compare_exchange_n(&table->next_key, &next, (int64_t)key + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	return true;
+}
+
+// gives back the key of a row that couldn't be written, the sequence doesn't reuse it
+void pk_release(pk_table_t *table, int key) {
+	pthread_mutex_lock(&table->lock);
+	size_t slot = find_slot(table, key);
+	if (table->keys[slot] == key) {
+		table->keys[slot] = PK_REMOVED;
+		table->count--;
+	}
+	pthread_mutex_unlock(&table->lock);
+}
@@ -0,0 +1,91 @@
+#include "protocol.h"
+
+void protocol_handshake(char *buffer) {
+	memcpy(buffer, HANDSHAKE_MAGIC, HANDSHAKE_SIZE - 1);
+	buffer[HANDSHAKE_SIZE - 1] = PROTOCOL_VERSION;
+}
+
+bool protocol_is_handshake(const char *data, size_t length) {
+	return length >= HANDSHAKE_SIZE && memcmp(data, HANDSHAKE_MAGIC, HANDSHAKE_SIZE - 1) == 0 &&
+		   data[HANDSHAKE_SIZE - 1] == PROTOCOL_VERSION;
+}
+
+size_t protocol_begin_frame(dynamicstr *out, char type) {
+	// the length is patched in by protocol_end_frame once the payload is known
+	size_t start = out->length;
+	protocol_append_u32(out, 0);
+	protocol_append_u8(out, (uint8_t)type);
+	return start;
+}
+
+void protocol_end_frame(dynamicstr *out, size_t start) {
+	uint32_t length = (uint32_t)(out->length - start - FRAME_HEADER_SIZE);
+	unsigned char *header = (unsigned char *)out->buffer + start;
+	header[0] = (unsigned char)(length >> 24);
+	header[1] = (unsigned char)(length >> 16);
+	header[2] = (unsigned char)(length >> 8);
+	header[3] = (unsigned char)length;
+}
+
+int protocol_append_frame(dynamicstr *out, char type, const char *payload, size_t length) {
+	if (string_reserve(out, FRAME_HEADER_SIZE + length) < 0)
+		return -1;
+
+	size_t start = protocol_begin_frame(out, type);
+	string_append(out, payload, length);
+	protocol_end_frame(out, start);
+	return 0;
+}
+
+int protocol_append_u8(dynamicstr *out, uint8_t value) {
+	return string_append_char(out, (char)value);
+}
+
+int protocol_append_u16(dynamicstr *out, uint16_t value) {
+	char bytes[2] = {(char)(value >> 8), (char)value};
+	return string_append(out, bytes, sizeof(bytes));
+}
+
+int protocol_append_u32(dynamicstr *out, uint32_t value) {
+	char bytes[4] = {(char)(value >> 24), (char)(value >> 16), (char)(value >> 8), (char)value};
+	return string_append(out, bytes, sizeof(bytes));
+}
+
+uint16_t protocol_read_u16(const char *data) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	return (uint16_t)(bytes[0] << 8 | bytes[1]);
+}
+
+uint32_t protocol_read_u32(const char *data) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+long protocol_frame_size(const char *data, size_t length) {
+	// returns the size of the complete frame at data, 0 if more bytes are needed
+	// and -1 if the frame is larger than we are willing to buffer
+	if (length < FRAME_HEADER_SIZE)
+		return 0;
+
+	uint32_t payload = protocol_read_u32(data);
+	if (payload > FRAME_MAX_SIZE)
+		return -1;
+	if (length < FRAME_HEADER_SIZE + (size_t)payload)
+		return 0;
+	return FRAME_HEADER_SIZE + (long)payload;
+}
+
+int protocol_send(int socket, const char *data, size_t length) {
+	// send() may write less than asked for on a stream socket
+	while (length > 0) {
+		ssize_t sent = send(socket, data, length, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += sent;
+		length -= sent;
+	}
+	return 0;
+}
@@ -5,7 +5,7 @@ queue_t* new_queue(size_t size)
 	queue_t* queue = (queue_t*)malloc(sizeof(queue_t));
 	queue->requests = (client_request**)malloc(size * sizeof(client_request*));
 	queue->max_size = size;
-	queue->size = queue->front = 0;
+	queue->size = queue->front = queue->high_water = 0;
 	queue->back = -1;
 
 	return queue;
@@ -28,6 +28,8 @@ bool enqueue(queue_t* queue, client_request* req)
 	queue->back = (queue->back + 1) % queue->max_size;
 	queue->requests[queue->back] = req;
 	queue->size++;
+	if (queue->size > queue->high_water)
+		queue->high_water = queue->size;
 
 	return true;
 }
@@ -0,0 +1,641 @@
+#include "replication.h"
+#include "db_functions.h"
+
+static uint32_t change_checksum(uint32_t type, const char *name, size_t name_length, const char *data, size_t length) {
+	uint32_t hash = 2166136261u ^ type; // FNV-1a
+	for (size_t i = 0; i < name_length; i++)
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	for (size_t i = 0; i < length; i++)
+		hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+	return hash;
+}
+
+// the clock changes are stamped with, it has to mean the same on the primary and on its replicas
+static uint64_t wall_clock_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_ms(long ms) {
+	struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+	nanosleep(&ts, NULL);
+}
+
+static int receive_all(int socket, void *buffer, size_t length) {
+	char *data = buffer;
+	while (length > 0) {
+		ssize_t received = recv(socket, data, length, 0);
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received <= 0) // the other side hung up
+			return -1;
+		data += received;
+		length -= received;
+	}
+	return 0;
+}
+
+static replication_t *replication_create(int role, size_t port) {
+	replication_t *replication = calloc(1, sizeof(replication_t));
+	if (!replication)
+		return NULL;
+
+	replication->role = role;
+	replication->port = port;
+	replication->log = replication->socket = replication->position_file = -1;
+	pthread_mutex_init(&replication->lock, NULL);
+	pthread_cond_init(&replication->appended, NULL);
+	return replication;
+}
+
+static void replication_free(replication_t *replication) {
+	if (replication->log >= 0)
+		close(replication->log);
+	if (replication->socket >= 0)
+		close(replication->socket);
+	if (replication->position_file >= 0)
+		close(replication->position_file);
+	pthread_mutex_destroy(&replication->lock);
+	pthread_cond_destroy(&replication->appended);
+	free(replication);
+}
+
+// the length of the part of the log that is intact, a record cut short by a crash ends it
+static uint64_t intact_length(int log, uint64_t begin, uint64_t size) {
+	uint64_t offset = begin;
+	char *data = NULL;
+	size_t capacity = 0;
+
+	while (offset + sizeof(change_record_t) <= size) {
+		change_record_t record;
+		if (pread(log, &record, sizeof(record), (off_t)offset) != sizeof(record))
+			break;
+		uint64_t length = record.name_length + record.length;
+		if (length > size - offset - sizeof(record))
+			break;
+		if (length > capacity) {
+			char *grown = realloc(data, length);
+			if (!grown)
+				break;
+			data = grown;
+			capacity = length;
+		}
+		if (pread(log, data, length, (off_t)(offset + sizeof(record))) != (ssize_t)length ||
+			record.checksum != change_checksum(record.type, data, record.name_length, data + record.name_length, record.length))
+			break;
+		offset += sizeof(record) + length;
+	}
+	free(data);
+	return offset;
+}
+
+// opens the replication log, starting a new one if there is none. Records are written at the end it keeps, not with O_APPEND, so the header can be rewritten
+static int open_log(replication_t *replication) {
+	int log = open(REPLICATION_LOG, O_RDWR | O_CREAT, 0644);
+	struct stat info;
+	if (log < 0 || fstat(log, &info) < 0) {
+		log_to_file("Error: Couldn't open() '%s' in open_log()\n", REPLICATION_LOG);
+		if (log >= 0)
+			close(log);
+		return -1;
+	}
+	replication->log = log;
+
+	change_log_header_t header;
+	if (info.st_size == 0) {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, REPLICATION_MAGIC, sizeof(header.magic));
+		header.format = REPLICATION_FORMAT;
+		header.id = wall_clock_ns() ^ ((uint64_t)getpid() << 32); // tells this log apart from one started later
+		header.begin = sizeof(header);
+		if (pwrite(log, &header, sizeof(header), 0) != sizeof(header)) {
+			log_to_file("Error: Couldn't write the header of '%s' in open_log()\n", REPLICATION_LOG);
+			return -1;
+		}
+		replication->id = header.id;
+		replication->begin = replication->end = sizeof(header);
+		return 0;
+	}
+
+	if (pread(log, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, REPLICATION_MAGIC, sizeof(header.magic)) != 0 ||
+		header.format != REPLICATION_FORMAT || header.begin < sizeof(header) || header.begin > (uint64_t)info.st_size) {
+		log_to_file("Error: '%s' isn't a replication log of this version in open_log()\n", REPLICATION_LOG);
+		return -1;
+	}
+	replication->id = header.id;
+	replication->begin = header.begin;
+	replication->end = intact_length(log, header.begin, (uint64_t)info.st_size);
+	if (replication->end < (uint64_t)info.st_size) { // later records would be hidden behind the damaged one
+		log_to_file("Error: Dropped %ld damaged bytes at the end of '%s' in open_log()\n", (long)(info.st_size - replication->end),
+					REPLICATION_LOG);
+		if (ftruncate(log, (off_t)replication->end) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Keeps a replication log in the database and listens for replicas on port of localhost. The
+ * log holds every change made from now on, a replica of a database that already has tables
+ * starts from a copy of it. Returns NULL if the log or the port can't be opened.
+ */
+replication_t *replication_primary(size_t port) {
+	replication_t *replication = replication_create(REPLICATION_PRIMARY, port);
+	if (!replication)
+		return NULL;
+	if (open_log(replication) < 0) {
+		replication_free(replication);
+		return NULL;
+	}
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = inet_addr(IP_ADDR);
+	replication->socket = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (replication->socket < 0 || setsockopt(replication->socket, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) < 0 ||
+		bind(replication->socket, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(replication->socket, REPLICATION_MAX_REPLICAS) < 0) {
+		log_to_file("Error: Couldn't listen for replicas on port %zu in replication_primary()\n", port);
+		replication_free(replication);
+		return NULL;
+	}
+	return replication;
+}
+
+/*
+ * Makes the server a read-only replica of the primary that ships its changes on port of
+ * localhost. The replica keeps how far it got in its own database and carries on from there.
+ */
+replication_t *replication_replica(size_t port) {
+	replication_t *replication = replication_create(REPLICATION_REPLICA, port);
+	if (!replication)
+		return NULL;
+
+	uint64_t saved[2] = {0, 0}; // the id of the primary's log and the position in it
+	replication->position_file = open(REPLICATION_POSITION, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (replication->position_file < 0) {
+		log_to_file("Error: Couldn't open() '%s' in replication_replica()\n", REPLICATION_POSITION);
+		replication_free(replication);
+		return NULL;
+	}
+	if (pread(replication->position_file, saved, sizeof(saved), 0) == sizeof(saved)) {
+		replication->id = saved[0];
+		replication->applied = saved[1];
+	}
+	return replication;
+}
+
+// a replica that has applied nothing starts with the first record
+static uint64_t first_record(uint64_t position) {
+	return position < sizeof(change_log_header_t) ? sizeof(change_log_header_t) : position;
+}
+
+static void save_position(replication_t *replication) {
+	pthread_mutex_lock(&replication->lock);
+	uint64_t saved[2] = {replication->id, replication->applied};
+	pthread_mutex_unlock(&replication->lock);
+
+	// not synced, a change applied twice after a crash leaves the same table behind
+	if (pwrite(replication->position_file, saved, sizeof(saved), 0) != sizeof(saved))
+		log_to_file("Error: Couldn't write '%s' in save_position()\n", REPLICATION_POSITION);
+}
+
+// appends a change to the replication log as a single write, so a reader never sees part of it
+static int log_change(replication_t *replication, uint32_t type, const char *name, int row_size, long first_row, const char *data,
+					  size_t length) {
+	if (!replication || replication->role != REPLICATION_PRIMARY)
+		return 0;
+
+	change_record_t record;
+	memset(&record, 0, sizeof(record));
+	record.type = type;
+	record.name_length = name ? (uint32_t)strlen(name) : 0;
+	record.row_size = (uint32_t)row_size;
+	record.first_row = (uint64_t)first_row;
+	record.length = length;
+	record.checksum = change_checksum(type, name, record.name_length, data, length);
+	struct iovec parts[3] = {{&record, sizeof(record)}, {(void *)name, record.name_length}, {(void *)data, length}};
+	size_t size = sizeof(record) + record.name_length + length;
+
+	pthread_mutex_lock(&replication->lock);
+	record.timestamp = wall_clock_ns(); // under the lock, so the timestamps only grow along the log
+	ssize_t written = pwritev(replication->log, parts, 3, (off_t)replication->end);
+	if (written != (ssize_t)size) {
+		if (written > 0 && ftruncate(replication->log, (off_t)replication->end) < 0) // a replica must never read part of a record
+			log_to_file("Error: Couldn't ftruncate() '%s' in log_change()\n", REPLICATION_LOG);
+		pthread_mutex_unlock(&replication->lock);
+		log_to_file("Error: Couldn't append to '%s' in log_change()\n", REPLICATION_LOG);
+		return -1;
+	}
+	replication->end += size;
+	pthread_cond_broadcast(&replication->appended);
+	pthread_mutex_unlock(&replication->lock);
+	return 0;
+}
+
+// a CREATE TABLE, DROP TABLE or CREATE INDEX that succeeded, logged before its locks are released
+int replication_log_statement(replication_t *replication, const char *statement) {
+	return log_change(replication, CHANGE_STATEMENT, NULL, 0, 0, statement, statement ? strlen(statement) : 0);
+}
+
+// rows that were appended to table starting at first_row, logged by the INSERT that wrote them
+int replication_log_rows(replication_t *replication, const char *table, int row_size, const char *rows, size_t length, long first_row) {
+	return log_change(replication, CHANGE_ROWS, table, row_size, first_row, rows, length);
+}
+
+bool replication_read_only(replication_t *replication) {
+	return replication && replication->role == REPLICATION_REPLICA;
+}
+
+typedef struct sender sender_t;
+struct sender {
+	replication_t *replication;
+	size_t slot;
+	int socket;
+	uint64_t confirmation; // the position the replica is sending, received bytes of it so far
+	size_t received;
+};
+
+/*
+ * Frees the log before the lowest position the connected replicas confirmed, once that is
+ * REPLICATION_TRIM past begin. The header is moved on before the bytes are punched out, so a
+ * crash in between leaves a log whose begin is right.
+ */
+static void trim_log(replication_t *replication) {
+	pthread_mutex_lock(&replication->lock);
+	uint64_t begin = replication->begin, target = replication->end;
+	bool connected = false;
+	for (size_t i = 0; i < REPLICATION_MAX_REPLICAS; i++) {
+		if (replication->connected[i] && replication->confirmed[i] < target)
+			target = replication->confirmed[i];
+		connected = connected || replication->connected[i];
+	}
+	if (!connected || replication->trimming || target < begin + REPLICATION_TRIM) {
+		pthread_mutex_unlock(&replication->lock);
+		return;
+	}
+	replication->begin = target; // replicas asking for less are turned away from now on
+	replication->trimming = true;
+	pthread_mutex_unlock(&replication->lock);
+
+	change_log_header_t header;
+	bool failed = pread(replication->log, &header, sizeof(header), 0) != sizeof(header);
+	header.begin = target;
+	failed = failed || pwrite(replication->log, &header, sizeof(header), 0) != sizeof(header) || fdatasync(replication->log) < 0;
+	if (failed)
+		log_to_file("Error: Couldn't move the beginning of '%s' in trim_log()\n", REPLICATION_LOG);
+
+	// the first page holds the header, the pages before the one target is in only hold records every replica has
+	off_t from = (off_t)(begin / REPLICATION_PAGE * REPLICATION_PAGE), to = (off_t)(target / REPLICATION_PAGE * REPLICATION_PAGE);
+	if (from < REPLICATION_PAGE)
+		from = REPLICATION_PAGE;
+	if (!failed && to > from && fallocate(replication->log, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, from, to - from) < 0)
+		log_to_file("Error: Couldn't free the start of '%s' in trim_log(), it keeps taking up disk\n", REPLICATION_LOG);
+
+	pthread_mutex_lock(&replication->lock);
+	if (failed)
+		replication->begin = begin;
+	replication->trimming = false;
+	pthread_mutex_unlock(&replication->lock);
+}
+
+// takes the positions the replica confirmed since the last call without waiting for more, returns -1 if it hung up
+static int receive_confirmations(sender_t *sender) {
+	replication_t *replication = sender->replication;
+	while (true) {
+		char *into = (char *)&sender->confirmation + sender->received;
+		ssize_t received = recv(sender->socket, into, sizeof(sender->confirmation) - sender->received, MSG_DONTWAIT);
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (received <= 0)
+			return -1;
+		sender->received += received;
+		if (sender->received < sizeof(sender->confirmation))
+			continue;
+
+		sender->received = 0;
+		pthread_mutex_lock(&replication->lock); // it can't have applied what it wasn't sent
+		if (sender->confirmation > replication->confirmed[sender->slot] && sender->confirmation <= replication->positions[sender->slot])
+			replication->confirmed[sender->slot] = sender->confirmation;
+		pthread_mutex_unlock(&replication->lock);
+	}
+}
+
+// streams the log to one replica from the position it asks for, with a heartbeat whenever there is nothing to send
+static void *send_changes(void *arg) {
+	sender_t *sender = arg;
+	replication_t *replication = sender->replication;
+	char *chunk = malloc(REPLICATION_CHUNK);
+
+	replication_hello_t hello;
+	memcpy(hello.magic, REPLICATION_MAGIC, sizeof(hello.magic));
+	hello.id = replication->id;
+	pthread_mutex_lock(&replication->lock);
+	hello.begin = replication->begin;
+	hello.end = replication->end;
+	pthread_mutex_unlock(&replication->lock);
+
+	uint64_t position = 0;
+	bool failed = !chunk || protocol_send(sender->socket, (const char *)&hello, sizeof(hello)) < 0 ||
+				  receive_all(sender->socket, &position, sizeof(position)) < 0;
+	if (!failed && (position < hello.begin || position > hello.end)) {
+		log_to_file("Error: A replica asked for position %" PRIu64 " of a log that is kept from %" PRIu64 " to %" PRIu64
+					" in send_changes()\n",
+					position, hello.begin, hello.end);
+		failed = true;
+	}
+	if (!failed) { // the log before it stays until the replica confirms more, it was kept since the replica connected
+		pthread_mutex_lock(&replication->lock);
+		replication->confirmed[sender->slot] = position;
+		pthread_mutex_unlock(&replication->lock);
+	}
+
+	while (!failed) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += REPLICATION_HEARTBEAT_MS / 1000;
+		deadline.tv_nsec += (REPLICATION_HEARTBEAT_MS % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		pthread_mutex_lock(&replication->lock);
+		replication->positions[sender->slot] = position;
+		while (replication->end == position && pthread_cond_timedwait(&replication->appended, &replication->lock, &deadline) == 0)
+			;
+		uint64_t end = replication->end;
+		pthread_mutex_unlock(&replication->lock);
+
+		replication_frame_t frame = {end, end - position < REPLICATION_CHUNK ? end - position : REPLICATION_CHUNK};
+		if (frame.length && pread(replication->log, chunk, frame.length, (off_t)position) != (ssize_t)frame.length) {
+			log_to_file("Error: Couldn't pread() '%s' in send_changes()\n", REPLICATION_LOG);
+			break;
+		}
+		failed = protocol_send(sender->socket, (const char *)&frame, sizeof(frame)) < 0 ||
+				 protocol_send(sender->socket, chunk, frame.length) < 0 || // the replica hung up
+				 receive_confirmations(sender) < 0;
+		position += frame.length;
+		if (!failed)
+			trim_log(replication);
+	}
+
+	pthread_mutex_lock(&replication->lock);
+	replication->connected[sender->slot] = false;
+	pthread_mutex_unlock(&replication->lock);
+	log_to_file("Replica on slot %zu disconnected\n", sender->slot);
+	close(sender->socket);
+	free(chunk);
+	free(sender);
+	return NULL;
+}
+
+static void *accept_replicas(void *arg) {
+	replication_t *replication = arg;
+
+	while (true) {
+		int socket = accept4(replication->socket, NULL, NULL, SOCK_CLOEXEC);
+		if (socket < 0) {
+			if (errno != EINTR) {
+				log_to_file("Error: Couldn't accept() a replica in accept_replicas()\n");
+				sleep_ms(REPLICATION_RETRY_MS); // out of descriptors, say
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&replication->lock);
+		size_t slot;
+		for (slot = 0; slot < REPLICATION_MAX_REPLICAS && replication->connected[slot]; slot++)
+			;
+		if (slot < REPLICATION_MAX_REPLICAS) { // nothing is trimmed until it said where it starts
+			replication->connected[slot] = true;
+			replication->positions[slot] = 0;
+			replication->confirmed[slot] = replication->begin;
+		}
+		pthread_mutex_unlock(&replication->lock);
+
+		sender_t *sender = slot < REPLICATION_MAX_REPLICAS ? malloc(sizeof(sender_t)) : NULL;
+		pthread_t thread;
+		if (!sender) {
+			log_to_file("Error: Couldn't take another replica in accept_replicas()\n");
+		} else {
+			*sender = (sender_t){replication, slot, socket};
+			if (pthread_create(&thread, NULL, send_changes, sender) == 0) {
+				pthread_detach(thread);
+				log_to_file("Replica connected on slot %zu\n", slot);
+				continue;
+			}
+			log_to_file("Error: Couldn't pthread_create() in accept_replicas()\n");
+			free(sender);
+		}
+		pthread_mutex_lock(&replication->lock);
+		if (slot < REPLICATION_MAX_REPLICAS)
+			replication->connected[slot] = false;
+		pthread_mutex_unlock(&replication->lock);
+		close(socket);
+	}
+	return NULL;
+}
+
+/*
+ * Applies the whole records at the start of data and returns their length, or -1 if one of
+ * them is damaged. A change that fails on the replica is logged and skipped, after a restart
+ * the changes it had already applied are replayed and fail that way.
+ */
+static long apply_changes(replication_t *replication, arena_t *arena, const char *data, size_t size) {
+	size_t offset = 0;
+
+	while (offset + sizeof(change_record_t) <= size) {
+		change_record_t record;
+		memcpy(&record, data + offset, sizeof(record));
+		const char *name = data + offset + sizeof(record);
+		uint64_t length = record.name_length + record.length;
+		if (length > size - offset - sizeof(record)) // the rest of it is still on its way
+			break;
+		if (record.checksum != change_checksum(record.type, name, record.name_length, name + record.name_length, record.length)) {
+			log_to_file("Error: Damaged change at position %" PRIu64 " in apply_changes()\n", replication->applied + offset);
+			return -1;
+		}
+
+		const char *change = name + record.name_length;
+		int result;
+		if (record.type == CHANGE_STATEMENT) {
+			result = apply_statement(replication->server, arena, arena_strndup(arena, change, record.length));
+		} else {
+			result = apply_rows(replication->server, arena, arena_strndup(arena, name, record.name_length), (int)record.row_size, change,
+								record.length, (long)record.first_row);
+		}
+		if (result < 0)
+			log_to_file("Error: Skipped the change at position %" PRIu64 " in apply_changes()\n", replication->applied + offset);
+		arena_reset(arena);
+
+		offset += sizeof(record) + length;
+		pthread_mutex_lock(&replication->lock);
+		replication->applied += sizeof(record) + length;
+		replication->applied_at = record.timestamp;
+		pthread_mutex_unlock(&replication->lock);
+	}
+	return (long)offset;
+}
+
+// applies what the primary sends on socket until the connection breaks
+static void follow(replication_t *replication, int socket, arena_t *arena, dynamicstr *pending) {
+	replication_hello_t hello;
+	if (receive_all(socket, &hello, sizeof(hello)) < 0 || memcmp(hello.magic, REPLICATION_MAGIC, sizeof(hello.magic)) != 0) {
+		log_to_file("Error: Port %zu doesn't ship a replication log in follow()\n", replication->port);
+		return;
+	}
+
+	pthread_mutex_lock(&replication->lock);
+	if (hello.id != replication->id) { // positions in another log mean nothing here, replaying from the start is safe
+		if (replication->id)
+			log_to_file("The primary started a new replication log, applying it from the start\n");
+		replication->id = hello.id;
+		replication->applied = 0;
+	}
+	replication->applied = first_record(replication->applied);
+	replication->primary_end = hello.end;
+	replication->heard_ns = stats_now_ns();
+	uint64_t position = replication->applied;
+	pthread_mutex_unlock(&replication->lock);
+	if (position < hello.begin) {
+		log_to_file("Error: The primary freed its log before position %" PRIu64 " in follow(), this replica has to start again from a copy "
+					"of the primary's database\n",
+					hello.begin);
+		return;
+	}
+	pthread_mutex_lock(&replication->lock);
+	replication->following = true;
+	pthread_mutex_unlock(&replication->lock);
+	save_position(replication);
+	if (protocol_send(socket, (const char *)&position, sizeof(position)) < 0)
+		return;
+	log_to_file("Following the primary on port %zu from position %" PRIu64 "\n", replication->port, position);
+
+	replication_frame_t frame;
+	while (receive_all(socket, &frame, sizeof(frame)) == 0) {
+		if (frame.length > REPLICATION_CHUNK || string_reserve(pending, frame.length) < 0 ||
+			receive_all(socket, pending->buffer + pending->length, frame.length) < 0)
+			break;
+		pending->length += frame.length;
+
+		pthread_mutex_lock(&replication->lock);
+		replication->primary_end = frame.end;
+		replication->heard_ns = stats_now_ns();
+		pthread_mutex_unlock(&replication->lock);
+
+		long applied = apply_changes(replication, arena, pending->buffer, pending->length);
+		if (applied < 0)
+			break;
+		if (applied == 0)
+			continue;
+		memmove(pending->buffer, pending->buffer + applied, pending->length - applied); // part of a record may be left
+		pending->length -= applied;
+		save_position(replication);
+
+		// lets the primary free the log before it
+		pthread_mutex_lock(&replication->lock);
+		position = replication->applied;
+		pthread_mutex_unlock(&replication->lock);
+		if (protocol_send(socket, (const char *)&position, sizeof(position)) < 0)
+			break;
+	}
+}
+
+static int connect_primary(size_t port) {
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = inet_addr(IP_ADDR);
+
+	int socket_fd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (socket_fd >= 0 && connect(socket_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		close(socket_fd);
+		return -1;
+	}
+	return socket_fd;
+}
+
+static void *follow_primary(void *arg) {
+	replication_t *replication = arg;
+	arena_t *arena = arena_create(SCRATCH_ARENA_SIZE);
+	dynamicstr pending;
+	string_init(&pending, NULL, 0);
+	bool reported = false; // a primary that isn't up yet is logged once
+
+	while (true) {
+		int socket = connect_primary(replication->port);
+		if (socket < 0) {
+			if (!reported)
+				log_to_file("Error: Couldn't connect() to the primary on port %zu in follow_primary(), retrying\n", replication->port);
+			reported = true;
+			sleep_ms(REPLICATION_RETRY_MS);
+			continue;
+		}
+		reported = false;
+
+		follow(replication, socket, arena, &pending);
+		close(socket);
+		string_clear(&pending);
+		pthread_mutex_lock(&replication->lock);
+		replication->following = false;
+		pthread_mutex_unlock(&replication->lock);
+		log_to_file("Lost the primary on port %zu, reconnecting\n", replication->port);
+		sleep_ms(REPLICATION_RETRY_MS);
+	}
+	return NULL;
+}
+
+// starts accepting replicas or following the primary, the threads run as long as the server
+void replication_start(replication_t *replication, struct server *server) {
+	if (!replication)
+		return;
+
+	replication->server = server;
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, replication->role == REPLICATION_PRIMARY ? accept_replicas : follow_primary, replication) != 0) {
+		log_to_file("Error: Couldn't pthread_create() in replication_start()\n");
+		return;
+	}
+	pthread_detach(thread);
+}
+
+// the role of the server and how far behind its replicas are, or it is, for .replication
+void replication_report(replication_t *replication, dynamicstr *out) {
+	if (!replication) {
+		string_set(out, "replication: off\n");
+		return;
+	}
+
+	pthread_mutex_lock(&replication->lock);
+	if (replication->role == REPLICATION_PRIMARY) {
+		size_t connected = 0;
+		for (size_t i = 0; i < REPLICATION_MAX_REPLICAS; i++)
+			connected += replication->connected[i];
+		string_set(out, "role: primary, shipping changes on port %zu\n", replication->port);
+		string_set(out, "log: %" PRIu64 " bytes, %" PRIu64 " kept, %zu replicas connected\n", replication->end,
+				   replication->end - replication->begin, connected);
+		for (size_t i = 0; i < REPLICATION_MAX_REPLICAS; i++)
+			if (replication->connected[i])
+				string_set(out, "replica %zu: %" PRIu64 " bytes behind\n", i, replication->end - first_record(replication->positions[i]));
+	} else {
+		uint64_t behind = replication->primary_end > replication->applied ? replication->primary_end - replication->applied : 0;
+		string_set(out, "role: replica of the primary on port %zu, %s\n", replication->port,
+				   replication->following ? "connected" : "disconnected");
+		string_set(out, "applied: %" PRIu64 " of %" PRIu64 " bytes, %" PRIu64 " bytes behind\n", first_record(replication->applied),
+				   first_record(replication->primary_end), behind);
+		// how old the last change applied is while there are more to apply
+		uint64_t now = wall_clock_ns();
+		double lag_ms = behind && replication->applied_at && now > replication->applied_at ? (now - replication->applied_at) / 1e6 : 0;
+		string_set(out, "lag: %.3f ms", lag_ms);
+		if (replication->heard_ns)
+			string_set(out, ", primary last heard %.3f s ago", (stats_now_ns() - replication->heard_ns) / 1e9);
+		string_set(out, "\n");
+	}
+	pthread_mutex_unlock(&replication->lock);
+}
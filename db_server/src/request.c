@@ -0,0 +1,806 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "request.h"
+
+#define T_END 0
+#define T_ERROR 1
+#define T_NAME 2
+#define T_NUMBER 3
+#define T_STRING 4
+#define T_STAR 5
+#define T_COMMA 6
+#define T_LPAREN 7
+#define T_RPAREN 8
+#define T_SEMICOLON 9
+#define T_EQUALS 10
+#define T_TABLES 11
+#define T_SCHEMA 12
+#define T_QUIT 13
+#define T_CREATE 14
+#define T_TABLE 15
+#define T_DROP 16
+#define T_INSERT 17
+#define T_INTO 18
+#define T_VALUES 19
+#define T_SELECT 20
+#define T_FROM 21
+#define T_DELETE 22
+#define T_WHERE 23
+#define T_UPDATE 24
+#define T_SET 25
+#define T_INT 26
+#define T_VARCHAR 27
+#define T_PRIMARY_KEY 28
+#define T_STATS 29
+#define T_INDEX 30
+#define T_ON 31
+#define T_USING 32
+#define T_HASH 33
+#define T_GROUP 34
+#define T_BY 35
+#define T_ORDER 36
+#define T_ASC 37
+#define T_DESC 38
+#define T_LIMIT 39
+#define T_OFFSET 40
+#define T_JOIN 41
+#define T_QUALIFIED 42
+#define T_REPLICATION 43
+#define T_ENGINE 44
+#define T_MEMORY 45
+#define T_COUNT 46
+
+typedef struct keyword keyword_t;
+struct keyword {
+	const char *text;
+	size_t length;
+	int token;
+};
+
+static const keyword_t keywords[] = {
+	{"CREATE", 6, T_CREATE},
+	{"TABLE", 5, T_TABLE},
+	{"DROP", 4, T_DROP},
+	{"INSERT", 6, T_INSERT},
+	{"INTO", 4, T_INTO},
+	{"VALUES", 6, T_VALUES},
+	{"SELECT", 6, T_SELECT},
+	{"FROM", 4, T_FROM},
+	{"DELETE", 6, T_DELETE},
+	{"WHERE", 5, T_WHERE},
+	{"UPDATE", 6, T_UPDATE},
+	{"SET", 3, T_SET},
+	{"INT", 3, T_INT},
+	{"VARCHAR", 7, T_VARCHAR},
+	{"INDEX", 5, T_INDEX},
+	{"ON", 2, T_ON},
+	{"USING", 5, T_USING},
+	{"HASH", 4, T_HASH},
+	{"GROUP", 5, T_GROUP},
+	{"BY", 2, T_BY},
+	{"ORDER", 5, T_ORDER},
+	{"ASC", 3, T_ASC},
+	{"DESC", 4, T_DESC},
+	{"LIMIT", 5, T_LIMIT},
+	{"OFFSET", 6, T_OFFSET},
+	{"JOIN", 4, T_JOIN},
+	{"ENGINE", 6, T_ENGINE},
+	{"MEMORY", 6, T_MEMORY},
+	{NULL, 0, T_END},
+};
+
+// static messages so that reporting an error never allocates, indexed by the expected token
+static const char *expected[T_COUNT] = {
+	[T_END] = "syntax error, expecting end of statement\n",
+	[T_NAME] = "syntax error, expecting a name\n",
+	[T_NUMBER] = "syntax error, expecting a number\n",
+	[T_STAR] = "syntax error, expecting * or a column name\n",
+	[T_COMMA] = "syntax error, expecting ','\n",
+	[T_LPAREN] = "syntax error, expecting (\n",
+	[T_RPAREN] = "syntax error, expecting ) or ','\n",
+	[T_SEMICOLON] = "syntax error, expecting ;\n",
+	[T_EQUALS] = "syntax error, expecting =\n",
+	[T_TABLE] = "syntax error, expecting TABLE\n",
+	[T_INTO] = "syntax error, expecting INTO\n",
+	[T_VALUES] = "syntax error, expecting VALUES\n",
+	[T_FROM] = "syntax error, expecting FROM\n",
+	[T_WHERE] = "syntax error, expecting WHERE\n",
+	[T_SET] = "syntax error, expecting SET\n",
+	[T_INT] = "syntax error, expecting INT or VARCHAR\n",
+	[T_ON] = "syntax error, expecting ON\n",
+	[T_HASH] = "syntax error, expecting HASH\n",
+	[T_BY] = "syntax error, expecting BY\n",
+	[T_QUALIFIED] = "syntax error, expecting table.column\n",
+	[T_MEMORY] = "syntax error, expecting MEMORY\n",
+};
+
+typedef struct parser parser_t;
+struct parser {
+	char *cursor;	// next unread character in the request string
+	char saved;		// character overwritten by the terminator of the previous token
+	bool has_saved; // whether *cursor has been overwritten and saved holds the real character
+
+	int token;
+	char *start; // current token, points into the request string
+	size_t length;
+	int number;
+
+	arena_t *arena;
+	const char *error;
+};
+
+static char peek(parser_t *parser) {
+	return parser->has_saved ? parser->saved : *parser->cursor;
+}
+
+static void advance(parser_t *parser) {
+	parser->cursor++;
+	parser->has_saved = false;
+}
+
+static bool is_name_char(char ch) {
+	return isalnum((unsigned char)ch) || ch == '_';
+}
+
+static void next(parser_t *parser) {
+	char ch;
+
+	while (isspace((unsigned char)(ch = peek(parser))))
+		advance(parser);
+
+	parser->start = parser->cursor;
+	parser->length = 0;
+
+	if (ch == '\0') {
+		parser->token = T_END;
+		return;
+	}
+
+	if (isalpha((unsigned char)ch) || ch == '_') {
+		while (is_name_char(peek(parser)))
+			advance(parser);
+		// table.column, as JOIN ... ON compares them
+		if (peek(parser) == '.' && (isalpha((unsigned char)parser->cursor[1]) || parser->cursor[1] == '_')) {
+			advance(parser);
+			while (is_name_char(peek(parser)))
+				advance(parser);
+			parser->length = parser->cursor - parser->start;
+			parser->token = T_QUALIFIED;
+			return;
+		}
+		parser->length = parser->cursor - parser->start;
+		parser->token = T_NAME;
+
+		for (const keyword_t *keyword = keywords; keyword->text; keyword++)
+			if (keyword->length == parser->length && strncmp(keyword->text, parser->start, parser->length) == 0) {
+				parser->token = keyword->token;
+				return;
+			}
+
+		// PRIMARY KEY is a single token with any whitespace in between
+		if (parser->length == 7 && strncmp(parser->start, "PRIMARY", 7) == 0) {
+			char *key = parser->cursor;
+			while (isspace((unsigned char)*key))
+				key++;
+			if (key != parser->cursor && strncmp(key, "KEY", 3) == 0 && !is_name_char(key[3])) {
+				parser->cursor = key + 3;
+				parser->token = T_PRIMARY_KEY;
+			}
+		}
+		return;
+	}
+
+	if (isdigit((unsigned char)ch) || (ch == '-' && isdigit((unsigned char)parser->cursor[1]))) {
+		bool negative = ch == '-';
+		unsigned int value = 0; // wraps around like the integer conversion it replaces
+
+		if (negative)
+			advance(parser);
+		while (isdigit((unsigned char)(ch = peek(parser)))) {
+			value = value * 10 + (unsigned int)(ch - '0');
+			advance(parser);
+		}
+		parser->length = parser->cursor - parser->start;
+		parser->number = (int)(negative ? 0u - value : value);
+		parser->token = T_NUMBER;
+		return;
+	}
+
+	if (ch == '\'') { // the token keeps its quotes, the same as char_val always has
+		advance(parser);
+		while ((ch = peek(parser)) != '\'') {
+			if (ch == '\0' || ch == '\n') {
+				parser->token = T_ERROR;
+				parser->error = "syntax error, unterminated string\n";
+				return;
+			}
+			advance(parser);
+		}
+		advance(parser);
+		parser->length = parser->cursor - parser->start;
+		parser->token = T_STRING;
+		return;
+	}
+
+	if (ch == '.') {
+		advance(parser);
+		char *name = parser->cursor;
+		while (is_name_char(peek(parser)))
+			advance(parser);
+		size_t length = parser->cursor - name;
+		parser->length = parser->cursor - parser->start;
+
+		if (length == 6 && strncmp(name, "tables", 6) == 0)
+			parser->token = T_TABLES;
+		else if (length == 6 && strncmp(name, "schema", 6) == 0)
+			parser->token = T_SCHEMA;
+		else if (length == 4 && strncmp(name, "quit", 4) == 0)
+			parser->token = T_QUIT;
+		else if (length == 5 && strncmp(name, "stats", 5) == 0)
+			parser->token = T_STATS;
+		else if (length == 11 && strncmp(name, "replication", 11) == 0)
+			parser->token = T_REPLICATION;
+		else {
+			parser->token = T_ERROR;
+			parser->error = "syntax error, unknown meta command\n";
+		}
+		return;
+	}
+
+	advance(parser);
+	parser->length = 1;
+	switch (ch) {
+	case '*':
+		parser->token = T_STAR;
+		break;
+	case ',':
+		parser->token = T_COMMA;
+		break;
+	case '(':
+		parser->token = T_LPAREN;
+		break;
+	case ')':
+		parser->token = T_RPAREN;
+		break;
+	case ';':
+		parser->token = T_SEMICOLON;
+		break;
+	case '=':
+		parser->token = T_EQUALS;
+		break;
+	default:
+		parser->token = T_ERROR;
+		parser->error = "syntax error, unexpected character\n";
+	}
+}
+
+/*
+ * Terminates the current token in place and returns it. The character
+ * that is overwritten by the terminator is kept in the parser so the
+ * next token can still be read.
+ */
+static char *text(parser_t *parser) {
+	char *end = parser->start + parser->length;
+
+	parser->saved = *end;
+	parser->has_saved = true;
+	*end = '\0';
+
+	return parser->start;
+}
+
+static bool expect(parser_t *parser, int token) {
+	if (parser->token != token) {
+		if (parser->token != T_ERROR) // keep the lexer's more specific message
+			parser->error = expected[token];
+		return false;
+	}
+	next(parser);
+	return true;
+}
+
+static bool name(parser_t *parser, char **target) {
+	if (parser->token != T_NAME)
+		return expect(parser, T_NAME);
+	*target = text(parser);
+	next(parser);
+	return true;
+}
+
+// table.column, split at the dot
+static bool qualified_name(parser_t *parser, char **table, char **column) {
+	if (parser->token != T_QUALIFIED)
+		return expect(parser, T_QUALIFIED);
+	*table = text(parser);
+	*column = strchr(*table, '.');
+	*(*column)++ = '\0';
+	next(parser);
+	return true;
+}
+
+static column_t *new_column(parser_t *parser, column_t ***link) {
+	column_t *column = arena_calloc(parser->arena, sizeof(column_t));
+
+	column->data_type = -1;
+	column->char_size = -1;
+
+	**link = column;
+	*link = &column->next;
+	return column;
+}
+
+static bool value(parser_t *parser, column_t *column) {
+	if (parser->token == T_NUMBER) {
+		column->data_type = DT_INT;
+		column->int_val = parser->number;
+	} else if (parser->token == T_STRING) {
+		column->data_type = DT_VARCHAR;
+		column->char_val = text(parser);
+	} else {
+		parser->error = parser->token == T_ERROR ? parser->error : "syntax error, expecting a string or a number\n";
+		return false;
+	}
+	next(parser);
+	return true;
+}
+
+static bool end_of_statement(parser_t *parser) {
+	return expect(parser, T_SEMICOLON) && expect(parser, T_END);
+}
+
+// WHERE name = value
+static bool where(parser_t *parser, request_t *request) {
+	column_t **link = &request->where;
+	column_t *column = new_column(parser, &link);
+
+	if (!expect(parser, T_WHERE) || !name(parser, &column->name) || !expect(parser, T_EQUALS))
+		return false;
+	return value(parser, column);
+}
+
+// CREATE INDEX name ON name (name) [USING HASH];
+static bool parse_create_index(parser_t *parser, request_t *request) {
+	column_t **link = &request->columns;
+
+	if (!name(parser, &request->index_name) || !expect(parser, T_ON) || !name(parser, &request->table_name) ||
+		!expect(parser, T_LPAREN) || !name(parser, &new_column(parser, &link)->name) || !expect(parser, T_RPAREN))
+		return false;
+	if (parser->token == T_USING) { // hash is the only kind of index there is
+		next(parser);
+		if (!expect(parser, T_HASH))
+			return false;
+	}
+	return end_of_statement(parser);
+}
+
+// CREATE TABLE name (name INT | name VARCHAR(n) | PRIMARY KEY(name), ...) [ENGINE=MEMORY];
+static bool parse_create(parser_t *parser, request_t *request) {
+	column_t **link = &request->columns;
+	column_t *column;
+	char *key;
+
+	if (!expect(parser, T_TABLE) || !name(parser, &request->table_name) || !expect(parser, T_LPAREN))
+		return false;
+
+	do {
+		if (parser->token == T_PRIMARY_KEY) {
+			next(parser);
+			if (!expect(parser, T_LPAREN) || !name(parser, &key) || !expect(parser, T_RPAREN))
+				return false;
+
+			for (column = request->columns; column && strcmp(column->name, key) != 0; column = column->next)
+				;
+			if (!column) { // keep unknown keys, add_table decides what to do with them
+				column = new_column(parser, &link);
+				column->name = key;
+			}
+			column->is_primary_key = 1;
+			continue;
+		}
+
+		column = new_column(parser, &link);
+		if (!name(parser, &column->name))
+			return false;
+
+		if (parser->token == T_INT) {
+			column->data_type = DT_INT;
+			next(parser);
+		} else if (parser->token == T_VARCHAR) {
+			column->data_type = DT_VARCHAR;
+			next(parser);
+			if (!expect(parser, T_LPAREN))
+				return false;
+			if (parser->token != T_NUMBER)
+				return expect(parser, T_NUMBER);
+			column->char_size = parser->number;
+			next(parser);
+			if (!expect(parser, T_RPAREN))
+				return false;
+		} else
+			return expect(parser, T_INT);
+	} while (parser->token == T_COMMA && (next(parser), true));
+
+	if (!expect(parser, T_RPAREN))
+		return false;
+	if (parser->token == T_ENGINE) { // memory is the only engine besides the default one
+		next(parser);
+		if (!expect(parser, T_EQUALS) || !expect(parser, T_MEMORY))
+			return false;
+		request->memory = 1;
+	}
+	return end_of_statement(parser);
+}
+
+// INSERT INTO name VALUES (value, ...);
+static bool parse_insert(parser_t *parser, request_t *request) {
+	column_t **link = &request->columns;
+
+	if (!expect(parser, T_INTO) || !name(parser, &request->table_name) || !expect(parser, T_VALUES) || !expect(parser, T_LPAREN))
+		return false;
+
+	do {
+		if (!value(parser, new_column(parser, &link)))
+			return false;
+	} while (parser->token == T_COMMA && (next(parser), true));
+
+	return expect(parser, T_RPAREN) && end_of_statement(parser);
+}
+
+// the aggregate functions by name, they are only recognized when followed by (
+static const struct {
+	const char *name;
+	char aggregate;
+} aggregates[] = {
+	{"COUNT", AGG_COUNT},
+	{"SUM", AGG_SUM},
+	{"MIN", AGG_MIN},
+	{"MAX", AGG_MAX},
+	{"AVG", AGG_AVG},
+};
+
+// name or FUNCTION(name), COUNT(*) keeps * as its column name
+static bool select_column(parser_t *parser, column_t ***link) {
+	column_t *column = new_column(parser, link);
+
+	if (!name(parser, &column->name))
+		return false;
+	if (parser->token != T_LPAREN)
+		return true;
+
+	for (size_t i = 0; i < sizeof(aggregates) / sizeof(aggregates[0]); i++)
+		if (strcmp(column->name, aggregates[i].name) == 0)
+			column->aggregate = aggregates[i].aggregate;
+	if (column->aggregate == AGG_NONE) {
+		parser->error = "syntax error, unknown aggregate function\n";
+		return false;
+	}
+
+	next(parser);
+	if (parser->token == T_STAR && column->aggregate == AGG_COUNT) {
+		column->name = text(parser);
+		next(parser);
+	} else if (!name(parser, &column->name))
+		return false;
+	return expect(parser, T_RPAREN);
+}
+
+// JOIN name ON table.column = table.column, with a column of each table on either side
+static bool join(parser_t *parser, request_t *request) {
+	column_t **link = &request->join_on;
+	char *left_table, *left, *right_table, *right;
+
+	next(parser);
+	if (!name(parser, &request->join_table) || !expect(parser, T_ON) || !qualified_name(parser, &left_table, &left) ||
+		!expect(parser, T_EQUALS) || !qualified_name(parser, &right_table, &right))
+		return false;
+
+	// the first column of join_on belongs to the FROM table, the second to the JOIN table
+	if (strcmp(left_table, request->table_name) != 0 || strcmp(right_table, request->join_table) != 0) {
+		char *swap = left_table;
+		left_table = right_table;
+		right_table = swap;
+		swap = left;
+		left = right;
+		right = swap;
+	}
+	if (strcmp(left_table, request->table_name) != 0 || strcmp(right_table, request->join_table) != 0) {
+		parser->error = "syntax error, ON has to compare a column of each joined table\n";
+		return false;
+	}
+	new_column(parser, &link)->name = left;
+	new_column(parser, &link)->name = right;
+	return true;
+}
+
+// ORDER BY name [ASC | DESC]
+static bool order_by(parser_t *parser, request_t *request) {
+	column_t **link = &request->order_by;
+
+	next(parser);
+	if (!expect(parser, T_BY) || !name(parser, &new_column(parser, &link)->name))
+		return false;
+	if (parser->token == T_ASC || parser->token == T_DESC) {
+		request->descending = parser->token == T_DESC;
+		next(parser);
+	}
+	return true;
+}
+
+// the row count after LIMIT or OFFSET
+static bool row_count(parser_t *parser, int *count) {
+	next(parser);
+	if (parser->token != T_NUMBER)
+		return expect(parser, T_NUMBER);
+	if (parser->number < 0) {
+		parser->error = "syntax error, LIMIT and OFFSET can't be negative\n";
+		return false;
+	}
+	*count = parser->number;
+	next(parser);
+	return true;
+}
+
+// SELECT * FROM name [JOIN ...] [WHERE name = value] [GROUP BY name] [ORDER BY ...] [LIMIT n] [OFFSET n];
+// or SELECT column, ... FROM name [JOIN ...] [WHERE name = value] [GROUP BY name] [ORDER BY ...] [LIMIT n] [OFFSET n];
+static bool parse_select(parser_t *parser, request_t *request) {
+	column_t **link = &request->columns;
+
+	request->limit = -1;
+
+	if (parser->token == T_STAR)
+		next(parser);
+	else if (parser->token != T_NAME)
+		return expect(parser, T_STAR);
+	else
+		do {
+			if (!select_column(parser, &link))
+				return false;
+		} while (parser->token == T_COMMA && (next(parser), true));
+
+	if (!expect(parser, T_FROM) || !name(parser, &request->table_name))
+		return false;
+	if (parser->token == T_JOIN && !join(parser, request))
+		return false;
+	if (parser->token == T_WHERE && !where(parser, request))
+		return false;
+	if (parser->token == T_GROUP) {
+		link = &request->group_by;
+		next(parser);
+		if (!expect(parser, T_BY) || !name(parser, &new_column(parser, &link)->name))
+			return false;
+	}
+	if (parser->token == T_ORDER && !order_by(parser, request))
+		return false;
+	if (parser->token == T_LIMIT && !row_count(parser, &request->limit))
+		return false;
+	if (parser->token == T_OFFSET && !row_count(parser, &request->offset))
+		return false;
+	return end_of_statement(parser);
+}
+
+// UPDATE name SET name = value, ... WHERE name = value;
+static bool parse_update(parser_t *parser, request_t *request) {
+	column_t **link = &request->columns;
+	column_t *column;
+
+	if (!name(parser, &request->table_name) || !expect(parser, T_SET))
+		return false;
+
+	do {
+		column = new_column(parser, &link);
+		if (!name(parser, &column->name) || !expect(parser, T_EQUALS) || !value(parser, column))
+			return false;
+	} while (parser->token == T_COMMA && (next(parser), true));
+
+	return where(parser, request) && end_of_statement(parser);
+}
+
+static arena_t *arena_of(request_t *request) {
+	// create_request always places the request first in its arena
+	return (arena_t *)((char *)request - ARENA_HEADER_SIZE);
+}
+
+request_t *create_request(size_t size) {
+	arena_t *arena = arena_create(ARENA_ROUND(sizeof(request_t)) + size);
+	if (!arena)
+		return NULL;
+
+	return arena_calloc(arena, sizeof(request_t));
+}
+
+void *request_alloc(request_t *request, size_t size) {
+	return arena_alloc(arena_of(request), size);
+}
+
+request_t *parse_request(char *request_string, char **parse_error) {
+	parser_t parser;
+	bool parsed = false;
+
+	if (!request_string) {
+		*parse_error = (char *)"syntax error, empty request\n";
+		return NULL;
+	}
+
+	// the request never copies any text so the arena only has to fit the columns,
+	// and a statement can't have more columns than a quarter of its characters
+	size_t length = strlen(request_string);
+	request_t *request = create_request((length / 4 + 1) * ARENA_ROUND(sizeof(column_t)));
+	if (!request) {
+		*parse_error = (char *)"error: server ran out of memory\n";
+		return NULL;
+	}
+
+	memset(&parser, 0, sizeof(parser));
+	parser.cursor = request_string;
+	parser.arena = arena_of(request);
+	next(&parser);
+
+	switch (parser.token) {
+	case T_CREATE:
+		request->request_type = RT_CREATE;
+		next(&parser);
+		if (parser.token == T_INDEX) {
+			request->request_type = RT_CREATE_INDEX;
+			next(&parser);
+			parsed = parse_create_index(&parser, request);
+		} else
+			parsed = parse_create(&parser, request);
+		break;
+	case T_DROP:
+		request->request_type = RT_DROP;
+		next(&parser);
+		parsed = expect(&parser, T_TABLE) && name(&parser, &request->table_name) && end_of_statement(&parser);
+		break;
+	case T_INSERT:
+		request->request_type = RT_INSERT;
+		next(&parser);
+		parsed = parse_insert(&parser, request);
+		break;
+	case T_SELECT:
+		request->request_type = RT_SELECT;
+		next(&parser);
+		parsed = parse_select(&parser, request);
+		break;
+	case T_DELETE:
+		request->request_type = RT_DELETE;
+		next(&parser);
+		parsed = expect(&parser, T_FROM) && name(&parser, &request->table_name) && where(&parser, request) && end_of_statement(&parser);
+		break;
+	case T_UPDATE:
+		request->request_type = RT_UPDATE;
+		next(&parser);
+		parsed = parse_update(&parser, request);
+		break;
+	case T_TABLES:
+		request->request_type = RT_TABLES;
+		next(&parser);
+		parsed = expect(&parser, T_END);
+		break;
+	case T_SCHEMA:
+		request->request_type = RT_SCHEMA;
+		next(&parser);
+		parsed = name(&parser, &request->table_name) && expect(&parser, T_END);
+		break;
+	case T_QUIT:
+		request->request_type = RT_QUIT;
+		next(&parser);
+		parsed = expect(&parser, T_END);
+		break;
+	case T_STATS:
+		request->request_type = RT_STATS;
+		next(&parser);
+		parsed = expect(&parser, T_END);
+		break;
+	case T_REPLICATION:
+		request->request_type = RT_REPLICATION;
+		next(&parser);
+		parsed = expect(&parser, T_END);
+		break;
+	default:
+		if (parser.token != T_ERROR)
+			parser.error = "syntax error, unknown statement\n";
+	}
+
+	if (!parsed) {
+		*parse_error = (char *)parser.error;
+		destroy_request(request);
+		return NULL;
+	}
+
+	return request;
+}
+
+static void print_columns(column_t *column, bool values) {
+	static const char *functions[] = {"", "COUNT", "SUM", "MIN", "MAX", "AVG"};
+
+	for (; column; column = column->next) {
+		if (column->aggregate != AGG_NONE)
+			printf("\t%s(%s)\n", functions[(int)column->aggregate], column->name);
+		else if (values && column->data_type == DT_INT)
+			printf("\t%s = %d\n", column->name ? column->name : "(null)", column->int_val);
+		else if (values)
+			printf("\t%s = %s\n", column->name ? column->name : "(null)", column->char_val);
+		else if (column->data_type == DT_INT)
+			printf("\t%s INT%s\n", column->name, column->is_primary_key ? " PRIMARY KEY" : "");
+		else
+			printf("\t%s VARCHAR(%d)%s\n", column->name, column->char_size, column->is_primary_key ? " PRIMARY KEY" : "");
+	}
+}
+
+void print_request(request_t *request) {
+	if (!request)
+		return;
+
+	switch (request->request_type) {
+	case RT_CREATE:
+		printf("CREATE TABLE %s%s\n", request->table_name, request->memory ? " ENGINE=MEMORY" : "");
+		print_columns(request->columns, false);
+		break;
+	case RT_TABLES:
+		printf(".tables\n");
+		break;
+	case RT_SCHEMA:
+		printf(".schema %s\n", request->table_name);
+		break;
+	case RT_DROP:
+		printf("DROP TABLE %s\n", request->table_name);
+		break;
+	case RT_INSERT:
+		printf("INSERT INTO %s\n", request->table_name);
+		print_columns(request->columns, true);
+		break;
+	case RT_SELECT:
+		printf("SELECT FROM %s\n", request->table_name);
+		print_columns(request->columns, false);
+		if (request->join_table)
+			printf("JOIN %s ON %s.%s = %s.%s\n", request->join_table, request->table_name, request->join_on->name,
+				   request->join_table, request->join_on->next->name);
+		if (request->where) {
+			printf("WHERE\n");
+			print_columns(request->where, true);
+		}
+		if (request->group_by)
+			printf("GROUP BY %s\n", request->group_by->name);
+		if (request->order_by)
+			printf("ORDER BY %s %s\n", request->order_by->name, request->descending ? "DESC" : "ASC");
+		if (request->limit >= 0)
+			printf("LIMIT %d\n", request->limit);
+		if (request->offset)
+			printf("OFFSET %d\n", request->offset);
+		break;
+	case RT_CREATE_INDEX:
+		printf("CREATE INDEX %s ON %s (%s)\n", request->index_name, request->table_name, request->columns->name);
+		break;
+	case RT_QUIT:
+		printf(".quit\n");
+		break;
+	case RT_STATS:
+		printf(".stats\n");
+		break;
+	case RT_REPLICATION:
+		printf(".replication\n");
+		break;
+	case RT_DELETE:
+		printf("DELETE FROM %s WHERE\n", request->table_name);
+		print_columns(request->where, true);
+		break;
+	case RT_UPDATE:
+		printf("UPDATE %s\nSET\n", request->table_name);
+		print_columns(request->columns, true);
+		printf("WHERE\n");
+		print_columns(request->where, true);
+		break;
+	}
+}
+
+void destroy_request(request_t *request) {
+	if (!request) // sanity check
+		return;
+
+	arena_destroy(arena_of(request)); // every column and copied string lives in the arena
+}
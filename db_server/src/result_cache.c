@@ -0,0 +1,271 @@
+#include "result_cache.h"
+
+result_cache_t *result_cache_create() {
+	result_cache_t *cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	pthread_mutex_init(&cache->lock, NULL);
+	return cache;
+}
+
+static void result_free(cached_result_t *result) {
+	free(result->key);
+	free(result->response);
+	free(result);
+}
+
+// the caller holds cache->lock
+static void result_put(cached_result_t *result) {
+	if (--result->references == 0)
+		result_free(result);
+}
+
+void result_cache_destroy(result_cache_t *cache) {
+	if (!cache) // sanity check
+		return;
+
+	for (cached_result_t *result = cache->newest, *older; result; result = older) {
+		older = result->older;
+		result_put(result);
+	}
+	for (size_t i = 0; i < VERSION_BUCKETS; i++) {
+		for (table_version_t *version = cache->versions[i], *next; version; version = next) {
+			next = version->next;
+			free(version->name);
+			free(version);
+		}
+	}
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+/*
+ * The key of a SELECT in the cache, the statement with whitespace collapsed outside of
+ * quotes and the protocol in front, since the same rows are encoded differently for text
+ * and binary clients. Returns NULL for other statements, EXECUTE included since prepared
+ * statements are private to a connection, or if it couldn't be allocated.
+ */
+char *result_cache_key(int protocol, const char *statement) {
+	while (isspace((unsigned char)*statement))
+		statement++;
+	if (strncmp(statement, "SELECT", 6) != 0 || !isspace((unsigned char)statement[6]))
+		return NULL;
+
+	char *key = malloc(strlen(statement) + 3);
+	if (!key)
+		return NULL;
+
+	size_t length = 0;
+	bool quoted = false;
+	key[length++] = (char)('0' + protocol);
+	key[length++] = ':';
+	for (const char *p = statement; *p; p++) {
+		if (!quoted && isspace((unsigned char)*p)) {
+			if (key[length - 1] != ' ' && key[length - 1] != ':')
+				key[length++] = ' ';
+			continue;
+		}
+		quoted ^= *p == '\'';
+		key[length++] = *p;
+	}
+	while (key[length - 1] == ' ')
+		length--;
+	key[length] = '\0';
+	return key;
+}
+
+// the caller holds cache->lock
+static table_version_t *find_version(result_cache_t *cache, const char *name, bool create) {
+	table_version_t **link = &cache->versions[string_hash(name, 0) % VERSION_BUCKETS];
+	while (*link && strcmp((*link)->name, name) != 0)
+		link = &(*link)->next;
+	if (*link || !create)
+		return *link;
+
+	table_version_t *version = calloc(1, sizeof(table_version_t));
+	if (version && !(version->name = strdup(name))) {
+		free(version);
+		version = NULL;
+	}
+	if (version)
+		version->version = ++cache->clock;
+	return *link = version;
+}
+
+// the caller holds cache->lock
+static uint64_t current_version(result_cache_t *cache, const char *name) {
+	table_version_t *version = name ? find_version(cache, name, false) : NULL;
+	return version ? version->version : 0;
+}
+
+// takes result out of the buckets and the LRU list, the caller holds cache->lock
+static void result_remove(result_cache_t *cache, cached_result_t *result) {
+	cached_result_t **link = &cache->buckets[string_hash(result->key, 0) % RESULT_BUCKETS];
+	while (*link != result)
+		link = &(*link)->next;
+	*link = result->next;
+
+	if (result->newer)
+		result->newer->older = result->older;
+	else
+		cache->newest = result->older;
+	if (result->older)
+		result->older->newer = result->newer;
+	else
+		cache->oldest = result->newer;
+
+	cache->bytes -= result->length;
+	result_put(result);
+}
+
+/*
+ * The versions of the tables a SELECT reads, taken while it holds their locks. A table gets
+ * its first version here, 0 means it couldn't be given one and the result isn't cached.
+ */
+void result_cache_versions(result_cache_t *cache, request_t *request, uint64_t *versions) {
+	pthread_mutex_lock(&cache->lock);
+	table_version_t *version = find_version(cache, request->table_name, true);
+	versions[0] = version ? version->version : 0;
+	version = request->join_table ? find_version(cache, request->join_table, true) : NULL;
+	versions[1] = version ? version->version : 0;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * Called by every write to a table once its rows changed, its cached results are stale from
+ * now on. A write to a table on disk holds it in LM_X or LM_IX, which keeps SELECTs out. An
+ * INSERT into a memory table only holds LM_IS and bumps from insert_data after its rows were
+ * appended, a SELECT that read the table in between took the older version and
+ * result_cache_insert turns its response away.
+ */
+void result_cache_bump(result_cache_t *cache, const char *table) {
+	pthread_mutex_lock(&cache->lock);
+	table_version_t *version = find_version(cache, table, true);
+	if (version)
+		version->version = ++cache->clock;
+	else // without a version the table's results can't be told apart, drop all of them
+		while (cache->oldest)
+			result_remove(cache, cache->oldest);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+// called by DROP TABLE. No result was made at version 0, which a table without an entry has, so
+// the results made from table never match again
+void result_cache_forget(result_cache_t *cache, const char *table) {
+	pthread_mutex_lock(&cache->lock);
+	table_version_t **link = &cache->versions[string_hash(table, 0) % VERSION_BUCKETS];
+	while (*link && strcmp((*link)->name, table) != 0)
+		link = &(*link)->next;
+	table_version_t *version = *link;
+	if (version) {
+		*link = version->next;
+		free(version->name);
+		free(version);
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * The cached response of the SELECT with key, or NULL if there is none made at the current
+ * version of its tables. The caller sends it and gives it back with result_cache_release.
+ */
+cached_result_t *result_cache_lookup(result_cache_t *cache, const char *key, request_t *request) {
+	pthread_mutex_lock(&cache->lock);
+	cached_result_t *result = cache->buckets[string_hash(key, 0) % RESULT_BUCKETS];
+	while (result && strcmp(result->key, key) != 0)
+		result = result->next;
+
+	if (result && (result->versions[0] != current_version(cache, request->table_name) ||
+				   result->versions[1] != current_version(cache, request->join_table))) {
+		result_remove(cache, result);
+		result = NULL;
+	}
+	if (!result) {
+		cache->misses++;
+		pthread_mutex_unlock(&cache->lock);
+		return NULL;
+	}
+
+	if (result->newer) { // move to the front of the LRU list
+		result->newer->older = result->older;
+		if (result->older)
+			result->older->newer = result->newer;
+		else
+			cache->oldest = result->newer;
+		result->newer = NULL;
+		result->older = cache->newest;
+		cache->newest->newer = result;
+		cache->newest = result;
+	}
+	result->references++;
+	cache->hits++;
+	pthread_mutex_unlock(&cache->lock);
+	return result;
+}
+
+void result_cache_release(result_cache_t *cache, cached_result_t *result) {
+	pthread_mutex_lock(&cache->lock);
+	result_put(result);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * Keeps the complete response of a SELECT made at versions of its tables, the FROM and the
+ * JOIN table or NULL. The cache takes over response. Responses larger than RESULT_MAX_SIZE or made at an old version are freed.
+ */
+void result_cache_insert(result_cache_t *cache, const char *key, char **tables, const uint64_t *versions, char *response,
+						 size_t length) {
+	cached_result_t *result = length <= RESULT_MAX_SIZE ? calloc(1, sizeof(cached_result_t)) : NULL;
+	if (!result) {
+		free(response);
+		return;
+	}
+	result->response = response;
+	result->length = length;
+	result->versions[0] = versions[0];
+	result->versions[1] = versions[1];
+	result->references = 1;
+	if (!(result->key = strdup(key))) {
+		result_free(result);
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	if (!versions[0] || (tables[1] && !versions[1]) || versions[0] != current_version(cache, tables[0]) ||
+		versions[1] != current_version(cache, tables[1])) {
+		pthread_mutex_unlock(&cache->lock); // a write came in after the SELECT released its locks
+		result_free(result);
+		return;
+	}
+
+	size_t bucket = string_hash(key, 0) % RESULT_BUCKETS;
+	for (cached_result_t *existing = cache->buckets[bucket]; existing; existing = existing->next)
+		if (strcmp(existing->key, key) == 0) { // another connection made it at the same time
+			result_remove(cache, existing);
+			break;
+		}
+
+	result->next = cache->buckets[bucket];
+	cache->buckets[bucket] = result;
+	result->older = cache->newest;
+	if (cache->newest)
+		cache->newest->newer = result;
+	else
+		cache->oldest = result;
+	cache->newest = result;
+	cache->bytes += length;
+
+	while (cache->bytes > RESULT_CACHE_BYTES)
+		result_remove(cache, cache->oldest);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+// the hits and misses so far and the bytes of the responses held, for .stats
+void result_cache_counters(result_cache_t *cache, uint64_t *hits, uint64_t *misses, size_t *bytes) {
+	pthread_mutex_lock(&cache->lock);
+	*hits = cache->hits;
+	*misses = cache->misses;
+	*bytes = cache->bytes;
+	pthread_mutex_unlock(&cache->lock);
+}
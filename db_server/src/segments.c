@@ -0,0 +1,540 @@
+#include "segments.h"
+#include "db_functions.h"
+
+// a part of a read or write that stays within one segment
+typedef struct transfer transfer_t;
+struct transfer {
+	size_t segment;
+	long offset; // in the segment
+	size_t length;
+	size_t at; // where the bytes are in the caller's memory, and in the registered buffer
+	ssize_t result;
+};
+
+static bool use_uring = false;
+static uint64_t last_id = 0; // of the segments loaded so far
+static uint64_t closed = 0;	 // bumped whenever segments that were registered in a ring are closed
+static __thread storage_ring_t *storage = NULL;
+static __thread bool storage_refused = false; // the kernel refused this thread a ring, it stays on system calls
+
+// reads and writes tables through a ring per thread from now on, or with system calls again
+void segments_use_uring(bool enabled) {
+	use_uring = enabled;
+}
+
+// the ring of this thread, NULL if tables are read and written with system calls
+static storage_ring_t *storage_ring() {
+	if (!use_uring || storage || storage_refused)
+		return use_uring ? storage : NULL;
+
+	int files[STORAGE_FILES];
+	for (size_t i = 0; i < STORAGE_FILES; i++)
+		files[i] = -1;
+	storage_ring_t *ring = calloc(1, sizeof(storage_ring_t));
+	void *buffer = NULL;
+	if (ring && posix_memalign(&buffer, INDEX_PAGE_SIZE, STORAGE_BUFFER_SIZE) == 0) {
+		ring->buffer = buffer;
+		ring->ring = uring_create(STORAGE_ENTRIES, 2 * STORAGE_ENTRIES);
+	}
+	if (ring && ring->ring && uring_register_files(ring->ring, files, STORAGE_FILES) == 0 &&
+		uring_register_buffer(ring->ring, ring->buffer, STORAGE_BUFFER_SIZE) == 0)
+		return storage = ring;
+
+	log_to_file("Error: Couldn't set up an io_uring for tables in storage_ring(), the thread stays on system calls\n");
+	storage_refused = true;
+	if (ring) {
+		uring_destroy(ring->ring);
+		free(ring->buffer);
+		free(ring);
+	}
+	return NULL;
+}
+
+// the slot segment i of segments is registered in, it takes over the oldest slot if it isn't registered yet
+static int storage_slot(storage_ring_t *ring, segments_t *segments, size_t i) {
+	for (size_t slot = 0; slot < STORAGE_FILES; slot++)
+		if (ring->files[slot].id == segments->id && ring->files[slot].segment == i)
+			return (int)slot;
+
+	// STORAGE_FILES is at least STORAGE_ENTRIES, a file queued in this round keeps its slot
+	size_t slot = ring->next_slot;
+	if (uring_update_file(ring->ring, (unsigned)slot, segments->segments[i].fd) < 0)
+		return -1;
+	ring->next_slot = (slot + 1) % STORAGE_FILES;
+	ring->files[slot].id = segments->id;
+	ring->files[slot].segment = i;
+	__atomic_store_n(&segments->registered, true, __ATOMIC_RELAXED);
+	return (int)slot;
+}
+
+// empties the slots of the segments with id, or every slot but those of id if all is set, so a
+// dropped table's files don't stay open in the ring
+static void storage_release(storage_ring_t *ring, uint64_t id, bool all) {
+	for (size_t slot = 0; slot < STORAGE_FILES; slot++) {
+		if (!ring->files[slot].id || (ring->files[slot].id == id) == all)
+			continue;
+		if (uring_update_file(ring->ring, (unsigned)slot, -1) < 0)
+			log_to_file("Error: Couldn't empty slot %zu of a ring in storage_release()\n", slot);
+		ring->files[slot].id = 0;
+	}
+}
+
+/*
+ * Moves the bytes of count transfers between memory and the segments, through the ring with a
+ * single submission if the thread has one or with a system call each. Sets the result of every
+ * transfer and returns how many of them, counted from the first, moved all of their bytes.
+ */
+static size_t transfer(segments_t *segments, char *memory, transfer_t *transfers, size_t count, bool write) {
+	storage_ring_t *ring = storage_ring();
+	for (size_t i = 0; i < count; i++)
+		transfers[i].result = -1;
+
+	// segments registered here may have been closed by another thread since, their ids never come back
+	uint64_t generation = __atomic_load_n(&closed, __ATOMIC_ACQUIRE);
+	if (ring && ring->generation != generation) {
+		storage_release(ring, segments->id, true);
+		ring->generation = generation;
+	}
+
+	if (!ring) {
+		for (size_t i = 0; i < count; i++) {
+			transfer_t *part = &transfers[i];
+			int fd = segments->segments[part->segment].fd;
+			do
+				part->result = write ? pwrite(fd, memory + part->at, part->length, part->offset)
+									 : pread(fd, memory + part->at, part->length, part->offset);
+			while (part->result < 0 && errno == EINTR);
+			if (part->result != (ssize_t)part->length)
+				break;
+		}
+	} else {
+		size_t queued = 0;
+		for (; queued < count; queued++) {
+			transfer_t *part = &transfers[queued];
+			int slot = storage_slot(ring, segments, part->segment);
+			struct io_uring_sqe *sqe = slot < 0 ? NULL : uring_sqe(ring->ring);
+			if (!sqe)
+				break;
+			if (write)
+				memcpy(ring->buffer + part->at, memory + part->at, part->length);
+			sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+			sqe->flags = IOSQE_FIXED_FILE;
+			sqe->fd = slot;
+			sqe->addr = (uint64_t)(uintptr_t)(ring->buffer + part->at);
+			sqe->len = (uint32_t)part->length;
+			sqe->off = (uint64_t)part->offset;
+			sqe->buf_index = 0;
+			sqe->user_data = queued;
+		}
+
+		// every transfer has to be back before the buffer is used again
+		int result = queued ? uring_submit(ring->ring, (unsigned)queued) : 0;
+		size_t reaped = 0;
+		while (reaped < queued) {
+			struct io_uring_cqe *cqe = uring_peek(ring->ring);
+			if (!cqe && (result = uring_submit(ring->ring, 1)) < 0)
+				break;
+			if (!cqe)
+				continue;
+			transfers[cqe->user_data].result = cqe->res;
+			uring_seen(ring->ring);
+			reaped++;
+		}
+		if (reaped < queued) { // the kernel may still use the buffer, the ring is left to it
+			log_to_file("Error: Couldn't io_uring_enter() for '%s' in transfer(), the thread goes back to system calls\n", segments->name);
+			storage = NULL;
+			storage_refused = true;
+			return 0;
+		}
+		for (size_t i = 0; !write && i < queued && transfers[i].result > 0; i++)
+			memcpy(memory + transfers[i].at, ring->buffer + transfers[i].at, (size_t)transfers[i].result);
+	}
+
+	size_t moved = 0;
+	while (moved < count && transfers[moved].result == (ssize_t)transfers[moved].length)
+		moved++;
+	return moved;
+}
+
+// the file of segment i of table name
+static void segment_path(char *path, size_t size, const char *name, size_t i) {
+	if (i == 0) // tables from before segments keep their data file
+		snprintf(path, size, "%s%s%s", DATA_FILE_PATH, name, DATA_FILE_ENDING);
+	else
+		snprintf(path, size, "%s%s.%zu%s", DATA_FILE_PATH, name, i, DATA_FILE_ENDING);
+}
+
+static void manifest_path(char *path, size_t size, const char *name) {
+	snprintf(path, size, "%s%s%s", DATA_FILE_PATH, name, SEGMENT_ENDING);
+}
+
+/*
+ * Reads the manifest of table name, *sizes gets the sizes of its sealed segments. Returns 1 if
+ * it was read, 0 if the table has none and -1 if it is damaged.
+ */
+static int read_manifest(const char *name, segment_manifest_t *manifest, uint64_t **sizes) {
+	char path[PATH_MAX];
+	manifest_path(path, sizeof(path), name);
+	*sizes = NULL;
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return errno == ENOENT ? 0 : -1;
+
+	if (fread(manifest, sizeof(*manifest), 1, file) == 1 && memcmp(manifest->magic, SEGMENT_MAGIC, sizeof(manifest->magic)) == 0 &&
+		manifest->format == SEGMENT_FORMAT && manifest->nr_of_segments > 0 && manifest->capacity > 0 &&
+		(*sizes = calloc(manifest->nr_of_segments, sizeof(uint64_t))) &&
+		fread(*sizes, sizeof(uint64_t), manifest->nr_of_segments - 1, file) == manifest->nr_of_segments - 1) {
+		fclose(file);
+		return 1;
+	}
+
+	log_to_file("Error: '%s' is damaged in read_manifest()\n", path);
+	free(*sizes);
+	*sizes = NULL;
+	fclose(file);
+	return -1;
+}
+
+// writes the manifest to a file of its own and renames it over the old one, so a crash leaves one of them behind
+static int write_manifest(segments_t *segments) {
+	char path[PATH_MAX], temp_path[PATH_MAX + 8];
+	manifest_path(path, sizeof(path), segments->name);
+	snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+
+	int fd = mkstemp(temp_path);
+	if (fd >= 0)
+		fchmod(fd, 0644); // mkstemp leaves it readable by the owner only, unlike the data files
+	FILE *file = fd < 0 ? NULL : fdopen(fd, "w");
+	if (!file) {
+		log_to_file("Error: Couldn't create '%s' in write_manifest()\n", temp_path);
+		if (fd >= 0) {
+			close(fd);
+			unlink(temp_path);
+		}
+		return -1;
+	}
+
+	segment_manifest_t manifest;
+	memset(&manifest, 0, sizeof(manifest));
+	memcpy(manifest.magic, SEGMENT_MAGIC, sizeof(manifest.magic));
+	manifest.format = SEGMENT_FORMAT;
+	manifest.nr_of_segments = (uint32_t)segments->nr_of_segments;
+	manifest.capacity = (uint64_t)segments->capacity;
+
+	bool failed = fwrite(&manifest, sizeof(manifest), 1, file) < 1;
+	for (size_t i = 0; i + 1 < segments->nr_of_segments && !failed; i++) {
+		uint64_t size = (uint64_t)segments->segments[i].size;
+		failed = fwrite(&size, sizeof(size), 1, file) < 1;
+	}
+	// the new manifest has to be on disk before it replaces the old one
+	failed = failed || fflush(file) != 0 || fsync(fd) < 0;
+	if (fclose(file) != 0 || failed || rename(temp_path, path) < 0) {
+		log_to_file("Error: Couldn't write the manifest to '%s' in write_manifest()\n", temp_path);
+		unlink(temp_path);
+		return -1;
+	}
+	return 0;
+}
+
+// seals the tail and starts a new, empty one after it
+static int roll_over(segments_t *segments) {
+	size_t i = segments->nr_of_segments;
+	segment_t *grown = realloc(segments->segments, (i + 1) * sizeof(segment_t));
+	if (!grown)
+		return -1;
+	segments->segments = grown;
+
+	// a crash after an earlier roll over may have left it behind, it was never listed so nothing in it counts
+	char path[PATH_MAX];
+	segment_path(path, sizeof(path), segments->name, i);
+	int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		log_to_file("Error: Couldn't open() '%s' in roll_over()\n", path);
+		return -1;
+	}
+
+	segment_t *tail = &grown[i - 1];
+	grown[i].fd = fd;
+	grown[i].start = tail->start + tail->size;
+	grown[i].size = 0;
+	segments->nr_of_segments++;
+	if (write_manifest(segments) < 0) {
+		segments->nr_of_segments--;
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+	fchmod(tail->fd, 0444); // sealed, it never changes again
+	return 0;
+}
+
+// the segment holding offset, the tail for offsets past the end of the table
+static segment_t *find_segment(segments_t *segments, long offset) {
+	size_t low = 0, high = segments->nr_of_segments - 1;
+	while (low < high) {
+		size_t middle = (low + high + 1) / 2;
+		if (segments->segments[middle].start <= offset)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+	return &segments->segments[low];
+}
+
+/*
+ * Reads up to length bytes of the table from offset on into buffer, a batch of transfers at a
+ * time that each stay within one segment. Returns how many bytes were read, fewer than length
+ * only at the end of the table or if a read failed.
+ */
+size_t segments_read_at(segments_t *segments, char *buffer, long offset, size_t length) {
+	transfer_t transfers[STORAGE_ENTRIES];
+	size_t read = 0;
+	while (read < length) {
+		size_t count = 0, batch = 0;
+		long position = offset + (long)read;
+		while (count < STORAGE_ENTRIES && read + batch < length && batch < STORAGE_BUFFER_SIZE) {
+			segment_t *segment = find_segment(segments, position);
+			if (position - segment->start >= segment->size) // the end of the table
+				break;
+
+			size_t part = (size_t)(segment->size - (position - segment->start));
+			if (part > length - read - batch)
+				part = length - read - batch;
+			if (part > STORAGE_BUFFER_SIZE - batch)
+				part = STORAGE_BUFFER_SIZE - batch;
+			transfers[count++] = (transfer_t){(size_t)(segment - segments->segments), position - segment->start, part, batch, 0};
+			batch += part;
+			position += (long)part;
+		}
+		if (!count)
+			break;
+
+		size_t moved = transfer(segments, buffer + read, transfers, count, false);
+		for (size_t i = 0; i < count && (i < moved || transfers[i].result > 0); i++)
+			read += i < moved ? transfers[i].length : (size_t)transfers[i].result;
+		if (moved < count)
+			break;
+	}
+	return read;
+}
+
+/*
+ * Reads count rows of a table with fixed size rows, row_numbers[i] into rows + i * row_size,
+ * handing the reads to the ring together. Returns how many of them, counted from the first,
+ * were read whole, the rest are past the end of the table or couldn't be read.
+ */
+size_t segments_read_rows(segments_t *segments, char *rows, const uint32_t *row_numbers, size_t count) {
+	size_t row_size = (size_t)segments->row_size;
+	size_t read = 0;
+	if (!row_size)
+		return 0;
+	if (row_size > STORAGE_BUFFER_SIZE) { // doesn't fit into the registered buffer, read on its own
+		while (read < count && segments_read_at(segments, rows + read * row_size, (long)row_numbers[read] * (long)row_size, row_size) == row_size)
+			read++;
+		return read;
+	}
+
+	size_t round = STORAGE_BUFFER_SIZE / row_size < STORAGE_ENTRIES ? STORAGE_BUFFER_SIZE / row_size : STORAGE_ENTRIES;
+	transfer_t transfers[STORAGE_ENTRIES];
+	while (read < count) {
+		size_t batch = 0;
+		for (; batch < round && read + batch < count; batch++) {
+			long position = (long)row_numbers[read + batch] * (long)row_size;
+			segment_t *segment = find_segment(segments, position);
+			if (position - segment->start + (long)row_size > segment->size)
+				break;
+			transfers[batch] = (transfer_t){(size_t)(segment - segments->segments), position - segment->start, row_size, batch * row_size, 0};
+		}
+		size_t moved = batch ? transfer(segments, rows + read * row_size, transfers, batch, false) : 0;
+		read += moved;
+		if (!batch || moved < batch)
+			break;
+	}
+	return read;
+}
+
+static ssize_t segments_read(void *cookie, char *buffer, size_t size) {
+	segments_t *segments = cookie;
+	size_t read = segments_read_at(segments, buffer, segments->position, size);
+	segments->position += (long)read;
+	return (ssize_t)read;
+}
+
+// appends to the tail whatever the position is, rows are never split since the capacity is a multiple of the row size
+static ssize_t segments_write(void *cookie, const char *buffer, size_t size) {
+	segments_t *segments = cookie;
+	size_t written = 0;
+	while (written < size) {
+		if (segments->segments[segments->nr_of_segments - 1].size >= segments->capacity && roll_over(segments) < 0)
+			break;
+
+		segment_t *tail = &segments->segments[segments->nr_of_segments - 1];
+		size_t part = (size_t)(segments->capacity - tail->size);
+		if (part > size - written)
+			part = size - written;
+		if (part > STORAGE_BUFFER_SIZE)
+			part = STORAGE_BUFFER_SIZE;
+		transfer_t piece = {segments->nr_of_segments - 1, tail->size, part, 0, 0};
+		transfer(segments, (char *)buffer + written, &piece, 1, true);
+		if (piece.result <= 0)
+			break;
+		tail->size += piece.result;
+		written += (size_t)piece.result;
+	}
+
+	segment_t *tail = &segments->segments[segments->nr_of_segments - 1];
+	segments->position = tail->start + tail->size;
+	return (ssize_t)written; // 0 tells stdio that the write failed
+}
+
+static int segments_seek(void *cookie, off64_t *offset, int whence) {
+	segments_t *segments = cookie;
+	segment_t *tail = &segments->segments[segments->nr_of_segments - 1];
+	long position = (long)*offset;
+	if (whence == SEEK_CUR)
+		position += segments->position;
+	else if (whence == SEEK_END)
+		position += tail->start + tail->size;
+	if (position < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	*offset = segments->position = position;
+	return 0;
+}
+
+static int segments_close(void *cookie) {
+	segments_t *segments = cookie;
+	if (__atomic_load_n(&segments->registered, __ATOMIC_RELAXED)) { // the rings of other threads empty their slots on their next transfer
+		if (storage)
+			storage_release(storage, segments->id, false);
+		__atomic_add_fetch(&closed, 1, __ATOMIC_RELEASE);
+	}
+	for (size_t i = 0; segments->segments && i < segments->nr_of_segments; i++)
+		if (segments->segments[i].fd >= 0)
+			close(segments->segments[i].fd);
+	free(segments->segments);
+	free(segments->name);
+	free(segments);
+	return 0;
+}
+
+static const cookie_io_functions_t segments_functions = {segments_read, segments_write, segments_seek, segments_close};
+
+// opens every segment of table name, append opens the tail for writing and gives the table a manifest if it has none
+segments_t *segments_load(const char *name, int row_size, bool append) {
+	segment_manifest_t manifest;
+	uint64_t *sizes = NULL;
+	int found = read_manifest(name, &manifest, &sizes);
+	if (found < 0)
+		return NULL;
+
+	segments_t *segments = calloc(1, sizeof(segments_t));
+	if (!segments) {
+		free(sizes);
+		return NULL;
+	}
+	segments->nr_of_segments = found ? manifest.nr_of_segments : 1;
+	segments->capacity = found ? (long)manifest.capacity : 0;
+	segments->append = append;
+	segments->row_size = row_size;
+	segments->id = __atomic_add_fetch(&last_id, 1, __ATOMIC_RELAXED);
+	segments->name = strdup(name);
+	segments->segments = calloc(segments->nr_of_segments, sizeof(segment_t));
+	bool failed = !segments->name || !segments->segments;
+
+	// every segment is opened now, so a DROP while the rows are sent doesn't take them away
+	long start = 0;
+	for (size_t i = 0; segments->segments && i < segments->nr_of_segments; i++)
+		segments->segments[i].fd = -1;
+	for (size_t i = 0; !failed && i < segments->nr_of_segments; i++) {
+		bool tail = i + 1 == segments->nr_of_segments;
+		char path[PATH_MAX];
+		struct stat info;
+		segment_path(path, sizeof(path), name, i);
+		segment_t *segment = &segments->segments[i];
+		if ((segment->fd = open(path, tail && append ? O_RDWR | O_APPEND : O_RDONLY)) < 0 || (tail && fstat(segment->fd, &info) < 0)) {
+			failed = true;
+			break;
+		}
+		segment->start = start;
+		segment->size = tail ? (long)info.st_size : (long)sizes[i];
+		start += segment->size;
+	}
+	free(sizes);
+
+	if (!failed && append && !segments->capacity) { // the first write to a table without a manifest
+		segments->capacity = row_size > 0 ? SEGMENT_SIZE / row_size * row_size : SEGMENT_SIZE;
+		if (segments->capacity < row_size)
+			segments->capacity = row_size;
+		failed = write_manifest(segments) < 0;
+	}
+	if (failed) {
+		int error = errno; // the callers report a missing data file
+		segments_close(segments);
+		errno = error;
+		return NULL;
+	}
+	return segments;
+}
+
+/*
+ * Opens table name as a single file over all of its segments. Reads see the rows that were in
+ * the table when it was opened. With append, writes go to the end of the table and start a new
+ * segment whenever the tail is full, row_size keeps a row from being split between two of them.
+ * loaded, if not NULL, is set to the segments behind the file for segments_read_rows() and
+ * segments_read_at(), they stay valid until the file is closed. Returns NULL if the table has
+ * no data file or its manifest is damaged.
+ */
+FILE *segments_open(const char *name, int row_size, bool append, segments_t **loaded) {
+	segments_t *segments = segments_load(name, row_size, append);
+	if (!segments)
+		return NULL;
+
+	FILE *file = fopencookie(segments, append ? "a" : "r", segments_functions);
+	if (!file)
+		segments_close(segments);
+	if (loaded)
+		*loaded = file ? segments : NULL;
+	return file;
+}
+
+/*
+ * Appends length bytes of whole rows to segments loaded for appending, with as few writes as
+ * the segments allow, a single one unless the tail fills up. Returns the row number of the
+ * first of them, or -1 if they couldn't all be written.
+ */
+long segments_append(segments_t *segments, const char *rows, size_t length) {
+	segment_t *tail = &segments->segments[segments->nr_of_segments - 1];
+	long first = (tail->start + tail->size) / segments->row_size;
+	return (size_t)segments_write(segments, rows, length) == length ? first : -1;
+}
+
+void segments_unload(segments_t *segments) {
+	if (segments) // sanity check
+		segments_close(segments);
+}
+
+// removes every segment of table name and then its manifest, returns -1 if the first segment couldn't be removed
+int segments_drop(const char *name) {
+	segment_manifest_t manifest;
+	uint64_t *sizes = NULL;
+	size_t nr_of_segments = read_manifest(name, &manifest, &sizes) > 0 ? manifest.nr_of_segments : 1;
+	free(sizes);
+
+	char path[PATH_MAX];
+	segment_path(path, sizeof(path), name, 0);
+	if (unlink(path) < 0)
+		return -1;
+
+	// one past the listed ones may be left over from a crash in roll_over()
+	for (size_t i = 1; i <= nr_of_segments; i++) {
+		segment_path(path, sizeof(path), name, i);
+		if (unlink(path) < 0 && errno != ENOENT)
+			log_to_file("Error: Couldn't unlink() '%s' in segments_drop()\n", path);
+	}
+	manifest_path(path, sizeof(path), name);
+	unlink(path);
+	return 0;
+}
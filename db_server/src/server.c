@@ -11,14 +11,27 @@ void handle_connection(void *arg) {
 
 	client_request *cli_req = (client_request *)malloc(sizeof(client_request));
 	cli_req->error = NULL;
+	cli_req->suspended = false;
+	memset(cli_req->trace, 0, sizeof(cli_req->trace));
+	cli_req->trace[TRACE_RECEIVED] = args->received_ns;
+	cli_req->trace[TRACE_DISPATCHED] = args->dispatched_ns;
+	trace_stamp(cli_req->trace, TRACE_HANDLED);
+	// the parser splits msg up in place, a primary ships the statements that change the database as they were sent
+	bool primary = args->server->replication && !replication_read_only(args->server->replication);
+	cli_req->statement = trace_enabled() || primary ? strdup(args->msg) : NULL;
+	cli_req->cache_key = result_cache_key(args->server->connections[args->socket].protocol, args->msg);
 	request_t *req = NULL;
-	req = parse_request(args->msg, &cli_req->error);
+	req = statement_cache_parse(args->server->statements, args->socket, args->msg, &cli_req->error, &cli_req->binding);
 
 	cli_req->request = req;
+	trace_stamp(cli_req->trace, TRACE_PARSED);
+	cli_req->msg = args->msg; // handed over since the request points into it
 	cli_req->client_socket = args->socket;
+	cli_req->protocol = args->server->connections[args->socket].protocol;
 	cli_req->server = args->server;
 	sem_wait(&(args->server->empty_sem));			   // wait here until the queue is not full
 	pthread_mutex_lock(&(args->server->enqueue_lock)); // lock so other threads can't enqueue
+	trace_stamp(cli_req->trace, TRACE_ENQUEUED);		   // the request belongs to the queue once it is in there
 	// the loop here is actually unnessecary since the thread got past the
 	// empty_sem but just for sanity we put it in a while loop
 	while (!enqueue(args->server->request_queue, cli_req))
@@ -27,10 +40,242 @@ void handle_connection(void *arg) {
 	sem_post(&(args->server->full_sem));				 // signal that the queue is not empty anymore
 
 	// cleanup
-	free(args->msg);
 	free(args);
 }
 
+// received_ns is when select() returned with the statement, 0 if it was held back until now
+static void dispatch_statement(server_t *server, size_t socket, char *msg, uint64_t received_ns) {
+	// malloc new args so it can persist through the new thread
+	connection_args *args = malloc(sizeof(connection_args));
+	args->server = server;
+	args->socket = socket;
+	args->msg = msg;
+	args->dispatched_ns = stats_now_ns();
+	args->received_ns = received_ns ? received_ns : args->dispatched_ns;
+
+	thread_pool_add_work(server->pool, handle_connection, args);
+}
+
+static size_t pending_output(connection_t *conn) {
+	return conn->output.length - conn->output_offset;
+}
+
+static void watch_writable(server_t *server, size_t socket, bool watch) {
+	pthread_mutex_lock(&server->write_lock);
+	bool changed = FD_ISSET(socket, &server->write_sockets) != watch;
+	if (watch)
+		FD_SET(socket, &server->write_sockets);
+	else
+		FD_CLR(socket, &server->write_sockets);
+	pthread_mutex_unlock(&server->write_lock);
+
+	// only the listen loop calls this with watch == false, it doesn't need waking up
+	if (changed && watch && write(server->wake_pipe[1], "", 1) < 0 && errno != EAGAIN)
+		log_to_file("Error: Couldn't write() to the wake pipe in watch_writable()\n");
+}
+
+// the caller holds conn->lock
+static int flush_output(server_t *server, size_t socket) {
+	connection_t *conn = &server->connections[socket];
+
+	while (pending_output(conn) > 0) {
+		ssize_t sent = send(socket, conn->output.buffer + conn->output_offset, pending_output(conn), MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) // the rest goes out when the socket is writable
+				return 0;
+
+			// the client is gone, drop what it will never read
+			log_to_file("Error: Couldn't send() to socket %ld in flush_output()\n", socket);
+			string_clear(&conn->output);
+			conn->output_offset = 0;
+			return -1;
+		}
+		conn->output_offset += sent;
+		stats_add(&stats_local()->bytes_sent, sent);
+	}
+
+	string_clear(&conn->output);
+	conn->output_offset = 0;
+	return 0;
+}
+
+// the caller holds conn->lock
+static int queue_output(server_t *server, size_t socket, const char *data, size_t length) {
+	connection_t *conn = &server->connections[socket];
+	if (conn->closing)
+		return -1;
+
+	bool idle = pending_output(conn) == 0;
+	if (conn->output_offset > conn->output.length / 2) { // reuse the space that was already sent
+		memmove(conn->output.buffer, conn->output.buffer + conn->output_offset, pending_output(conn));
+		conn->output.length -= conn->output_offset;
+		conn->output_offset = 0;
+	}
+	if (string_append(&conn->output, data, length) < 0)
+		return -1;
+
+	// try writing right away, the listen loop only takes over if the socket is full
+	if (idle && flush_output(server, socket) < 0)
+		return -1;
+	if (idle && pending_output(conn) > 0)
+		watch_writable(server, socket, true);
+	return 0;
+}
+
+// the caller holds conn->lock
+static void close_connection(server_t *server, size_t socket) {
+	connection_t *conn = &server->connections[socket];
+	if (conn->closing)
+		return;
+
+	conn->closing = true;
+	stats_add(&stats_local()->connections_closed, 1);
+	FD_CLR(socket, &(server->current_sockets));
+	watch_writable(server, socket, false);
+	statement_cache_forget(server->statements, socket);
+	string_clear(&conn->output);
+	conn->output_offset = 0;
+	if (conn->scan) { // a paused SELECT won't be resumed, it ends here
+		scan_destroy(conn->scan);
+		conn->scan = NULL;
+		conn->in_flight--;
+	}
+	// shutdown right away so the client sees the end of the stream, but keep the
+	// descriptor until the statements still running on it are done with it
+	shutdown(socket, SHUT_RDWR);
+	if (conn->in_flight == 0 && close(socket) == -1)
+		log_to_file("Error: Couldn't close() socket %ld in connection_close()\n", socket);
+}
+
+static void send_error_frame(server_t *server, size_t socket, const char *msg) {
+	dynamicstr out;
+	string_init(&out, NULL, FRAME_HEADER_SIZE + strlen(msg));
+	protocol_append_frame(&out, F_ERROR, msg, strlen(msg));
+	queue_output(server, socket, out.buffer, out.length);
+	string_free(&out);
+}
+
+// the caller holds conn->lock
+static void dispatch_frames(server_t *server, size_t socket, uint64_t received_ns) {
+	connection_t *conn = &server->connections[socket];
+
+	// only one statement per connection runs at a time so the responses come back in order
+	while (conn->in_flight == 0 && !conn->closing) {
+		char *frame = conn->input.buffer + conn->input_offset;
+		long frame_size = protocol_frame_size(frame, conn->input.length - conn->input_offset);
+		if (frame_size == 0) // wait for the rest of the frame
+			break;
+		if (frame_size < 0) {
+			log_to_file("Error: Frame from %s is too large, closing the connection\n", get_ip_from_socket_fd(socket));
+			send_error_frame(server, socket, "error: frame is too large\n");
+			close_connection(server, socket);
+			break;
+		}
+		conn->input_offset += frame_size;
+
+		if (frame[FRAME_HEADER_SIZE - 1] != F_QUERY) {
+			send_error_frame(server, socket, "error: expected a query frame\n");
+			continue;
+		}
+
+		size_t length = frame_size - FRAME_HEADER_SIZE;
+		char *msg = (char *)malloc((length + 1) * sizeof(char));
+		memcpy(msg, frame + FRAME_HEADER_SIZE, length);
+		msg[length] = '\0';
+
+		conn->in_flight++;
+		dispatch_statement(server, socket, msg, received_ns);
+	}
+
+	if (conn->input_offset == conn->input.length) { // everything was consumed
+		string_clear(&conn->input);
+		conn->input_offset = 0;
+	}
+}
+
+static void receive_frames(server_t *server, size_t socket, const char *data, size_t length, uint64_t received_ns) {
+	connection_t *conn = &server->connections[socket];
+
+	// move the unconsumed tail to the front before appending more
+	if (conn->input_offset > 0) {
+		memmove(conn->input.buffer, conn->input.buffer + conn->input_offset, conn->input.length - conn->input_offset);
+		conn->input.length -= conn->input_offset;
+		conn->input_offset = 0;
+	}
+	string_append(&conn->input, data, length);
+	dispatch_frames(server, socket, received_ns);
+}
+
+void connection_done(server_t *server, size_t socket) {
+	connection_t *conn = &server->connections[socket];
+
+	pthread_mutex_lock(&conn->lock);
+	conn->in_flight--;
+	if (conn->closing) {
+		if (conn->in_flight == 0 && close(socket) == -1)
+			log_to_file("Error: Couldn't close() socket %ld in connection_done()\n", socket);
+	} else if (conn->protocol == PROTOCOL_BINARY) { // statements that were pipelined behind this one
+		dispatch_frames(server, socket, 0);
+	}
+	pthread_mutex_unlock(&conn->lock);
+}
+
+int connection_write(server_t *server, size_t socket, const char *data, size_t length) {
+	connection_t *conn = &server->connections[socket];
+
+	pthread_mutex_lock(&conn->lock);
+	int result = queue_output(server, socket, data, length);
+	pthread_mutex_unlock(&conn->lock);
+	return result;
+}
+
+bool connection_congested(server_t *server, size_t socket) {
+	connection_t *conn = &server->connections[socket];
+
+	pthread_mutex_lock(&conn->lock);
+	bool congested = pending_output(conn) >= OUTPUT_HIGH_WATERMARK;
+	pthread_mutex_unlock(&conn->lock);
+	return congested;
+}
+
+bool connection_park(server_t *server, size_t socket, struct scan *scan) {
+	connection_t *conn = &server->connections[socket];
+
+	// checked under the lock so the listen loop can't drain the output in between
+	pthread_mutex_lock(&conn->lock);
+	bool parked = !conn->closing && pending_output(conn) >= OUTPUT_LOW_WATERMARK;
+	if (parked)
+		conn->scan = scan;
+	pthread_mutex_unlock(&conn->lock);
+	return parked;
+}
+
+static void connection_writable(server_t *server, size_t socket) {
+	connection_t *conn = &server->connections[socket];
+
+	pthread_mutex_lock(&conn->lock);
+	flush_output(server, socket);
+	if (pending_output(conn) == 0)
+		watch_writable(server, socket, false);
+
+	// hand a paused SELECT back to the pool once the client has caught up
+	if (conn->scan && pending_output(conn) < OUTPUT_LOW_WATERMARK) {
+		thread_pool_add_work(server->pool, resume_scan, conn->scan);
+		conn->scan = NULL;
+	}
+	pthread_mutex_unlock(&conn->lock);
+}
+
+void connection_close(server_t *server, size_t socket) {
+	connection_t *conn = &server->connections[socket];
+
+	pthread_mutex_lock(&conn->lock);
+	close_connection(server, socket);
+	pthread_mutex_unlock(&conn->lock);
+}
+
 void assign_work(void *arg) {
 	server_t *server = (server_t *)arg;
 	if (!server) {
@@ -45,6 +290,7 @@ void assign_work(void *arg) {
 		// full_sem but just for sanity we put it in an if statement
 		if ((cli_req = dequeue(server->request_queue))) // check if dequeue worked
 		{
+			trace_stamp(cli_req->trace, TRACE_DEQUEUED);
 			thread_pool_add_work(server->pool, execute_request, cli_req);
 			sem_post(&(server->empty_sem)); // signal that the queue is not full anymore
 		}
@@ -63,8 +309,37 @@ server_t *server_create(bool daemon, size_t port, size_t request_handling, char
 
 	server = calloc(1, sizeof(*server));
 
+	if (!(server->locks = lock_manager_create(LOCK_FILE))) {
+		log_to_file("Error: Couldn't lock '%s' in server_create(), is another server using the database?\n", LOCK_FILE);
+		free(server);
+		return NULL;
+	}
+	if (!(server->catalog = catalog_open(CATALOG_FILE, META_FILE)) || catalog_open_indexes(server->catalog, INDEX_CATALOG) < 0) {
+		log_to_file("Error: Couldn't open the catalog '%s' in server_create()\n", CATALOG_FILE);
+		catalog_close(server->catalog);
+		lock_manager_destroy(server->locks);
+		free(server);
+		return NULL;
+	}
+
 	server->pool = thread_pool_create(nr_of_threads);
 	server->request_queue = new_queue(queue_size);
+	server->statements = statement_cache_create();
+	server->results = result_cache_create();
+	server->keys = primary_keys_create();
+	server->appends = appends_create();
+	if (primary_keys_load(server->keys, server->catalog) < 0)
+		log_to_file("Error: Couldn't load every primary key in server_create(), they are read on the first INSERT\n");
+	server->connections = calloc(FD_SETSIZE, sizeof(connection_t));
+	for (size_t i = 0; i < FD_SETSIZE; i++) {
+		pthread_mutex_init(&server->connections[i].lock, NULL);
+		string_init(&server->connections[i].input, NULL, 0);
+		string_init(&server->connections[i].output, NULL, 0);
+	}
+	pthread_mutex_init(&server->write_lock, NULL);
+	FD_ZERO(&server->write_sockets);
+	if (pipe2(server->wake_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+		log_to_file("Error: Couldn't pipe2() in server_create()\n");
 	server->queue_size = queue_size;
 	log_file = log;
 	if (log_file) {
@@ -96,6 +371,248 @@ server_t *server_create(bool daemon, size_t port, size_t request_handling, char
 	return server;
 }
 
+// the descriptor may be reused, start from a clean connection
+static void accept_connection(server_t *server, size_t socket) {
+	connection_t *conn = &server->connections[socket];
+
+	pthread_mutex_lock(&conn->lock);
+	conn->protocol = PROTOCOL_TEXT;
+	conn->negotiated = false;
+	conn->closing = false;
+	conn->in_flight = 0;
+	string_clear(&conn->input);
+	conn->input_offset = 0;
+	string_clear(&conn->output);
+	conn->output_offset = 0;
+	pthread_mutex_unlock(&conn->lock);
+
+	stats_add(&stats_local()->connections_opened, 1);
+	statement_cache_forget(server->statements, socket);
+	log_to_file("Accepted new connection from %s\n", get_ip_from_socket_fd(socket));
+}
+
+// handles received bytes of socket, client_msg is NUL terminated after them
+static void receive_data(server_t *server, size_t socket, char *client_msg, size_t received, uint64_t received_ns) {
+	connection_t *conn = &server->connections[socket];
+	stats_add(&stats_local()->bytes_received, received);
+
+	pthread_mutex_lock(&conn->lock);
+	if (!conn->negotiated) {
+		conn->negotiated = true;
+		if (protocol_is_handshake(client_msg, received)) { // accept by echoing the handshake
+			char handshake[HANDSHAKE_SIZE];
+			protocol_handshake(handshake);
+			conn->protocol = PROTOCOL_BINARY;
+			if (queue_output(server, socket, handshake, HANDSHAKE_SIZE) < 0)
+				log_to_file("Error: Couldn't send() the handshake in receive_data()\n");
+			receive_frames(server, socket, client_msg + HANDSHAKE_SIZE, received - HANDSHAKE_SIZE, received_ns);
+			pthread_mutex_unlock(&conn->lock);
+			return;
+		}
+	}
+	if (conn->protocol == PROTOCOL_BINARY) {
+		receive_frames(server, socket, client_msg, received, received_ns);
+		pthread_mutex_unlock(&conn->lock);
+		return;
+	}
+	pthread_mutex_unlock(&conn->lock);
+
+	size_t length = strlen(client_msg);
+	if (!length) // nothing was received
+		return;
+	char *msg = (char *)malloc((length + 1) * sizeof(char)); // malloc new msg so it can persist with the new thread
+	strcpy(msg, client_msg);								 // copy client message to a new string
+
+	if (client_newline(&msg)) // the client only sent newline and no request
+	{
+		free(msg);
+		return;
+	}
+
+	pthread_mutex_lock(&conn->lock);
+	conn->in_flight++;
+	pthread_mutex_unlock(&conn->lock);
+	dispatch_statement(server, socket, msg, received_ns);
+}
+
+// what a completion of the listen ring is for, kept in the top byte of its user_data
+#define LISTEN_ACCEPT 1
+#define LISTEN_RECEIVE 2
+#define LISTEN_WAKE 3
+#define LISTEN_WRITABLE 4
+
+// queues op on socket, the descriptor is a fixed file of the ring at the index of its number
+static struct io_uring_sqe *listener_queue(listener_t *listener, int op, size_t socket, uint8_t opcode) {
+	struct io_uring_sqe *sqe = uring_sqe(listener->ring);
+	if (!sqe) {
+		log_to_file("Error: Couldn't queue an io_uring submission for socket %ld in listener_queue()\n", socket);
+		return NULL;
+	}
+	sqe->opcode = opcode;
+	sqe->fd = (int)socket;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->user_data = (uint64_t)op << 56 | (uint64_t)(listener->generations[socket] & 0xffffff) << 32 | socket;
+
+	if (op == LISTEN_RECEIVE) { // into the registered buffer of the socket, leaving room for a NUL
+		sqe->addr = (uintptr_t)(listener->buffers + socket * RECEIVE_SIZE);
+		sqe->len = RECEIVE_SIZE - 1;
+	} else if (op == LISTEN_WAKE) {
+		sqe->addr = (uintptr_t)listener->drain;
+		sqe->len = sizeof(listener->drain);
+	} else if (op == LISTEN_WRITABLE) {
+		sqe->poll32_events = POLLOUT;
+		FD_SET(socket, &listener->polling);
+	}
+	return sqe;
+}
+
+static void listener_accept(server_t *server, listener_t *listener) {
+	server->address_size = sizeof(server->storage);
+	struct io_uring_sqe *sqe = listener_queue(listener, LISTEN_ACCEPT, server->socket, IORING_OP_ACCEPT);
+	if (sqe) {
+		sqe->addr = (uintptr_t)&server->storage;
+		sqe->addr2 = (uintptr_t)&server->address_size;
+	}
+}
+
+// polls the sockets the workers couldn't write everything to
+static void listener_watch(server_t *server, listener_t *listener) {
+	fd_set writable;
+	pthread_mutex_lock(&server->write_lock);
+	writable = server->write_sockets;
+	pthread_mutex_unlock(&server->write_lock);
+
+	for (size_t i = 0; i < FD_SETSIZE; i++)
+		if (FD_ISSET(i, &writable) && !FD_ISSET(i, &listener->polling))
+			listener_queue(listener, LISTEN_WRITABLE, i, IORING_OP_POLL_ADD);
+}
+
+static bool connection_closing(server_t *server, size_t socket) {
+	connection_t *conn = &server->connections[socket];
+
+	pthread_mutex_lock(&conn->lock);
+	bool closing = conn->closing;
+	pthread_mutex_unlock(&conn->lock);
+	return closing;
+}
+
+static void listener_complete(server_t *server, listener_t *listener, uint64_t user_data, int result, uint64_t received_ns) {
+	int op = (int)(user_data >> 56);
+	uint32_t generation = (uint32_t)(user_data >> 32) & 0xffffff;
+	size_t socket = (uint32_t)user_data;
+
+	switch (op) {
+	case LISTEN_ACCEPT:
+		listener_accept(server, listener);
+		if (result < 0) {
+			log_to_file("Error: Couldn't accept() in listener_complete()\n");
+			break;
+		}
+		socket = (size_t)result;
+		if (socket >= FD_SETSIZE) {
+			log_to_file("Error: Too many connections, refusing %s in listener_complete()\n", get_ip_from_socket_fd(result));
+			close(result);
+			break;
+		}
+		if (uring_update_file(listener->ring, socket, result) < 0) {
+			log_to_file("Error: Couldn't make socket %ld a fixed file in listener_complete()\n", socket);
+			close(result);
+			break;
+		}
+		listener->generations[socket]++;
+		accept_connection(server, socket);
+		listener_queue(listener, LISTEN_RECEIVE, socket, IORING_OP_READ_FIXED);
+		break;
+	case LISTEN_RECEIVE:
+		if (generation != (listener->generations[socket] & 0xffffff)) // the descriptor was accepted again since
+			break;
+		if (result > 0) {
+			char *client_msg = listener->buffers + socket * RECEIVE_SIZE;
+			client_msg[result] = '\0';
+			receive_data(server, socket, client_msg, result, received_ns);
+			if (!connection_closing(server, socket)) {
+				listener_queue(listener, LISTEN_RECEIVE, socket, IORING_OP_READ_FIXED);
+				break;
+			}
+		} else {
+			if (result < 0)
+				log_to_file("Error: Couldn't recv() in listener_complete()\n");
+			connection_close(server, socket); // the client hung up
+		}
+		uring_update_file(listener->ring, socket, -1); // the ring's reference would keep the socket open
+		break;
+	case LISTEN_WAKE:
+		listener_watch(server, listener);
+		listener_queue(listener, LISTEN_WAKE, server->wake_pipe[0], IORING_OP_READ);
+		break;
+	case LISTEN_WRITABLE:
+		FD_CLR(socket, &listener->polling);
+		if (generation != (listener->generations[socket] & 0xffffff))
+			break;
+		connection_writable(server, socket);
+		pthread_mutex_lock(&server->write_lock);
+		bool watched = FD_ISSET(socket, &server->write_sockets);
+		pthread_mutex_unlock(&server->write_lock);
+		if (watched)
+			listener_queue(listener, LISTEN_WRITABLE, socket, IORING_OP_POLL_ADD);
+		break;
+	}
+}
+
+static void listener_destroy(listener_t *listener) {
+	uring_destroy(listener->ring);
+	free(listener->buffers);
+	free(listener->generations);
+}
+
+/*
+ * The listen loop on io_uring. Accepts, receives and writable polls of every connection are
+ * queued in one ring and handed to the kernel with a single io_uring_enter(), which also
+ * waits for the next completions. The sockets are fixed files of the ring and are received
+ * into one registered buffer. Sends stay with the workers, since the output buffer of a
+ * connection moves as they append to it. Only returns if the ring couldn't be set up.
+ */
+static void listen_uring(server_t *server) {
+	listener_t listener;
+	memset(&listener, 0, sizeof(listener));
+	listener.ring = uring_create(URING_ENTRIES, URING_COMPLETIONS);
+	listener.buffers = malloc((size_t)FD_SETSIZE * RECEIVE_SIZE);
+	listener.generations = calloc(FD_SETSIZE, sizeof(uint32_t));
+	int *files = malloc(FD_SETSIZE * sizeof(int));
+
+	int result = listener.ring && listener.buffers && listener.generations && files ? 0 : -1;
+	if (result == 0) {
+		for (size_t i = 0; i < FD_SETSIZE; i++)
+			files[i] = -1;
+		files[server->socket] = (int)server->socket;
+		files[server->wake_pipe[0]] = server->wake_pipe[0];
+		result = uring_register_files(listener.ring, files, FD_SETSIZE);
+	}
+	if (result == 0)
+		result = uring_register_buffer(listener.ring, listener.buffers, (size_t)FD_SETSIZE * RECEIVE_SIZE);
+	free(files);
+	if (result < 0) {
+		listener_destroy(&listener);
+		return;
+	}
+
+	listener_accept(server, &listener);
+	listener_queue(&listener, LISTEN_WAKE, server->wake_pipe[0], IORING_OP_READ);
+	while (true) {
+		if (uring_submit(listener.ring, 1) < 0)
+			log_to_file("Error: Couldn't io_uring_enter() in listen_uring()\n");
+		uint64_t received_ns = stats_now_ns();
+
+		struct io_uring_cqe *cqe;
+		while ((cqe = uring_peek(listener.ring))) {
+			uint64_t user_data = cqe->user_data;
+			int result = cqe->res;
+			uring_seen(listener.ring);
+			listener_complete(server, &listener, user_data, result, received_ns);
+		}
+	}
+}
+
 void server_listen(server_t *server) {
 	if (listen(server->socket, 30) != 0)
 		log_to_file("Error: Couldn't listen() on port %ld in server_listen()", server->port);
@@ -103,26 +620,53 @@ void server_listen(server_t *server) {
 	printf("Listening on port %ld...\n", server->port);
 	log_to_file("Server listening on port %ld...\n", server->port);
 
+	if (server->io == IO_URING) {
+		listen_uring(server);
+		log_to_file("Error: Couldn't set up io_uring in server_listen(), falling back to select()\n");
+		server->io = IO_POSIX;
+	}
+
 	size_t new_socket;
-	size_t length = 0;
-	char client_msg[1024];
-	char *msg = NULL;
+	ssize_t received = 0;
+	char client_msg[RECEIVE_SIZE];
 
 	size_t max_socket = server->socket;
+	size_t wake_socket = server->wake_pipe[0];
+	char drain[64];
 	fd_set ready_sockets;
+	fd_set writable_sockets;
 	FD_ZERO(&(server->current_sockets));
 	FD_SET(server->socket, &(server->current_sockets)); // add server sockets to fd set
+	FD_SET(wake_socket, &(server->current_sockets));	// workers queueing output wake us up through this
+	if (wake_socket > max_socket)
+		max_socket = wake_socket;
 
 	while (true) {
 		ready_sockets = server->current_sockets; // copy current sockets to new fd_set since select is destructive
-
-		if (select(FD_SETSIZE, &ready_sockets, NULL, NULL, NULL) < 0) // check socket descriptors
-			log_to_file("Error: Couldn't select() in server_listen()");
+		pthread_mutex_lock(&server->write_lock);
+		writable_sockets = server->write_sockets;
+		pthread_mutex_unlock(&server->write_lock);
+
+		if (select(FD_SETSIZE, &ready_sockets, &writable_sockets, NULL, NULL) < 0) { // check socket descriptors
+			if (errno != EINTR)
+				log_to_file("Error: Couldn't select() in server_listen()");
+			continue;
+		}
+		uint64_t selected_ns = stats_now_ns();
 
 		for (size_t i = 0; i <= max_socket; i++) {
+			if (FD_ISSET(i, &writable_sockets)) // flush queued output before reading more requests
+				connection_writable(server, i);
+
 			if (!FD_ISSET(i, &ready_sockets)) // nothing to read on socket descriptor
 				continue;
 
+			if (i == wake_socket) {
+				while (read(wake_socket, drain, sizeof(drain)) > 0)
+					;
+				continue;
+			}
+
 			new_socket = i;
 			if (new_socket == server->socket) // new connection
 			{
@@ -131,39 +675,29 @@ void server_listen(server_t *server) {
 					log_to_file("Error: Couldn't accept() in server_listen()");
 					continue;
 				}
+				if (new_socket >= FD_SETSIZE) {
+					log_to_file("Error: Too many connections, refusing %s in server_listen()\n", get_ip_from_socket_fd(new_socket));
+					close(new_socket);
+					continue;
+				}
+
 				// add new connection to socket descriptors
 				FD_SET(new_socket, &(server->current_sockets));
-				max_socket = new_socket;
-
-				log_to_file("Accepted new connection from %s\n", get_ip_from_socket_fd(new_socket));
-				continue;
-			}
-
-			memset(&client_msg, 0, 1024);					 // clear memory
-			if (recv(new_socket, client_msg, 1024, 0) == -1) // receive data from socket
-			{
-				log_to_file("Error: Couldn't recv() in server_listen()");
+				if (new_socket > max_socket)
+					max_socket = new_socket;
+				accept_connection(server, new_socket);
 				continue;
 			}
 
-			if (!(length = strlen(client_msg))) // nothing was received
-				continue;
-			msg = (char *)malloc((length + 1) * sizeof(char)); // malloc new msg so it can persist with the new thread
-			strcpy(msg, client_msg);						   // copy client message to a new string
-
-			if (client_newline(&msg)) // the client only sent newline and no request
+			memset(&client_msg, 0, sizeof(client_msg));							   // clear memory
+			if ((received = recv(new_socket, client_msg, sizeof(client_msg) - 1, 0)) <= 0) // receive data from socket
 			{
-				free(msg);
+				if (received < 0)
+					log_to_file("Error: Couldn't recv() in server_listen()");
+				connection_close(server, new_socket); // the client hung up
 				continue;
 			}
-
-			// malloc new args so it can persist through the new thread
-			connection_args *args = malloc(sizeof(connection_args));
-			args->server = server;
-			args->socket = new_socket;
-			args->msg = msg;
-
-			thread_pool_add_work(server->pool, handle_connection, args);
+			receive_data(server, new_socket, client_msg, received, selected_ns);
 		}
 	}
 }
@@ -175,12 +709,29 @@ void server_destroy(server_t *server) {
 	thread_pool_wait(server->pool);
 	thread_pool_destroy(server->pool);
 	delete_queue(server->request_queue);
+	lock_manager_destroy(server->locks);
+	statement_cache_destroy(server->statements);
+	result_cache_destroy(server->results);
+	primary_keys_destroy(server->keys);
+	appends_destroy(server->appends);
+	catalog_close(server->catalog);
+	for (size_t i = 0; i < FD_SETSIZE; i++) {
+		pthread_mutex_destroy(&server->connections[i].lock);
+		string_free(&server->connections[i].input);
+		string_free(&server->connections[i].output);
+	}
+	free(server->connections);
+	pthread_mutex_destroy(&server->write_lock);
+	close(server->wake_pipe[0]);
+	close(server->wake_pipe[1]);
+	trace_close();
 
 	free(server);
 }
 
 void server_init(server_t *server) {
 	thread_pool_add_work(server->pool, assign_work, server);
+	replication_start(server->replication, server);
 }
 
 void daemonize_server() {
@@ -0,0 +1,310 @@
+#include "sort.h"
+
+// how the sort key of a row is found and encoded
+typedef struct sorter sorter_t;
+struct sorter {
+	int offset;
+	int width; // of the column in the row
+	char data_type;
+	bool descending;
+	int key_width; // of the encoded key in an entry
+	int entry_size;
+};
+
+static int compare_entries(const void *a, const void *b, void *entry_size) {
+	return memcmp(a, b, *(int *)entry_size);
+}
+
+static void put_u32(char *out, uint32_t value) {
+	out[0] = (char)(value >> 24);
+	out[1] = (char)(value >> 16);
+	out[2] = (char)(value >> 8);
+	out[3] = (char)value;
+}
+
+uint32_t sort_entry_row(const char *entry, int entry_size) {
+	const unsigned char *row = (const unsigned char *)entry + entry_size - sizeof(uint32_t);
+	return (uint32_t)row[0] << 24 | (uint32_t)row[1] << 16 | (uint32_t)row[2] << 8 | row[3];
+}
+
+static void make_entry(sorter_t *sorter, char *entry, const char *row, uint32_t row_number) {
+	const char *field = row + sorter->offset;
+
+	if (sorter->data_type == DT_INT) { // flipping the sign bit makes the unsigned order the signed one
+		put_u32(entry, (uint32_t)decode_int(field) ^ 0x80000000u);
+	} else { // without the left padding and zero filled, shorter strings sort first
+		int skip = 0;
+		while (skip < sorter->width && field[skip] == PADDING)
+			skip++;
+		memcpy(entry, field + skip, sorter->width - skip);
+		memset(entry + sorter->width - skip, 0, skip);
+	}
+	if (sorter->descending)
+		for (int i = 0; i < sorter->key_width; i++)
+			entry[i] = ~entry[i];
+	put_u32(entry + sorter->key_width, row_number);
+}
+
+// sorts entries and writes them to a new run
+static int spill_run(merge_t *merge, char *entries, size_t count) {
+	qsort_r(entries, count, merge->entry_size, compare_entries, &merge->entry_size);
+
+	FILE *run = create_temp_file(SORT_FILE_ENDING);
+	if (!run)
+		return -1;
+	if (fwrite(entries, merge->entry_size, count, run) < count) {
+		log_to_file("Error: Couldn't fwrite() a run in spill_run()\n");
+		fclose(run);
+		return -1;
+	}
+
+	FILE **runs = realloc(merge->runs, (merge->nr_of_runs + 1) * sizeof(FILE *));
+	if (!runs) {
+		fclose(run);
+		return -1;
+	}
+	merge->runs = runs;
+	merge->runs[merge->nr_of_runs++] = run;
+	return 0;
+}
+
+// merges two sorted runs into a new one, the inputs are closed
+static FILE *merge_pair(FILE *a, FILE *b, int entry_size) {
+	FILE *out = create_temp_file(SORT_FILE_ENDING);
+	char *entry_a = malloc(2 * entry_size);
+	char *entry_b = entry_a + entry_size;
+
+	if (out && entry_a) {
+		rewind(a);
+		rewind(b);
+		bool has_a = fread(entry_a, entry_size, 1, a) == 1;
+		bool has_b = fread(entry_b, entry_size, 1, b) == 1;
+		while (has_a || has_b) {
+			if (has_a && (!has_b || memcmp(entry_a, entry_b, entry_size) < 0)) {
+				fwrite(entry_a, entry_size, 1, out);
+				has_a = fread(entry_a, entry_size, 1, a) == 1;
+			} else {
+				fwrite(entry_b, entry_size, 1, out);
+				has_b = fread(entry_b, entry_size, 1, b) == 1;
+			}
+		}
+	}
+
+	bool failed = !out || !entry_a || ferror(a) || ferror(b) || ferror(out);
+	free(entry_a);
+	fclose(a);
+	fclose(b);
+	if (failed && out) {
+		log_to_file("Error: Couldn't merge two runs in merge_pair()\n");
+		fclose(out);
+		return NULL;
+	}
+	return out;
+}
+
+// takes the two oldest runs, so every run goes through about the same number of merges.
+// the caller holds merge->lock, which is released while the pair is merged
+static void merge_next_pair(merge_t *merge) {
+	FILE *a = merge->runs[0];
+	FILE *b = merge->runs[1];
+	merge->nr_of_runs -= 2;
+	memmove(merge->runs, merge->runs + 2, merge->nr_of_runs * sizeof(FILE *));
+	merge->merging++;
+	pthread_mutex_unlock(&merge->lock);
+
+	FILE *out = merge_pair(a, b, merge->entry_size);
+
+	pthread_mutex_lock(&merge->lock);
+	merge->merging--;
+	if (out) // there is room, the pair took two slots
+		merge->runs[merge->nr_of_runs++] = out;
+	else
+		merge->failed = true;
+	pthread_cond_broadcast(&merge->changed);
+}
+
+static void merge_release(merge_t *merge) {
+	pthread_mutex_lock(&merge->lock);
+	bool last = --merge->references == 0;
+	pthread_mutex_unlock(&merge->lock);
+	if (!last)
+		return;
+
+	for (size_t i = 0; i < merge->nr_of_runs; i++)
+		fclose(merge->runs[i]);
+	free(merge->runs);
+	pthread_mutex_destroy(&merge->lock);
+	pthread_cond_destroy(&merge->changed);
+	free(merge);
+}
+
+// runs on the pool next to the sorting thread, it leaves once there is no pair to merge
+static void merge_helper(void *arg) {
+	merge_t *merge = arg;
+
+	pthread_mutex_lock(&merge->lock);
+	while (!merge->failed && merge->nr_of_runs > 1)
+		merge_next_pair(merge);
+	pthread_mutex_unlock(&merge->lock);
+	merge_release(merge);
+}
+
+// merges the runs down to one, with help from the pool, and returns it rewound
+static FILE *merge_runs(merge_t *merge, thread_pool_t *pool) {
+	size_t helpers = merge->nr_of_runs / 2;
+	if (helpers > SORT_MERGE_THREADS)
+		helpers = SORT_MERGE_THREADS;
+	for (size_t i = 1; i < helpers; i++) {
+		pthread_mutex_lock(&merge->lock);
+		merge->references++;
+		pthread_mutex_unlock(&merge->lock);
+		if (!thread_pool_add_work(pool, merge_helper, merge))
+			merge_release(merge);
+	}
+
+	// helpers that never got a thread don't hold anything up, this thread merges what is left
+	pthread_mutex_lock(&merge->lock);
+	while ((!merge->failed && merge->nr_of_runs > 1) || merge->merging) {
+		if (merge->failed || merge->nr_of_runs < 2)
+			pthread_cond_wait(&merge->changed, &merge->lock);
+		else
+			merge_next_pair(merge);
+	}
+	FILE *run = NULL;
+	if (!merge->failed && merge->nr_of_runs == 1) {
+		run = merge->runs[0];
+		merge->nr_of_runs = 0;
+		rewind(run);
+	}
+	pthread_mutex_unlock(&merge->lock);
+	return run;
+}
+
+static void sift_down(char *heap, size_t count, size_t i, int size, char *swap) {
+	while (true) {
+		size_t largest = i, left = 2 * i + 1, right = 2 * i + 2;
+		if (left < count && memcmp(heap + left * size, heap + largest * size, size) > 0)
+			largest = left;
+		if (right < count && memcmp(heap + right * size, heap + largest * size, size) > 0)
+			largest = right;
+		if (largest == i)
+			return;
+		memcpy(swap, heap + i * size, size);
+		memcpy(heap + i * size, heap + largest * size, size);
+		memcpy(heap + largest * size, swap, size);
+		i = largest;
+	}
+}
+
+// keeps the limit smallest entries in a max-heap, the largest is the one to beat
+static void heap_offer(char *heap, size_t *count, size_t limit, const char *entry, int size, char *swap) {
+	if (*count < limit) {
+		size_t i = (*count)++;
+		memcpy(heap + i * size, entry, size);
+		while (i > 0 && memcmp(heap + (i - 1) / 2 * size, heap + i * size, size) < 0) {
+			size_t parent = (i - 1) / 2;
+			memcpy(swap, heap + i * size, size);
+			memcpy(heap + i * size, heap + parent * size, size);
+			memcpy(heap + parent * size, swap, size);
+			i = parent;
+		}
+	} else if (memcmp(entry, heap, size) < 0) {
+		memcpy(heap, entry, size);
+		sift_down(heap, *count, 0, size, swap);
+	}
+}
+
+/*
+ * Puts the rows the scan would send in ORDER BY order. The sort keys and row numbers of the
+ * matching rows are extracted and sorted in memory if they fit SORT_MEMORY, the scan then
+ * seeks to every row in turn. Larger inputs are spilled as sorted runs, merged on the pool
+ * and the scan reads the row numbers from the merged run. With a LIMIT that fits in memory
+ * only a heap of the best LIMIT + OFFSET rows is kept, limit_scan then skips to the page.
+ */
+int sort_scan(scan_t *scan, request_t *request, arena_t *arena, char **client_msg) {
+	sorter_t sorter;
+	column_t *column = find_column(scan->columns, request->order_by->name, &sorter.offset);
+	if (!column) {
+		*client_msg = create_format_buffer(arena, "error: table '%s' has no column '%s'\n", request->table_name, request->order_by->name);
+		return -1;
+	}
+	sorter.width = column_width(column);
+	sorter.data_type = column->data_type;
+	sorter.descending = request->descending;
+	sorter.key_width = column->data_type == DT_INT ? (int)sizeof(uint32_t) : column->char_size;
+	sorter.entry_size = sorter.key_width + sizeof(uint32_t);
+
+	if (request->limit == 0) {
+		scan->nr_of_rows = 0;
+		return 0;
+	}
+
+	// OFFSET skips rows of the sorted result, which are still needed to find the page
+	long wanted = request->limit > 0 ? (long)request->limit + request->offset : -1;
+	merge_t *merge = calloc(1, sizeof(merge_t));
+	bool top_k = wanted > 0 && (size_t)wanted <= SORT_MEMORY / sorter.entry_size;
+	size_t capacity = top_k ? (size_t)wanted : SORT_MEMORY / sorter.entry_size + 1;
+	char *entries = malloc(capacity * sorter.entry_size);
+	char *scratch = malloc(2 * sorter.entry_size);
+	char *batch = malloc((size_t)SCAN_BATCH * scan->row_size);
+	uint32_t *row_numbers = malloc(SCAN_BATCH * sizeof(uint32_t));
+	size_t count = 0, total = 0;
+	int result = merge && entries && scratch && batch && row_numbers ? 0 : -1;
+
+	if (merge) {
+		pthread_mutex_init(&merge->lock, NULL);
+		pthread_cond_init(&merge->changed, NULL);
+		merge->references = 1;
+		merge->entry_size = sorter.entry_size;
+	}
+
+	while (result == 0 && scan->next_row < scan->nr_of_rows) {
+		size_t read = scan_read_batch(scan, batch, row_numbers);
+		for (size_t i = 0; result == 0 && i < read; i++) {
+			make_entry(&sorter, scratch, batch + i * scan->row_size, row_numbers[i]);
+			total++;
+			if (top_k) {
+				heap_offer(entries, &count, capacity, scratch, sorter.entry_size, scratch + sorter.entry_size);
+				continue;
+			}
+			if (count == capacity) {
+				result = spill_run(merge, entries, count);
+				count = 0;
+			}
+			memcpy(entries + count * sorter.entry_size, scratch, sorter.entry_size);
+			count++;
+		}
+	}
+
+	// the scan sends the rows in their new order and no longer needs to filter them
+	scan->next_row = 0;
+	scan->key = NULL;
+	if (result == 0 && !merge->nr_of_runs) {
+		qsort_r(entries, count, sorter.entry_size, compare_entries, &sorter.entry_size);
+		if ((scan->rows = arena_alloc(scan->arena, (count ? count : 1) * sizeof(uint32_t)))) {
+			for (size_t i = 0; i < count; i++)
+				scan->rows[i] = sort_entry_row(entries + i * sorter.entry_size, sorter.entry_size);
+			scan->nr_of_rows = wanted > 0 && (size_t)wanted < count ? wanted : (long)count;
+		} else
+			result = -1;
+	} else if (result == 0) {
+		if (count)
+			result = spill_run(merge, entries, count);
+		if (result == 0 && !(scan->order_file = merge_runs(merge, ((server_t *)scan->server)->pool)))
+			result = -1;
+		scan->order_entry_size = sorter.entry_size;
+		scan->order_entry = arena_alloc(scan->arena, sorter.entry_size);
+		scan->rows = NULL;
+		scan->nr_of_rows = wanted > 0 && (size_t)wanted < total ? wanted : (long)total;
+	}
+
+	if (merge)
+		merge_release(merge);
+	free(entries);
+	free(scratch);
+	free(batch);
+	free(row_numbers);
+	if (result < 0)
+		*client_msg = create_format_buffer(arena, "error: the server couldn't sort table '%s'\n", request->table_name);
+	return result;
+}
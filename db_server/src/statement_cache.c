@@ -0,0 +1,541 @@
+#include "statement_cache.h"
+
+static bool is_identifier(char ch) {
+	return isalnum((unsigned char)ch) || ch == '_';
+}
+
+/*
+ * Collapses whitespace and replaces every literal in text with '?' so that
+ * statements that only differ in their values share a key. The literals
+ * are returned in text order. Returns false if text can't be normalized,
+ * the caller should then hand it to the parser as is.
+ */
+static bool normalize(const char *text, char *key, literal_t *literals, size_t *nr_of_literals) {
+	const char *p = text;
+	char prev = '\0';
+	size_t length = 0;
+	bool space = false;
+
+	*nr_of_literals = 0;
+	while (*p) {
+		if (isspace((unsigned char)*p)) {
+			space = length > 0;
+			p++;
+			continue;
+		}
+		if (space)
+			key[length++] = ' ';
+		space = false;
+
+		bool number = isdigit((unsigned char)*p) || (*p == '-' && isdigit((unsigned char)p[1]));
+		if (*p == '\'' || (number && !is_identifier(prev))) {
+			if (*nr_of_literals == MAX_LITERALS)
+				return false;
+
+			literal_t *literal = &literals[(*nr_of_literals)++];
+			literal->start = p;
+			if (*p == '\'') {
+				const char *end = strpbrk(p + 1, "'\n");
+				if (!end || *end == '\n') // unterminated string, let the parser report it
+					return false;
+				literal->data_type = DT_VARCHAR;
+				p = end + 1;
+			} else {
+				literal->data_type = DT_INT;
+				p++; // the digit or the sign
+				while (isdigit((unsigned char)*p))
+					p++;
+			}
+			literal->length = p - literal->start;
+			key[length++] = '?';
+			prev = '?';
+			continue;
+		}
+		if (*p == '?') // parameters are only valid in PREPARE
+			return false;
+
+		prev = key[length++] = *p++;
+	}
+	key[length] = '\0';
+
+	return true;
+}
+
+static bool is_cacheable(const char *key) {
+	return strncmp(key, "INSERT ", 7) == 0 || strncmp(key, "UPDATE ", 7) == 0 ||
+		   strncmp(key, "DELETE ", 7) == 0 || strncmp(key, "SELECT ", 7) == 0;
+}
+
+// whether the parser fills the column with a literal from the statement text
+static bool is_value_column(request_t *request, bool where) {
+	if (where)
+		return true;
+	return request->request_type == RT_INSERT || request->request_type == RT_UPDATE;
+}
+
+static char *request_strndup(request_t *request, const char *str, size_t length) {
+	char *copy = request_alloc(request, length + 1);
+	memcpy(copy, str, length);
+	copy[length] = '\0';
+	return copy;
+}
+
+/*
+ * Copies the columns of a template into the arena of request. If literals
+ * is set, every value column takes its value from the next literal instead
+ * of the template.
+ */
+static column_t *clone_columns(request_t *request, column_t *source, bool values, literal_t **literal) {
+	column_t *first = NULL;
+	column_t **link = &first;
+
+	for (; source; source = source->next) {
+		column_t *column = request_alloc(request, sizeof(column_t));
+		*column = *source;
+		column->name = source->name ? request_strndup(request, source->name, strlen(source->name)) : NULL;
+		column->next = NULL;
+
+		if (values && literal) {
+			literal_t *current = (*literal)++;
+			if (current->data_type == DT_INT)
+				column->int_val = (int)strtol(current->start, NULL, 10);
+			else
+				column->char_val = request_strndup(request, current->start, current->length);
+		} else if (source->char_val)
+			column->char_val = request_strndup(request, source->char_val, strlen(source->char_val));
+
+		*link = column;
+		link = &column->next;
+	}
+
+	return first;
+}
+
+// clones the template of statement, or copies source if statement is NULL
+static request_t *clone_request(request_t *source, literal_t *literals, statement_t *statement) {
+	request_t *request = create_request(STATEMENT_ARENA_SIZE);
+	literal_t *literal = literals;
+
+	request->request_type = source->request_type;
+	request->table_name = source->table_name ? request_strndup(request, source->table_name, strlen(source->table_name)) : NULL;
+	request->columns = clone_columns(request, source->columns, is_value_column(source, false), literals ? &literal : NULL);
+	request->where = clone_columns(request, source->where, is_value_column(source, true), literals ? &literal : NULL);
+	request->group_by = clone_columns(request, source->group_by, false, NULL);
+	request->order_by = clone_columns(request, source->order_by, false, NULL);
+	request->descending = source->descending;
+	request->limit = source->limit;
+	request->offset = source->offset;
+	request->join_table = source->join_table ? request_strndup(request, source->join_table, strlen(source->join_table)) : NULL;
+	request->join_on = clone_columns(request, source->join_on, false, NULL);
+	request->memory = source->memory;
+	if (statement && statement->limit_literal >= 0)
+		request->limit = (int)strtol(literals[statement->limit_literal].start, NULL, 10);
+	if (statement && statement->offset_literal >= 0)
+		request->offset = (int)strtol(literals[statement->offset_literal].start, NULL, 10);
+
+	return request;
+}
+
+// the literal that follows keyword in key, -1 if key doesn't have it
+static int keyword_literal(const char *key, const char *keyword) {
+	size_t length = strlen(keyword);
+	for (const char *p = strstr(key, keyword); p; p = strstr(p + 1, keyword)) {
+		if ((p != key && p[-1] != ' ') || strncmp(p + length, " ?", 2) != 0)
+			continue;
+		int literal = 0;
+		for (const char *q = key; q < p; q++)
+			literal += *q == '?';
+		return literal;
+	}
+	return -1;
+}
+
+// collects the data types of the value columns, LIMIT and OFFSET of statement. Returns false if they don't line up with the literals
+static bool bind_literals(statement_t *statement, const char *key, request_t *request, literal_t *literals, size_t nr_of_literals) {
+	char *data_types = statement->data_types;
+	size_t count = 0;
+	column_t *column;
+
+	if (is_value_column(request, false))
+		for (column = request->columns; column; column = column->next) {
+			if (count == nr_of_literals || column->data_type != literals[count].data_type)
+				return false;
+			data_types[count++] = column->data_type;
+		}
+	for (column = request->where; column; column = column->next) {
+		if (count == nr_of_literals || column->data_type != literals[count].data_type)
+			return false;
+		data_types[count++] = column->data_type;
+	}
+
+	// the row counts of a page come last, so paging through a table uses a single shape
+	statement->limit_literal = request->request_type == RT_SELECT ? keyword_literal(key, "LIMIT") : -1;
+	statement->offset_literal = request->request_type == RT_SELECT ? keyword_literal(key, "OFFSET") : -1;
+	int page[2] = {statement->limit_literal, statement->offset_literal};
+	for (size_t i = 0; i < 2; i++) {
+		if (page[i] < 0)
+			continue;
+		if ((size_t)page[i] != count || literals[count].data_type != DT_INT)
+			return false;
+		data_types[count++] = DT_INT;
+	}
+
+	return count == nr_of_literals;
+}
+
+// the parser rejects negative row counts, a cached statement has to leave them to it
+static bool valid_page(statement_t *statement, literal_t *literals) {
+	return (statement->limit_literal < 0 || literals[statement->limit_literal].start[0] != '-') &&
+		   (statement->offset_literal < 0 || literals[statement->offset_literal].start[0] != '-');
+}
+
+static binding_t *binding_create() {
+	binding_t *binding = calloc(1, sizeof(binding_t));
+	if (!binding)
+		return NULL;
+	binding->references = 1;
+	pthread_mutex_init(&binding->lock, NULL);
+	return binding;
+}
+
+static binding_t *binding_acquire(binding_t *binding) {
+	if (binding)
+		__atomic_fetch_add(&binding->references, 1, __ATOMIC_RELAXED);
+	return binding;
+}
+
+void binding_release(binding_t *binding) {
+	if (!binding || __atomic_sub_fetch(&binding->references, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	if (binding->arena)
+		arena_destroy(binding->arena);
+	pthread_mutex_destroy(&binding->lock);
+	free(binding);
+}
+
+static void statement_free(statement_t *statement) {
+	binding_release(statement->binding);
+	destroy_request(statement->template);
+	free(statement->key);
+	free(statement);
+}
+
+static void statement_cache_flush(statement_cache_t *cache) {
+	statement_t *current, *next;
+
+	for (size_t i = 0; i < STATEMENT_BUCKETS; i++) {
+		for (current = cache->buckets[i]; current; current = next) {
+			next = current->next;
+			statement_free(current);
+		}
+		cache->buckets[i] = NULL;
+	}
+	cache->count = 0;
+}
+
+static statement_t *statement_find(statement_cache_t *cache, const char *key) {
+	statement_t *statement = cache->buckets[string_hash(key, 0) % STATEMENT_BUCKETS];
+
+	while (statement && strcmp(statement->key, key) != 0)
+		statement = statement->next;
+	return statement;
+}
+
+// caches request under key, returns a reference to the binding of its statement, NULL if it isn't cached
+static binding_t *statement_insert(statement_cache_t *cache, char *key, request_t *request, literal_t *literals, size_t nr_of_literals) {
+	statement_t *statement = calloc(1, sizeof(statement_t));
+	if (!statement || !bind_literals(statement, key, request, literals, nr_of_literals)) {
+		free(statement);
+		return NULL;
+	}
+	statement->nr_of_literals = nr_of_literals;
+
+	pthread_rwlock_wrlock(&cache->lock);
+	statement_t *existing = statement_find(cache, key);
+	if (existing) { // the same shape with other literal types, keep the latest one and its binding, the table is the same
+		destroy_request(existing->template);
+		existing->template = clone_request(request, NULL, NULL);
+		memcpy(existing->data_types, statement->data_types, sizeof(statement->data_types));
+		existing->limit_literal = statement->limit_literal;
+		existing->offset_literal = statement->offset_literal;
+		binding_t *binding = binding_acquire(existing->binding);
+		pthread_rwlock_unlock(&cache->lock);
+		free(statement);
+		return binding;
+	}
+
+	if (cache->count >= STATEMENT_CACHE_SIZE) // a bounded cache without bookkeeping on hits
+		statement_cache_flush(cache);
+
+	size_t bucket = string_hash(key, 0) % STATEMENT_BUCKETS;
+	statement->key = strdup(key);
+	statement->template = clone_request(request, NULL, NULL);
+	statement->binding = binding_create();
+	statement->next = cache->buckets[bucket];
+	cache->buckets[bucket] = statement;
+	cache->count++;
+	binding_t *binding = binding_acquire(statement->binding);
+	pthread_rwlock_unlock(&cache->lock);
+	return binding;
+}
+
+/*
+ * Returns the request for text, either cloned from a cached template or
+ * from the parser. In the latter case parsed is set and the request points
+ * into text. *binding gets a reference to the binding of the statement, or
+ * NULL if it isn't cached.
+ */
+static request_t *cached_parse(statement_cache_t *cache, char *text, char **error, bool *parsed, binding_t **binding) {
+	literal_t literals[MAX_LITERALS];
+	size_t nr_of_literals;
+	request_t *request = NULL;
+	char *key = malloc(strlen(text) + 1);
+
+	*parsed = true;
+	*binding = NULL;
+	if (!normalize(text, key, literals, &nr_of_literals) || !is_cacheable(key)) {
+		free(key);
+		return parse_request(text, error);
+	}
+
+	pthread_rwlock_rdlock(&cache->lock);
+	statement_t *statement = statement_find(cache, key);
+	if (statement && statement->nr_of_literals == nr_of_literals) {
+		size_t i;
+		for (i = 0; i < nr_of_literals && statement->data_types[i] == literals[i].data_type; i++)
+			;
+		if (i == nr_of_literals && valid_page(statement, literals)) {
+			request = clone_request(statement->template, literals, statement);
+			*binding = binding_acquire(statement->binding);
+		}
+	}
+	pthread_rwlock_unlock(&cache->lock);
+
+	if (request) {
+		*parsed = false;
+		__atomic_fetch_add(&cache->hits, 1, __ATOMIC_RELAXED);
+		free(key);
+		return request;
+	}
+
+	__atomic_fetch_add(&cache->misses, 1, __ATOMIC_RELAXED);
+	if ((request = parse_request(text, error)))
+		*binding = statement_insert(cache, key, request, literals, nr_of_literals);
+
+	free(key);
+	return request;
+}
+
+static prepared_t **prepared_find(statement_cache_t *cache, size_t client_socket, const char *name) {
+	prepared_t **link = &cache->prepared[string_hash(name, client_socket) % STATEMENT_BUCKETS];
+
+	while (*link && ((*link)->client_socket != client_socket || strcmp((*link)->name, name) != 0))
+		link = &(*link)->next;
+	return link;
+}
+
+// reads an identifier at *text into name and moves *text past it
+static bool read_name(char **text, char *name, size_t size) {
+	size_t length = 0;
+
+	while (isspace((unsigned char)**text))
+		(*text)++;
+	while (is_identifier(**text) && length + 1 < size)
+		name[length++] = *(*text)++;
+	name[length] = '\0';
+
+	return length > 0 && !is_identifier(**text);
+}
+
+// PREPARE <name> AS <statement with ? parameters>
+static request_t *prepare(statement_cache_t *cache, size_t client_socket, char *text, char **error) {
+	char name[64];
+	char *body = text;
+	size_t nr_of_parameters = 0;
+
+	if (!read_name(&body, name, sizeof(name))) {
+		*error = "syntax error: PREPARE expects a statement name\n";
+		return NULL;
+	}
+	while (isspace((unsigned char)*body))
+		body++;
+	if (strncmp(body, "AS", 2) != 0 || !isspace((unsigned char)body[2])) {
+		*error = "syntax error: expected AS after the PREPARE statement name\n";
+		return NULL;
+	}
+	body += 3;
+
+	// validate the statement by parsing it with a placeholder value for each parameter
+	char *check = malloc(strlen(body) + 1);
+	bool quoted = false;
+	size_t i;
+	for (i = 0; body[i]; i++) {
+		quoted ^= body[i] == '\'';
+		check[i] = (!quoted && body[i] == '?') ? '0' : body[i];
+		nr_of_parameters += !quoted && body[i] == '?';
+	}
+	check[i] = '\0';
+
+	request_t *request = parse_request(check, error);
+	free(check);
+	if (!request)
+		return NULL;
+	bool cacheable = request->request_type == RT_INSERT || request->request_type == RT_UPDATE ||
+					 request->request_type == RT_DELETE || request->request_type == RT_SELECT;
+	destroy_request(request);
+	if (!cacheable) {
+		*error = "error: only INSERT, UPDATE, DELETE and SELECT can be prepared\n";
+		return NULL;
+	}
+
+	pthread_mutex_lock(&cache->prepared_lock);
+	prepared_t **link = prepared_find(cache, client_socket, name);
+	prepared_t *prepared = *link;
+	if (prepared) { // redefining a statement replaces it
+		free(prepared->text);
+	} else {
+		prepared = calloc(1, sizeof(prepared_t));
+		prepared->name = strdup(name);
+		prepared->client_socket = client_socket;
+		*link = prepared;
+	}
+	prepared->text = strdup(body);
+	prepared->nr_of_parameters = nr_of_parameters;
+	pthread_mutex_unlock(&cache->prepared_lock);
+
+	request = create_request(sizeof(name));
+	request->request_type = RT_PREPARE;
+	request->table_name = request_strndup(request, name, strlen(name));
+	return request;
+}
+
+// EXECUTE <name> [(value, ...)]
+static request_t *execute(statement_cache_t *cache, size_t client_socket, char *text, char **error, binding_t **binding) {
+	char name[64];
+	char *arguments = text;
+	literal_t literals[MAX_LITERALS];
+	size_t nr_of_literals, i;
+
+	if (!read_name(&arguments, name, sizeof(name))) {
+		*error = "syntax error: EXECUTE expects a statement name\n";
+		return NULL;
+	}
+
+	// the argument list may only contain literals and punctuation
+	char *key = malloc(strlen(arguments) + 1);
+	bool valid = normalize(arguments, key, literals, &nr_of_literals);
+	for (i = 0; valid && key[i]; i++)
+		valid = strchr("?,;() ", key[i]) != NULL;
+	free(key);
+	if (!valid) {
+		*error = "syntax error: EXECUTE expects a list of values\n";
+		return NULL;
+	}
+
+	pthread_mutex_lock(&cache->prepared_lock);
+	prepared_t *prepared = *prepared_find(cache, client_socket, name);
+	if (!prepared) {
+		pthread_mutex_unlock(&cache->prepared_lock);
+		*error = "error: prepared statement does not exist\n";
+		return NULL;
+	}
+	if (prepared->nr_of_parameters != nr_of_literals) {
+		*error = "error: wrong number of parameters for prepared statement\n";
+		pthread_mutex_unlock(&cache->prepared_lock);
+		return NULL;
+	}
+
+	// substitute the arguments and take the normal cached path
+	size_t length = strlen(prepared->text) + 1;
+	for (i = 0; i < nr_of_literals; i++)
+		length += literals[i].length;
+	char *statement = malloc(length);
+	char *out = statement;
+	bool quoted = false;
+	i = 0;
+	for (char *p = prepared->text; *p; p++) {
+		quoted ^= *p == '\'';
+		if (quoted || *p != '?') {
+			*out++ = *p;
+			continue;
+		}
+		memcpy(out, literals[i].start, literals[i].length);
+		out += literals[i++].length;
+	}
+	*out = '\0';
+	pthread_mutex_unlock(&cache->prepared_lock);
+
+	bool parsed;
+	request_t *request = cached_parse(cache, statement, error, &parsed, binding);
+	if (request && parsed) { // detach the request from the statement buffer
+		request_t *copy = clone_request(request, NULL, NULL);
+		destroy_request(request);
+		request = copy;
+	}
+	free(statement);
+	return request;
+}
+
+statement_cache_t *statement_cache_create() {
+	statement_cache_t *cache = calloc(1, sizeof(*cache));
+
+	pthread_rwlock_init(&cache->lock, NULL);
+	pthread_mutex_init(&cache->prepared_lock, NULL);
+
+	return cache;
+}
+
+void statement_cache_destroy(statement_cache_t *cache) {
+	if (!cache) // sanity check
+		return;
+
+	statement_cache_flush(cache);
+	for (size_t i = 0; i < STATEMENT_BUCKETS; i++) {
+		prepared_t *current, *next;
+		for (current = cache->prepared[i]; current; current = next) {
+			next = current->next;
+			free(current->name);
+			free(current->text);
+			free(current);
+		}
+	}
+
+	pthread_rwlock_destroy(&cache->lock);
+	pthread_mutex_destroy(&cache->prepared_lock);
+	free(cache);
+}
+
+// *binding gets a reference to the binding of the statement, which the caller releases, NULL if it isn't cached
+request_t *statement_cache_parse(statement_cache_t *cache, size_t client_socket, char *text, char **error, binding_t **binding) {
+	char *start = text;
+
+	*binding = NULL;
+	while (isspace((unsigned char)*start))
+		start++;
+	if (strncmp(start, "PREPARE", 7) == 0 && isspace((unsigned char)start[7]))
+		return prepare(cache, client_socket, start + 7, error);
+	if (strncmp(start, "EXECUTE", 7) == 0 && isspace((unsigned char)start[7]))
+		return execute(cache, client_socket, start + 7, error, binding);
+
+	bool parsed;
+	return cached_parse(cache, text, error, &parsed, binding);
+}
+
+void statement_cache_forget(statement_cache_t *cache, size_t client_socket) {
+	pthread_mutex_lock(&cache->prepared_lock);
+	for (size_t i = 0; i < STATEMENT_BUCKETS; i++) {
+		prepared_t **link = &cache->prepared[i];
+		while (*link) {
+			prepared_t *prepared = *link;
+			if (prepared->client_socket != client_socket) {
+				link = &prepared->next;
+				continue;
+			}
+			*link = prepared->next;
+			free(prepared->name);
+			free(prepared->text);
+			free(prepared);
+		}
+	}
+	pthread_mutex_unlock(&cache->prepared_lock);
+}
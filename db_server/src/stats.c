@@ -0,0 +1,76 @@
+#include "stats.h"
+
+const char *stats_request_names[STATS_REQUEST_TYPES] = {
+	[RT_CREATE] = "create",
+	[RT_TABLES] = "tables",
+	[RT_SCHEMA] = "schema",
+	[RT_DROP] = "drop",
+	[RT_INSERT] = "insert",
+	[RT_SELECT] = "select",
+	[RT_QUIT] = "quit",
+	[RT_DELETE] = "delete",
+	[RT_UPDATE] = "update",
+	[RT_PREPARE] = "prepare",
+	[RT_STATS] = "stats",
+	[RT_CREATE_INDEX] = "index",
+	[RT_REPLICATION] = "replication",
+	[STATS_INVALID] = "invalid",
+};
+
+// every shard ever created, threads live as long as the server so they are never freed
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_stats_t *shards = NULL;
+
+thread_stats_t *stats_local() {
+	static __thread thread_stats_t *local = NULL;
+	if (local)
+		return local;
+
+	local = calloc(1, sizeof(thread_stats_t));
+	for (int i = 0; i < STATS_REQUEST_TYPES; i++)
+		histogram_init(&local->latency[i]);
+
+	pthread_mutex_lock(&shards_lock);
+	local->next = shards;
+	shards = local;
+	pthread_mutex_unlock(&shards_lock);
+	return local;
+}
+
+// counter has to be in the calling thread's shard, a plain load and store is enough with a
+// single writer and keeps the bus lock of an atomic add off the request path
+void stats_add(uint64_t *counter, uint64_t value) {
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+void stats_request(int type, uint64_t latency_ns) {
+	thread_stats_t *local = stats_local();
+	stats_add(&local->requests[type], 1);
+	histogram_record_local(&local->latency[type], latency_ns);
+}
+
+// total is overwritten with the sum of every shard, the figures may be a moment apart
+void stats_collect(thread_stats_t *total) {
+	memset(total, 0, sizeof(*total));
+	for (int i = 0; i < STATS_REQUEST_TYPES; i++)
+		histogram_init(&total->latency[i]);
+
+	pthread_mutex_lock(&shards_lock);
+	for (thread_stats_t *shard = shards; shard; shard = shard->next) {
+		for (int i = 0; i < STATS_REQUEST_TYPES; i++) {
+			total->requests[i] += __atomic_load_n(&shard->requests[i], __ATOMIC_RELAXED);
+			histogram_merge(&total->latency[i], &shard->latency[i]);
+		}
+		total->bytes_received += __atomic_load_n(&shard->bytes_received, __ATOMIC_RELAXED);
+		total->bytes_sent += __atomic_load_n(&shard->bytes_sent, __ATOMIC_RELAXED);
+		total->connections_opened += __atomic_load_n(&shard->connections_opened, __ATOMIC_RELAXED);
+		total->connections_closed += __atomic_load_n(&shard->connections_closed, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&shards_lock);
+}
+
+uint64_t stats_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
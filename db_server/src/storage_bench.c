@@ -0,0 +1,458 @@
+#include "server.h"
+#include <time.h>
+
+#define USAGE "usage: storage_bench [options]\n\n" \
+	"-o <file>\tWrite the results to file, in the format -b reads.\n" \
+	"-b <file>\tCompare against a baseline written by -o.\n" \
+	"-t <percent>\tFail if a benchmark is this much slower than the baseline (10).\n" \
+	"-f <filter>\tOnly run benchmarks whose name contains filter.\n" \
+	"-q\t\tQuick run with a tenth of the iterations.\n" \
+	"-u\t\tRead and write the tables through io_uring, like the server with -i uring."
+
+#define REPEATS 5 // every benchmark is run this many times and the median is reported
+#define MAX_RESULTS 64
+#define BENCH_PREFIX "mb_"
+#define SCRATCH_CATALOG "/tmp/storage_bench_catalog.bin"
+#define SCRATCH_DATA "/tmp/storage_bench_data.txt"
+
+typedef void (*bench_func_t)(void *ctx, size_t ops);
+
+typedef struct result result_t;
+struct result {
+	char name[64];
+	double ns_per_op;
+};
+
+typedef struct table_fixture table_fixture_t;
+struct table_fixture {
+	size_t width;
+	char meta_line[1024]; // the table as meta.txt stored it, the name in front of the columns
+	column_t *columns;	  // template parsed from meta_line
+	column_t *values;	  // one value for every column but the primary key
+	int row_size;
+	arena_t *arena;
+	FILE *data_file;
+};
+
+static result_t results[MAX_RESULTS];
+static server_t server; // what insert_data, create_table and drop_table look up through cli_req->server
+static size_t nr_of_results = 0;
+static size_t scale = 1;
+static const char *filter = NULL;
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void measure(const char *name, bench_func_t func, void *ctx, size_t ops) {
+	if (filter && !strstr(name, filter))
+		return;
+
+	ops = ops / scale ? ops / scale : 1;
+	double runs[REPEATS];
+	for (int i = 0; i < REPEATS; i++) {
+		uint64_t start = now_ns();
+		func(ctx, ops);
+		runs[i] = (double)(now_ns() - start) / ops;
+	}
+	qsort(runs, REPEATS, sizeof(double), compare_doubles);
+
+	if (nr_of_results < MAX_RESULTS) {
+		snprintf(results[nr_of_results].name, sizeof(results[nr_of_results].name), "%s", name);
+		results[nr_of_results++].ns_per_op = runs[REPEATS / 2];
+	}
+	printf("%-32s %12.1f ns/op\n", name, runs[REPEATS / 2]);
+	fflush(stdout);
+}
+
+// width columns, a primary key followed by alternating VARCHAR(8) and INT columns
+static void table_fixture_init(table_fixture_t *table, size_t width) {
+	dynamicstr line;
+	string_init(&line, NULL, 0);
+	string_set(&line, "%sw%zu,1id INT", BENCH_PREFIX, width);
+	for (size_t i = 1; i < width; i++)
+		string_set(&line, ",c%zu %s", i, i % 2 ? "VARCHAR(8)" : "INT");
+	string_append_str(&line, ROW_DELIM);
+	snprintf(table->meta_line, sizeof(table->meta_line), "%s", line.buffer);
+	string_free(&line);
+
+	table->width = width;
+	table->arena = arena_create(SCRATCH_ARENA_SIZE);
+
+	// the columns follow the table name
+	is_primary_key is_pk = {0, 0, false};
+	table->columns = arena_calloc(table->arena, sizeof(column_t));
+	populate_column(table->arena, table->columns, strchr(table->meta_line, ',') + 1, &is_pk);
+	table->row_size = is_pk.total_row_size;
+
+	column_t **link = &table->values;
+	for (column_t *col = table->columns->next; col; col = col->next) {
+		column_t *value = arena_calloc(table->arena, sizeof(column_t));
+		value->data_type = col->data_type;
+		value->int_val = 1234567;
+		value->char_val = "'abcdefg'";
+		*link = value;
+		link = &value->next;
+	}
+}
+
+static void bench_encode(void *ctx, size_t ops) {
+	table_fixture_t *table = ctx;
+	char *msg = NULL;
+	dynamicstr row;
+	string_init(&row, table->arena, table->row_size);
+
+	for (size_t i = 0; i < ops; i++) {
+		string_clear(&row);
+		column_to_buffer(table->arena, table->columns, table->values, &row, (int)i, &msg);
+	}
+}
+
+static void bench_schema(void *ctx, size_t ops) {
+	table_fixture_t *table = ctx;
+	arena_t *arena = arena_create(SCRATCH_ARENA_SIZE);
+	const char *columns = strchr(table->meta_line, ',') + 1;
+
+	for (size_t i = 0; i < ops; i++) {
+		is_primary_key is_pk = {0, 0, false};
+		column_t *first = arena_calloc(arena, sizeof(column_t));
+		populate_column(arena, first, columns, &is_pk);
+		arena_reset(arena);
+	}
+	arena_destroy(arena);
+}
+
+// writes rows encoded the way insert_data stores them
+static void write_rows(table_fixture_t *table, size_t rows) {
+	char *msg = NULL;
+	dynamicstr row;
+	string_init(&row, NULL, table->row_size);
+
+	FILE *data = fopen(SCRATCH_DATA, "w");
+	for (size_t i = 0; i < rows; i++) {
+		string_clear(&row);
+		column_to_buffer(table->arena, table->columns, table->values, &row, (int)i + 1, &msg);
+		string_append_str(&row, ROW_DELIM);
+		fwrite(row.buffer, sizeof(char), row.length, data);
+	}
+	fclose(data);
+	string_free(&row);
+}
+
+// the loop continue_scan runs, minus the socket
+static void scan(table_fixture_t *table, size_t ops, bool binary) {
+	arena_t *arena = arena_create(SCAN_ARENA_SIZE);
+	char *row = arena_alloc(arena, table->row_size);
+	dynamicstr out;
+	string_init(&out, arena, SEND_BUFFER_SIZE);
+
+	FILE *data = fopen(SCRATCH_DATA, "r");
+	for (size_t i = 0; i < ops; i++) {
+		if (fread(row, sizeof(char), table->row_size, data) < (size_t)table->row_size) {
+			rewind(data);
+			i--;
+			continue;
+		}
+		if (binary)
+			encode_binary_row(&out, table->columns, row);
+		else
+			encode_text_row(&out, table->columns, row);
+		if (out.length >= SEND_BUFFER_SIZE)
+			string_clear(&out);
+	}
+	fclose(data);
+	arena_destroy(arena);
+}
+
+static void bench_scan_text(void *ctx, size_t ops) {
+	scan(ctx, ops, false);
+}
+
+static void bench_scan_binary(void *ctx, size_t ops) {
+	scan(ctx, ops, true);
+}
+
+static client_request *bench_request(char *statement) {
+	client_request *cli_req = calloc(1, sizeof(client_request));
+	cli_req->msg = strdup(statement);
+	cli_req->request = parse_request(cli_req->msg, &cli_req->error);
+	cli_req->arena = arena_create(SCRATCH_ARENA_SIZE);
+	cli_req->client_socket = -1;
+	cli_req->server = &server;
+	return cli_req;
+}
+
+static void bench_request_destroy(client_request *cli_req) {
+	if (cli_req->request)
+		destroy_request(cli_req->request);
+	arena_destroy(cli_req->arena);
+	free(cli_req->msg);
+	free(cli_req);
+}
+
+static void bench_insert(void *ctx, size_t ops) {
+	client_request *cli_req = ctx;
+	char *msg = NULL;
+
+	for (size_t i = 0; i < ops; i++) {
+		insert_data(cli_req, &msg);
+		arena_reset(cli_req->arena);
+	}
+}
+
+typedef struct catalog_fixture catalog_fixture_t;
+struct catalog_fixture {
+	catalog_t *catalog;
+	char *name;
+};
+
+static void bench_catalog_exists(void *ctx, size_t ops) {
+	catalog_fixture_t *fixture = ctx;
+
+	for (size_t i = 0; i < ops; i++)
+		catalog_exists(fixture->catalog, fixture->name);
+}
+
+static void bench_catalog_open(void *ctx, size_t ops) {
+	(void)ctx;
+	for (size_t i = 0; i < ops; i++)
+		catalog_close(catalog_open(SCRATCH_CATALOG, "/nonexistent"));
+}
+
+// runs a CREATE or DROP through the same function the server would
+static void run_statement(char *statement) {
+	char *msg = NULL;
+	client_request *cli_req = bench_request(statement);
+	if (cli_req->request && cli_req->request->request_type == RT_CREATE)
+		create_table(cli_req, &msg);
+	else if (cli_req->request && cli_req->request->request_type == RT_DROP)
+		drop_table(cli_req, &msg);
+	bench_request_destroy(cli_req);
+}
+
+static void run_insert_benchmarks(size_t width) {
+	char name[64];
+	dynamicstr statement;
+	string_init(&statement, NULL, 0);
+
+	string_set(&statement, "DROP TABLE %sw%zu;", BENCH_PREFIX, width); // left over from a crashed run
+	run_statement(statement.buffer);
+
+	string_clear(&statement);
+	string_set(&statement, "CREATE TABLE %sw%zu (id INT", BENCH_PREFIX, width);
+	for (size_t i = 1; i < width; i++)
+		string_set(&statement, ", c%zu %s", i, i % 2 ? "VARCHAR(8)" : "INT");
+	string_append_str(&statement, ", PRIMARY KEY(id));");
+	run_statement(statement.buffer);
+
+	string_clear(&statement);
+	string_set(&statement, "INSERT INTO %sw%zu VALUES (", BENCH_PREFIX, width);
+	for (size_t i = 1; i < width; i++)
+		string_set(&statement, "%s%s", i > 1 ? ", " : "", i % 2 ? "'abcdefg'" : "1234567");
+	string_append_str(&statement, ");");
+
+	client_request *insert = bench_request(statement.buffer);
+	snprintf(name, sizeof(name), "insert/w%zu", width);
+	measure(name, bench_insert, insert, 2000);
+	bench_request_destroy(insert);
+
+	string_clear(&statement);
+	string_set(&statement, "DROP TABLE %sw%zu;", BENCH_PREFIX, width);
+	run_statement(statement.buffer);
+	string_free(&statement);
+}
+
+static void run_catalog_benchmarks(size_t tables) {
+	char name[64];
+	char table[32];
+	remove(SCRATCH_CATALOG);
+	catalog_t *catalog = catalog_open(SCRATCH_CATALOG, "/nonexistent");
+	for (size_t i = 0; i < tables; i++) {
+		snprintf(table, sizeof(table), "%st%zu", BENCH_PREFIX, i);
+		catalog_create(catalog, table, "1id INT,name VARCHAR(8)", false);
+	}
+
+	// the last table was the worst case for the linear search of meta.txt, a missing one read everything too
+	catalog_fixture_t last = {catalog, table};
+	snprintf(name, sizeof(name), "table_exists/last/t%zu", tables);
+	measure(name, bench_catalog_exists, &last, 200000);
+	catalog_fixture_t missing = {catalog, BENCH_PREFIX "missing"};
+	snprintf(name, sizeof(name), "table_exists/missing/t%zu", tables);
+	measure(name, bench_catalog_exists, &missing, 200000);
+	catalog_close(catalog);
+
+	// what a server start pays for the catalog
+	snprintf(name, sizeof(name), "catalog_open/t%zu", tables);
+	measure(name, bench_catalog_open, NULL, 1000000 / tables + 10);
+	remove(SCRATCH_CATALOG);
+}
+
+static int load_baseline(const char *path, result_t *baseline, size_t *count) {
+	FILE *file = fopen(path, "r");
+	if (!file)
+		return -1;
+
+	char *line = NULL;
+	size_t nr_of_chars = 0;
+	*count = 0;
+	while (getline(&line, &nr_of_chars, file) != -1 && *count < MAX_RESULTS) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%63s %lf", baseline[*count].name, &baseline[*count].ns_per_op) == 2)
+			(*count)++;
+	}
+	free(line);
+	fclose(file);
+	return 0;
+}
+
+static int write_results(const char *path) {
+	FILE *file = fopen(path, "w");
+	if (!file)
+		return -1;
+
+	fprintf(file, "# storage_bench results in ns per operation, compare with storage_bench -b %s\n", path);
+	for (size_t i = 0; i < nr_of_results; i++)
+		fprintf(file, "%s\t%.1f\n", results[i].name, results[i].ns_per_op);
+	fclose(file);
+	return 0;
+}
+
+static int compare(const char *path, double threshold) {
+	result_t baseline[MAX_RESULTS];
+	size_t count = 0;
+	if (load_baseline(path, baseline, &count) < 0) {
+		printf("error: couldn't read the baseline '%s'\n", path);
+		return -1;
+	}
+
+	int regressions = 0;
+	printf("\n%-32s %12s %12s %8s\n", "benchmark", "ns/op", "baseline", "change");
+	for (size_t i = 0; i < nr_of_results; i++) {
+		for (size_t j = 0; j < count; j++) {
+			if (strcmp(results[i].name, baseline[j].name) != 0)
+				continue;
+
+			double change = 100.0 * (results[i].ns_per_op - baseline[j].ns_per_op) / baseline[j].ns_per_op;
+			bool regressed = change > threshold;
+			regressions += regressed;
+			printf("%-32s %12.1f %12.1f %+7.1f%%%s\n", results[i].name, results[i].ns_per_op, baseline[j].ns_per_op, change,
+				   regressed ? "  REGRESSION" : "");
+			break;
+		}
+	}
+
+	if (regressions)
+		printf("\n%d benchmark(s) regressed by more than %.1f%%\n", regressions, threshold);
+	return regressions;
+}
+
+int main(int argc, char *argv[]) {
+	char *output = NULL;
+	char *baseline = NULL;
+	double threshold = 10.0;
+
+	// start at one because the first argument is the name of the executable
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-h") == 0) {
+			printf("%s\n", USAGE);
+			exit(EXIT_SUCCESS);
+		} else if (strcmp(argv[i], "-q") == 0) {
+			scale = 10;
+			continue;
+		} else if (strcmp(argv[i], "-u") == 0) {
+			segments_use_uring(true);
+			continue;
+		}
+
+		if (i + 1 >= argc) {
+			printf("error: expected a positional argument\n");
+			exit(EXIT_FAILURE);
+		}
+		char *second_arg = argv[++i];
+
+		if (strcmp(argv[i - 1], "-o") == 0)
+			output = second_arg;
+		else if (strcmp(argv[i - 1], "-b") == 0)
+			baseline = second_arg;
+		else if (strcmp(argv[i - 1], "-t") == 0)
+			threshold = strtod(second_arg, NULL);
+		else if (strcmp(argv[i - 1], "-f") == 0)
+			filter = second_arg;
+		else {
+			printf("Incorrect argument '%s'\n\n%s\n", argv[i - 1], USAGE);
+			exit(3);
+		}
+	}
+
+	// the insert benchmarks use the real database, make sure no server is using it
+	lock_manager_t *locks = lock_manager_create(LOCK_FILE);
+	if (!locks) {
+		printf("error: couldn't lock '%s', stop the server before running the benchmarks\n", LOCK_FILE);
+		exit(EXIT_FAILURE);
+	}
+	log_file = "/dev/null"; // keep the per-statement log lines out of syslog
+	server.locks = locks;
+	server.keys = primary_keys_create();
+	server.results = result_cache_create();
+	server.appends = appends_create();
+	if (!(server.catalog = catalog_open(CATALOG_FILE, META_FILE))) {
+		printf("error: couldn't open the catalog '%s'\n", CATALOG_FILE);
+		exit(EXIT_FAILURE);
+	}
+
+	static const size_t widths[] = {2, 8, 32};
+	static const size_t scan_rows[] = {1000, 100000};
+	char name[64];
+	table_fixture_t tables[3];
+
+	for (size_t w = 0; w < 3; w++) {
+		table_fixture_init(&tables[w], widths[w]);
+		snprintf(name, sizeof(name), "encode/w%zu", widths[w]);
+		measure(name, bench_encode, &tables[w], 200000);
+		snprintf(name, sizeof(name), "schema/w%zu", widths[w]);
+		measure(name, bench_schema, &tables[w], 200000);
+	}
+
+	for (size_t w = 0; w < 3; w++) {
+		for (size_t r = 0; r < 2; r++) {
+			write_rows(&tables[w], scan_rows[r]);
+			snprintf(name, sizeof(name), "scan_text/w%zu/r%zu", widths[w], scan_rows[r]);
+			measure(name, bench_scan_text, &tables[w], 4 * scan_rows[r] > 200000 ? 4 * scan_rows[r] : 200000);
+			snprintf(name, sizeof(name), "scan_binary/w%zu/r%zu", widths[w], scan_rows[r]);
+			measure(name, bench_scan_binary, &tables[w], 4 * scan_rows[r] > 200000 ? 4 * scan_rows[r] : 200000);
+		}
+	}
+	remove(SCRATCH_DATA);
+
+	for (size_t w = 0; w < 3; w++)
+		run_insert_benchmarks(widths[w]);
+
+	run_catalog_benchmarks(10);
+	run_catalog_benchmarks(100);
+	run_catalog_benchmarks(1000);
+	run_catalog_benchmarks(100000);
+
+	for (size_t w = 0; w < 3; w++)
+		arena_destroy(tables[w].arena);
+	catalog_close(server.catalog);
+	result_cache_destroy(server.results);
+	primary_keys_destroy(server.keys);
+	appends_destroy(server.appends);
+	lock_manager_destroy(locks);
+
+	if (output && write_results(output) < 0) {
+		printf("error: couldn't write the results to '%s'\n", output);
+		return 1;
+	}
+	if (baseline && compare(baseline, threshold) != 0)
+		return 1;
+	return 0;
+}
@@ -35,6 +35,7 @@ static thread_pool_work_t* thread_pool_work_get(thread_pool_t* pool)
 		return NULL;
 
 	pool->work_first = work->next;	// new first
+	pool->queued_count--;
 	if (!work->next)				// if it was the last one in the queue
 		pool->work_last = NULL;		// correct queue
 
@@ -163,6 +164,8 @@ bool thread_pool_add_work(thread_pool_t* pool, thread_func_t func, void* arg)
 		pool->work_last = work;							// link work to be last in queue
 	}
 
+	pool->queued_count++;
+
 	pthread_cond_broadcast(&(pool->work_cond));			// unblock the threads that are currently blocked
 	pthread_mutex_unlock(&(pool->work_mutex));			// release lock
 
@@ -185,3 +188,19 @@ void thread_pool_wait(thread_pool_t* pool)
 	}
 	pthread_mutex_unlock(&(pool->work_mutex));
 }
+
+// threads that would pick up new work right away, a hint since the pool keeps changing
+size_t thread_pool_idle(thread_pool_t* pool)
+{
+	size_t idle = 0;
+
+	if (!pool) // sanity check
+		return 0;
+
+	pthread_mutex_lock(&(pool->work_mutex));
+	if (pool->thread_count > pool->working_count + pool->queued_count)
+		idle = pool->thread_count - pool->working_count - pool->queued_count;
+	pthread_mutex_unlock(&(pool->work_mutex));
+
+	return idle;
+}
@@ -0,0 +1,151 @@
+#include "trace.h"
+#include "db_functions.h"
+#include "stats.h"
+
+const char *trace_span_names[TRACE_STAMPS] = {
+	[TRACE_RECEIVED] = NULL, // the start of the statement, nothing ends here
+	[TRACE_DISPATCHED] = "select loop",
+	[TRACE_HANDLED] = "pool wait",
+	[TRACE_PARSED] = "parse",
+	[TRACE_ENQUEUED] = "queue full", // blocked on empty_sem
+	[TRACE_DEQUEUED] = "request queue",
+	[TRACE_STARTED] = "requeue", // assign_work handing it back to the pool
+	[TRACE_LOCKED] = "lock wait",
+	[TRACE_EXECUTED] = "execute",
+	[TRACE_DONE] = "respond",
+};
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file = NULL;
+static bool trace_empty = true; // nothing written yet, the next event doesn't need a separator
+static unsigned int trace_rate = TRACE_SAMPLE_RATE;
+static uint64_t slow_ns = 0; // 0 turns the slow query log off
+
+int trace_open(const char *path, unsigned int sample_rate, double slow_ms) {
+	if (sample_rate)
+		trace_rate = sample_rate;
+	slow_ns = slow_ms > 0 ? (uint64_t)(slow_ms * 1e6) : 0;
+	if (!path)
+		return 0;
+
+	if (!(trace_file = fopen(path, "w"))) {
+		log_to_file("Error: Couldn't fopen() '%s' in trace_open()\n", path);
+		return -1;
+	}
+	// viewers accept the array without its closing bracket, so a trace of a server
+	// that never shut down cleanly can still be opened
+	fputs("[\n", trace_file);
+	fflush(trace_file);
+	return 0;
+}
+
+void trace_close() {
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file) {
+		fputs("\n]\n", trace_file);
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+// whether statements have to keep their text for trace_finish
+bool trace_enabled() {
+	return trace_file || slow_ns;
+}
+
+void trace_stamp(uint64_t *trace, int stage) {
+	trace[stage] = stats_now_ns();
+}
+
+static void append_json_string(dynamicstr *out, const char *text) {
+	string_append_char(out, '"');
+	for (; *text; text++) {
+		unsigned char ch = (unsigned char)*text;
+		if (ch == '"' || ch == '\\') {
+			string_append_char(out, '\\');
+			string_append_char(out, ch);
+		} else if (ch < 0x20) {
+			string_set(out, "\\u%04x", ch);
+		} else {
+			string_append_char(out, ch);
+		}
+	}
+	string_append_char(out, '"');
+}
+
+// a complete ("X") event, timestamps are in microseconds and every connection gets its own row
+static void append_event(dynamicstr *out, const char *name, const char *category, uint64_t start, uint64_t end, size_t socket) {
+	if (out->length)
+		string_append_str(out, ",\n");
+	string_set(out, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%zu", name, category,
+			   start / 1e3, (end - start) / 1e3, (int)getpid(), socket);
+}
+
+static void write_events(uint64_t *trace, const char *type, size_t socket, const char *statement) {
+	dynamicstr out;
+	string_init(&out, NULL, 1024);
+
+	append_event(&out, type, "statement", trace[TRACE_RECEIVED], trace[TRACE_DONE], socket);
+	string_append_str(&out, ",\"args\":{\"statement\":");
+	append_json_string(&out, statement);
+	string_append_str(&out, "}}");
+
+	uint64_t last = trace[TRACE_RECEIVED];
+	for (int stage = TRACE_RECEIVED + 1; stage < TRACE_STAMPS; stage++) {
+		if (!trace[stage]) // the statement skipped this stage, a parse error never takes a lock
+			continue;
+		append_event(&out, trace_span_names[stage], "stage", last, trace[stage], socket);
+		string_append_char(&out, '}');
+		last = trace[stage];
+	}
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file) {
+		if (!trace_empty)
+			fputs(",\n", trace_file);
+		fwrite(out.buffer, sizeof(char), out.length, trace_file);
+		fflush(trace_file); // the server is usually stopped with a signal
+		trace_empty = false;
+	}
+	pthread_mutex_unlock(&trace_lock);
+	string_free(&out);
+}
+
+static void log_slow_query(uint64_t *trace, size_t socket, const char *statement) {
+	dynamicstr out;
+	string_init(&out, NULL, 256);
+
+	// text clients usually send a trailing newline
+	int length = (int)strlen(statement);
+	while (length > 0 && isspace((unsigned char)statement[length - 1]))
+		length--;
+	string_set(&out, "Slow query on socket %zu took %.3f ms: %.*s\n\t", socket, (trace[TRACE_DONE] - trace[TRACE_RECEIVED]) / 1e6,
+			   length, statement);
+
+	uint64_t last = trace[TRACE_RECEIVED];
+	const char *separator = "";
+	for (int stage = TRACE_RECEIVED + 1; stage < TRACE_STAMPS; stage++) {
+		if (!trace[stage])
+			continue;
+		string_set(&out, "%s%s %.3f ms", separator, trace_span_names[stage], (trace[stage] - last) / 1e6);
+		last = trace[stage];
+		separator = ", ";
+	}
+	string_append_char(&out, '\n');
+
+	log_to_file("%s", out.buffer);
+	string_free(&out);
+}
+
+// trace needs every stage the statement went through stamped, including TRACE_DONE
+void trace_finish(uint64_t *trace, const char *type, size_t socket, const char *statement) {
+	static __thread unsigned int sequence = 0; // per thread so sampling doesn't share a counter
+
+	if (!statement)
+		return;
+	if (slow_ns && trace[TRACE_DONE] - trace[TRACE_RECEIVED] >= slow_ns)
+		log_slow_query(trace, socket, statement);
+	if (trace_file && sequence++ % trace_rate == 0)
+		write_events(trace, type, socket, statement);
+}
@@ -0,0 +1,136 @@
+#include "uring.h"
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*
+ * Sets up a ring with room for entries submissions and completions completions and maps
+ * its queues. Returns NULL if the kernel has no io_uring or doesn't allow it, the caller
+ * then stays on plain system calls.
+ */
+uring_t *uring_create(unsigned entries, unsigned completions) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = completions;
+
+	uring_t *ring = calloc(1, sizeof(uring_t));
+	if (!ring)
+		return NULL;
+	if ((ring->fd = uring_setup(entries, &params)) < 0) {
+		free(ring);
+		return NULL;
+	}
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+		uring_destroy(ring);
+		return NULL;
+	}
+
+	char *sq = ring->sq_ring, *cq = ring->cq_ring;
+	ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+	ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	// submission i always uses slot i, so the indirection array is filled in once
+	for (unsigned i = 0; i < params.sq_entries; i++)
+		ring->sq_array[i] = i;
+	return ring;
+}
+
+void uring_destroy(uring_t *ring) {
+	if (!ring) // sanity check
+		return;
+
+	if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->cq_ring && ring->cq_ring != MAP_FAILED)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sqes && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_size);
+	close(ring->fd);
+	free(ring);
+}
+
+// a cleared submission to fill in, the queued ones are handed to the kernel first if the ring is full
+struct io_uring_sqe *uring_sqe(uring_t *ring) {
+	unsigned tail = *ring->sq_tail + ring->sq_queued;
+	if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) > *ring->sq_mask) {
+		if (uring_submit(ring, 0) < 0)
+			return NULL;
+		tail = *ring->sq_tail;
+		if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) > *ring->sq_mask)
+			return NULL;
+	}
+
+	struct io_uring_sqe *sqe = &ring->sqes[tail & *ring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_queued++;
+	return sqe;
+}
+
+// hands every queued submission to the kernel in one system call and waits until wait_nr have completed
+int uring_submit(uring_t *ring, unsigned wait_nr) {
+	__atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->sq_queued, __ATOMIC_RELEASE);
+	ring->sq_queued = 0;
+
+	while (true) { // the kernel may have taken the submissions before a signal interrupted the wait
+		unsigned pending = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		int result = uring_enter(ring->fd, pending, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+		if (result >= 0 || errno != EINTR)
+			return result;
+	}
+}
+
+// the oldest completion, NULL if there is none
+struct io_uring_cqe *uring_peek(uring_t *ring) {
+	unsigned head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return NULL;
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+// gives the completion uring_peek returned back to the kernel
+void uring_seen(uring_t *ring) {
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// registers fds as fixed files, index i stands for fds[i] and -1 leaves a slot empty
+int uring_register_files(uring_t *ring, const int *fds, unsigned count) {
+	return uring_register(ring->fd, IORING_REGISTER_FILES, fds, count);
+}
+
+// puts fd into slot index of the fixed files, -1 empties it
+int uring_update_file(uring_t *ring, unsigned index, int fd) {
+	struct io_uring_files_update update;
+	memset(&update, 0, sizeof(update));
+	update.offset = index;
+	update.fds = (uint64_t)(uintptr_t)&fd;
+	return uring_register(ring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1 ? 0 : -1;
+}
+
+// pins length bytes at base, reads into them skip mapping the pages on every request
+int uring_register_buffer(uring_t *ring, void *base, size_t length) {
+	struct iovec iov = {.iov_base = base, .iov_len = length};
+	return uring_register(ring->fd, IORING_REGISTER_BUFFERS, &iov, 1);
+}
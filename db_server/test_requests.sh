@@ -50,6 +50,174 @@ echo -e "DROP TABLE that doesn't exist:"
 echo -e "\n-------------------\n"
 sleep $SLEEP
 
+echo -e "EXECUTE with the right and the wrong number of parameters:"
+./client "CREATE TABLE people (id INT, name VARCHAR(8), age INT);"
+./client -b "PREPARE add_person AS INSERT INTO people VALUES (?, ?, ?);" "EXECUTE add_person (1, 'Ada', 30);" "EXECUTE add_person (2, 'Bo');" "EXECUTE add_person (2, 'Bo', 25, 7);" "SELECT * FROM people;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "Cached SELECTs that only differ in LIMIT and OFFSET:"
+./client "INSERT INTO people VALUES (2, 'Bo', 25);"
+./client "INSERT INTO people VALUES (3, 'Cy', 30);"
+./client "SELECT * FROM people LIMIT 1;"
+./client "SELECT * FROM people LIMIT 3;"
+./client "SELECT * FROM people LIMIT 2 OFFSET 1;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "Cached INSERT with a newline in a string:"
+./client $'INSERT INTO people VALUES (4, \'D\ni\', 25);'
+./client "SELECT * FROM people WHERE id = 4;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "Cached statements after the table was created again with other columns:"
+./client "SELECT * FROM people WHERE age = 30;"
+./client "DROP TABLE people;"
+./client "CREATE TABLE people (id INT, age INT);"
+./client "INSERT INTO people VALUES (7, 30);"
+./client "SELECT * FROM people WHERE age = 30;"
+./client "DROP TABLE people;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "Index lookup after an INSERT:"
+./client "CREATE TABLE pets (id INT, kind VARCHAR(5));"
+./client "INSERT INTO pets VALUES (1, 'cat');"
+./client "INSERT INTO pets VALUES (2, 'dog');"
+./client "CREATE INDEX pets_kind ON pets (kind);"
+./client "INSERT INTO pets VALUES (3, 'cat');"
+./client "SELECT * FROM pets WHERE kind = 'cat';"
+./client "SELECT * FROM pets WHERE kind = 'cow';"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "CREATE INDEX with a name that is taken:"
+./client "CREATE INDEX pets_kind ON pets (id);"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "Index name after its table was dropped:"
+./client "DROP TABLE pets;"
+./client "CREATE TABLE pets (id INT, kind VARCHAR(5));"
+./client "INSERT INTO pets VALUES (4, 'cat');"
+./client "CREATE INDEX pets_kind ON pets (kind);"
+./client "SELECT * FROM pets WHERE kind = 'cat';"
+./client "DROP TABLE pets;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "Aggregates over a whole table and per group:"
+./client "CREATE TABLE sales (id INT, region VARCHAR(5), amount INT);"
+./client "INSERT INTO sales VALUES (1, 'north', 10);"
+./client "INSERT INTO sales VALUES (2, 'south', 5);"
+./client "INSERT INTO sales VALUES (3, 'north', 7);"
+./client "INSERT INTO sales VALUES (4, 'east', 5);"
+./client "SELECT COUNT(*), SUM(amount), MIN(amount), MAX(amount), AVG(amount) FROM sales;"
+./client "SELECT region, COUNT(*), SUM(amount) FROM sales GROUP BY region;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "Aggregates without rows and over a VARCHAR:"
+./client "SELECT SUM(amount) FROM sales WHERE region = 'west';"
+./client "CREATE TABLE nothing (id INT);"
+./client "SELECT COUNT(*), SUM(id) FROM nothing;"
+./client "SELECT MAX(region) FROM sales;"
+./client "DROP TABLE nothing;"
+./client "DROP TABLE sales;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "ORDER BY ASC and DESC with ties:"
+./client "CREATE TABLE scores (id INT, team VARCHAR(5), points INT);"
+./client "INSERT INTO scores VALUES (1, 'red', 10);"
+./client "INSERT INTO scores VALUES (2, 'blue', 5);"
+./client "INSERT INTO scores VALUES (3, 'red', 7);"
+./client "INSERT INTO scores VALUES (4, 'green', 5);"
+./client "SELECT * FROM scores ORDER BY points;"
+./client "SELECT * FROM scores ORDER BY points ASC;"
+./client "SELECT * FROM scores ORDER BY points DESC;"
+./client "SELECT * FROM scores ORDER BY team DESC;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "ORDER BY a column that doesn't exist:"
+./client "SELECT * FROM scores ORDER BY rank;"
+./client "DROP TABLE scores;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "LIMIT and OFFSET, with an OFFSET beyond the end:"
+./client "CREATE TABLE queue (id INT, job VARCHAR(6));"
+./client "INSERT INTO queue VALUES (1, 'build');"
+./client "INSERT INTO queue VALUES (2, 'test');"
+./client "INSERT INTO queue VALUES (3, 'deploy');"
+./client "SELECT * FROM queue LIMIT 2;"
+./client "SELECT * FROM queue LIMIT 2 OFFSET 2;"
+./client "SELECT * FROM queue LIMIT 2 OFFSET 10;"
+./client "SELECT * FROM queue LIMIT 0;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "LIMIT and OFFSET after WHERE and ORDER BY, and a negative LIMIT:"
+./client "SELECT * FROM queue ORDER BY id DESC LIMIT 1 OFFSET 1;"
+./client "SELECT * FROM queue WHERE job = 'test' LIMIT 1 OFFSET 1;"
+./client "SELECT * FROM queue LIMIT -1;"
+./client "DROP TABLE queue;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "JOIN with matches on both sides:"
+./client "CREATE TABLE orders (id INT, region VARCHAR(5), total INT);"
+./client "CREATE TABLE regions (name VARCHAR(5), manager VARCHAR(6));"
+./client "INSERT INTO orders VALUES (1, 'north', 10);"
+./client "INSERT INTO orders VALUES (2, 'south', 5);"
+./client "INSERT INTO orders VALUES (3, 'north', 7);"
+./client "INSERT INTO regions VALUES ('north', 'Nils');"
+./client "INSERT INTO regions VALUES ('east', 'Eva');"
+./client "SELECT * FROM orders JOIN regions ON orders.region = regions.name;"
+./client "SELECT * FROM orders JOIN regions ON orders.region = regions.name WHERE region = 'north';"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "JOIN with an empty side and with a column that doesn't exist:"
+./client "CREATE TABLE returns (id INT);"
+./client "SELECT * FROM orders JOIN returns ON orders.id = returns.id;"
+./client "SELECT * FROM returns JOIN orders ON returns.id = orders.id;"
+./client "SELECT * FROM orders JOIN regions ON orders.region = regions.boss;"
+./client "DROP TABLE returns;"
+./client "DROP TABLE regions;"
+./client "DROP TABLE orders;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "Memory table with rows:"
+./client "CREATE TABLE sessions (id INT, user VARCHAR(6)) ENGINE=MEMORY;"
+./client "INSERT INTO sessions VALUES (1, 'oscar');"
+./client "INSERT INTO sessions VALUES (2, 'emil');"
+./client "SELECT * FROM sessions;"
+./client "SELECT COUNT(*) FROM sessions;"
+./client "CREATE INDEX sessions_user ON sessions (user);"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "Memory table after DROP:"
+./client "DROP TABLE sessions;"
+./client "SELECT * FROM sessions;"
+./client "INSERT INTO sessions VALUES (3, 'anna');"
+./client "CREATE TABLE sessions (id INT) ENGINE=MEMORY;"
+./client "SELECT * FROM sessions;"
+./client "DROP TABLE sessions;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
+echo -e "DELETE and UPDATE, which aren't supported, over both protocols:"
+./client "CREATE TABLE notes (id INT);"
+./client "DELETE FROM notes WHERE id = 1;"
+./client -b "UPDATE notes SET id = 2 WHERE id = 1;" "DELETE FROM notes WHERE id = 1;" "DROP TABLE notes;"
+echo -e "\n-------------------\n"
+sleep $SLEEP
+
 # killall db
 # ./client "SELECT * FROM students;"
 # ./client "CREATE TABLE students (id INT, first_name VARCHAR(7), last_name VARCHAR(8), PRIMARY KEY(id));"